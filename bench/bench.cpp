@@ -0,0 +1,64 @@
+// -----------------------------------------------------------------------------
+// Brandy compiler benchmarks
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "bench.h"
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  namespace bench
+  {
+    // -------------------------------------------------------------------------
+
+    bool load_input(const std::vector<const char *> &files, size_t size, std::string &text)
+    {
+      std::string once;
+
+      for (const char *filename : files)
+      {
+        std::ifstream in(filename, std::ios::binary);
+        if (!in)
+        {
+          std::cout << "Failed to open " << filename << std::endl;
+          return false;
+        }
+
+        std::ostringstream contents;
+        contents << in.rdbuf();
+        once += contents.str();
+
+        // Files don't always end their last line
+        if (!once.empty() && once.back() != '\n')
+          once += '\n';
+      }
+
+      text.clear();
+
+      if (once.empty())
+        return true;
+
+      while (text.size() < size)
+        text += once;
+
+      return true;
+    }
+
+    void report(const char *name, double ms, size_t count, const char *unit)
+    {
+      std::cout << std::left << std::setw(40) << name << std::right << std::fixed << std::setprecision(2)
+        << std::setw(10) << ms << " ms" << std::setw(12) << (ms * 1000000.0 / (count ? count : 1)) << " ns/" << unit
+        << std::endl;
+    }
+
+    // -------------------------------------------------------------------------
+  }
+}
+
+// -----------------------------------------------------------------------------
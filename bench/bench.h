@@ -0,0 +1,76 @@
+// -----------------------------------------------------------------------------
+// Brandy compiler benchmarks
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  namespace bench
+  {
+    // -------------------------------------------------------------------------
+
+    // What every benchmark runs on: the files named on the command line one
+    // after the other, repeated until there's at least size bytes. The
+    // numbers quoted in the history were taken on test_scripts repeated to
+    // 10 MB. Returns false if a file can't be read.
+    bool load_input(const std::vector<const char *> &files, size_t size, std::string &text);
+
+    // How long the function takes, in milliseconds
+    template<typename function_type>
+    double time_ms(function_type function)
+    {
+      typedef std::chrono::steady_clock clock;
+
+      const clock::time_point start = clock::now();
+      function();
+      return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    }
+
+    // Runs the function runs times and returns the fastest, in milliseconds
+    template<typename function_type>
+    double best_of(size_t runs, function_type function)
+    {
+      double best = 0.0;
+
+      for (size_t i = 0; i < runs; ++i)
+      {
+        const double ms = time_ms(function);
+        best = i == 0 ? ms : std::min(best, ms);
+      }
+
+      return best;
+    }
+
+    // One line per thing timed, with its throughput over count items
+    void report(const char *name, double ms, size_t count, const char *unit);
+
+    // -------------------------------------------------------------------------
+
+    // Each benchmark times its variants on the input and reports them. The
+    // check is printed too, so the work can't be optimized away and the
+    // variants can be seen to agree.
+    void parsing(const std::string &text, size_t runs);
+    void passes(const std::string &text, size_t runs);
+    void scanners(const std::string &text, size_t runs);
+    void symbol_tables(const std::string &text, size_t runs);
+
+    // -------------------------------------------------------------------------
+  }
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
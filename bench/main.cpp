@@ -0,0 +1,93 @@
+// -----------------------------------------------------------------------------
+// Brandy compiler benchmarks
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "bench.h"
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+
+namespace
+{
+  struct benchmark
+  {
+    const char *name;
+    const char *description;
+    void (*run)(const std::string &text, size_t runs);
+  };
+
+  const benchmark benchmarks[] =
+  {
+    { "parsing", "Parsing, and long lines that used to parse in quadratic time", brandy::bench::parsing },
+    { "passes", "The semantic passes in shared walks against a walk each", brandy::bench::passes },
+    { "scanners", "Lexing with the vectorized scanners against the DFA alone", brandy::bench::scanners },
+    { "symbols", "flat_map against std::unordered_map as a symbol table", brandy::bench::symbol_tables },
+  };
+
+  void usage()
+  {
+    std::cout << "bench <benchmark> [--size <MB>] [--runs <count>] <files...>" << std::endl << std::endl;
+
+    for (const benchmark &bench : benchmarks)
+      std::cout << "  " << bench.name << ": " << bench.description << std::endl;
+  }
+}
+
+// -----------------------------------------------------------------------------
+
+int main(int argc, const char **argv)
+{
+  if (argc < 2)
+  {
+    usage();
+    return -1;
+  }
+
+  const benchmark *chosen = nullptr;
+
+  for (const benchmark &bench : benchmarks)
+  {
+    if (strcmp(argv[1], bench.name) == 0)
+      chosen = &bench;
+  }
+
+  if (!chosen)
+  {
+    usage();
+    return -1;
+  }
+
+  size_t size = 10;
+  size_t runs = 5;
+  std::vector<const char *> files;
+
+  for (int i = 2; i < argc; ++i)
+  {
+    if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+      size = size_t(atoi(argv[++i]));
+    else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+      runs = size_t(atoi(argv[++i]));
+    else
+      files.push_back(argv[i]);
+  }
+
+  if (files.empty() || runs == 0)
+  {
+    usage();
+    return -1;
+  }
+
+  std::string text;
+  if (!brandy::bench::load_input(files, size * 1024 * 1024, text))
+    return -1;
+
+  std::cout << chosen->description << ", " << text.size() / 1024 << " KB, best of " << runs << std::endl;
+  chosen->run(text, runs);
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,83 @@
+// -----------------------------------------------------------------------------
+// Brandy parser benchmark
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "bench.h"
+#include "lexer.h"
+#include "parser.h"
+#include <iostream>
+#include <string>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  namespace bench
+  {
+    // -------------------------------------------------------------------------
+
+    namespace
+    {
+      // "var x = a0 + a1 + ..." on one line. Expressions used to be
+      // rescanned to the end of the line for each operator, which made this
+      // quadratic in the number of terms.
+      std::string long_sum(size_t terms)
+      {
+        std::string text = "var x = a0";
+
+        for (size_t i = 1; i < terms; ++i)
+          text += " + a" + std::to_string(i);
+
+        return text + "\n";
+      }
+
+      // Parses the tokens runs times and returns the fastest, leaving the
+      // copy of the tokens and freeing the tree out of the time
+      double parse_tokens(const std::vector<token> &tokens, size_t runs, size_t &errors)
+      {
+        const compilation_context context((compiler_flags()));
+        double best = 0.0;
+
+        for (size_t i = 0; i < runs; ++i)
+        {
+          parser p(context, tokens);
+          unique_ptr<module_node> module;
+
+          const double ms = time_ms([&]() { module = p.parse_module(); });
+          best = i == 0 ? ms : std::min(best, ms);
+          errors = p.errors().size();
+        }
+
+        return best;
+      }
+
+      void report_parse(const char *name, const std::string &text, size_t runs)
+      {
+        std::vector<token> tokens;
+        tokenize_string(text.c_str(), tokens);
+
+        size_t errors = 0;
+        const double ms = parse_tokens(tokens, runs, errors);
+
+        report(name, ms, tokens.size(), "token");
+        std::cout << "  " << tokens.size() << " tokens, " << errors << " errors" << std::endl;
+      }
+    }
+
+    // -------------------------------------------------------------------------
+
+    void parsing(const std::string &text, size_t runs)
+    {
+      report_parse("the input", text, runs);
+
+      // The time per token should stay the same as the line gets longer
+      report_parse("one line sum of 10000 terms", long_sum(10000), runs);
+      report_parse("one line sum of 50000 terms", long_sum(50000), runs);
+    }
+
+    // -------------------------------------------------------------------------
+  }
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,90 @@
+// -----------------------------------------------------------------------------
+// Brandy semantic pass benchmark
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "bench.h"
+#include "binopnodereplacervisitor.h"
+#include "functionreturnvisitor.h"
+#include "lexer.h"
+#include "namereferenceresolvervisitor.h"
+#include "parser.h"
+#include "passmanager.h"
+#include "symbolfillervisitor.h"
+#include <iostream>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  namespace bench
+  {
+    // -------------------------------------------------------------------------
+
+    namespace
+    {
+      // The semantic passes with a walk each, as they ran before walks were
+      // shared
+      void add_separate_passes(pass_manager &passes)
+      {
+        passes.add<function_return_visitor>("function returns", pass_manager::after_earlier);
+        passes.add<symbol_table_filler_visitor>("symbol tables", pass_manager::after_earlier);
+        passes.add<name_reference_resolver_visitor>("name resolution", pass_manager::after_earlier);
+        passes.add<bin_op_replacer_visitor>("operator overloads", pass_manager::after_earlier);
+      }
+
+      // Runs the passes over a freshly parsed tree runs times and returns
+      // the fastest, leaving the parse and freeing the tree out of the time
+      double run_passes(const std::vector<token> &tokens, size_t runs, void (*add_passes)(pass_manager &), size_t &walks)
+      {
+        const compilation_context context((compiler_flags()));
+        double best = 0.0;
+
+        for (size_t i = 0; i < runs; ++i)
+        {
+          unique_ptr<module_node> module = parser(context, tokens).parse_module();
+
+          pass_manager passes;
+          add_passes(passes);
+          walks = passes.walk_count();
+
+          const double ms = time_ms([&]() { passes.run(module.get()); });
+          best = i == 0 ? ms : std::min(best, ms);
+        }
+
+        return best;
+      }
+    }
+
+    // -------------------------------------------------------------------------
+
+    void passes(const std::string &text, size_t runs)
+    {
+      std::vector<token> tokens;
+      tokenize_string(text.c_str(), tokens);
+
+      // The passes only ever see a clean parse
+      const compilation_context context((compiler_flags()));
+      parser check(context, tokens);
+      check.parse_module();
+
+      if (!check.errors().empty())
+      {
+        std::cout << "The input has " << check.errors().size() << " syntax errors" << std::endl;
+        return;
+      }
+
+      size_t separateWalks = 0, sharedWalks = 0;
+
+      const double separateMs = run_passes(tokens, runs, add_separate_passes, separateWalks);
+      const double sharedMs = run_passes(tokens, runs, add_semantic_passes, sharedWalks);
+
+      report(("a walk per pass, " + std::to_string(separateWalks) + " walks").c_str(), separateMs, tokens.size(), "token");
+      report(("shared walks, " + std::to_string(sharedWalks) + " walks").c_str(), sharedMs, tokens.size(), "token");
+    }
+
+    // -------------------------------------------------------------------------
+  }
+}
+
+// -----------------------------------------------------------------------------
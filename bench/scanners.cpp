@@ -0,0 +1,98 @@
+// -----------------------------------------------------------------------------
+// Brandy lexer scanner benchmark
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "bench.h"
+#include "charscan.h"
+#include "lexer.h"
+#include <iostream>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  namespace bench
+  {
+    // -------------------------------------------------------------------------
+
+    namespace
+    {
+      // Reads every token with the DFA alone, as the lexer did before the
+      // scanners, hashing identifiers as read_next_token does
+      size_t read_with_dfa(const char *str)
+      {
+        const lexer &dfa = brandy_lexer();
+        size_t count = 0;
+
+        while (*str)
+        {
+          lexeme lex;
+          if (!dfa.read_token(str, &lex)) break;
+
+          if (lex.type == token_types::IDENTIFIER)
+            lex.hash = hash_text(str, lex.length);
+
+          str += lex.length;
+          ++count;
+        }
+
+        return count;
+      }
+
+      size_t read_with_scanners(const char *str)
+      {
+        size_t count = 0;
+
+        while (*str)
+        {
+          lexeme lex;
+          if (!read_next_token(str, &lex)) break;
+
+          str += lex.length;
+          ++count;
+        }
+
+        return count;
+      }
+
+      // The newline count block comments are scanned with, over the lot
+      size_t count_newlines(const char *str, size_t length)
+      {
+        size_t count = 0;
+
+        for (size_t i = 0; i < length; ++i)
+          count += str[i] == '\n';
+
+        return count;
+      }
+    }
+
+    // -------------------------------------------------------------------------
+
+    void scanners(const std::string &text, size_t runs)
+    {
+      size_t dfaTokens = 0, scannedTokens = 0;
+
+      const double dfaMs = best_of(runs, [&]() { dfaTokens = read_with_dfa(text.c_str()); });
+      const double scannedMs = best_of(runs, [&]() { scannedTokens = read_with_scanners(text.c_str()); });
+
+      report("DFA only", dfaMs, text.size(), "byte");
+      report("scanners, then the DFA", scannedMs, text.size(), "byte");
+      std::cout << "  read " << dfaTokens << " and " << scannedTokens << " tokens" << std::endl;
+
+      size_t loopLines = 0, scannedLines = 0;
+
+      const double loopMs = best_of(runs, [&]() { loopLines = count_newlines(text.c_str(), text.size()); });
+      const double countMs = best_of(runs, [&]() { scannedLines = scan::count_newlines(text.c_str(), text.size()); });
+
+      report("newlines, byte at a time", loopMs, text.size(), "byte");
+      report("newlines, scan::count_newlines", countMs, text.size(), "byte");
+      std::cout << "  counted " << loopLines << " and " << scannedLines << " lines" << std::endl;
+    }
+
+    // -------------------------------------------------------------------------
+  }
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,86 @@
+// -----------------------------------------------------------------------------
+// Brandy symbol table benchmark
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "bench.h"
+#include "lexer.h"
+#include "symbol.h"
+#include <iostream>
+#include <string>
+#include <unordered_map>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  namespace bench
+  {
+    // -------------------------------------------------------------------------
+
+    namespace
+    {
+      // Declares and looks up the input's identifiers the way the symbol
+      // passes do: every run of 4 * scopeSize names is a scope, a name not
+      // in it is declared while it has room and every name is looked up.
+      // Returns how many lookups found their name.
+      template<typename table_type>
+      size_t fill_scopes(const std::vector<token> &names, size_t scopeSize)
+      {
+        size_t found = 0;
+
+        for (size_t start = 0; start < names.size(); start += scopeSize * 4)
+        {
+          table_type table;
+          const size_t end = std::min(names.size(), start + scopeSize * 4);
+
+          for (size_t i = start; i < end; ++i)
+          {
+            if (table.find(names[i]) != table.end())
+              ++found;
+            else if (table.size() < scopeSize)
+              table.insert(std::make_pair(names[i], symbol(names[i], symbol::variable, nullptr)));
+          }
+        }
+
+        return found;
+      }
+    }
+
+    // -------------------------------------------------------------------------
+
+    void symbol_tables(const std::string &text, size_t runs)
+    {
+      std::vector<token> tokens;
+      tokenize_string(text.c_str(), tokens);
+
+      std::vector<token> names;
+      for (const token &tok : tokens)
+      {
+        if (tok.type() == token_types::IDENTIFIER)
+          names.push_back(tok);
+      }
+
+      // Most scopes hold a few names, which flat_map keeps inline
+      const size_t scopeSizes[] = { 4, 16, 256 };
+
+      for (size_t scopeSize : scopeSizes)
+      {
+        size_t flatFound = 0, stdFound = 0;
+
+        const double flatMs = best_of(runs, [&]() { flatFound = fill_scopes<symbol_table>(names, scopeSize); });
+        const double stdMs = best_of(runs, [&]() { stdFound = fill_scopes<std::unordered_map<token, symbol>>(names, scopeSize); });
+
+        const std::string size = std::to_string(scopeSize);
+        report(("flat_map, scopes of " + size).c_str(), flatMs, names.size(), "name");
+        report(("std::unordered_map, scopes of " + size).c_str(), stdMs, names.size(), "name");
+
+        std::cout << "  found " << flatFound << " and " << stdFound << " of " << names.size() << std::endl;
+      }
+    }
+
+    // -------------------------------------------------------------------------
+  }
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,163 @@
+// -----------------------------------------------------------------------------
+// Brandy AST node arena
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "arena.h"
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  const size_t node_arena::BLOCK_SIZE;
+
+  namespace
+  {
+    void *allocate_block(size_t size)
+    {
+#ifdef _WIN32
+      void *block = _aligned_malloc(size, size);
+#else
+      void *block = nullptr;
+      if (posix_memalign(&block, size, size) != 0)
+        block = nullptr;
+#endif
+      if (!block) throw std::bad_alloc();
+      return block;
+    }
+
+    template<typename value_type>
+    value_type round_up(value_type value, size_t alignment)
+    {
+      return (value + alignment - 1) & ~value_type(alignment - 1);
+    }
+
+    void free_block(void *block)
+    {
+#ifdef _WIN32
+      _aligned_free(block);
+#else
+      free(block);
+#endif
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  node_arena::node_arena() :
+    m_block(0),
+    m_next(nullptr),
+    m_end(nullptr),
+    m_allocated(0)
+  {
+  }
+
+  node_arena::~node_arena()
+  {
+    for (void *block : m_blocks)
+      free_block(block);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void *node_arena::allocate(size_t size, size_t alignment)
+  {
+    assert(size + sizeof(node_arena *) + alignment <= BLOCK_SIZE && "Allocation too large for a node arena");
+
+    // Sizes are rounded up so that the bump pointer stays aligned, and giving
+    // back the last allocation always lands exactly on it
+    size = round_up(size, MAX_ALIGNMENT);
+
+    char *memory = reinterpret_cast<char *>(round_up(std::uintptr_t(m_next), alignment));
+
+    if (!m_next || memory + size > m_end)
+    {
+      next_block();
+      memory = reinterpret_cast<char *>(round_up(std::uintptr_t(m_next), alignment));
+    }
+
+    m_next = memory + size;
+    m_allocated += size;
+
+    return memory;
+  }
+
+  void node_arena::deallocate(void *memory, size_t size)
+  {
+    size = round_up(size, MAX_ALIGNMENT);
+
+    if (static_cast<char *>(memory) + size == m_next)
+    {
+      m_next = static_cast<char *>(memory);
+      m_allocated -= size;
+    }
+  }
+
+  node_arena::position node_arena::mark() const
+  {
+    position pos = { m_block, m_next, m_allocated };
+    return pos;
+  }
+
+  void node_arena::release(const position &pos)
+  {
+    if (!pos.next)
+    {
+      // Marked before the first block, start over at the beginning
+      m_block = 0;
+      m_next = m_end = nullptr;
+      m_allocated = 0;
+      return;
+    }
+
+    m_block = pos.block;
+    m_next = pos.next;
+    m_end = static_cast<char *>(m_blocks[m_block]) + BLOCK_SIZE;
+    m_allocated = pos.allocated;
+  }
+
+  node_arena *node_arena::owner(const void *memory)
+  {
+    std::uintptr_t block = std::uintptr_t(memory) & ~std::uintptr_t(BLOCK_SIZE - 1);
+    return *reinterpret_cast<node_arena **>(block);
+  }
+
+  size_t node_arena::bytes_allocated() const
+  {
+    return m_allocated;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void node_arena::next_block()
+  {
+    if (m_next)
+      ++m_block;
+
+    if (m_block == m_blocks.size())
+    {
+      void *block = allocate_block(BLOCK_SIZE);
+      m_blocks.push_back(block);
+
+      // The header that owner() reads
+      *static_cast<node_arena **>(block) = this;
+    }
+
+    m_next = static_cast<char *>(m_blocks[m_block]) + sizeof(node_arena *);
+    m_end = static_cast<char *>(m_blocks[m_block]) + BLOCK_SIZE;
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
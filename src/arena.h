@@ -0,0 +1,78 @@
+// -----------------------------------------------------------------------------
+// Brandy AST node arena
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  // A bump pointer allocator for syntax tree nodes. Memory is handed out in
+  // the order it's asked for and only given back when the arena is destroyed,
+  // all at once. Blocks are aligned to their size and start with a pointer to
+  // the arena, so any allocation can find the arena it came from.
+  class node_arena
+  {
+  public:
+    static const size_t BLOCK_SIZE = 64 * 1024;
+
+    // Enough for any node. VS2013 has no alignof, so it's the type trait.
+    static const size_t MAX_ALIGNMENT = std::alignment_of<std::max_align_t>::value;
+
+    node_arena();
+    ~node_arena();
+
+    node_arena(const node_arena &) = delete;
+    node_arena &operator=(const node_arena &) = delete;
+
+    void *allocate(size_t size, size_t alignment = MAX_ALIGNMENT);
+
+    // Only gives the memory back if it's the most recent allocation, anything
+    // else waits for the arena to go
+    void deallocate(void *memory, size_t size);
+
+    // Where the next allocation would go. Releasing back to a position gives
+    // up everything allocated after it, whatever its state.
+    struct position
+    {
+      size_t block;
+      char *next;
+      size_t allocated;
+    };
+
+    position mark() const;
+    void release(const position &pos);
+
+    // The arena that allocated memory
+    static node_arena *owner(const void *memory);
+
+    size_t bytes_allocated() const;
+
+  private:
+    void next_block();
+
+    // Blocks past m_block are left over from a release and get reused
+    std::vector<void *> m_blocks;
+    size_t m_block;
+    char *m_next;
+    char *m_end;
+    size_t m_allocated;
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
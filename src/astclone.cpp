@@ -0,0 +1,462 @@
+// -----------------------------------------------------------------------------
+// Brandy syntax tree copying
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "astclone.h"
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    // Copies the fields of each type of node, and those of its base type
+    // first, the same way for_each_child lists children
+    class node_cloner
+    {
+    public:
+      node_cloner(node_arena &arena) :
+        m_arena(arena)
+      {
+      }
+
+      unique_ptr<abstract_node> clone(const abstract_node *node)
+      {
+        switch (node->kind)
+        {
+#define NODE_KIND(node_type, visit_base)\
+        case node_kind::node_type:\
+          return clone_as(static_cast<const node_type *>(node));
+#include "astnodes.inl"
+#undef NODE_KIND
+        default:
+          assert(false);
+          return nullptr;
+        }
+      }
+
+      unique_ptr<class_node> clone_sharing(const class_node *node, const std::vector<bool> &share)
+      {
+        auto copy = make_node<class_node>(m_arena);
+        copy_fields(static_cast<symbol_node *>(copy.get()), static_cast<const symbol_node *>(node));
+        child(copy->base_classes, node->base_classes);
+
+        copy->members.reserve(node->members.size());
+
+        for (size_t i = 0; i < node->members.size(); ++i)
+        {
+          symbol_node *member = node->members[i].get();
+
+          if (!share[i])
+          {
+            copy->members.push_back(clone_child(member));
+            continue;
+          }
+
+          copy->members.emplace_back(member);
+
+          for (auto &entry : node->symbols)
+          {
+            if (entry.second.node == member)
+              copy->symbols.insert(entry);
+          }
+        }
+
+        return copy;
+      }
+
+    private:
+      template<typename node_type>
+      unique_ptr<abstract_node> clone_as(const node_type *node)
+      {
+        auto copy = make_node<node_type>(m_arena);
+        copy_fields(copy.get(), node);
+        return std::move(copy);
+      }
+
+      template<typename node_type>
+      unique_ptr<node_type> clone_child(const node_type *node)
+      {
+        return unique_ptr<node_type>(static_cast<node_type *>(clone(node).release()));
+      }
+
+      template<typename node_type>
+      void child(unique_ptr<node_type> &copy, const unique_ptr<node_type> &node)
+      {
+        if (node)
+          copy = clone_child(node.get());
+      }
+
+      template<typename node_type>
+      void child(unique_vector<node_type> &copy, const unique_vector<node_type> &nodes)
+      {
+        copy.reserve(nodes.size());
+        for (auto &node : nodes)
+          copy.push_back(clone_child(node.get()));
+      }
+
+#define CLONE_DECL(node_type) void copy_fields(node_type *copy, const node_type *node)
+#define CLONE_BASE(base_node) copy_fields(static_cast<base_node *>(copy), static_cast<const base_node *>(node))
+#define COPY(field) copy->field = node->field
+#define CLONE(field) child(copy->field, node->field)
+
+      CLONE_DECL(abstract_node)
+      {
+        COPY(begin);
+        COPY(end);
+      }
+
+      CLONE_DECL(module_node)
+      {
+        CLONE_BASE(abstract_node);
+        CLONE(members);
+        CLONE(statements);
+      }
+
+      CLONE_DECL(statement_node)
+      {
+        CLONE_BASE(abstract_node);
+      }
+
+      CLONE_DECL(symbol_node)
+      {
+        CLONE_BASE(statement_node);
+        COPY(name);
+        COPY(docs);
+        CLONE(attributes);
+        CLONE(qualifiers);
+        COPY(type);
+      }
+
+      CLONE_DECL(expression_node)
+      {
+        CLONE_BASE(statement_node);
+        COPY(resulting_type);
+      }
+
+      CLONE_DECL(post_expression_node)
+      {
+        CLONE_BASE(expression_node);
+        CLONE(left);
+      }
+
+      CLONE_DECL(class_node)
+      {
+        CLONE_BASE(symbol_node);
+        CLONE(base_classes);
+        CLONE(members);
+      }
+
+      CLONE_DECL(function_node)
+      {
+        CLONE_BASE(symbol_node);
+        CLONE(parameters);
+        CLONE(return_type);
+        CLONE(scope);
+      }
+
+      CLONE_DECL(var_node)
+      {
+        CLONE_BASE(symbol_node);
+        CLONE(type);
+        CLONE(expression);
+        COPY(var_type);
+      }
+
+      CLONE_DECL(parameter_node)
+      {
+        CLONE_BASE(var_node);
+        CLONE(default_value);
+      }
+
+      CLONE_DECL(property_node)
+      {
+        CLONE_BASE(symbol_node);
+        CLONE(type);
+        CLONE(getter);
+        CLONE(setter);
+        CLONE(setter_value);
+      }
+
+      CLONE_DECL(binary_operator_node)
+      {
+        CLONE_BASE(expression_node);
+        CLONE(left);
+        CLONE(right);
+        COPY(operation);
+      }
+
+      CLONE_DECL(unary_operator_node)
+      {
+        CLONE_BASE(expression_node);
+        CLONE(expression);
+        COPY(operation);
+      }
+
+      CLONE_DECL(member_access_node)
+      {
+        CLONE_BASE(post_expression_node);
+        COPY(member_name);
+      }
+
+      CLONE_DECL(call_node)
+      {
+        CLONE_BASE(post_expression_node);
+        CLONE(parameters);
+      }
+
+      CLONE_DECL(cast_node)
+      {
+        CLONE_BASE(post_expression_node);
+        CLONE(type);
+      }
+
+      CLONE_DECL(index_node)
+      {
+        CLONE_BASE(post_expression_node);
+        CLONE(index);
+      }
+
+      CLONE_DECL(tuple_expansion_node)
+      {
+        CLONE_BASE(post_expression_node);
+      }
+
+      CLONE_DECL(literal_node)
+      {
+        CLONE_BASE(expression_node);
+        COPY(value);
+      }
+
+      CLONE_DECL(tuple_literal_node)
+      {
+        CLONE_BASE(expression_node);
+        CLONE(items);
+      }
+
+      CLONE_DECL(table_literal_node)
+      {
+        CLONE_BASE(expression_node);
+        CLONE(keys);
+        CLONE(values);
+      }
+
+      CLONE_DECL(lambda_capture_node)
+      {
+        CLONE_BASE(abstract_node);
+        CLONE(name);
+        COPY(capture_type);
+      }
+
+      CLONE_DECL(lambda_node)
+      {
+        CLONE_BASE(expression_node);
+        CLONE(captures);
+        CLONE(parameters);
+        CLONE(return_type);
+        CLONE(scope);
+      }
+
+      // Left unresolved, its symbol is in the original's tables
+      CLONE_DECL(name_reference_node)
+      {
+        CLONE_BASE(expression_node);
+        COPY(name);
+        copy->resolved_table = nullptr;
+      }
+
+      CLONE_DECL(goto_node)
+      {
+        CLONE_BASE(statement_node);
+        COPY(target_name);
+      }
+
+      CLONE_DECL(label_node)
+      {
+        CLONE_BASE(statement_node);
+        COPY(name);
+      }
+
+      CLONE_DECL(return_node)
+      {
+        CLONE_BASE(statement_node);
+        CLONE(value);
+      }
+
+      CLONE_DECL(break_node)
+      {
+        CLONE_BASE(statement_node);
+        COPY(count);
+      }
+
+      CLONE_DECL(continue_node)
+      {
+        CLONE_BASE(statement_node);
+        COPY(count);
+      }
+
+      CLONE_DECL(if_node)
+      {
+        CLONE_BASE(statement_node);
+        CLONE(condition);
+        CLONE(else_clause);
+        CLONE(scope);
+      }
+
+      CLONE_DECL(while_node)
+      {
+        CLONE_BASE(statement_node);
+        CLONE(condition);
+        CLONE(scope);
+      }
+
+      CLONE_DECL(for_node)
+      {
+        CLONE_BASE(statement_node);
+        COPY(loop_var_name);
+        CLONE(loop_iterator);
+        CLONE(loop_start);
+        CLONE(loop_end);
+        CLONE(loop_increment);
+        CLONE(condition);
+        CLONE(scope);
+      }
+
+      CLONE_DECL(import_node)
+      {
+        CLONE_BASE(statement_node);
+        COPY(name_path);
+        COPY(effective_name);
+        COPY(is_meta);
+        COPY(resolved_meta);
+      }
+
+      CLONE_DECL(meta_node)
+      {
+        CLONE_BASE(statement_node);
+        CLONE(symbols);
+        CLONE(statements);
+      }
+
+      CLONE_DECL(typedef_node)
+      {
+        CLONE_BASE(symbol_node);
+        CLONE(attributes);
+        COPY(name);
+        CLONE(type);
+      }
+
+      CLONE_DECL(type_node)
+      {
+        CLONE_BASE(expression_node);
+      }
+
+      CLONE_DECL(tuple_node)
+      {
+        CLONE_BASE(type_node);
+        CLONE(inner_types);
+      }
+
+      CLONE_DECL(delegate_node)
+      {
+        CLONE_BASE(type_node);
+        CLONE(parameter_types);
+        CLONE(return_type);
+      }
+
+      CLONE_DECL(plain_type_node)
+      {
+        CLONE_BASE(type_node);
+        COPY(name);
+        CLONE(qualifiers);
+        CLONE(post_type);
+      }
+
+      CLONE_DECL(decltype_node)
+      {
+        CLONE_BASE(type_node);
+        CLONE(decltype_expression);
+      }
+
+      CLONE_DECL(post_type_node)
+      {
+        CLONE_BASE(abstract_node);
+      }
+
+      CLONE_DECL(type_indirect_node)
+      {
+        CLONE_BASE(post_type_node);
+        COPY(indirection_type);
+      }
+
+      CLONE_DECL(type_array_node)
+      {
+        CLONE_BASE(post_type_node);
+        CLONE(array_size);
+      }
+
+      CLONE_DECL(type_template_node)
+      {
+        CLONE_BASE(post_type_node);
+        CLONE(template_parameters);
+      }
+
+      CLONE_DECL(qualifier_node)
+      {
+        CLONE_BASE(abstract_node);
+        COPY(qualifier);
+      }
+
+      CLONE_DECL(attribute_node)
+      {
+        CLONE_BASE(abstract_node);
+        CLONE(attributes);
+      }
+
+      CLONE_DECL(scope_node)
+      {
+        CLONE_BASE(abstract_node);
+        CLONE(statements);
+      }
+
+#undef CLONE_DECL
+#undef CLONE_BASE
+#undef COPY
+#undef CLONE
+
+      node_arena &m_arena;
+    };
+  }
+
+  // ---------------------------------------------------------------------------
+
+  unique_ptr<abstract_node> clone_tree(const abstract_node *node, node_arena &arena)
+  {
+    node_cloner cloner(arena);
+    return cloner.clone(node);
+  }
+
+  unique_ptr<class_node> clone_class_sharing(const class_node *node, const std::vector<bool> &share, node_arena &arena)
+  {
+    node_cloner cloner(arena);
+    return cloner.clone_sharing(node, share);
+  }
+
+  void return_borrowed(class_node *copy)
+  {
+    const node_arena *arena = node_arena::owner(copy);
+
+    for (auto &member : copy->members)
+    {
+      if (node_arena::owner(member.get()) != arena)
+        member.release();
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,51 @@
+// -----------------------------------------------------------------------------
+// Brandy syntax tree copying
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#ifndef AST_CLONE_H
+#define AST_CLONE_H
+
+#pragma once
+
+#include "astnodes.h"
+#include <vector>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  // Deep copies a node and everything under it into an arena. The copy shares
+  // the original's tokens, so whatever owns those has to outlive it.
+  //
+  // Symbol tables are left empty and name references unresolved, the copy
+  // is meant to go through the semantic passes again (IE a class template
+  // being instantiated with its typedefs rebound).
+  unique_ptr<abstract_node> clone_tree(const abstract_node *node, node_arena &arena);
+
+  // Copies a class, except for the members share is true for, which the
+  // copy borrows from the original instead of copying (IE the members of a
+  // class template that don't mention the typedefs being bound). Borrowed
+  // members have already been through the semantic passes, so the copy's
+  // symbol table starts out with the original's symbols for them and the
+  // passes don't go into them (see module_node::borrows_nodes).
+  //
+  // The original has to outlive the copy, which has to give what it
+  // borrowed back with return_borrowed before it's deleted.
+  unique_ptr<class_node> clone_class_sharing(const class_node *node, const std::vector<bool> &share, node_arena &arena);
+  void return_borrowed(class_node *copy);
+
+  template<typename node_type>
+  unique_ptr<node_type> clone_node(const node_type *node, node_arena &arena)
+  {
+    return unique_ptr<node_type>(static_cast<node_type *>(clone_tree(node, arena).release()));
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
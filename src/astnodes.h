@@ -8,11 +8,14 @@
 
 #pragma once
 
+#include "arena.h"
 #include "qualifiers.h"
 #include "symbol.h"
 #include "tokens.h"
 #include <cassert>
+#include <cstdint>
 #include <memory>
+#include <type_traits>
 #include <vector>
 
 // -----------------------------------------------------------------------------
@@ -78,6 +81,46 @@ namespace brandy
   struct attribute_node;
   struct scope_node;
 
+  class bytecode_image;
+
+  // ---------------------------------------------------------------------------
+  // Node kinds
+
+  // Every node knows which type it is, so static_walk can switch on it rather
+  // than make virtual calls, and walks can pass over kinds a visitor doesn't
+  // want without calling it at all
+#define NODE_KIND(node_type, visit_base) node_type,
+  enum class node_kind : std::uint8_t
+  {
+#include "astnodes.inl"
+    count
+  };
+#undef NODE_KIND
+
+  // One bit for each kind
+  typedef std::uint64_t node_kind_set;
+
+  static_assert(unsigned(node_kind::count) < 64, "Node kinds don't fit in a node_kind_set");
+
+  const node_kind_set ALL_NODE_KINDS = (node_kind_set(1) << unsigned(node_kind::count)) - 1;
+
+  inline node_kind_set kind_bit(node_kind kind)
+  {
+    return node_kind_set(1) << unsigned(kind);
+  }
+
+  template<typename node_type>
+  struct node_kind_of;
+
+#define NODE_KIND(node_type, visit_base)\
+  template<> struct node_kind_of<node_type>\
+  {\
+    static const node_kind value = node_kind::node_type;\
+    static const node_kind_set bit = node_kind_set(1) << unsigned(node_kind::node_type);\
+  };
+#include "astnodes.inl"
+#undef NODE_KIND
+
   // ---------------------------------------------------------------------------
 
   class ast_visitor
@@ -85,6 +128,7 @@ namespace brandy
   public:
     enum visitor_result { resume, stop, replace, rewalk };
 
+    ast_visitor();
     virtual ~ast_visitor();
 
     virtual ast_visitor::visitor_result visit(abstract_node *node);
@@ -135,7 +179,20 @@ namespace brandy
     virtual ast_visitor::visitor_result visit(attribute_node *node);
     virtual ast_visitor::visitor_result visit(scope_node *node);
 
+    // Called once a node's children have been walked, unless visiting it
+    // returned stop. Visitors that keep a stack of scopes pop them here.
+    virtual void leave(abstract_node *node);
+
     std::unique_ptr<abstract_node> replacement_node;
+
+    // Walks only call visit and leave for the kinds of node in handled_kinds,
+    // others are walked through as if visiting them returned resume. Kinds in
+    // skipped_kinds are treated as returning stop, so whatever is under them
+    // isn't walked at all. By default every kind is handled and none skipped.
+    // A visitor narrowing them has to include the kinds whose visit falls
+    // through to an overload it has, see node_kinds_of.
+    node_kind_set handled_kinds;
+    node_kind_set skipped_kinds;
   };
 
   template<typename T>
@@ -151,24 +208,39 @@ namespace brandy
     if (visit)
     {
     start:
-      auto result = node->internal_visit(visitor);
+      const node_kind_set kind = kind_bit(node->kind);
 
-      switch (result)
-      {
-      case ast_visitor::replace:
+      if (visitor->skipped_kinds & kind)
+        return;
+
+      if (visitor->handled_kinds & kind)
       {
-        auto replacement = visitor->replacement_node.release();
-        node = unique_ptr<node_type>(static_cast<node_type *>(replacement));
+        auto result = node->internal_visit(visitor);
+
+        switch (result)
+        {
+        case ast_visitor::replace:
+        {
+          auto replacement = visitor->replacement_node.release();
+          node = unique_ptr<node_type>(static_cast<node_type *>(replacement));
+        }
+        // Fall through to visit the node with its new value
+        case ast_visitor::rewalk:
+          goto start;
+        case ast_visitor::stop:
+          return;
+        }
       }
-      // Fall through to visit the node with its new value
-      case ast_visitor::rewalk:
-        goto start;
-      case ast_visitor::stop:
-        return;
+      else
+      {
+        visit = false;
       }
     }
 
     node->internal_walk(visitor);
+
+    if (visit)
+      visitor->leave(node.get());
   }
 
   // Walks a node
@@ -177,20 +249,35 @@ namespace brandy
   {
     if (visit)
     {
-    start:
-      auto result = node->internal_visit(visitor);
-      assert(result != ast_visitor::replace); // Can't replace the node when taking it by pointer
+      const node_kind_set kind = kind_bit(node->kind);
 
-      switch (result)
-      {
-      case ast_visitor::rewalk:
-        goto start;
-      case ast_visitor::stop:
+      if (visitor->skipped_kinds & kind)
         return;
+
+      if (visitor->handled_kinds & kind)
+      {
+      start:
+        auto result = node->internal_visit(visitor);
+        assert(result != ast_visitor::replace); // Can't replace the node when taking it by pointer
+
+        switch (result)
+        {
+        case ast_visitor::rewalk:
+          goto start;
+        case ast_visitor::stop:
+          return;
+        }
+      }
+      else
+      {
+        visit = false;
       }
     }
 
     node->internal_walk(visitor);
+
+    if (visit)
+      visitor->leave(node);
   }
 
   // ---------------------------------------------------------------------------
@@ -199,21 +286,62 @@ namespace brandy
   struct abstract_node
   {
     std::vector<token>::const_iterator begin, end;
+
+    // Set by make_node
+    node_kind kind;
+
     virtual ~abstract_node();
 
+    // Nodes are only made in a node_arena (see make_node). Deleting one runs
+    // its destructor and leaves the memory to the arena, unless it was the
+    // last thing allocated, like a node the parser made and then rejected.
+    static void *operator new(size_t size, node_arena &arena);
+    static void operator delete(void *memory, node_arena &arena);
+    static void operator delete(void *memory, size_t size);
+
     virtual ast_visitor::visitor_result internal_visit(ast_visitor *visitor) = 0;
     virtual void internal_walk(ast_visitor *visitor) = 0;
   };
 
+  // ---------------------------------------------------------------------------
+
+  template<typename node_type>
+  unique_ptr<node_type> make_node(node_arena &arena)
+  {
+    unique_ptr<node_type> node(new (arena) node_type());
+    node->kind = node_kind_of<node_type>::value;
+    return node;
+  }
+
+  // Makes a node in the same arena as an existing one, for visitors that add
+  // or replace nodes. It starts out over the same tokens, so anything
+  // reporting an error on it has a line to give.
+  template<typename node_type>
+  unique_ptr<node_type> make_node_near(const abstract_node *existing)
+  {
+    auto node = make_node<node_type>(*node_arena::owner(existing));
+    node->begin = existing->begin;
+    node->end = existing->end;
+    return node;
+  }
+
   // ---------------------------------------------------------------------------
   // Module
 
   struct module_node : public abstract_node
   {
+    // A module is the first node made in its arena and owns it, deleting the
+    // module frees the arena along with every node in it
+    static void operator delete(void *memory);
+
     unique_vector<symbol_node> members;
     unique_vector<statement_node> statements;
     symbol_table symbols;
 
+    // Set when some of its nodes are borrowed from another module's tree,
+    // which has already been through the passes (see clone_class_sharing)
+    bool borrows_nodes;
+
     ast_visitor::visitor_result internal_visit(ast_visitor *visitor) override;
     void internal_walk(ast_visitor *visitor) override;
   };
@@ -415,7 +543,12 @@ namespace brandy
   struct name_reference_node : public expression_node
   {
     token name;
-    symbol *resolved_symbol;
+
+    // The table the name was found in, null if it wasn't. Inserting into a
+    // table moves its symbols, so the symbol is found again when it's asked
+    // for, and the pointer is only good until the next insert.
+    symbol_table *resolved_table;
+    symbol *resolved_symbol() const;
 
     ast_visitor::visitor_result internal_visit(ast_visitor *visitor) override;
     void internal_walk(ast_visitor *visitor) override;
@@ -503,6 +636,10 @@ namespace brandy
     token effective_name;
     bool is_meta;
 
+    // The imported module's meta code, set by the driver when that module is
+    // compiled along with this one and has any, before the semantic passes run
+    const bytecode_image *resolved_meta;
+
     ast_visitor::visitor_result internal_visit(ast_visitor *visitor) override;
     void internal_walk(ast_visitor *visitor) override;
   };
@@ -625,6 +762,493 @@ namespace brandy
     void internal_walk(ast_visitor *visitor) override;
   };
 
+  // ---------------------------------------------------------------------------
+  // Kinds of node
+
+  // The kinds of node_type and every type of node derived from it, to build
+  // a visitor's handled_kinds or skipped_kinds from
+  template<typename node_type>
+  struct node_kinds_of
+  {
+#define NODE_KIND(kind_type, visit_base)\
+    | (std::is_base_of<node_type, kind_type>::value ? node_kind_of<kind_type>::bit : 0)
+
+    static const node_kind_set value = 0
+#include "astnodes.inl"
+      ;
+
+#undef NODE_KIND
+  };
+
+  // ---------------------------------------------------------------------------
+  // Children
+
+  // Calls walk with each child pointer or vector of them, in the order
+  // they're walked. Both internal_walk and static_walk go through these.
+#define CHILDREN_DECL(node_type)\
+  template<typename walker> void for_each_child(node_type *node, walker &walk)
+#define CHILDREN_BASE(base_node) for_each_child(static_cast<base_node *>(node), walk)
+
+  // Nothing to walk, so the parameters go unnamed
+  template<typename walker> void for_each_child(abstract_node *, walker &)
+  {
+  }
+
+  CHILDREN_DECL(module_node)
+  {
+    CHILDREN_BASE(abstract_node);
+    walk(node->members);
+    walk(node->statements);
+  }
+
+  CHILDREN_DECL(statement_node)
+  {
+    CHILDREN_BASE(abstract_node);
+  }
+
+  CHILDREN_DECL(symbol_node)
+  {
+    CHILDREN_BASE(statement_node);
+    walk(node->attributes);
+    walk(node->qualifiers);
+  }
+
+  CHILDREN_DECL(expression_node)
+  {
+    CHILDREN_BASE(statement_node);
+  }
+
+  CHILDREN_DECL(post_expression_node)
+  {
+    CHILDREN_BASE(expression_node);
+    walk(node->left);
+  }
+
+  CHILDREN_DECL(class_node)
+  {
+    CHILDREN_BASE(symbol_node);
+    walk(node->base_classes);
+    walk(node->members);
+  }
+
+  CHILDREN_DECL(function_node)
+  {
+    CHILDREN_BASE(symbol_node);
+    walk(node->parameters);
+    walk(node->return_type);
+    walk(node->scope);
+  }
+
+  CHILDREN_DECL(var_node)
+  {
+    CHILDREN_BASE(symbol_node);
+    walk(node->type);
+    walk(node->expression);
+  }
+
+  CHILDREN_DECL(parameter_node)
+  {
+    CHILDREN_BASE(var_node);
+    walk(node->default_value);
+  }
+
+  CHILDREN_DECL(property_node)
+  {
+    CHILDREN_BASE(symbol_node);
+    walk(node->type);
+    walk(node->getter);
+    walk(node->setter);
+    walk(node->setter_value);
+  }
+
+  CHILDREN_DECL(binary_operator_node)
+  {
+    CHILDREN_BASE(expression_node);
+    walk(node->left);
+    walk(node->right);
+  }
+
+  CHILDREN_DECL(unary_operator_node)
+  {
+    CHILDREN_BASE(expression_node);
+    walk(node->expression);
+  }
+
+  CHILDREN_DECL(member_access_node)
+  {
+    CHILDREN_BASE(post_expression_node);
+  }
+
+  CHILDREN_DECL(call_node)
+  {
+    CHILDREN_BASE(post_expression_node);
+    walk(node->parameters);
+  }
+
+  CHILDREN_DECL(cast_node)
+  {
+    CHILDREN_BASE(post_expression_node);
+    walk(node->type);
+  }
+
+  CHILDREN_DECL(index_node)
+  {
+    CHILDREN_BASE(post_expression_node);
+    walk(node->index);
+  }
+
+  CHILDREN_DECL(tuple_expansion_node)
+  {
+    CHILDREN_BASE(post_expression_node);
+  }
+
+  CHILDREN_DECL(literal_node)
+  {
+    CHILDREN_BASE(expression_node);
+  }
+
+  CHILDREN_DECL(tuple_literal_node)
+  {
+    CHILDREN_BASE(expression_node);
+    walk(node->items);
+  }
+
+  CHILDREN_DECL(table_literal_node)
+  {
+    CHILDREN_BASE(expression_node);
+    walk(node->keys);
+    walk(node->values);
+  }
+
+  CHILDREN_DECL(lambda_capture_node)
+  {
+    CHILDREN_BASE(abstract_node);
+    walk(node->name);
+  }
+
+  CHILDREN_DECL(lambda_node)
+  {
+    CHILDREN_BASE(expression_node);
+    walk(node->captures);
+    walk(node->parameters);
+    walk(node->return_type);
+    walk(node->scope);
+  }
+
+  CHILDREN_DECL(name_reference_node)
+  {
+    CHILDREN_BASE(expression_node);
+  }
+
+  CHILDREN_DECL(goto_node)
+  {
+    CHILDREN_BASE(statement_node);
+  }
+
+  CHILDREN_DECL(label_node)
+  {
+    CHILDREN_BASE(statement_node);
+  }
+
+  CHILDREN_DECL(return_node)
+  {
+    CHILDREN_BASE(statement_node);
+    walk(node->value);
+  }
+
+  CHILDREN_DECL(break_node)
+  {
+    CHILDREN_BASE(statement_node);
+  }
+
+  CHILDREN_DECL(continue_node)
+  {
+    CHILDREN_BASE(statement_node);
+  }
+
+  CHILDREN_DECL(if_node)
+  {
+    CHILDREN_BASE(statement_node);
+    walk(node->condition);
+    walk(node->scope);
+    walk(node->else_clause);
+  }
+
+  CHILDREN_DECL(while_node)
+  {
+    CHILDREN_BASE(statement_node);
+    walk(node->condition);
+    walk(node->scope);
+  }
+
+  CHILDREN_DECL(for_node)
+  {
+    CHILDREN_BASE(statement_node);
+    walk(node->loop_iterator);
+    walk(node->loop_start);
+    walk(node->loop_end);
+    walk(node->loop_increment);
+    walk(node->condition);
+    walk(node->scope);
+  }
+
+  CHILDREN_DECL(import_node)
+  {
+    CHILDREN_BASE(statement_node);
+  }
+
+  CHILDREN_DECL(meta_node)
+  {
+    CHILDREN_BASE(statement_node);
+    walk(node->symbols);
+    walk(node->statements);
+  }
+
+  // Its own attributes hide the ones it has as a symbol_node
+  CHILDREN_DECL(typedef_node)
+  {
+    CHILDREN_BASE(statement_node);
+    walk(node->attributes);
+    walk(node->type);
+  }
+
+  CHILDREN_DECL(type_node)
+  {
+    CHILDREN_BASE(abstract_node);
+  }
+
+  CHILDREN_DECL(tuple_node)
+  {
+    CHILDREN_BASE(type_node);
+    walk(node->inner_types);
+  }
+
+  CHILDREN_DECL(delegate_node)
+  {
+    CHILDREN_BASE(type_node);
+    walk(node->parameter_types);
+    walk(node->return_type);
+  }
+
+  CHILDREN_DECL(plain_type_node)
+  {
+    CHILDREN_BASE(type_node);
+    walk(node->qualifiers);
+    walk(node->post_type);
+  }
+
+  CHILDREN_DECL(decltype_node)
+  {
+    CHILDREN_BASE(type_node);
+    walk(node->decltype_expression);
+  }
+
+  CHILDREN_DECL(post_type_node)
+  {
+    CHILDREN_BASE(abstract_node);
+  }
+
+  CHILDREN_DECL(type_indirect_node)
+  {
+    CHILDREN_BASE(post_type_node);
+  }
+
+  CHILDREN_DECL(type_array_node)
+  {
+    CHILDREN_BASE(post_type_node);
+    walk(node->array_size);
+  }
+
+  CHILDREN_DECL(type_template_node)
+  {
+    CHILDREN_BASE(post_type_node);
+    walk(node->template_parameters);
+  }
+
+  CHILDREN_DECL(qualifier_node)
+  {
+    CHILDREN_BASE(abstract_node);
+  }
+
+  CHILDREN_DECL(attribute_node)
+  {
+    CHILDREN_BASE(abstract_node);
+    walk(node->attributes);
+  }
+
+  CHILDREN_DECL(scope_node)
+  {
+    CHILDREN_BASE(abstract_node);
+    walk(node->statements);
+  }
+
+#undef CHILDREN_DECL
+#undef CHILDREN_BASE
+
+  // ---------------------------------------------------------------------------
+  // Static visitors
+
+  // A visitor for static_walk, where which overload to call is worked out by
+  // the compiler instead of through virtual calls. Derive from it as
+  //
+  //   class my_visitor : public static_visitor<my_visitor>
+  //
+  // and bring the defaults in with "using static_visitor<my_visitor>::visit"
+  // next to the overloads. As with ast_visitor, a type of node with no
+  // overload of its own goes to the one for its base type.
+  //
+  // handled_kinds and skipped_kinds work as they do on an ast_visitor, but
+  // are constants, so a visitor can hide them with its own and the walk
+  // drops whatever it can't need when it's compiled.
+  template<typename derived>
+  class static_visitor
+  {
+  public:
+    static const node_kind_set handled_kinds = ALL_NODE_KINDS;
+    static const node_kind_set skipped_kinds = 0;
+
+    ast_visitor::visitor_result visit(abstract_node *)
+    {
+      return ast_visitor::resume;
+    }
+
+#define NODE_KIND(node_type, visit_base)\
+    ast_visitor::visitor_result visit(node_type *node)\
+    {\
+      return static_cast<derived *>(this)->visit(static_cast<visit_base *>(node));\
+    }
+#include "astnodes.inl"
+#undef NODE_KIND
+
+    void leave(abstract_node *)
+    {
+    }
+
+    std::unique_ptr<abstract_node> replacement_node;
+  };
+
+  template<typename derived>
+  const node_kind_set static_visitor<derived>::handled_kinds;
+
+  template<typename derived>
+  const node_kind_set static_visitor<derived>::skipped_kinds;
+
+  // ---------------------------------------------------------------------------
+
+  // Walks a tree for a static_visitor, a switch on each node's kind finds
+  // its type
+  template<typename visitor_type>
+  class static_walker
+  {
+  public:
+    static_walker(visitor_type &visitor) :
+      m_visitor(visitor)
+    {
+    }
+
+    template<typename node_type>
+    void walk(unique_ptr<node_type> &node)
+    {
+      ast_visitor::visitor_result result;
+
+      do
+      {
+        result = walk_kind(node.get());
+
+        if (result == ast_visitor::replace)
+        {
+          auto replacement = m_visitor.replacement_node.release();
+          node = unique_ptr<node_type>(static_cast<node_type *>(replacement));
+        }
+      } while (result == ast_visitor::replace || result == ast_visitor::rewalk);
+    }
+
+    template<typename node_type>
+    void walk(node_type *node)
+    {
+      ast_visitor::visitor_result result;
+
+      do
+      {
+        result = walk_kind(node);
+        assert(result != ast_visitor::replace); // Can't replace the node when taking it by pointer
+      } while (result == ast_visitor::rewalk);
+    }
+
+    // For for_each_child
+    template<typename node_type>
+    void operator()(unique_ptr<node_type> &node)
+    {
+      if (node)
+        walk(node);
+    }
+
+    template<typename node_type>
+    void operator()(unique_vector<node_type> &nodes)
+    {
+      for (auto &node : nodes)
+        walk(node);
+    }
+
+  private:
+    ast_visitor::visitor_result walk_kind(abstract_node *node)
+    {
+      switch (node->kind)
+      {
+#define NODE_KIND(node_type, visit_base)\
+      case node_kind::node_type:\
+        return walk_as(static_cast<node_type *>(node));
+#include "astnodes.inl"
+#undef NODE_KIND
+      default:
+        assert(false);
+        return ast_visitor::stop;
+      }
+    }
+
+    // Returns replace or rewalk when the node has to be walked again
+    template<typename node_type>
+    ast_visitor::visitor_result walk_as(node_type *node)
+    {
+      const node_kind_set kind = node_kind_of<node_type>::bit;
+
+      if (visitor_type::skipped_kinds & kind)
+        return ast_visitor::stop;
+
+      const bool handled = (visitor_type::handled_kinds & kind) != 0;
+
+      if (handled)
+      {
+        ast_visitor::visitor_result result = m_visitor.visit(node);
+        if (result != ast_visitor::resume)
+          return result;
+      }
+
+      for_each_child(node, *this);
+
+      if (handled)
+        m_visitor.leave(node);
+
+      return ast_visitor::resume;
+    }
+
+    visitor_type &m_visitor;
+  };
+
+  template<typename visitor_type, typename node_type>
+  void static_walk(unique_ptr<node_type> &node, visitor_type &visitor)
+  {
+    static_walker<visitor_type> walker(visitor);
+    walker.walk(node);
+  }
+
+  template<typename visitor_type, typename node_type>
+  void static_walk(node_type *node, visitor_type &visitor)
+  {
+    static_walker<visitor_type> walker(visitor);
+    walker.walk(node);
+  }
+
   // ---------------------------------------------------------------------------
 }
 
@@ -0,0 +1,53 @@
+NODE_KIND(module_node, abstract_node)
+
+NODE_KIND(symbol_node, abstract_node)
+NODE_KIND(expression_node, statement_node)
+NODE_KIND(post_expression_node, statement_node)
+NODE_KIND(statement_node, abstract_node)
+
+NODE_KIND(class_node, symbol_node)
+NODE_KIND(function_node, symbol_node)
+NODE_KIND(var_node, symbol_node)
+NODE_KIND(parameter_node, var_node)
+NODE_KIND(property_node, symbol_node)
+
+NODE_KIND(binary_operator_node, expression_node)
+NODE_KIND(unary_operator_node, expression_node)
+NODE_KIND(member_access_node, post_expression_node)
+NODE_KIND(call_node, post_expression_node)
+NODE_KIND(cast_node, post_expression_node)
+NODE_KIND(index_node, post_expression_node)
+NODE_KIND(tuple_expansion_node, post_expression_node)
+NODE_KIND(literal_node, expression_node)
+NODE_KIND(tuple_literal_node, expression_node)
+NODE_KIND(table_literal_node, expression_node)
+NODE_KIND(lambda_capture_node, abstract_node)
+NODE_KIND(lambda_node, expression_node)
+NODE_KIND(name_reference_node, expression_node)
+
+NODE_KIND(goto_node, statement_node)
+NODE_KIND(label_node, statement_node)
+NODE_KIND(return_node, statement_node)
+NODE_KIND(break_node, statement_node)
+NODE_KIND(continue_node, statement_node)
+NODE_KIND(if_node, statement_node)
+NODE_KIND(while_node, statement_node)
+NODE_KIND(for_node, statement_node)
+NODE_KIND(import_node, statement_node)
+NODE_KIND(meta_node, statement_node)
+NODE_KIND(typedef_node, symbol_node)
+
+NODE_KIND(type_node, abstract_node)
+NODE_KIND(tuple_node, type_node)
+NODE_KIND(delegate_node, type_node)
+NODE_KIND(plain_type_node, type_node)
+NODE_KIND(decltype_node, type_node)
+
+NODE_KIND(post_type_node, abstract_node)
+NODE_KIND(type_indirect_node, post_type_node)
+NODE_KIND(type_array_node, post_type_node)
+NODE_KIND(type_template_node, post_type_node)
+
+NODE_KIND(qualifier_node, abstract_node)
+NODE_KIND(attribute_node, abstract_node)
+NODE_KIND(scope_node, abstract_node)
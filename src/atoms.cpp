@@ -0,0 +1,286 @@
+// -----------------------------------------------------------------------------
+// Brandy identifier atom table
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "atoms.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+#define GET_16_BITS(d) (*((const std::uint16_t *) (d)))
+
+  std::uint32_t hash_text(const char *data, size_t length)
+  {
+    size_t len = length;
+
+    std::uint32_t hash = std::uint32_t(len), tmp;
+    int rem;
+
+    if (len == 0) return 0;
+
+    rem = len & 3;
+    len >>= 2;
+
+    /* Main loop */
+    for (; len > 0; len--) {
+      hash += GET_16_BITS(data);
+      tmp = (GET_16_BITS(data + 2) << 11) ^ hash;
+      hash = (hash << 16) ^ tmp;
+      data += 2 * sizeof(uint16_t);
+      hash += hash >> 11;
+    }
+
+    /* Handle end cases */
+    switch (rem) {
+    case 3:
+      hash += GET_16_BITS(data);
+      hash ^= hash << 16;
+      hash ^= ((signed char)data[sizeof(uint16_t)]) << 18;
+      hash += hash >> 11;
+      break;
+
+    case 2:
+      hash += GET_16_BITS(data);
+      hash ^= hash << 11;
+      hash += hash >> 17;
+      break;
+
+    case 1:
+      hash += (signed char)*data;
+      hash ^= hash << 10;
+      hash += hash >> 1;
+    }
+
+    /* Force "avalanching" of final 127 bits */
+    hash ^= hash << 3;
+    hash += hash >> 5;
+    hash ^= hash << 4;
+    hash += hash >> 17;
+    hash ^= hash << 25;
+    hash += hash >> 6;
+
+    return hash;
+  }
+
+#undef GET_16_BITS
+
+  // ---------------------------------------------------------------------------
+
+  namespace atoms
+  {
+    namespace
+    {
+      struct entry
+      {
+        const char *text;
+        std::uint32_t length;
+        std::uint32_t hash;
+      };
+
+      // Entries live in fixed size blocks that never move, so reading an atom
+      // doesn't need a lock
+      const size_t ENTRY_BLOCK_BITS = 12;
+      const size_t ENTRY_BLOCK_SIZE = size_t(1) << ENTRY_BLOCK_BITS;
+      const size_t MAX_ENTRY_BLOCKS = 4096;
+
+      const size_t TEXT_BLOCK_SIZE = 64 * 1024;
+
+      // The lookup is split by the top bits of the hash, each part with its
+      // own lock, so threads lexing at once rarely wait on each other
+      const size_t SHARD_BITS = 4;
+      const size_t SHARD_COUNT = size_t(1) << SHARD_BITS;
+
+      struct shard
+      {
+        shard() :
+          count(0),
+          slots(256, NONE),
+          textUsed(0),
+          textSize(0)
+        {
+        }
+
+        const char *store_text(const char *str, size_t length)
+        {
+          if (textBlocks.empty() || textUsed + length + 1 > textSize)
+          {
+            textSize = std::max(TEXT_BLOCK_SIZE, length + 1);
+            textBlocks.emplace_back(new char[textSize]);
+            textUsed = 0;
+          }
+
+          char *stored = textBlocks.back().get() + textUsed;
+          memcpy(stored, str, length);
+          stored[length] = '\0';
+          textUsed += length + 1;
+
+          return stored;
+        }
+
+        size_t count;
+
+        // Open addressed, linear probing, kept under half full
+        std::vector<id> slots;
+
+        std::vector<std::unique_ptr<char[]>> textBlocks;
+        size_t textUsed;
+        size_t textSize;
+
+        std::mutex lock;
+      };
+
+      struct table
+      {
+        table() :
+          next(1) // Id 0 is reserved for tokens that aren't atoms
+        {
+          for (auto &block : blocks)
+            block.store(nullptr, std::memory_order_relaxed);
+
+          blocks[0].store(new entry[ENTRY_BLOCK_SIZE](), std::memory_order_relaxed);
+        }
+
+        ~table()
+        {
+          for (auto &block : blocks)
+            delete[] block.load(std::memory_order_relaxed);
+        }
+
+        entry &at(id atom)
+        {
+          return blocks[atom >> ENTRY_BLOCK_BITS].load(std::memory_order_acquire)[atom & (ENTRY_BLOCK_SIZE - 1)];
+        }
+
+        shard &shard_for(std::uint32_t hash)
+        {
+          return shards[hash >> (32 - SHARD_BITS)];
+        }
+
+        // Ids are handed out across every shard, a new block is made by
+        // whichever shard first needs it
+        id add()
+        {
+          const id atom = next++;
+
+          if ((atom >> ENTRY_BLOCK_BITS) >= MAX_ENTRY_BLOCKS)
+          {
+            fprintf(stderr, "Fatal error: more than %u distinct identifiers\n", unsigned(MAX_ENTRY_BLOCKS * ENTRY_BLOCK_SIZE));
+            abort();
+          }
+
+          std::atomic<entry *> &block = blocks[atom >> ENTRY_BLOCK_BITS];
+
+          if (!block.load(std::memory_order_acquire))
+          {
+            std::lock_guard<std::mutex> lock(blockLock);
+
+            if (!block.load(std::memory_order_relaxed))
+              block.store(new entry[ENTRY_BLOCK_SIZE](), std::memory_order_release);
+          }
+
+          return atom;
+        }
+
+        void grow(shard &part)
+        {
+          std::vector<id> bigger(part.slots.size() * 2, NONE);
+          const size_t mask = bigger.size() - 1;
+
+          for (id atom : part.slots)
+          {
+            if (atom == NONE) continue;
+
+            size_t i = at(atom).hash & mask;
+            while (bigger[i] != NONE)
+              i = (i + 1) & mask;
+
+            bigger[i] = atom;
+          }
+
+          part.slots.swap(bigger);
+        }
+
+        std::atomic<entry *> blocks[MAX_ENTRY_BLOCKS];
+        std::atomic<id> next;
+        std::mutex blockLock;
+
+        shard shards[SHARD_COUNT];
+      };
+
+      // Namespace scope rather than built on first use, as function statics
+      // aren't thread safe in VS2013 and the first use can be on any thread.
+      // Nothing interns during static initialization.
+      table g_table;
+    }
+
+    // -------------------------------------------------------------------------
+
+    id intern(const char *str, size_t length)
+    {
+      return intern(str, length, hash_text(str, length));
+    }
+
+    id intern(const char *str, size_t length, std::uint32_t hash)
+    {
+      table &atoms = g_table;
+      shard &part = atoms.shard_for(hash);
+
+      std::lock_guard<std::mutex> lock(part.lock);
+
+      size_t mask = part.slots.size() - 1;
+      size_t i = hash & mask;
+
+      for (; part.slots[i] != NONE; i = (i + 1) & mask)
+      {
+        const entry &existing = atoms.at(part.slots[i]);
+        if (existing.hash == hash && existing.length == length && memcmp(existing.text, str, length) == 0)
+          return part.slots[i];
+      }
+
+      const id atom = atoms.add();
+
+      entry &added = atoms.at(atom);
+      added.text = part.store_text(str, length);
+      added.length = std::uint32_t(length);
+      added.hash = hash;
+
+      part.slots[i] = atom;
+
+      if (++part.count * 2 > part.slots.size())
+        atoms.grow(part);
+
+      return atom;
+    }
+
+    const char *text(id atom)
+    {
+      return g_table.at(atom).text;
+    }
+
+    size_t length(id atom)
+    {
+      return g_table.at(atom).length;
+    }
+
+    std::uint32_t hash(id atom)
+    {
+      return g_table.at(atom).hash;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,48 @@
+// -----------------------------------------------------------------------------
+// Brandy identifier atom table
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#ifndef ATOMS_H
+#define ATOMS_H
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  // SuperFastHash of length bytes of data
+  std::uint32_t hash_text(const char *data, size_t length);
+
+  // ---------------------------------------------------------------------------
+
+  // Every distinct identifier spelling is interned once and given an id, so
+  // two identifiers are the same name exactly when their atoms are equal.
+  // Interning is thread safe and atoms live until the program exits.
+  namespace atoms
+  {
+    typedef std::uint32_t id;
+
+    const id NONE = 0;
+
+    id intern(const char *str, size_t length);
+    id intern(const char *str, size_t length, std::uint32_t hash); // hash must be hash_text(str, length)
+
+    // The interned spelling, NUL terminated
+    const char   *text(id atom);
+    size_t      length(id atom);
+    std::uint32_t hash(id atom);
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
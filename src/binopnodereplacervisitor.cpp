@@ -9,9 +9,14 @@
 
 namespace brandy
 {
+  bin_op_replacer_visitor::bin_op_replacer_visitor()
+  {
+    handled_kinds = node_kinds_of<binary_operator_node>::value;
+  }
+
   ast_visitor::visitor_result bin_op_replacer_visitor::visit(binary_operator_node *node)
   {
-    std::unique_ptr<call_node> newCallNode = std::make_unique<call_node>();
+    std::unique_ptr<call_node> newCallNode = make_node_near<call_node>(node);
 
     token nameToken;
     switch(node->operation.type())
@@ -154,7 +159,7 @@ namespace brandy
 
     }
 
-    std::unique_ptr<member_access_node> newMemAccNode = std::make_unique<member_access_node>();
+    std::unique_ptr<member_access_node> newMemAccNode = make_node_near<member_access_node>(node);
     newMemAccNode->member_name = nameToken;
     newMemAccNode->left = std::move(node->left);
 
@@ -19,7 +19,7 @@ namespace brandy
   class bin_op_replacer_visitor : public ast_visitor
   {
   public:
-    //bin_op_visitor();
+    bin_op_replacer_visitor();
 
     ast_visitor::visitor_result visit(binary_operator_node *node) override;
 
@@ -0,0 +1,240 @@
+// -----------------------------------------------------------------------------
+// Brandy incremental build state
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "buildstate.h"
+#include "astnodes.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <stdlib.h>
+#include <string.h>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    // Bump this whenever the file layout or what goes into a hash changes
+    const char STATE_HEADER[] = "brandy build state 1";
+
+    typedef std::vector<token>::const_iterator token_iterator;
+
+    // Finds the token ranges of the bodies inside a declaration. Bodies are
+    // always scopes, and nothing inside one is part of the interface.
+    class body_finder : public static_visitor<body_finder>
+    {
+    public:
+      using static_visitor<body_finder>::visit;
+
+      static const node_kind_set handled_kinds = node_kind_of<scope_node>::bit;
+
+      ast_visitor::visitor_result visit(scope_node *node)
+      {
+        bodies.push_back(std::make_pair(node->begin, node->end));
+        return ast_visitor::stop;
+      }
+
+      std::vector<std::pair<token_iterator, token_iterator>> bodies;
+    };
+
+    std::uint64_t hash_symbol(const symbol &sym)
+    {
+      fnv_hasher hasher;
+      hasher.add(std::uint32_t(sym.symbol_type));
+      hasher.add(sym.name);
+
+      // Implicitly declared variables are just a name
+      if (!dynamic_cast<symbol_node *>(sym.node))
+        return hasher.value();
+
+      body_finder finder;
+      static_walk(sym.node, finder);
+
+      auto &bodies = finder.bodies;
+      std::sort(bodies.begin(), bodies.end());
+
+      auto body = bodies.begin();
+      for (auto it = sym.node->begin; it < sym.node->end;)
+      {
+        if (body != bodies.end() && it >= body->first)
+        {
+          it = std::max(it, body->second);
+          ++body;
+          continue;
+        }
+
+        hasher.add(*it);
+        ++it;
+      }
+
+      return hasher.value();
+    }
+
+    bool parse_hash(const std::string &text, std::uint64_t *hash)
+    {
+      char *end;
+      *hash = strtoull(text.c_str(), &end, 16);
+      return !text.empty() && *end == '\0';
+    }
+
+    void write_hash(std::ostream &out, std::uint64_t hash)
+    {
+      out << std::hex << std::setw(16) << std::setfill('0') << hash << std::dec;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  module_record::module_record() :
+    source_hash(0),
+    interface_hash(0)
+  {
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void build_state::load(const char *filename)
+  {
+    m_records.clear();
+
+    std::ifstream in(filename);
+    std::string line;
+
+    if (!std::getline(in, line) || line != STATE_HEADER)
+      return;
+
+    module_record *current = nullptr;
+
+    while (std::getline(in, line))
+    {
+      size_t space = line.find(' ');
+      if (space == std::string::npos)
+        break;
+
+      std::string key = line.substr(0, space);
+      std::string value = line.substr(space + 1);
+
+      if (key == "module")
+      {
+        current = &m_records[value];
+        continue;
+      }
+
+      // Anything unexpected means the file is damaged, so trust none of it
+      if (!current)
+        break;
+
+      if (key == "source" && parse_hash(value, &current->source_hash))
+        continue;
+
+      if (key == "interface" && parse_hash(value, &current->interface_hash))
+        continue;
+
+      size_t split = value.find(' ');
+      std::uint64_t hash;
+      if (key == "import" && split != std::string::npos && parse_hash(value.substr(split + 1), &hash))
+      {
+        current->imports.push_back(std::make_pair(value.substr(0, split), hash));
+        continue;
+      }
+
+      break;
+    }
+
+    if (!in.eof())
+      m_records.clear();
+  }
+
+  bool build_state::save(const char *filename) const
+  {
+    std::ofstream out(filename);
+    if (!out)
+      return false;
+
+    out << STATE_HEADER << '\n';
+
+    for (auto &entry : m_records)
+    {
+      const module_record &record = entry.second;
+
+      out << "module " << entry.first << '\n';
+      out << "source ";
+      write_hash(out, record.source_hash);
+      out << "\ninterface ";
+      write_hash(out, record.interface_hash);
+      out << '\n';
+
+      for (auto &import : record.imports)
+      {
+        out << "import " << import.first << ' ';
+        write_hash(out, import.second);
+        out << '\n';
+      }
+    }
+
+    return bool(out);
+  }
+
+  const module_record *build_state::find(const std::string &path) const
+  {
+    auto found = m_records.find(path);
+    return found != m_records.end() ? &found->second : nullptr;
+  }
+
+  void build_state::record(const std::string &path, const module_record &entry)
+  {
+    m_records[path] = entry;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  std::uint64_t hash_source(const char *text, size_t length)
+  {
+    fnv_hasher hasher;
+    hasher.add(text, length);
+    return hasher.value();
+  }
+
+  std::uint64_t hash_interface(module_node *module)
+  {
+    std::vector<std::uint64_t> symbols;
+
+    for (auto &entry : module->symbols)
+    {
+      const symbol &sym = entry.second;
+
+      // Imports and labels can't be reached from another module
+      switch (sym.symbol_type)
+      {
+      case symbol::function:
+      case symbol::variable:
+      case symbol::type_name:
+      case symbol::property:
+      case symbol::typedef_name:
+        symbols.push_back(hash_symbol(sym));
+        break;
+      default:
+        break;
+      }
+    }
+
+    // The symbol table's order depends on the order names were interned in,
+    // which changes from run to run when compiling on several threads
+    std::sort(symbols.begin(), symbols.end());
+
+    fnv_hasher hasher;
+    for (std::uint64_t symbolHash : symbols)
+      hasher.add(symbolHash);
+
+    return hasher.value();
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
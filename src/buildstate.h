@@ -0,0 +1,145 @@
+// -----------------------------------------------------------------------------
+// Brandy incremental build state
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#ifndef BUILD_STATE_H
+#define BUILD_STATE_H
+
+#pragma once
+
+#include "tokens.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  struct module_node;
+
+  // ---------------------------------------------------------------------------
+
+  // What a module looked like the last time it compiled cleanly
+  struct module_record
+  {
+    module_record();
+
+    std::uint64_t source_hash;
+    std::uint64_t interface_hash;
+
+    // Every module name it imports, with the interface hash of the module
+    // that name found at the time (zero if it wasn't part of the compilation)
+    std::vector<std::pair<std::string, std::uint64_t>> imports;
+  };
+
+  // ---------------------------------------------------------------------------
+
+  // The records of the last compilation, keyed by module path. Kept in a
+  // small text file between runs.
+  class build_state
+  {
+  public:
+    // A missing or unreadable file just leaves the state empty, which makes
+    // everything compile
+    void load(const char *filename);
+    bool save(const char *filename) const;
+
+    // Returns nullptr if the module has no record
+    const module_record *find(const std::string &path) const;
+
+    void record(const std::string &path, const module_record &entry);
+
+  private:
+    std::unordered_map<std::string, module_record> m_records;
+  };
+
+  // ---------------------------------------------------------------------------
+
+  // 64 bit FNV-1a, tens of thousands of modules can't be told apart with a
+  // 32 bit hash. Hashes that are saved between runs use it, so it mustn't
+  // change without bumping the version of what they're saved in.
+  class fnv_hasher
+  {
+  public:
+    fnv_hasher() :
+      m_value(0xCBF29CE484222325ull)
+    {
+    }
+
+    void add(const void *data, size_t length)
+    {
+      auto bytes = static_cast<const unsigned char *>(data);
+      for (size_t i = 0; i < length; ++i)
+      {
+        m_value ^= bytes[i];
+        m_value *= 0x100000001B3ull;
+      }
+    }
+
+    template<typename value_type>
+    void add(const value_type &value)
+    {
+      add(&value, sizeof(value));
+    }
+
+    void add(const token &tok)
+    {
+      add(std::uint32_t(tok.type()));
+      add(std::uint32_t(tok.length()));
+      add(tok.text(), tok.length());
+    }
+
+    std::uint64_t value() const
+    {
+      return m_value;
+    }
+
+  private:
+    std::uint64_t m_value;
+  };
+
+  // Takes the same adds as fnv_hasher but keeps the bytes, for keys that a
+  // hash collision mustn't mix up
+  class key_writer
+  {
+  public:
+    void add(const void *data, size_t length)
+    {
+      m_bytes.append(static_cast<const char *>(data), length);
+    }
+
+    template<typename value_type>
+    void add(const value_type &value)
+    {
+      add(&value, sizeof(value));
+    }
+
+    const std::string &bytes() const
+    {
+      return m_bytes;
+    }
+
+  private:
+    std::string m_bytes;
+  };
+
+  std::uint64_t hash_source(const char *text, size_t length);
+
+  // Hashes what other modules can see of a module: the kind and name of
+  // every module level symbol, and the tokens that declare it apart from
+  // function and property bodies. Only valid once its symbol table is filled.
+  std::uint64_t hash_interface(module_node *module);
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
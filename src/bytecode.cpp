@@ -0,0 +1,108 @@
+// -----------------------------------------------------------------------------
+// Brandy meta code bytecode
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "bytecode.h"
+#include <iomanip>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  namespace opcodes
+  {
+#define OPCODE(name, format) #name,
+    const char *names[] =
+    {
+#include "opcodes.inl"
+      nullptr
+    };
+#undef OPCODE
+  }
+
+  namespace
+  {
+    enum operand_format { none, a, ab, abc, abx, sbx, asbx };
+
+#define OPCODE(name, format) format,
+    const operand_format formats[] =
+    {
+#include "opcodes.inl"
+      none
+    };
+#undef OPCODE
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bytecode_function::bytecode_function() :
+    name(atoms::NONE),
+    parameters(0),
+    registers(0),
+    code_hash(0),
+    cache_results(false),
+    mapped_code(nullptr),
+    mapped_lines(nullptr),
+    mapped_size(0),
+    globals(nullptr)
+  {
+  }
+
+  const instruction *bytecode_function::code_data() const
+  {
+    return mapped_code ? mapped_code : code.data();
+  }
+
+  size_t bytecode_function::code_size() const
+  {
+    return mapped_code ? mapped_size : code.size();
+  }
+
+  std::uint32_t bytecode_function::line(size_t pc) const
+  {
+    return mapped_code ? mapped_lines[pc] : lines[pc];
+  }
+
+  void bytecode_function::disassemble(std::ostream &out) const
+  {
+    if (name != atoms::NONE)
+      out << "function " << atoms::text(name);
+    else
+      out << "meta code";
+
+    out << " (" << parameters << " parameters, " << registers << " registers, "
+      << constants.size() << " constants" << (cache_results ? ", results cached" : "") << ")\n";
+
+    for (size_t pc = 0; pc < code_size(); ++pc)
+    {
+      const instruction i = code_data()[pc];
+      const opcodes::type op = instructions::op(i);
+
+      out << std::setw(6) << pc << std::setw(6) << line(pc) << "  "
+        << std::left << std::setw(11) << opcodes::names[op] << std::right;
+
+      switch (formats[op])
+      {
+      case a:    out << instructions::a(i); break;
+      case ab:   out << instructions::a(i) << ' ' << instructions::b(i); break;
+      case abc:  out << instructions::a(i) << ' ' << instructions::b(i) << ' ' << instructions::c(i); break;
+      case abx:  out << instructions::a(i) << ' ' << instructions::bx(i); break;
+      case sbx:  out << "to " << pc + 1 + instructions::sbx(i); break;
+      case asbx: out << instructions::a(i) << " to " << pc + 1 + instructions::sbx(i); break;
+      case none: break;
+      }
+
+      if (op == opcodes::LOADK)
+        out << "    ; " << meta_text(constants[instructions::bx(i)]);
+
+      out << '\n';
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,153 @@
+// -----------------------------------------------------------------------------
+// Brandy meta code bytecode
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#pragma once
+
+#include "metavalue.h"
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  class meta_globals;
+
+  // ---------------------------------------------------------------------------
+
+  // Meta code runs on registers rather than a stack. Every local variable
+  // and parameter of a function gets a register when it's compiled, so
+  // nothing is looked up by name while it runs, and temporaries go in the
+  // registers above those.
+  //
+  // An instruction is 32 bits, the opcode in the low 8 and then up to three
+  // 8 bit operands, A, B and C. Bx is B and C as one unsigned 16 bit operand
+  // (a constant or a global), sBx the same with a bias to make it signed (a
+  // jump, from the instruction after it).
+  //
+  //   LOADNIL A         R[A] = nil
+  //   LOADBOOL A B      R[A] = B != 0
+  //   LOADK A Bx        R[A] = K[Bx]
+  //   MOVE A B          R[A] = R[B]
+  //   GETGLOBAL A Bx    R[A] = G[Bx]
+  //   SETGLOBAL A Bx    G[Bx] = R[A]
+  //   NEWTABLE A        R[A] = {}
+  //   GETINDEX A B C    R[A] = R[B][R[C]], a module's functions by name too
+  //   SETINDEX A B C    R[A][R[B]] = R[C]
+  //   ADD A B C ...     R[A] = R[B] + R[C], and so on up to GE
+  //   NEG A B ...       R[A] = -R[B], NOT and BNOT the same
+  //   JMP sBx           pc += sBx
+  //   JMPIF A sBx       if R[A] is true, pc += sBx (JMPIFNOT if false)
+  //   FORPREP A B       starts a loop from R[A] to R[A + 1] by R[A + 2], to
+  //                     R[A + 1] as well if B. Skips the next instruction
+  //                     (the jump out of the loop) unless it runs no times.
+  //   FORLOOP A sBx     R[A] += R[A + 2], jumps back while it's in range
+  //   ITERNEXT A        R[A + 2] = the value at position R[A + 1] in table
+  //                     R[A], which is moved on, and skips the next
+  //                     instruction. Goes on to it after the last value.
+  //   CALL A B          R[A] = R[A](R[A + 1] ... R[A + B])
+  //   RETURN A          returns R[A]
+  //   RETURNNIL         returns nil
+  namespace opcodes
+  {
+#define OPCODE(name, format) name,
+    enum type : std::uint8_t
+    {
+#include "opcodes.inl"
+      COUNT
+    };
+#undef OPCODE
+
+    extern const char *names[];
+  }
+
+  typedef std::uint32_t instruction;
+
+  namespace instructions
+  {
+    const unsigned MAX_OPERAND = 0xFF;
+    const unsigned MAX_BX = 0xFFFF;
+    const int SBX_BIAS = 0x7FFF;
+
+    inline instruction make(opcodes::type op, unsigned a = 0, unsigned b = 0, unsigned c = 0)
+    {
+      return instruction(op) | (a << 8) | (b << 16) | (c << 24);
+    }
+
+    inline instruction make_bx(opcodes::type op, unsigned a, unsigned bx)
+    {
+      return instruction(op) | (a << 8) | (bx << 16);
+    }
+
+    inline instruction make_sbx(opcodes::type op, unsigned a, int sbx)
+    {
+      return make_bx(op, a, unsigned(sbx + SBX_BIAS));
+    }
+
+    inline opcodes::type op(instruction i) { return opcodes::type(i & 0xFF); }
+    inline unsigned a(instruction i)       { return (i >> 8) & 0xFF; }
+    inline unsigned b(instruction i)       { return (i >> 16) & 0xFF; }
+    inline unsigned c(instruction i)       { return i >> 24; }
+    inline unsigned bx(instruction i)      { return i >> 16; }
+    inline int sbx(instruction i)          { return int(i >> 16) - SBX_BIAS; }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  // A compiled meta function, the statements of a meta block to run once, or
+  // a call to a meta function from outside meta code
+  struct bytecode_function
+  {
+    bytecode_function();
+
+    atoms::id name;
+
+    // The parameters are the first registers
+    size_t parameters;
+    size_t registers;
+
+    std::vector<instruction> code;
+
+    // The line each instruction came from, for errors
+    std::vector<std::uint32_t> lines;
+
+    std::vector<meta_value> constants;
+
+    // A hash of its code and constants and of every function it can call,
+    // the same in any module or compilation that compiles the same meta code
+    std::uint64_t code_hash;
+
+    // Marked @[cache_result()], calls to it go through the meta_result_cache
+    bool cache_results;
+
+    // Functions loaded from a bytecode_image run their instructions and
+    // lines where the image is, code and lines are left empty
+    const instruction *mapped_code;
+    const std::uint32_t *mapped_lines;
+    size_t mapped_size;
+
+    // The globals of the module it came from when it's from an image, null
+    // for the module's own, which use the globals of the meta_vm
+    meta_globals *globals;
+
+    const instruction *code_data() const;
+    size_t code_size() const;
+    std::uint32_t line(size_t pc) const;
+
+    void disassemble(std::ostream &out) const;
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,765 @@
+// -----------------------------------------------------------------------------
+// Brandy meta bytecode image
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "bytecodeimage.h"
+#include "buildstate.h"
+#include "metaevaluator.h"
+#include <algorithm>
+#include <fstream>
+#include <string.h>
+#include <unordered_map>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  const std::uint32_t bytecode_image::VERSION;
+
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    const char MAGIC[4] = { 'B', 'R', 'D', 'B' };
+
+    const std::uint32_t CACHE_RESULTS = 1;
+
+    // Written as is, so files only work on machines with the same byte order
+    struct file_header
+    {
+      char magic[4];
+      std::uint32_t version;
+      std::uint64_t source_hash;
+
+      // Of everything after the header
+      std::uint64_t content_hash;
+
+      // The first block_count functions are meta blocks
+      std::uint32_t function_count;
+      std::uint32_t block_count;
+      std::uint32_t constant_count;
+      std::uint32_t relocation_count;
+      std::uint32_t import_count;
+
+      // Instructions, and lines, of every function
+      std::uint32_t code_size;
+      std::uint32_t global_count;
+      std::uint32_t names_size;
+    };
+
+    struct file_function
+    {
+      std::uint32_t name;
+      std::uint32_t parameters;
+      std::uint32_t registers;
+      std::uint32_t flags;
+      std::uint32_t code;
+      std::uint32_t code_size;
+      std::uint32_t constants;
+      std::uint32_t constant_count;
+      std::uint64_t code_hash;
+    };
+
+    // The value is a bool or int, the bits of a real, or the offset of a
+    // string or of the name of a type, builtin or module. Strings can have
+    // NULs in them, so they have their length too.
+    struct file_constant
+    {
+      std::uint32_t kind;
+      std::uint32_t length;
+      std::uint64_t value;
+    };
+
+    enum relocation_kind : std::uint32_t { function_relocation, import_relocation };
+
+    // The global slot starts out holding a function, or the meta code of
+    // another module, by its index in the imports
+    struct file_relocation
+    {
+      std::uint32_t global;
+      std::uint32_t kind;
+      std::uint32_t target;
+      std::uint32_t unused;
+    };
+
+    static_assert(sizeof(file_header) == 56, "The image header can't have padding");
+    static_assert(sizeof(file_function) == 40, "Image functions can't have padding");
+    static_assert(sizeof(file_constant) == 16, "Image constants can't have padding");
+    static_assert(sizeof(file_relocation) == 16, "Image relocations can't have padding");
+
+    const file_header &header_of(const char *data)
+    {
+      return *reinterpret_cast<const file_header *>(data);
+    }
+
+    const file_function *functions_of(const char *data)
+    {
+      return reinterpret_cast<const file_function *>(data + sizeof(file_header));
+    }
+
+    const file_constant *constants_of(const char *data)
+    {
+      return reinterpret_cast<const file_constant *>(functions_of(data) + header_of(data).function_count);
+    }
+
+    const file_relocation *relocations_of(const char *data)
+    {
+      return reinterpret_cast<const file_relocation *>(constants_of(data) + header_of(data).constant_count);
+    }
+
+    // The names of the modules it imports
+    const std::uint32_t *imports_of(const char *data)
+    {
+      return reinterpret_cast<const std::uint32_t *>(relocations_of(data) + header_of(data).relocation_count);
+    }
+
+    const instruction *code_of(const char *data)
+    {
+      return reinterpret_cast<const instruction *>(imports_of(data) + header_of(data).import_count);
+    }
+
+    const std::uint32_t *lines_of(const char *data)
+    {
+      return code_of(data) + header_of(data).code_size;
+    }
+
+    const char *names_of(const char *data)
+    {
+      return reinterpret_cast<const char *>(lines_of(data) + header_of(data).code_size);
+    }
+
+    // -------------------------------------------------------------------------
+
+    bool in_range(size_t at, size_t count)
+    {
+      return at < count;
+    }
+
+    bool jumps_in_range(size_t pc, instruction i, size_t size)
+    {
+      const std::int64_t target = std::int64_t(pc) + 1 + instructions::sbx(i);
+      return target >= 0 && std::uint64_t(target) < size;
+    }
+
+    // Only registers below the function's count, and constants, globals and
+    // jumps that exist, so a damaged image can't make the vm read anywhere
+    // it shouldn't
+    bool valid_code(const instruction *code, const file_function &function, size_t globals)
+    {
+      using namespace instructions;
+
+      const size_t size = function.code_size;
+      const size_t registers = function.registers;
+
+      // Nothing can run off the end
+      const opcodes::type last = op(code[size - 1]);
+      if (last != opcodes::RETURN && last != opcodes::RETURNNIL)
+        return false;
+
+      for (size_t pc = 0; pc < size; ++pc)
+      {
+        const instruction i = code[pc];
+
+        switch (op(i))
+        {
+        case opcodes::LOADNIL:
+        case opcodes::NEWTABLE:
+        case opcodes::LOADBOOL:
+        case opcodes::RETURN:
+          if (!in_range(a(i), registers)) return false;
+          break;
+
+        case opcodes::LOADK:
+          if (!in_range(a(i), registers) || !in_range(bx(i), function.constant_count)) return false;
+          break;
+
+        case opcodes::GETGLOBAL:
+        case opcodes::SETGLOBAL:
+          if (!in_range(a(i), registers) || !in_range(bx(i), globals)) return false;
+          break;
+
+        case opcodes::MOVE:
+        case opcodes::NEG:
+        case opcodes::NOT:
+        case opcodes::BNOT:
+          if (!in_range(a(i), registers) || !in_range(b(i), registers)) return false;
+          break;
+
+        case opcodes::JMP:
+          if (!jumps_in_range(pc, i, size)) return false;
+          break;
+
+        case opcodes::JMPIF:
+        case opcodes::JMPIFNOT:
+          if (!in_range(a(i), registers) || !jumps_in_range(pc, i, size)) return false;
+          break;
+
+        case opcodes::FORLOOP:
+          if (!in_range(a(i) + 2, registers) || !jumps_in_range(pc, i, size)) return false;
+          break;
+
+        // Both skip the instruction after them
+        case opcodes::FORPREP:
+        case opcodes::ITERNEXT:
+          if (!in_range(a(i) + 2, registers) || !in_range(pc + 2, size)) return false;
+          break;
+
+        case opcodes::CALL:
+          if (!in_range(a(i) + b(i), registers)) return false;
+          break;
+
+        case opcodes::RETURNNIL:
+          break;
+
+        default:
+          // The rest have three registers
+          if (op(i) >= opcodes::COUNT) return false;
+          if (!in_range(a(i), registers) || !in_range(b(i), registers) || !in_range(c(i), registers)) return false;
+          break;
+        }
+      }
+
+      return true;
+    }
+
+    // -------------------------------------------------------------------------
+
+    class image_builder
+    {
+    public:
+      image_builder() :
+        m_blockCount(0),
+        m_globalCount(0)
+      {
+        // Offset zero is the empty string, the name of every block
+        m_names.push_back('\0');
+        m_interned.emplace(std::string(), 0);
+      }
+
+      // Returns false if the meta code holds something that can't be written
+      bool add(const meta_evaluator &meta)
+      {
+        const auto &functions = meta.functions();
+        const size_t count = meta.compiled_count();
+
+        std::unordered_map<const bytecode_function *, std::uint32_t> indexes;
+        for (size_t i = 0; i < count; ++i)
+          indexes.emplace(functions[i].get(), std::uint32_t(i));
+
+        for (size_t i = 0; i < count; ++i)
+        {
+          if (!add_function(*functions[i]))
+            return false;
+        }
+
+        m_blockCount = std::uint32_t(meta.block_count());
+
+        const meta_globals &globals = meta.globals();
+        m_globalCount = std::uint32_t(globals.values.size());
+
+        for (size_t slot = 0; slot < globals.values.size(); ++slot)
+        {
+          const meta_value &value = globals.values[slot];
+
+          file_relocation relocation;
+          relocation.global = std::uint32_t(slot);
+          relocation.unused = 0;
+
+          // Modules with no natives are another module's meta code
+          if (value.tag == meta_value::module_value && !value.as_module->functions)
+          {
+            // Another module's meta code is found again when it's loaded
+            relocation.kind = import_relocation;
+            relocation.target = add_import(value.as_module->name);
+          }
+          else if (value.tag == meta_value::function_value)
+          {
+            // Functions from elsewhere are set again by the blocks, like
+            // any other value they put in a global
+            auto found = indexes.find(value.as_function);
+            if (found == indexes.end())
+              continue;
+
+            relocation.kind = function_relocation;
+            relocation.target = found->second;
+          }
+          else
+          {
+            continue;
+          }
+
+          m_relocations.push_back(relocation);
+        }
+
+        return true;
+      }
+
+      void build(std::vector<char> &storage, std::uint64_t sourceHash) const
+      {
+        const size_t functionsSize = m_functions.size() * sizeof(file_function);
+        const size_t constantsSize = m_constants.size() * sizeof(file_constant);
+        const size_t relocationsSize = m_relocations.size() * sizeof(file_relocation);
+        const size_t importsSize = m_imports.size() * sizeof(std::uint32_t);
+        const size_t codeSize = m_code.size() * sizeof(instruction);
+        const size_t linesSize = m_lines.size() * sizeof(std::uint32_t);
+        const size_t bodySize = functionsSize + constantsSize + relocationsSize + importsSize + codeSize + linesSize +
+          m_names.size();
+
+        storage.resize(sizeof(file_header) + bodySize);
+
+        char *at = storage.data() + sizeof(file_header);
+        if (functionsSize) memcpy(at, m_functions.data(), functionsSize);
+        at += functionsSize;
+        if (constantsSize) memcpy(at, m_constants.data(), constantsSize);
+        at += constantsSize;
+        if (relocationsSize) memcpy(at, m_relocations.data(), relocationsSize);
+        at += relocationsSize;
+        if (importsSize) memcpy(at, m_imports.data(), importsSize);
+        at += importsSize;
+        if (codeSize) memcpy(at, m_code.data(), codeSize);
+        at += codeSize;
+        if (linesSize) memcpy(at, m_lines.data(), linesSize);
+        at += linesSize;
+        memcpy(at, m_names.data(), m_names.size());
+
+        file_header header;
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = bytecode_image::VERSION;
+        header.source_hash = sourceHash;
+        header.content_hash = hash_source(storage.data() + sizeof(file_header), bodySize);
+        header.function_count = std::uint32_t(m_functions.size());
+        header.block_count = m_blockCount;
+        header.constant_count = std::uint32_t(m_constants.size());
+        header.relocation_count = std::uint32_t(m_relocations.size());
+        header.import_count = std::uint32_t(m_imports.size());
+        header.code_size = std::uint32_t(m_code.size());
+        header.global_count = m_globalCount;
+        header.names_size = std::uint32_t(m_names.size());
+
+        memcpy(storage.data(), &header, sizeof(header));
+      }
+
+    private:
+      bool add_function(const bytecode_function &function)
+      {
+        file_function entry;
+        entry.name = function.name == atoms::NONE ? 0 : intern(atoms::text(function.name), atoms::length(function.name));
+        entry.parameters = std::uint32_t(function.parameters);
+        entry.registers = std::uint32_t(function.registers);
+        entry.flags = function.cache_results ? CACHE_RESULTS : 0;
+        entry.code = std::uint32_t(m_code.size());
+        entry.code_size = std::uint32_t(function.code_size());
+        entry.constants = std::uint32_t(m_constants.size());
+        entry.constant_count = std::uint32_t(function.constants.size());
+        entry.code_hash = function.code_hash;
+
+        for (const meta_value &constant : function.constants)
+        {
+          if (!add_constant(constant))
+            return false;
+        }
+
+        m_code.insert(m_code.end(), function.code_data(), function.code_data() + function.code_size());
+        for (size_t pc = 0; pc < function.code_size(); ++pc)
+          m_lines.push_back(function.line(pc));
+
+        m_functions.push_back(entry);
+        return true;
+      }
+
+      bool add_constant(const meta_value &value)
+      {
+        file_constant constant;
+        constant.kind = value.tag;
+        constant.length = 0;
+        constant.value = 0;
+
+        switch (value.tag)
+        {
+        case meta_value::nil_value:
+          break;
+        case meta_value::bool_value:
+          constant.value = value.as_bool ? 1 : 0;
+          break;
+        case meta_value::int_value:
+          memcpy(&constant.value, &value.as_int, sizeof(constant.value));
+          break;
+        case meta_value::real_value:
+          memcpy(&constant.value, &value.as_real, sizeof(constant.value));
+          break;
+        case meta_value::string_value:
+          constant.length = std::uint32_t(atoms::length(value.as_string));
+          constant.value = intern(atoms::text(value.as_string), constant.length);
+          break;
+        case meta_value::type_value:
+          constant.value = intern(atoms::text(value.as_type->name), atoms::length(value.as_type->name));
+          break;
+        case meta_value::native_value:
+          constant.value = intern(value.as_native->name, strlen(value.as_native->name));
+          break;
+        case meta_value::module_value:
+          if (!value.as_module->functions)
+            return false;
+          constant.value = intern(value.as_module->name, strlen(value.as_module->name));
+          break;
+        default:
+          return false;
+        }
+
+        m_constants.push_back(constant);
+        return true;
+      }
+
+      std::uint32_t add_import(const char *name)
+      {
+        const std::uint32_t offset = intern(name, strlen(name));
+
+        auto found = std::find(m_imports.begin(), m_imports.end(), offset);
+        if (found != m_imports.end())
+          return std::uint32_t(found - m_imports.begin());
+
+        m_imports.push_back(offset);
+        return std::uint32_t(m_imports.size() - 1);
+      }
+
+      std::uint32_t intern(const char *text, size_t length)
+      {
+        const std::string key(text, length);
+
+        auto found = m_interned.find(key);
+        if (found != m_interned.end())
+          return found->second;
+
+        std::uint32_t offset = std::uint32_t(m_names.size());
+        m_names.insert(m_names.end(), key.begin(), key.end());
+        m_names.push_back('\0');
+
+        m_interned.emplace(key, offset);
+        return offset;
+      }
+
+      std::vector<file_function> m_functions;
+      std::vector<file_constant> m_constants;
+      std::vector<file_relocation> m_relocations;
+      std::vector<std::uint32_t> m_imports;
+      std::vector<instruction> m_code;
+      std::vector<std::uint32_t> m_lines;
+      std::vector<char> m_names;
+      std::unordered_map<std::string, std::uint32_t> m_interned;
+      std::uint32_t m_blockCount;
+      std::uint32_t m_globalCount;
+    };
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bytecode_image::bytecode_image(const meta_evaluator &meta, std::uint64_t sourceHash) :
+    m_data(nullptr),
+    m_length(0),
+    m_valid(false)
+  {
+    image_builder builder;
+    m_valid = builder.add(meta);
+    builder.build(m_storage, sourceHash);
+
+    m_data = m_storage.data();
+    m_length = m_storage.size();
+    m_links.resize(header_of(m_data).import_count);
+  }
+
+  bytecode_image::bytecode_image(const char *data, size_t length) :
+    m_data(data),
+    m_length(length),
+    m_valid(false)
+  {
+    if (length < sizeof(file_header))
+      return;
+
+    const file_header &header = header_of(data);
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION)
+      return;
+
+    // Sizes are checked before anything is read through them. Every count
+    // is 32 bits, so these can't overflow.
+    const std::uint64_t bodySize = length - sizeof(file_header);
+    const std::uint64_t expected =
+      std::uint64_t(header.function_count) * sizeof(file_function) +
+      std::uint64_t(header.constant_count) * sizeof(file_constant) +
+      std::uint64_t(header.relocation_count) * sizeof(file_relocation) +
+      std::uint64_t(header.import_count) * sizeof(std::uint32_t) +
+      std::uint64_t(header.code_size) * (sizeof(instruction) + sizeof(std::uint32_t)) +
+      header.names_size;
+
+    if (header.names_size == 0 || expected != bodySize || header.block_count > header.function_count)
+      return;
+
+    if (hash_source(data + sizeof(file_header), size_t(bodySize)) != header.content_hash)
+      return;
+
+    const char *names = names_of(data);
+    if (names[header.names_size - 1] != '\0')
+      return;
+
+    const file_function *functions = functions_of(data);
+    const instruction *code = code_of(data);
+
+    for (size_t i = 0; i < header.function_count; ++i)
+    {
+      const file_function &function = functions[i];
+
+      if (function.name >= header.names_size || function.parameters > function.registers)
+        return;
+      if (function.code_size == 0 || function.code > header.code_size || function.code_size > header.code_size - function.code)
+        return;
+      if (function.constants > header.constant_count || function.constant_count > header.constant_count - function.constants)
+        return;
+      if (!valid_code(code + function.code, function, header.global_count))
+        return;
+    }
+
+    const file_constant *constants = constants_of(data);
+    for (size_t i = 0; i < header.constant_count; ++i)
+    {
+      const file_constant &constant = constants[i];
+
+      switch (constant.kind)
+      {
+      case meta_value::nil_value:
+      case meta_value::bool_value:
+      case meta_value::int_value:
+      case meta_value::real_value:
+        break;
+      case meta_value::string_value:
+        if (constant.value >= header.names_size || constant.length >= header.names_size - constant.value)
+          return;
+        break;
+      case meta_value::type_value:
+      case meta_value::native_value:
+      case meta_value::module_value:
+        if (constant.value >= header.names_size)
+          return;
+        break;
+      default:
+        return;
+      }
+    }
+
+    const std::uint32_t *imports = imports_of(data);
+    for (size_t i = 0; i < header.import_count; ++i)
+    {
+      if (imports[i] >= header.names_size)
+        return;
+    }
+
+    const file_relocation *relocations = relocations_of(data);
+    for (size_t i = 0; i < header.relocation_count; ++i)
+    {
+      const file_relocation &relocation = relocations[i];
+
+      if (relocation.global >= header.global_count)
+        return;
+      if (relocation.kind == function_relocation && relocation.target >= header.function_count)
+        return;
+      if (relocation.kind == import_relocation && relocation.target >= header.import_count)
+        return;
+      if (relocation.kind > import_relocation)
+        return;
+    }
+
+    m_links.resize(header.import_count);
+    m_valid = true;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool bytecode_image::valid() const
+  {
+    return m_valid;
+  }
+
+  bool bytecode_image::write(const char *filename) const
+  {
+    std::ofstream out(filename, std::ios::binary);
+    if (!out)
+      return false;
+
+    out.write(m_data, std::streamsize(m_length));
+    return bool(out);
+  }
+
+  std::uint64_t bytecode_image::source_hash() const
+  {
+    return header_of(m_data).source_hash;
+  }
+
+  std::uint64_t bytecode_image::content_hash() const
+  {
+    return header_of(m_data).content_hash;
+  }
+
+  const char *bytecode_image::data() const
+  {
+    return m_data;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  size_t bytecode_image::import_count() const
+  {
+    return header_of(m_data).import_count;
+  }
+
+  const char *bytecode_image::import_name(size_t index) const
+  {
+    return names_of(m_data) + imports_of(m_data)[index];
+  }
+
+  const bytecode_image *bytecode_image::linked(size_t index) const
+  {
+    return m_links[index];
+  }
+
+  void bytecode_image::link(size_t index, const bytecode_image *image)
+  {
+    m_links[index] = image;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  meta_library::meta_library(const bytecode_image &image, const std::string &name, meta_heap &heap,
+    const std::vector<const meta_module *> &imports) :
+    m_name(name),
+    m_valid(false)
+  {
+    const char *data = image.data();
+    const file_header &header = header_of(data);
+    const file_function *functions = functions_of(data);
+    const file_constant *constants = constants_of(data);
+    const file_relocation *relocations = relocations_of(data);
+    const instruction *code = code_of(data);
+    const std::uint32_t *lines = lines_of(data);
+    const char *names = names_of(data);
+
+    m_module.name = m_name.c_str();
+    m_module.functions = nullptr;
+    m_module.count = 0;
+    m_module.meta_functions = nullptr;
+    m_module.meta_count = 0;
+    m_module.hash = image.content_hash();
+
+    m_globals.values.resize(header.global_count);
+
+    for (size_t i = 0; i < header.function_count; ++i)
+    {
+      const file_function &entry = functions[i];
+
+      std::unique_ptr<bytecode_function> function(new bytecode_function());
+      function->name = entry.name ? atoms::intern(names + entry.name, strlen(names + entry.name)) : atoms::NONE;
+      function->parameters = entry.parameters;
+      function->registers = entry.registers;
+      function->code_hash = entry.code_hash;
+      function->cache_results = (entry.flags & CACHE_RESULTS) != 0;
+      function->mapped_code = code + entry.code;
+      function->mapped_lines = lines + entry.code;
+      function->mapped_size = entry.code_size;
+      function->globals = &m_globals;
+
+      // Types and strings are this compilation's, so constants are made
+      // again for every module using the image
+      for (size_t k = entry.constants; k < entry.constants + entry.constant_count; ++k)
+      {
+        const file_constant &constant = constants[k];
+        const char *text = names + constant.value;
+        meta_value value;
+
+        switch (constant.kind)
+        {
+        case meta_value::bool_value:
+          value = meta_value::of_bool(constant.value != 0);
+          break;
+        case meta_value::int_value:
+        {
+          std::int64_t number;
+          memcpy(&number, &constant.value, sizeof(number));
+          value = meta_value::of_int(number);
+          break;
+        }
+        case meta_value::real_value:
+        {
+          double number;
+          memcpy(&number, &constant.value, sizeof(number));
+          value = meta_value::of_real(number);
+          break;
+        }
+        case meta_value::string_value:
+          value = meta_value::of_string(atoms::intern(text, constant.length));
+          break;
+        case meta_value::type_value:
+          value = meta_value::of_type(heap.type(atoms::intern(text, strlen(text))));
+          break;
+        case meta_value::native_value:
+        {
+          const native_function *native = meta_vm::builtin(atoms::intern(text, strlen(text)));
+          if (!native) return;
+          value = meta_value::of_native(native);
+          break;
+        }
+        case meta_value::module_value:
+        {
+          const meta_module *module = meta_import(text);
+          if (!module) return;
+          value = meta_value::of_module(module);
+          break;
+        }
+        default:
+          break;
+        }
+
+        function->constants.push_back(value);
+      }
+
+      if (i < header.block_count)
+        m_blocks.push_back(function.get());
+      else
+        m_exports.push_back(function.get());
+
+      m_functions.push_back(std::move(function));
+    }
+
+    for (size_t i = 0; i < header.relocation_count; ++i)
+    {
+      const file_relocation &relocation = relocations[i];
+
+      if (relocation.kind == function_relocation)
+        m_globals.values[relocation.global] = meta_value::of_function(m_functions[relocation.target].get());
+      else
+        m_globals.values[relocation.global] = meta_value::of_module(imports[relocation.target]);
+    }
+
+    m_module.meta_functions = m_exports.data();
+    m_module.meta_count = m_exports.size();
+    m_valid = true;
+  }
+
+  bool meta_library::valid() const
+  {
+    return m_valid;
+  }
+
+  const std::vector<const bytecode_function *> &meta_library::blocks() const
+  {
+    return m_blocks;
+  }
+
+  const meta_module *meta_library::module() const
+  {
+    return &m_module;
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
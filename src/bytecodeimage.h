@@ -0,0 +1,127 @@
+// -----------------------------------------------------------------------------
+// Brandy meta bytecode image
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#ifndef BYTECODE_IMAGE_H
+#define BYTECODE_IMAGE_H
+
+#pragma once
+
+#include "bytecode.h"
+#include "metavalue.h"
+#include "metavm.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  class meta_evaluator;
+
+  // ---------------------------------------------------------------------------
+
+  // A module's compiled meta code, in a form that's written to disk and run
+  // from where it's mapped. Meta blocks in other modules that import it use
+  // its meta functions without it being parsed or analyzed again.
+  //
+  // The file is a header, then a fixed size entry for every function (the
+  // meta blocks first), the constant pool, the relocations, the imports,
+  // every function's instructions and then their lines, one after the
+  // other, and the names. Function names, imports and string and type
+  // constants are offsets into the names, and each distinct string is
+  // stored once.
+  //
+  // Instructions already refer to globals by slot, so they're used as they
+  // are. The relocations say which slots start out holding which function,
+  // or the meta code of which import, the meta blocks set the rest when
+  // they run.
+  class bytecode_image
+  {
+  public:
+    static const std::uint32_t VERSION = 1;
+
+    // Builds the image of a module whose meta code has run. It isn't valid
+    // if the meta code holds something an image can't, like a table
+    // constant.
+    bytecode_image(const meta_evaluator &meta, std::uint64_t sourceHash);
+
+    // Views the bytes of an image file, which have to outlive it. Check
+    // valid() before using it.
+    bytecode_image(const char *data, size_t length);
+
+    // False if the bytes are from another version, cut short or damaged
+    bool valid() const;
+
+    bool write(const char *filename) const;
+
+    // The hash of the source it was built from (see build_state), and of
+    // everything in it
+    std::uint64_t source_hash() const;
+    std::uint64_t content_hash() const;
+
+    // For meta_library, which reads the functions where they are
+    const char *data() const;
+
+    // Other modules whose meta code it imports, by name. The driver links
+    // each to that module's image before anything imports this one, those
+    // it can't find are left null.
+    size_t import_count() const;
+    const char *import_name(size_t index) const;
+    const bytecode_image *linked(size_t index) const;
+    void link(size_t index, const bytecode_image *image);
+
+  private:
+    // Only used when built from a module, otherwise the bytes are borrowed
+    std::vector<char> m_storage;
+    std::vector<const bytecode_image *> m_links;
+
+    const char *m_data;
+    size_t m_length;
+    bool m_valid;
+  };
+
+  // ---------------------------------------------------------------------------
+
+  // The functions of a bytecode_image, ready to run in the meta_heap of a
+  // module importing them. Their instructions stay in the image, only the
+  // constants and globals are made here. The meta blocks still have to run
+  // before the functions are called, to set the globals.
+  class meta_library
+  {
+  public:
+    // The image has to be valid and outlive it, and the imports are the
+    // modules of its linked images in order. Fails if the image has
+    // constants that don't exist in this compiler, like a removed builtin.
+    meta_library(const bytecode_image &image, const std::string &name, meta_heap &heap,
+      const std::vector<const meta_module *> &imports);
+
+    bool valid() const;
+
+    const std::vector<const bytecode_function *> &blocks() const;
+
+    // What meta code importing the module sees, its meta functions by name
+    const meta_module *module() const;
+
+  private:
+    std::string m_name;
+    std::vector<std::unique_ptr<bytecode_function>> m_functions;
+    std::vector<const bytecode_function *> m_blocks;
+    std::vector<const bytecode_function *> m_exports;
+    meta_globals m_globals;
+    meta_module m_module;
+    bool m_valid;
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
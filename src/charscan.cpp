@@ -0,0 +1,208 @@
+// -----------------------------------------------------------------------------
+// Vectorized character run scanners for the lexer
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "charscan.h"
+#include <bitset>
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define BRANDY_SCAN_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BRANDY_SCAN_SSE2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  namespace scan
+  {
+    // -------------------------------------------------------------------------
+
+#if defined(BRANDY_SCAN_AVX2)
+    typedef __m256i simd_vec;
+    const size_t SIMD_WIDTH = 32;
+    const std::uint32_t SIMD_FULL_MASK = 0xFFFFFFFFu;
+#define SIMD_LOAD(p)      _mm256_load_si256(reinterpret_cast<const __m256i *>(p))
+#define SIMD_LOADU(p)     _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p))
+#define SIMD_SPLAT(c)     _mm256_set1_epi8(char(c))
+#define SIMD_EQ(v, c)     _mm256_cmpeq_epi8(v, SIMD_SPLAT(c))
+#define SIMD_IN(v, lo, hi) _mm256_and_si256(_mm256_cmpgt_epi8(v, SIMD_SPLAT((lo) - 1)), _mm256_cmpgt_epi8(SIMD_SPLAT((hi) + 1), v))
+#define SIMD_OR(a, b)     _mm256_or_si256(a, b)
+#define SIMD_MASK(v)      std::uint32_t(_mm256_movemask_epi8(v))
+#elif defined(BRANDY_SCAN_SSE2)
+    typedef __m128i simd_vec;
+    const size_t SIMD_WIDTH = 16;
+    const std::uint32_t SIMD_FULL_MASK = 0xFFFFu;
+#define SIMD_LOAD(p)      _mm_load_si128(reinterpret_cast<const __m128i *>(p))
+#define SIMD_LOADU(p)     _mm_loadu_si128(reinterpret_cast<const __m128i *>(p))
+#define SIMD_SPLAT(c)     _mm_set1_epi8(char(c))
+#define SIMD_EQ(v, c)     _mm_cmpeq_epi8(v, SIMD_SPLAT(c))
+#define SIMD_IN(v, lo, hi) _mm_and_si128(_mm_cmpgt_epi8(v, SIMD_SPLAT((lo) - 1)), _mm_cmplt_epi8(v, SIMD_SPLAT((hi) + 1)))
+#define SIMD_OR(a, b)     _mm_or_si128(a, b)
+#define SIMD_MASK(v)      std::uint32_t(_mm_movemask_epi8(v))
+#endif
+
+    // -------------------------------------------------------------------------
+    // Character classes. The scalar overload is the reference, the vector
+    // overload returns one bit per byte that matches.
+
+    namespace
+    {
+      struct whitespace_class
+      {
+        static bool match(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+#ifdef SIMD_MASK
+        static std::uint32_t match(simd_vec v)
+        {
+          return SIMD_MASK(SIMD_OR(SIMD_OR(SIMD_EQ(v, ' '), SIMD_EQ(v, '\t')), SIMD_EQ(v, '\r')));
+        }
+#endif
+      };
+
+      struct identifier_class
+      {
+        static bool match(char c)
+        {
+          return
+            (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+            (c >= '0' && c <= '9') || c == '_' || c == '$';
+        }
+
+#ifdef SIMD_MASK
+        static std::uint32_t match(simd_vec v)
+        {
+          // Bytes >= 0x80 compare as negative, so they never fall in a range
+          return SIMD_MASK(SIMD_OR(
+            SIMD_OR(SIMD_IN(v, 'a', 'z'), SIMD_IN(v, 'A', 'Z')),
+            SIMD_OR(SIMD_IN(v, '0', '9'), SIMD_OR(SIMD_EQ(v, '_'), SIMD_EQ(v, '$')))));
+        }
+#endif
+      };
+
+      struct line_comment_class
+      {
+        static bool match(char c) { return c != '\n' && c != '\0'; }
+
+#ifdef SIMD_MASK
+        static std::uint32_t match(simd_vec v)
+        {
+          return ~SIMD_MASK(SIMD_OR(SIMD_EQ(v, '\n'), SIMD_EQ(v, '\0')));
+        }
+#endif
+      };
+
+      struct block_comment_class
+      {
+        static bool match(char c) { return c != '*' && c != '\0'; }
+
+#ifdef SIMD_MASK
+        static std::uint32_t match(simd_vec v)
+        {
+          return ~SIMD_MASK(SIMD_OR(SIMD_EQ(v, '*'), SIMD_EQ(v, '\0')));
+        }
+#endif
+      };
+
+      // -----------------------------------------------------------------------
+
+      inline size_t first_set_bit(std::uint32_t mask)
+      {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return index;
+#elif defined(__GNUC__)
+        return __builtin_ctz(mask);
+#else
+        size_t index = 0;
+        while (!(mask & 1)) { mask >>= 1; ++index; }
+        return index;
+#endif
+      }
+
+      // Length of the run of characters in char_class at the start of str.
+      // Loads are aligned so they never cross into a page past the
+      // terminator, which no class matches.
+      template<typename char_class>
+      size_t scan_run(const char *str)
+      {
+#ifdef SIMD_MASK
+        const size_t misalign = std::uintptr_t(str) & (SIMD_WIDTH - 1);
+        const char *block = str - misalign;
+
+        std::uint32_t stops = ~char_class::match(SIMD_LOAD(block)) & (SIMD_FULL_MASK << misalign) & SIMD_FULL_MASK;
+
+        while (!stops)
+        {
+          block += SIMD_WIDTH;
+          stops = ~char_class::match(SIMD_LOAD(block)) & SIMD_FULL_MASK;
+        }
+
+        return size_t(block - str) + first_set_bit(stops);
+#else
+        const char *end = str;
+        while (*end && char_class::match(*end))
+          ++end;
+
+        return size_t(end - str);
+#endif
+      }
+    }
+
+    // -------------------------------------------------------------------------
+
+    size_t whitespace(const char *str)
+    {
+      return scan_run<whitespace_class>(str);
+    }
+
+    size_t identifier(const char *str)
+    {
+      return scan_run<identifier_class>(str);
+    }
+
+    size_t line_comment_body(const char *str)
+    {
+      return scan_run<line_comment_class>(str);
+    }
+
+    size_t block_comment_body(const char *str)
+    {
+      return scan_run<block_comment_class>(str);
+    }
+
+    // -------------------------------------------------------------------------
+
+    size_t count_newlines(const char *str, size_t length)
+    {
+      size_t count = 0, i = 0;
+
+#ifdef SIMD_MASK
+      for (; i + SIMD_WIDTH <= length; i += SIMD_WIDTH)
+        count += std::bitset<32>(SIMD_MASK(SIMD_EQ(SIMD_LOADU(str + i), '\n'))).count();
+#endif
+
+      for (; i < length; ++i)
+      {
+        if (str[i] == '\n')
+          ++count;
+      }
+
+      return count;
+    }
+
+    // -------------------------------------------------------------------------
+  }
+}
+
+// -----------------------------------------------------------------------------
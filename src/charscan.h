@@ -0,0 +1,44 @@
+// -----------------------------------------------------------------------------
+// Vectorized character run scanners for the lexer
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#ifndef CHAR_SCAN_H
+#define CHAR_SCAN_H
+
+#pragma once
+
+#include <cstddef>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  // Each scanner returns the length of the run of matching characters at the
+  // start of a NUL terminated string. None of them ever match the terminator.
+  namespace scan
+  {
+    // [ \t\r]*
+    size_t whitespace(const char *str);
+
+    // [A-Za-z0-9_$]*
+    size_t identifier(const char *str);
+
+    // [^\n]* - the body of a line comment
+    size_t line_comment_body(const char *str);
+
+    // [^*]* - the body of a block comment up to the next star
+    size_t block_comment_body(const char *str);
+
+    // Number of '\n' characters in the first length characters of str
+    size_t count_newlines(const char *str, size_t length);
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,29 @@
+// -----------------------------------------------------------------------------
+// Brandy compilation context
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "context.h"
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  compilation_context::compilation_context(const compiler_flags &flags) :
+    m_flags(flags)
+  {
+  }
+
+  // ---------------------------------------------------------------------------
+
+  const compiler_flags &compilation_context::flags() const
+  {
+    return m_flags;
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
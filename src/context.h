@@ -0,0 +1,38 @@
+// -----------------------------------------------------------------------------
+// Brandy compilation context
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#ifndef COMPILATION_CONTEXT_H
+#define COMPILATION_CONTEXT_H
+
+#pragma once
+
+#include "flags.h"
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  // What a compilation was asked to do. It's handed to whatever needs it
+  // rather than read from a global, and doesn't change once compiling starts,
+  // so any number of modules can be worked on at once against one context.
+  class compilation_context
+  {
+  public:
+    compilation_context(const compiler_flags &flags);
+
+    const compiler_flags &flags() const;
+
+  private:
+    compiler_flags m_flags;
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,770 @@
+// -----------------------------------------------------------------------------
+// Brandy multi-module compilation driver
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "driver.h"
+#include "lexer.h"
+#include "passmanager.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <unordered_map>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    const char SOURCE_EXTENSION[] = ".brandy";
+
+    enum path_kind { missing, file, directory };
+
+    path_kind kind_of(const std::string &path)
+    {
+#ifdef _WIN32
+      DWORD attributes = GetFileAttributesA(path.c_str());
+      if (attributes == INVALID_FILE_ATTRIBUTES) return missing;
+      return (attributes & FILE_ATTRIBUTE_DIRECTORY) ? directory : file;
+#else
+      struct stat info;
+      if (stat(path.c_str(), &info) != 0) return missing;
+      return S_ISDIR(info.st_mode) ? directory : file;
+#endif
+    }
+
+    // Names of everything in a directory but "." and ".."
+    std::vector<std::string> list_directory(const std::string &path)
+    {
+      std::vector<std::string> names;
+
+#ifdef _WIN32
+      WIN32_FIND_DATAA data;
+      HANDLE find = FindFirstFileA((path + "\\*").c_str(), &data);
+      if (find == INVALID_HANDLE_VALUE) return names;
+
+      do
+      {
+        if (strcmp(data.cFileName, ".") != 0 && strcmp(data.cFileName, "..") != 0)
+          names.push_back(data.cFileName);
+      } while (FindNextFileA(find, &data));
+
+      FindClose(find);
+#else
+      DIR *dir = opendir(path.c_str());
+      if (!dir) return names;
+
+      while (dirent *entry = readdir(dir))
+      {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+          names.push_back(entry->d_name);
+      }
+
+      closedir(dir);
+#endif
+
+      // Same order whatever the file system hands back
+      std::sort(names.begin(), names.end());
+      return names;
+    }
+
+    bool has_source_extension(const std::string &name)
+    {
+      const size_t length = sizeof(SOURCE_EXTENSION) - 1;
+      return name.size() > length && name.compare(name.size() - length, length, SOURCE_EXTENSION) == 0;
+    }
+
+    // The file name without its directories or extension
+    std::string stem(const std::string &path)
+    {
+      size_t start = path.find_last_of("/\\");
+      start = start == std::string::npos ? 0 : start + 1;
+
+      size_t end = path.find_last_of('.');
+      if (end == std::string::npos || end < start)
+        end = path.size();
+
+      return path.substr(start, end - start);
+    }
+
+    std::string interface_path(const compiled_module *module)
+    {
+      return module->path + "i";
+    }
+
+    std::string image_path(const compiled_module *module)
+    {
+      return module->path + "b";
+    }
+
+    // Finds the modules a module imports. Imports are statements, so there's
+    // no need to look inside expressions or types.
+    class import_collector : public static_visitor<import_collector>
+    {
+    public:
+      using static_visitor<import_collector>::visit;
+
+      static const node_kind_set handled_kinds = node_kind_of<import_node>::bit;
+      static const node_kind_set skipped_kinds = node_kinds_of<expression_node>::value;
+
+      ast_visitor::visitor_result visit(import_node *node)
+      {
+        std::string name;
+        for (const token &part : node->name_path)
+        {
+          if (!name.empty()) name += '.';
+          name.append(part.text(), part.length());
+        }
+
+        names.push_back(name);
+        nodes.push_back(node);
+        return ast_visitor::stop;
+      }
+
+      std::vector<std::string> names;
+      std::vector<import_node *> nodes;
+    };
+
+    // Finds the import cycles among the modules that aren't finished yet,
+    // as strongly connected components of their imports (Tarjan's), and
+    // keeps the ones whose imports from outside the cycle are all finished
+    class cycle_finder
+    {
+    public:
+      cycle_finder() : m_next(0) { }
+
+      std::vector<compiled_module *> ready_cycles(const std::vector<std::unique_ptr<compiled_module>> &modules)
+      {
+        for (auto &module : modules)
+        {
+          if (!module->finished && m_states.find(module.get()) == m_states.end())
+            connect(module.get());
+        }
+
+        return std::move(m_ready);
+      }
+
+    private:
+      struct visit_state
+      {
+        size_t index;
+        size_t low_link;
+        bool on_stack;
+      };
+
+      void connect(compiled_module *module)
+      {
+        // Elements of an unordered_map stay put as it grows
+        visit_state &state = m_states[module];
+        state.index = state.low_link = m_next++;
+        state.on_stack = true;
+        m_stack.push_back(module);
+
+        for (compiled_module *imported : module->imports)
+        {
+          if (imported->finished) continue;
+
+          auto found = m_states.find(imported);
+          if (found == m_states.end())
+          {
+            connect(imported);
+            state.low_link = std::min(state.low_link, m_states[imported].low_link);
+          }
+          else if (found->second.on_stack)
+          {
+            state.low_link = std::min(state.low_link, found->second.index);
+          }
+        }
+
+        if (state.low_link != state.index) return;
+
+        // The module is the root of a component, which is everything above
+        // it on the stack
+        auto first = std::find(m_stack.begin(), m_stack.end(), module);
+        std::vector<compiled_module *> component(first, m_stack.end());
+        m_stack.erase(first, m_stack.end());
+
+        for (compiled_module *member : component)
+          m_states[member].on_stack = false;
+
+        // A lone module only imports something that's waiting on a cycle
+        if (component.size() > 1 && imports_finished(component))
+          m_ready.insert(m_ready.end(), component.begin(), component.end());
+      }
+
+      static bool imports_finished(const std::vector<compiled_module *> &component)
+      {
+        for (compiled_module *member : component)
+        {
+          for (compiled_module *imported : member->imports)
+          {
+            if (!imported->finished && std::find(component.begin(), component.end(), imported) == component.end())
+              return false;
+          }
+        }
+
+        return true;
+      }
+
+      std::unordered_map<compiled_module *, visit_state> m_states;
+      std::vector<compiled_module *> m_stack;
+      std::vector<compiled_module *> m_ready;
+      size_t m_next;
+    };
+  }
+
+  // ---------------------------------------------------------------------------
+
+  compiled_module::compiled_module(const std::string &path, const std::string &name) :
+    path(path),
+    name(name),
+    loaded(false),
+    source_hash(0),
+    interface_hash(0),
+    previous(nullptr),
+    up_to_date(false),
+    waiting_on(0),
+    scheduled(false),
+    finished(false)
+  {
+  }
+
+  // ---------------------------------------------------------------------------
+
+  compilation_driver::compilation_driver(const compilation_context &context) :
+    m_context(context)
+  {
+  }
+
+  compilation_driver::~compilation_driver()
+  {
+    // Class instances can borrow from any module's tree, even one that comes
+    // later (see meta_evaluator::compile_class)
+    for (auto &module : m_modules)
+      module->meta.reset();
+  }
+
+  bool compilation_driver::add_input(const char *path)
+  {
+    if (strcmp(path, "-") == 0)
+    {
+      // Nothing can import standard input, so it has no name
+      m_modules.emplace_back(new compiled_module(path, ""));
+      return true;
+    }
+
+    switch (kind_of(path))
+    {
+    case file:
+      m_modules.emplace_back(new compiled_module(path, stem(path)));
+      return true;
+    case directory:
+      add_directory(path, "");
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  void compilation_driver::add_directory(const std::string &path, const std::string &namePrefix)
+  {
+    for (const std::string &entry : list_directory(path))
+    {
+      std::string entryPath = path + "/" + entry;
+
+      switch (kind_of(entryPath))
+      {
+      case directory:
+        add_directory(entryPath, namePrefix + entry + ".");
+        break;
+      case file:
+        if (has_source_extension(entry))
+          m_modules.emplace_back(new compiled_module(entryPath, namePrefix + stem(entry)));
+        break;
+      default:
+        break;
+      }
+    }
+  }
+
+  const std::vector<std::unique_ptr<compiled_module>> &compilation_driver::modules() const
+  {
+    return m_modules;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool compilation_driver::compile()
+  {
+    // Tracing prints as it goes, which only reads well from one thread
+    const compiler_flags &flags = m_context.flags();
+    const bool tracing = flags.dump_parser_stack() || flags.dump_parser_timings();
+
+    // The dumps want every module's tree, so nothing is skipped for them,
+    // but the state is still saved for next time
+    const char *stateFile = flags.build_state_file();
+    if (stateFile && !tracing && !flags.dump_ast() && !flags.dump_ast_graph())
+      m_state.load(stateFile);
+
+    if (flags.time_passes() || flags.trace_passes_file())
+      m_profiler.reset(new pass_profiler());
+
+    const char *metaCacheFile = flags.meta_cache_file();
+    if (metaCacheFile)
+      m_metaCache.load(metaCacheFile);
+
+    thread_pool pool(tracing ? 1 : flags.jobs());
+
+    for (auto &module : m_modules)
+    {
+      compiled_module *m = module.get();
+      pool.submit([this, m] { read(m); });
+    }
+
+    pool.wait();
+
+    link_imports();
+
+    for (auto &module : m_modules)
+    {
+      if (module->waiting_on == 0)
+        schedule(pool, module.get());
+    }
+
+    pool.wait();
+
+    // Whatever is left is part of an import cycle or waits on one. There's
+    // no right order inside a cycle, so each cycle goes all at once when
+    // nothing else holds it up. Its members count down their importers when
+    // they finish like any other module, which lets go of whatever waits on
+    // the cycle in order.
+    for (;;)
+    {
+      const std::vector<compiled_module *> ready = cycle_finder().ready_cycles(m_modules);
+      if (ready.empty()) break;
+
+      for (compiled_module *module : ready)
+        schedule(pool, module);
+
+      pool.wait();
+    }
+
+    if (stateFile)
+      save_state(stateFile);
+
+    if (metaCacheFile && !m_metaCache.save(metaCacheFile))
+      std::cout << "Failed to write meta cache " << metaCacheFile << std::endl;
+
+    if (flags.time_passes())
+    {
+      m_profiler->print_summary(std::cout);
+      std::cout << "Meta results cached: " << m_metaCache.hits() << " hits, " << m_metaCache.misses() << " misses" << std::endl;
+      std::cout << "Class instances: " << m_instanceCache.misses() << " made, " << m_instanceCache.hits() << " reused, "
+        << m_instanceCache.folds() << " folded" << std::endl;
+    }
+
+    const char *traceFile = flags.trace_passes_file();
+    if (traceFile && !m_profiler->write_trace(traceFile))
+      std::cout << "Failed to write pass trace " << traceFile << std::endl;
+
+    for (auto &module : m_modules)
+    {
+      if (!module->loaded)
+        return false;
+
+      if (!module->up_to_date && !module->module_parser->errors().empty())
+        return false;
+
+      if (module->meta && !module->meta->errors().empty())
+        return false;
+    }
+
+    return true;
+  }
+
+  void compilation_driver::save_state(const char *filename) const
+  {
+    // Only what's being compiled now is kept, records of modules that are
+    // gone are dropped
+    build_state state;
+
+    for (auto &module : m_modules)
+    {
+      if (!module->loaded || module->path == "-")
+        continue;
+
+      // No record for broken modules, so they're compiled (and their errors
+      // shown) again next time
+      if (!module->up_to_date && !module->module_parser->errors().empty())
+        continue;
+
+      module_record record;
+      record.source_hash = module->source_hash;
+      record.interface_hash = module->interface_hash;
+
+      for (const std::string &name : module->import_names)
+      {
+        std::uint64_t hash;
+        imported_interface(module.get(), name, &hash);
+        record.imports.push_back(std::make_pair(name, hash));
+      }
+
+      state.record(module->path, record);
+    }
+
+    if (!state.save(filename))
+      std::cout << "Failed to write build state " << filename << std::endl;
+  }
+
+  void compilation_driver::profile(const char *stage, const compiled_module *module,
+    pass_profiler::clock::time_point start, pass_profiler::clock::time_point end,
+    const pass_profiler::stats &stats)
+  {
+    m_profiler->add(stage, stats);
+    m_profiler->trace(stage, module->path, start, end, stats);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void compilation_driver::read(compiled_module *module)
+  {
+    if (m_context.flags().build_state_file() && module->path != "-")
+    {
+      auto file = m_sources.load(module->path.c_str());
+      if (!file) return;
+
+      module->source_hash = hash_source(file->text(), file->length());
+
+      // Whether it needs parsing depends on its imports, which are only
+      // known once everything else is parsed
+      auto record = m_state.find(module->path);
+      if (record && record->source_hash == module->source_hash)
+      {
+        module->loaded = true;
+        module->previous = record;
+        return;
+      }
+    }
+
+    parse(module);
+  }
+
+  void compilation_driver::parse(compiled_module *module)
+  {
+    typedef pass_profiler::clock clock;
+
+    std::vector<token> tokens;
+    clock::time_point lexStart;
+
+    if (module->path == "-")
+    {
+      lexStart = clock::now();
+      module->stream = token_stream::from_file(stdin);
+      tokenize_stream(*module->stream, tokens);
+    }
+    else
+    {
+      auto file = m_sources.load(module->path.c_str());
+      if (!file) return;
+
+      lexStart = clock::now();
+      tokenize_string(file->text(), tokens);
+    }
+
+    const clock::time_point lexEnd = clock::now();
+    const size_t tokenCount = tokens.size();
+
+    module->loaded = true;
+    module->module_parser.reset(new parser(m_context, std::move(tokens)));
+    module->module = module->module_parser->parse_module();
+
+    if (m_profiler)
+    {
+      pass_profiler::stats lexStats;
+      lexStats.time = lexEnd - lexStart;
+      lexStats.count = tokenCount;
+      lexStats.arena_bytes = tokenCount * sizeof(token);
+      profile("lexing", module, lexStart, lexEnd, lexStats);
+
+      const clock::time_point parseEnd = clock::now();
+
+      // Everything in the module's arena was made by the parser
+      pass_profiler::stats parseStats;
+      parseStats.time = parseEnd - lexEnd;
+      parseStats.count = tokenCount;
+      if (module->module)
+        parseStats.arena_bytes = node_arena::owner(module->module.get())->bytes_allocated();
+      profile("parsing", module, lexEnd, parseEnd, parseStats);
+    }
+  }
+
+  void compilation_driver::link_imports()
+  {
+    for (auto &module : m_modules)
+    {
+      if (!module->name.empty())
+        m_byName.emplace(module->name, module.get());
+    }
+
+    for (auto &module : m_modules)
+    {
+      if (!module->loaded) continue;
+
+      // Modules that weren't parsed import what they did last time
+      if (module->module)
+      {
+        import_collector collector;
+        static_walk(module->module, collector);
+        module->import_names = std::move(collector.names);
+      }
+      else
+      {
+        for (auto &import : module->previous->imports)
+          module->import_names.push_back(import.first);
+      }
+
+      for (const std::string &name : module->import_names)
+      {
+        // Imports of modules that aren't part of this compilation don't
+        // hold anything up
+        auto found = m_byName.find(name);
+        if (found == m_byName.end() || found->second == module.get())
+          continue;
+
+        compiled_module *imported = found->second;
+        if (std::find(module->imports.begin(), module->imports.end(), imported) != module->imports.end())
+          continue;
+
+        module->imports.push_back(imported);
+        imported->importers.push_back(module.get());
+      }
+
+      module->waiting_on = module->imports.size();
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void compilation_driver::schedule(thread_pool &pool, compiled_module *module)
+  {
+    if (module->scheduled.exchange(true))
+      return;
+
+    pool.submit([this, &pool, module] { analyze(pool, module); });
+  }
+
+  void compilation_driver::analyze(thread_pool &pool, compiled_module *module)
+  {
+    if (module->previous && !module->module)
+    {
+      if (imports_unchanged(module) && load_interface(module))
+      {
+        module->up_to_date = true;
+        module->interface_hash = module->previous->interface_hash;
+      }
+      else
+      {
+        parse(module);
+      }
+    }
+
+    // Broken statements are left half built, so only a clean parse goes on
+    if (module->module && module->module_parser->errors().empty())
+    {
+      module_node *node = module->module.get();
+
+      resolve_imports(module);
+
+      pass_manager passes;
+      add_semantic_passes(passes);
+      passes.run(node, m_profiler.get(), module->path);
+
+      // Meta code can only run once every name in it is resolved, and what
+      // it replaces can change what the module exports
+      module->meta.reset(new meta_evaluator(node, &m_metaCache, &m_instanceCache));
+
+      if (m_profiler)
+      {
+        const auto metaStart = pass_profiler::clock::now();
+        const size_t bytes = node_arena::owner(node)->bytes_allocated();
+
+        module->meta->evaluate(m_profiler.get(), module->path);
+
+        pass_profiler::stats metaStats;
+        metaStats.time = pass_profiler::clock::now() - metaStart;
+        metaStats.count = module->meta->functions().size();
+        metaStats.arena_bytes = node_arena::owner(node)->bytes_allocated() - bytes;
+        profile("meta evaluation", module, metaStart, metaStart + metaStats.time, metaStats);
+      }
+      else
+      {
+        module->meta->evaluate();
+      }
+
+      const char *stateFile = m_context.flags().build_state_file();
+      if (stateFile)
+        module->interface_hash = hash_interface(node);
+
+      // Modules without meta code get an empty image, so one that's missing
+      // means the module has to be compiled again
+      if (module->meta->errors().empty())
+      {
+        std::unique_ptr<bytecode_image> image(new bytecode_image(*module->meta, module->source_hash));
+        if (image->valid())
+          module->meta_image = std::move(image);
+      }
+
+      if (module->meta_image)
+      {
+        const std::uint64_t importsHash = link_image(module);
+
+        if (stateFile)
+        {
+          fnv_hasher hasher;
+          hasher.add(module->interface_hash);
+          hasher.add(module->meta_image->content_hash());
+          hasher.add(importsHash);
+          module->interface_hash = hasher.value();
+        }
+      }
+
+      module->exports.reset(new module_interface(node, module->source_hash, module->interface_hash));
+
+      // A file that didn't get written fails to load next time, and the
+      // module is just compiled again
+      if (stateFile)
+      {
+        module->exports->write(interface_path(module).c_str());
+
+        if (module->meta_image)
+          module->meta_image->write(image_path(module).c_str());
+        else
+          remove(image_path(module).c_str());
+      }
+    }
+
+    module->finished = true;
+
+    for (compiled_module *importer : module->importers)
+    {
+      if (--importer->waiting_on == 0)
+        schedule(pool, importer);
+    }
+  }
+
+  bool compilation_driver::load_interface(compiled_module *module)
+  {
+    // The mapping lives as long as the source manager, same as the sources
+    auto file = m_sources.load(interface_path(module).c_str());
+    if (!file) return false;
+
+    std::unique_ptr<module_interface> exports(new module_interface(file->text(), file->length()));
+
+    // An interface left by some other version of the source is no good
+    if (!exports->valid() ||
+        exports->source_hash() != module->source_hash ||
+        exports->interface_hash() != module->previous->interface_hash)
+      return false;
+
+    // Meta code importing it runs its instructions from the mapping
+    auto imageFile = m_sources.load(image_path(module).c_str());
+    if (!imageFile) return false;
+
+    std::unique_ptr<bytecode_image> image(new bytecode_image(imageFile->text(), imageFile->length()));
+    if (!image->valid() || image->source_hash() != module->source_hash)
+      return false;
+
+    module->meta_image = std::move(image);
+    link_image(module);
+
+    module->exports = std::move(exports);
+    return true;
+  }
+
+  // Images are linked to the images of the modules their meta code imports,
+  // which are finished first unless they're in an import cycle. Returns a
+  // hash of their interfaces, which covers their meta code.
+  std::uint64_t compilation_driver::link_image(compiled_module *module)
+  {
+    bytecode_image *image = module->meta_image.get();
+    fnv_hasher hasher;
+
+    for (size_t i = 0; i < image->import_count(); ++i)
+    {
+      auto found = m_byName.find(image->import_name(i));
+      if (found == m_byName.end() || found->second == module || !found->second->finished)
+        continue;
+
+      image->link(i, found->second->meta_image.get());
+      hasher.add(found->second->interface_hash);
+    }
+
+    return hasher.value();
+  }
+
+  void compilation_driver::resolve_imports(compiled_module *module)
+  {
+    import_collector collector;
+    static_walk(module->module, collector);
+
+    for (size_t i = 0; i < collector.names.size(); ++i)
+    {
+      // Modules in an import cycle might not be finished yet
+      auto found = m_byName.find(collector.names[i]);
+      if (found == m_byName.end() || found->second == module || !found->second->finished)
+        continue;
+
+      collector.nodes[i]->resolved_meta = found->second->meta_image.get();
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool compilation_driver::imported_interface(const compiled_module *importer, const std::string &name, std::uint64_t *hash) const
+  {
+    *hash = 0;
+
+    auto found = m_byName.find(name);
+    if (found == m_byName.end() || found->second == importer)
+      return true;
+
+    const compiled_module *imported = found->second;
+    if (!imported->finished)
+      return false;
+
+    *hash = imported->interface_hash;
+    return true;
+  }
+
+  bool compilation_driver::imports_unchanged(const compiled_module *module) const
+  {
+    // Imports still being worked on, like the rest of an import cycle, can't
+    // be vouched for
+    for (auto &import : module->previous->imports)
+    {
+      std::uint64_t hash;
+      if (!imported_interface(module, import.first, &hash) || hash != import.second)
+        return false;
+    }
+
+    return true;
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
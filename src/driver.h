@@ -0,0 +1,176 @@
+// -----------------------------------------------------------------------------
+// Brandy multi-module compilation driver
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#ifndef COMPILATION_DRIVER_H
+#define COMPILATION_DRIVER_H
+
+#pragma once
+
+#include "buildstate.h"
+#include "bytecodeimage.h"
+#include "context.h"
+#include "instancecache.h"
+#include "metacache.h"
+#include "metaevaluator.h"
+#include "moduleinterface.h"
+#include "parser.h"
+#include "passprofiler.h"
+#include "sourcemanager.h"
+#include "tokenstream.h"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  class thread_pool;
+
+  // ---------------------------------------------------------------------------
+
+  struct compiled_module
+  {
+    compiled_module(const std::string &path, const std::string &name);
+
+    std::string path;
+
+    // What other modules import this one as, IE "a.b.c" for a/b/c.brandy
+    // under a directory being compiled
+    std::string name;
+
+    // False if the file couldn't be read, nothing else is set then
+    bool loaded;
+
+    // Only worked out when there's a build state file (see
+    // compiler_flags::build_state_file)
+    std::uint64_t source_hash;
+    std::uint64_t interface_hash;
+
+    // The module's record from the last compilation, set when its source
+    // hasn't changed since. It's only parsed if one of its imports changed.
+    const module_record *previous;
+
+    // Skipped, nothing it depends on changed since the last compilation.
+    // It has no tokens or tree then, just the exports read from its
+    // interface file.
+    bool up_to_date;
+
+    // Only set when reading standard input, owns the text of the tokens
+    std::unique_ptr<token_stream> stream;
+
+    // Owns the tokens, and has the errors found parsing
+    std::unique_ptr<parser> module_parser;
+    unique_ptr<module_node> module;
+
+    // Set once its meta code has run, it owns the class instances meta code
+    // made and has any errors it found. Instances borrow nodes from the tree
+    // of whichever module has the class, so the driver destroys every
+    // module's evaluator before any module's tree.
+    std::unique_ptr<meta_evaluator> meta;
+
+    // What importers see of it, set once it's finished unless it had errors
+    std::unique_ptr<module_interface> exports;
+
+    // Its meta code, for meta blocks that import it. Set along with the
+    // exports unless its meta code failed or holds something an image
+    // can't.
+    std::unique_ptr<bytecode_image> meta_image;
+
+    // Every module name it imports, whether or not it's being compiled
+    std::vector<std::string> import_names;
+
+    // Modules it imports that are being compiled too, and ones importing it
+    std::vector<compiled_module *> imports;
+    std::vector<compiled_module *> importers;
+
+    // Imports that haven't been through the semantic passes yet
+    std::atomic<size_t> waiting_on;
+    std::atomic<bool> scheduled;
+
+    // Set once it's through the semantic passes, or found to be up to date
+    std::atomic<bool> finished;
+  };
+
+  // ---------------------------------------------------------------------------
+
+  // Compiles any number of modules on a pool of threads. Every module is
+  // lexed and parsed at once, then the semantic passes run on each module as
+  // soon as the modules it imports are through them.
+  //
+  // With a build state file, a module whose source is the same as last time
+  // is only compiled again if the interface of something it imports changed.
+  // Changing a function body recompiles that module and nothing else. Every
+  // compiled module's interface is written next to it, as path + "i", and
+  // that's what's loaded for a module that isn't compiled again. So is its
+  // meta code, as path + "b", which is part of its interface hash as meta
+  // code importing it depends on it.
+  class compilation_driver
+  {
+  public:
+    compilation_driver(const compilation_context &context);
+    ~compilation_driver();
+
+    // Adds a file, "-" for standard input, or every .brandy file under a
+    // directory. Returns false if there's no such file or directory.
+    bool add_input(const char *path);
+
+    // Returns true when every module loaded and parsed without errors
+    bool compile();
+
+    // In the order they were added, directories sorted by name
+    const std::vector<std::unique_ptr<compiled_module>> &modules() const;
+
+  private:
+    void add_directory(const std::string &path, const std::string &namePrefix);
+
+    void read(compiled_module *module);
+    void parse(compiled_module *module);
+    void link_imports();
+
+    void schedule(thread_pool &pool, compiled_module *module);
+    void analyze(thread_pool &pool, compiled_module *module);
+
+    bool load_interface(compiled_module *module);
+    std::uint64_t link_image(compiled_module *module);
+    void resolve_imports(compiled_module *module);
+
+    // The interface hash of the module an import name refers to, zero if
+    // it isn't being compiled. Returns false if that module isn't finished.
+    bool imported_interface(const compiled_module *importer, const std::string &name, std::uint64_t *hash) const;
+    bool imports_unchanged(const compiled_module *module) const;
+    void save_state(const char *filename) const;
+
+    // Adds a stage's work on a module to the profile
+    void profile(const char *stage, const compiled_module *module,
+      pass_profiler::clock::time_point start, pass_profiler::clock::time_point end,
+      const pass_profiler::stats &stats);
+
+    const compilation_context &m_context;
+    source_manager m_sources;
+    std::vector<std::unique_ptr<compiled_module>> m_modules;
+    std::unordered_map<std::string, compiled_module *> m_byName;
+
+    // What the last compilation saw
+    build_state m_state;
+
+    // Shared by every module's meta code
+    meta_result_cache m_metaCache;
+    instance_cache m_instanceCache;
+
+    // Only made for --time-passes or --trace-passes
+    std::unique_ptr<pass_profiler> m_profiler;
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
@@ -4,7 +4,9 @@
 // -----------------------------------------------------------------------------
 
 #include "flags.h"
-#include <stack>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
 
 // -----------------------------------------------------------------------------
 
@@ -12,18 +14,18 @@ namespace brandy
 {
   // ---------------------------------------------------------------------------
 
-  namespace
-  {
-    std::stack<compiler_flags> g_options_stack;
-  }
-
-  // ---------------------------------------------------------------------------
-  
   compiler_flags::compiler_flags() :
     m_dumpParserStack(false),
+    m_dumpParserTimings(false),
     m_dumpAst(false),
     m_dumpAstGraph(false),
-    m_inputFile(nullptr)
+    m_dumpBytecode(false),
+    m_jobs(0),
+    m_buildStateFile(nullptr),
+    m_timePasses(false),
+    m_tracePassesFile(nullptr),
+    m_metaCacheFile(nullptr),
+    m_inputFiles()
   {
   }
   
@@ -31,12 +33,17 @@ namespace brandy
 
   bool compiler_flags::parse_options(int argc, const char **argv)
   {
-    for (int i = 0; i < argc; ++i)
+    // The first argument is the program
+    for (int i = 1; i < argc; ++i)
     {
       if (strcmp(argv[i], "--dump-parser-stack") == 0)
       {
         m_dumpParserStack = true;
       }
+      else if (strcmp(argv[i], "--dump-parser-timings") == 0)
+      {
+        m_dumpParserTimings = true;
+      }
       else if (strcmp(argv[i], "--dump-ast") == 0)
       {
         m_dumpAst = true;
@@ -45,51 +52,126 @@ namespace brandy
       {
         m_dumpAstGraph = true;
       }
+      else if (strcmp(argv[i], "--dump-bytecode") == 0)
+      {
+        m_dumpBytecode = true;
+      }
+      else if (strcmp(argv[i], "--jobs") == 0 || strcmp(argv[i], "-j") == 0)
+      {
+        if (i + 1 == argc || atoi(argv[i + 1]) <= 0)
+        {
+          std::cout << argv[i] << " needs a number of threads" << std::endl;
+          return false;
+        }
+
+        m_jobs = size_t(atoi(argv[++i]));
+      }
+      else if (strcmp(argv[i], "--build-state") == 0)
+      {
+        if (i + 1 == argc)
+        {
+          std::cout << argv[i] << " needs a file name" << std::endl;
+          return false;
+        }
+
+        m_buildStateFile = argv[++i];
+      }
+      else if (strcmp(argv[i], "--time-passes") == 0)
+      {
+        m_timePasses = true;
+      }
+      else if (strcmp(argv[i], "--trace-passes") == 0)
+      {
+        if (i + 1 == argc)
+        {
+          std::cout << argv[i] << " needs a file name" << std::endl;
+          return false;
+        }
+
+        m_tracePassesFile = argv[++i];
+      }
+      else if (strcmp(argv[i], "--meta-cache") == 0)
+      {
+        if (i + 1 == argc)
+        {
+          std::cout << argv[i] << " needs a file name" << std::endl;
+          return false;
+        }
+
+        m_metaCacheFile = argv[++i];
+      }
       else
       {
-        m_inputFile = argv[i];
+        m_inputFiles.push_back(argv[i]);
       }
     }
 
+    if (m_inputFiles.empty())
+    {
+      std::cout << "No input files" << std::endl;
+      return false;
+    }
+
     return true;
   }
 
   // ---------------------------------------------------------------------------
 
-  bool compiler_flags::dump_parser_stack()
+  bool compiler_flags::dump_parser_stack() const
   {
     return m_dumpParserStack;
   }
+
+  bool compiler_flags::dump_parser_timings() const
+  {
+    return m_dumpParserTimings;
+  }
  
-  bool compiler_flags::dump_ast()
+  bool compiler_flags::dump_ast() const
   {
     return m_dumpAst;
   }
 
-  bool compiler_flags::dump_ast_graph()
+  bool compiler_flags::dump_ast_graph() const
   {
     return m_dumpAstGraph;
   }
 
+  bool compiler_flags::dump_bytecode() const
+  {
+    return m_dumpBytecode;
+  }
+
   // ---------------------------------------------------------------------------
 
-  const char *compiler_flags::input_file()
+  const std::vector<const char *> &compiler_flags::input_files() const
   {
-    return m_inputFile;
+    return m_inputFiles;
   }
 
-  // ---------------------------------------------------------------------------
+  size_t compiler_flags::jobs() const
+  {
+    return m_jobs;
+  }
 
-  void compiler_flags::push_options()
+  const char *compiler_flags::build_state_file() const
   {
-    g_options_stack.push(*this);
+    return m_buildStateFile;
   }
 
-  // ---------------------------------------------------------------------------
+  bool compiler_flags::time_passes() const
+  {
+    return m_timePasses;
+  }
+
+  const char *compiler_flags::trace_passes_file() const
+  {
+    return m_tracePassesFile;
+  }
 
-  compiler_flags &compiler_flags::current()
+  const char *compiler_flags::meta_cache_file() const
   {
-    return g_options_stack.top();
+    return m_metaCacheFile;
   }
 
   // ---------------------------------------------------------------------------
@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <vector>
 
 // -----------------------------------------------------------------------------
@@ -23,23 +24,48 @@ namespace brandy
 
     bool parse_options(int argc, const char **argv);
 
-    bool dump_parser_stack();
-    bool dump_ast();
-    bool dump_ast_graph();
-    const char *input_file();
+    bool dump_parser_stack() const;
+    bool dump_parser_timings() const;
+    bool dump_ast() const;
+    bool dump_ast_graph() const;
 
-    void push_options();
+    // Print the bytecode meta blocks are compiled to
+    bool dump_bytecode() const;
+
+    // Files or directories to compile, "-" for standard input
+    const std::vector<const char *> &input_files() const;
+
+    // Threads to compile with, zero for one per core
+    size_t jobs() const;
+
+    // Where to keep what the last compilation saw so unchanged modules can
+    // be skipped, nullptr to always compile everything
+    const char *build_state_file() const;
+
+    // Print how long each stage of compilation took, and what it did
+    bool time_passes() const;
+
+    // Where to write a Chrome trace of each stage, nullptr for none
+    const char *trace_passes_file() const;
+
+    // Where to keep the results of @[cache_result()] meta functions between
+    // compilations, nullptr to only keep them for this one
+    const char *meta_cache_file() const;
 
-    static compiler_flags &current();
   private:
     bool m_dumpParserStack;
+    bool m_dumpParserTimings;
     bool m_dumpAst;
     bool m_dumpAstGraph;
-    const char *m_inputFile;
+    bool m_dumpBytecode;
+    size_t m_jobs;
+    const char *m_buildStateFile;
+    bool m_timePasses;
+    const char *m_tracePassesFile;
+    const char *m_metaCacheFile;
+    std::vector<const char *> m_inputFiles;
   };
 
-#define CURRENT_FLAGS (brandy::compiler_flags::current())
-
   // ---------------------------------------------------------------------------
 }
 
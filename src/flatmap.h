@@ -0,0 +1,423 @@
+// -----------------------------------------------------------------------------
+// Brandy flat hash map
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#ifndef FLAT_MAP_H
+#define FLAT_MAP_H
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BRANDY_FLAT_MAP_SSE2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  // An open addressed hash map for the symbol tables. Most scopes only hold a
+  // few names, so the first SMALL_SIZE entries live inside the map itself and
+  // are found with a linear scan. Past that, entries go into one flat array
+  // with a control byte each (empty, or 7 bits of the hash) and are probed 16
+  // control bytes at a time, SwissTable style.
+  //
+  // Unlike std::unordered_map, inserting can move entries, so pointers and
+  // iterators into the map are only good until the next insert. There's no
+  // erase, scopes only ever grow.
+  template<typename key_type, typename mapped_type,
+    typename hasher = std::hash<key_type>, typename key_equal = std::equal_to<key_type>>
+  class flat_map
+  {
+  public:
+    typedef std::pair<const key_type, mapped_type> value_type;
+
+    static const size_t SMALL_SIZE = 4;
+
+    // -------------------------------------------------------------------------
+
+    template<typename map_type, typename value>
+    class basic_iterator
+    {
+    public:
+      basic_iterator(map_type *map, size_t index) :
+        m_map(map),
+        m_index(index)
+      {
+        skip_empty();
+      }
+
+      // Allows iterator -> const_iterator
+      template<typename other_map, typename other_value>
+      basic_iterator(const basic_iterator<other_map, other_value> &other) :
+        m_map(other.m_map),
+        m_index(other.m_index)
+      {
+      }
+
+      value &operator*() const { return m_map->slot(m_index); }
+      value *operator->() const { return &m_map->slot(m_index); }
+
+      basic_iterator &operator++()
+      {
+        ++m_index;
+        skip_empty();
+        return *this;
+      }
+
+      bool operator==(const basic_iterator &rhs) const { return m_index == rhs.m_index; }
+      bool operator!=(const basic_iterator &rhs) const { return m_index != rhs.m_index; }
+
+    private:
+      template<typename, typename> friend class basic_iterator;
+
+      void skip_empty()
+      {
+        while (m_index < m_map->slot_count() && !m_map->is_full(m_index))
+          ++m_index;
+      }
+
+      map_type *m_map;
+      size_t m_index;
+    };
+
+    typedef basic_iterator<flat_map, value_type> iterator;
+    typedef basic_iterator<const flat_map, const value_type> const_iterator;
+
+    // -------------------------------------------------------------------------
+
+    flat_map() :
+      m_size(0),
+      m_capacity(0),
+      m_slots(nullptr),
+      m_ctrl(nullptr)
+    {
+    }
+
+    flat_map(const flat_map &other) :
+      flat_map()
+    {
+      for (const value_type &entry : other)
+        insert(entry);
+    }
+
+    flat_map(flat_map &&other) :
+      flat_map()
+    {
+      swap(other);
+    }
+
+    flat_map &operator=(flat_map other)
+    {
+      swap(other);
+      return *this;
+    }
+
+    ~flat_map()
+    {
+      clear();
+    }
+
+    // -------------------------------------------------------------------------
+
+    size_t size() const { return m_size; }
+    bool  empty() const { return m_size == 0; }
+
+    iterator       begin()       { return iterator(this, 0); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    iterator         end()       { return iterator(this, slot_count()); }
+    const_iterator   end() const { return const_iterator(this, slot_count()); }
+
+    iterator find(const key_type &key)
+    {
+      return iterator(this, find_index(key));
+    }
+
+    const_iterator find(const key_type &key) const
+    {
+      return const_iterator(this, find_index(key));
+    }
+
+    size_t count(const key_type &key) const
+    {
+      return find_index(key) != slot_count() ? 1 : 0;
+    }
+
+    // Returns the existing entry and false if the key is already there
+    std::pair<iterator, bool> insert(const value_type &entry)
+    {
+      size_t index = find_index(entry.first);
+      if (index != slot_count())
+        return std::make_pair(iterator(this, index), false);
+
+      return std::make_pair(iterator(this, add(entry.first, entry.second)), true);
+    }
+
+    mapped_type &operator[](const key_type &key)
+    {
+      size_t index = find_index(key);
+      if (index == slot_count())
+        index = add(key, mapped_type());
+
+      return slot(index).second;
+    }
+
+    void clear()
+    {
+      for (size_t i = 0; i < slot_count(); ++i)
+      {
+        if (is_full(i))
+          slot(i).~value_type();
+      }
+
+      operator delete(m_slots);
+      delete[] m_ctrl;
+
+      m_size = 0;
+      m_capacity = 0;
+      m_slots = nullptr;
+      m_ctrl = nullptr;
+    }
+
+    void swap(flat_map &other)
+    {
+      // Inline entries can't be swapped by pointer, they're moved across
+      inline_storage saved;
+      const size_t ourInline = m_capacity ? 0 : m_size;
+      const size_t theirInline = other.m_capacity ? 0 : other.m_size;
+
+      relocate(&inline_slot(0), reinterpret_cast<value_type *>(&saved), ourInline);
+      relocate(&other.inline_slot(0), &inline_slot(0), theirInline);
+      relocate(reinterpret_cast<value_type *>(&saved), &other.inline_slot(0), ourInline);
+
+      std::swap(m_size, other.m_size);
+      std::swap(m_capacity, other.m_capacity);
+      std::swap(m_slots, other.m_slots);
+      std::swap(m_ctrl, other.m_ctrl);
+    }
+
+  private:
+    static const size_t GROUP_WIDTH = 16;
+    static const std::uint8_t EMPTY = 0x80;
+
+    // Room for the inline entries. VS2013 has no alignas, so it's the type
+    // trait.
+    typedef typename std::aligned_storage<SMALL_SIZE * sizeof(value_type),
+      std::alignment_of<value_type>::value>::type inline_storage;
+
+    // -------------------------------------------------------------------------
+
+    // In small mode the slots are the inline entries, of which the first
+    // m_size are full
+    size_t slot_count() const
+    {
+      return m_capacity ? m_capacity : m_size;
+    }
+
+    bool is_full(size_t index) const
+    {
+      return m_capacity == 0 || m_ctrl[index] != EMPTY;
+    }
+
+    value_type &slot(size_t index)
+    {
+      return m_capacity ? m_slots[index] : inline_slot(index);
+    }
+
+    const value_type &slot(size_t index) const
+    {
+      return m_capacity ? m_slots[index] : inline_slot(index);
+    }
+
+    value_type &inline_slot(size_t index)
+    {
+      return reinterpret_cast<value_type *>(&m_inline)[index];
+    }
+
+    const value_type &inline_slot(size_t index) const
+    {
+      return reinterpret_cast<const value_type *>(&m_inline)[index];
+    }
+
+    // Moves count entries to uninitialized memory, destroying the originals
+    static void relocate(value_type *from, value_type *to, size_t count)
+    {
+      for (size_t i = 0; i < count; ++i)
+      {
+        new (&to[i]) value_type(std::move(from[i]));
+        from[i].~value_type();
+      }
+    }
+
+    static size_t hash_of(const key_type &key)
+    {
+      return hasher()(key);
+    }
+
+    // -------------------------------------------------------------------------
+
+    // Bit i is set when control byte i of the group equals h2
+    static std::uint32_t match_group(const std::uint8_t *group, std::uint8_t h2)
+    {
+#ifdef BRANDY_FLAT_MAP_SSE2
+      __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+      return std::uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(char(h2)))));
+#else
+      std::uint32_t mask = 0;
+      for (size_t i = 0; i < GROUP_WIDTH; ++i)
+      {
+        if (group[i] == h2)
+          mask |= 1u << i;
+      }
+      return mask;
+#endif
+    }
+
+    static size_t lowest_bit(std::uint32_t mask)
+    {
+#if defined(_MSC_VER)
+      unsigned long index;
+      _BitScanForward(&index, mask);
+      return index;
+#elif defined(__GNUC__)
+      return __builtin_ctz(mask);
+#else
+      size_t index = 0;
+      while (!(mask & 1)) { mask >>= 1; ++index; }
+      return index;
+#endif
+    }
+
+    // Slot index of key, or slot_count() if it isn't in the map
+    size_t find_index(const key_type &key) const
+    {
+      if (m_capacity == 0)
+      {
+        for (size_t i = 0; i < m_size; ++i)
+        {
+          if (key_equal()(inline_slot(i).first, key))
+            return i;
+        }
+
+        return m_size;
+      }
+
+      const size_t hash = hash_of(key);
+      const std::uint8_t h2 = std::uint8_t(hash & 0x7F);
+      const size_t groupMask = m_capacity / GROUP_WIDTH - 1;
+
+      // Triangular probing visits every group once
+      size_t group = (hash >> 7) & groupMask;
+      for (size_t step = 1;; ++step)
+      {
+        const std::uint8_t *ctrl = m_ctrl + group * GROUP_WIDTH;
+
+        for (std::uint32_t match = match_group(ctrl, h2); match; match &= match - 1)
+        {
+          size_t index = group * GROUP_WIDTH + lowest_bit(match);
+          if (key_equal()(m_slots[index].first, key))
+            return index;
+        }
+
+        // A group with an empty slot ends the probe, the key would be there
+        if (match_group(ctrl, EMPTY))
+          return m_capacity;
+
+        group = (group + step) & groupMask;
+      }
+    }
+
+    // Puts a key that isn't in the map yet into it, returns its slot index
+    size_t add(const key_type &key, const mapped_type &value)
+    {
+      if (m_capacity == 0 && m_size < SMALL_SIZE)
+      {
+        new (&inline_slot(m_size)) value_type(key, value);
+        return m_size++;
+      }
+
+      // Grow at 7/8 full
+      if (m_capacity == 0 || (m_size + 1) * 8 > m_capacity * 7)
+        rehash(m_capacity ? m_capacity * 2 : GROUP_WIDTH * 2);
+
+      size_t index = place(hash_of(key));
+      new (&m_slots[index]) value_type(key, value);
+      ++m_size;
+
+      return index;
+    }
+
+    // Claims the first empty slot on the probe sequence for hash
+    size_t place(size_t hash)
+    {
+      const size_t groupMask = m_capacity / GROUP_WIDTH - 1;
+
+      size_t group = (hash >> 7) & groupMask;
+      for (size_t step = 1;; ++step)
+      {
+        std::uint8_t *ctrl = m_ctrl + group * GROUP_WIDTH;
+
+        std::uint32_t empty = match_group(ctrl, EMPTY);
+        if (empty)
+        {
+          size_t offset = lowest_bit(empty);
+          ctrl[offset] = std::uint8_t(hash & 0x7F);
+          return group * GROUP_WIDTH + offset;
+        }
+
+        group = (group + step) & groupMask;
+      }
+    }
+
+    void rehash(size_t capacity)
+    {
+      flat_map bigger;
+      bigger.m_capacity = capacity;
+      bigger.m_slots = static_cast<value_type *>(operator new(capacity * sizeof(value_type)));
+      bigger.m_ctrl = new std::uint8_t[capacity];
+      memset(bigger.m_ctrl, EMPTY, capacity);
+
+      for (size_t i = 0; i < slot_count(); ++i)
+      {
+        if (!is_full(i)) continue;
+
+        value_type &entry = slot(i);
+        size_t index = bigger.place(hash_of(entry.first));
+        new (&bigger.m_slots[index]) value_type(std::move(entry));
+        ++bigger.m_size;
+      }
+
+      swap(bigger);
+    }
+
+    // -------------------------------------------------------------------------
+
+    size_t m_size;
+    size_t m_capacity; // Zero while the entries are inline
+    value_type *m_slots;
+    std::uint8_t *m_ctrl;
+
+    inline_storage m_inline;
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
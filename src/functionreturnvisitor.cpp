@@ -11,6 +11,15 @@ namespace brandy
 {
   // ---------------------------------------------------------------------------
 
+  function_return_visitor::function_return_visitor()
+  {
+    handled_kinds = node_kinds_of<function_node>::value |
+      node_kinds_of<lambda_node>::value |
+      node_kinds_of<property_node>::value;
+  }
+
+  // ---------------------------------------------------------------------------
+
   ast_visitor::visitor_result function_return_visitor::visit(function_node *node)
   {
     if (node->scope->statements.size() == 1)
@@ -22,7 +31,9 @@ namespace brandy
         node->scope->statements[0].release();
 
         // Create a return node, set its value to the statement we read
-        auto returnNode = std::make_unique<return_node>();
+        auto returnNode = make_node_near<return_node>(node);
+        returnNode->begin = expr->begin;
+        returnNode->end = expr->end;
         returnNode->value = std::unique_ptr<expression_node>(expr);
 
         // Put our return statement in the statements list
@@ -44,7 +55,9 @@ namespace brandy
         node->scope->statements[0].release();
 
         // Create a return node, set its value to the statement we read
-        auto returnNode = std::make_unique<return_node>();
+        auto returnNode = make_node_near<return_node>(node);
+        returnNode->begin = expr->begin;
+        returnNode->end = expr->end;
         returnNode->value = std::unique_ptr<expression_node>(expr);
 
         // Put our return statement in the statements list
@@ -63,7 +76,9 @@ namespace brandy
       {
         node->getter->statements[0].release();
 
-        auto returnNode = std::make_unique<return_node>();
+        auto returnNode = make_node_near<return_node>(node);
+        returnNode->begin = expr->begin;
+        returnNode->end = expr->end;
         returnNode->value = std::unique_ptr<expression_node>(expr);
 
         node->getter->statements[0] = move(returnNode);
@@ -18,6 +18,10 @@ namespace brandy
 
   class function_return_visitor : public ast_visitor
   {
+  public:
+    function_return_visitor();
+
+  private:
     virtual ast_visitor::visitor_result visit(function_node *node);
     virtual ast_visitor::visitor_result visit(lambda_node *node);
     virtual ast_visitor::visitor_result visit(property_node *node);
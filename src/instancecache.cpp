@@ -0,0 +1,73 @@
+// -----------------------------------------------------------------------------
+// Brandy class instance cache
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "instancecache.h"
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  instance_cache::instance_cache() :
+    m_hits(0),
+    m_misses(0),
+    m_folds(0)
+  {
+  }
+
+  class_node *instance_cache::find(const std::string &key, const std::string &shape)
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    auto found = m_declarations.find(key);
+    if (found != m_declarations.end())
+    {
+      ++m_hits;
+      return found->second;
+    }
+
+    auto folded = m_shapes.find(shape);
+    if (folded == m_shapes.end())
+    {
+      ++m_misses;
+      return nullptr;
+    }
+
+    // Later instances with the key are hits
+    ++m_folds;
+    m_declarations.emplace(key, folded->second);
+    return folded->second;
+  }
+
+  void instance_cache::store(const std::string &key, const std::string &shape, class_node *declaration)
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_declarations.emplace(key, declaration);
+    m_shapes.emplace(shape, declaration);
+  }
+
+  size_t instance_cache::hits() const
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_hits;
+  }
+
+  size_t instance_cache::misses() const
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_misses;
+  }
+
+  size_t instance_cache::folds() const
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_folds;
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,69 @@
+// -----------------------------------------------------------------------------
+// Brandy class instance cache
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#ifndef INSTANCE_CACHE_H
+#define INSTANCE_CACHE_H
+
+#pragma once
+
+#include "astnodes.h"
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  // The classes compiler.compile_class made, keyed by the class instantiated
+  // and its bindings (see meta_evaluator::instance_keys). Keys are compared
+  // whole, so two instances are never taken for one because they hash the
+  // same. One cache is shared by every module in a compilation, so a class
+  // with the same tokens bound the same way is only cloned and analyzed
+  // once, by whichever module got to it first. The others use that module's
+  // instance.
+  //
+  // Each instance also has a shape, which is the same for instances that
+  // come out with the same layout and code, IE a class that only copies
+  // the pointers it's bound to. An instance with no class of its own uses
+  // the declaration of another with its shape, which is folding it.
+  //
+  // Only the declarations are kept, the modules holding them belong to the
+  // meta_evaluator that made them, which lives as long as the compilation.
+  class instance_cache
+  {
+  public:
+    instance_cache();
+
+    // The class made for the key or folded into it, or null if it has to
+    // be made
+    class_node *find(const std::string &key, const std::string &shape);
+
+    // Two modules making the same class at once both make it, the first
+    // stored is kept
+    void store(const std::string &key, const std::string &shape, class_node *declaration);
+
+    size_t hits() const;
+    size_t misses() const;
+    size_t folds() const;
+
+  private:
+    mutable std::mutex m_lock;
+    std::unordered_map<std::string, class_node *> m_declarations;
+    std::unordered_map<std::string, class_node *> m_shapes;
+    size_t m_hits;
+    size_t m_misses;
+    size_t m_folds;
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
@@ -4,8 +4,12 @@
 // -----------------------------------------------------------------------------
 
 #include "lexer.h"
+#include "charscan.h"
+#include <algorithm>
 #include <assert.h>
 #include <ctype.h>
+#include <map>
+#include <string.h>
 #include <vector>
 
 // -----------------------------------------------------------------------------
@@ -17,9 +21,13 @@ namespace brandy
   // There are 210 states last I checked
   const size_t APPROX_STATE_COUNT = 256;
 
+  const lexer::table_state lexer::DEAD_STATE;
+
   // ---------------------------------------------------------------------------
 
-  lexer::lexer()
+  lexer::lexer() :
+    m_byteClasses(),
+    m_classCount(0)
   {
     // Make our vector large enough for all states to avoid reallocation
     m_states.reserve(APPROX_STATE_COUNT);
@@ -28,9 +36,13 @@ namespace brandy
 
   // ---------------------------------------------------------------------------
 
-  bool lexer::read_token(const char *stream, token *outputTok) const
+  bool lexer::read_token(const char *stream, lexeme *output, bool *reachedEnd) const
   {
-    const state *current = &m_states.front(), *previous = nullptr;
+    assert(!m_table.empty() && "lexer::freeze must be called before reading tokens");
+
+    const table_state    *table = m_table.data();
+    const std::uint8_t *classes = m_byteClasses;
+    table_state        current = 0;
 
     auto currentToken = std::make_pair(token_types::INVALID, size_t(0));
     auto lastGoodToken = currentToken;
@@ -38,21 +50,25 @@ namespace brandy
     size_t &i = currentToken.second;
     do
     {
-      currentToken.first = current->accept;
+      currentToken.first = m_accepts[current];
 
-      if (current->accept != token_types::INVALID)
+      if (currentToken.first != token_types::INVALID)
         lastGoodToken = currentToken;
 
-      previous = current;
-      current = get_next_from(current, stream[i]);
-    } while (current && stream[i++]);
+      current = table[current * m_classCount + classes[std::uint8_t(stream[i])]];
+    } while (current != DEAD_STATE && stream[i++]);
+
+    if (reachedEnd)
+      *reachedEnd = current != DEAD_STATE || stream[i] == '\0';
 
     if (currentToken.first == token_types::INVALID && lastGoodToken.second != 0)
       currentToken = lastGoodToken;
 
-    *outputTok = token(stream, currentToken.second, currentToken.first);
+    output->length = currentToken.second;
+    output->type = currentToken.first;
+    output->hash = 0;
 
-    return outputTok->type() != token_types::INVALID;
+    return output->type != token_types::INVALID;
   }
 
   // ---------------------------------------------------------------------------
@@ -99,7 +115,53 @@ namespace brandy
 
   // ---------------------------------------------------------------------------
 
-  void lexer::dump_dotfile(FILE *f)
+  void lexer::freeze()
+  {
+    const size_t stateCount = m_states.size();
+    assert(stateCount < DEAD_STATE);
+
+    // Resolve every (state, byte) pair through the edge map and the letter,
+    // number and default fallbacks once, so reading never has to
+    std::vector<table_state> columns(256 * stateCount);
+    for (size_t c = 0; c < 256; ++c)
+    {
+      for (size_t s = 0; s < stateCount; ++s)
+      {
+        const state *next = get_next_from(&m_states[s], char(c));
+        columns[c * stateCount + s] = next ? table_state(next->index) : DEAD_STATE;
+      }
+    }
+
+    // Bytes that every state treats the same way share a column
+    std::map<std::vector<table_state>, std::uint8_t> classIds;
+    for (size_t c = 0; c < 256; ++c)
+    {
+      auto first = columns.begin() + c * stateCount;
+      std::vector<table_state> column(first, first + stateCount);
+
+      auto found = classIds.find(column);
+      if (found == classIds.end())
+        found = classIds.emplace(std::move(column), std::uint8_t(classIds.size())).first;
+
+      m_byteClasses[c] = found->second;
+    }
+
+    m_classCount = classIds.size();
+    m_table.assign(stateCount * m_classCount, DEAD_STATE);
+    m_accepts.resize(stateCount);
+
+    for (size_t s = 0; s < stateCount; ++s)
+    {
+      m_accepts[s] = m_states[s].accept;
+
+      for (size_t c = 0; c < 256; ++c)
+        m_table[s * m_classCount + m_byteClasses[c]] = columns[c * stateCount + s];
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void lexer::dump_dotfile(FILE *f) const
   {
     fputs("digraph G {\n", f);
 
@@ -162,9 +224,9 @@ namespace brandy
     auto found = state->edges.find(c);
     if (found != state->edges.end())
       return &m_states[found->second];
-    else if (state->letter_edge != INVALID_EDGE && isalpha(c))
+    else if (state->letter_edge != INVALID_EDGE && isalpha(std::uint8_t(c)))
       return &m_states[state->letter_edge];
-    else if (state->number_edge != INVALID_EDGE && isdigit(c))
+    else if (state->number_edge != INVALID_EDGE && isdigit(std::uint8_t(c)))
       return &m_states[state->number_edge];
     else if (state->default != INVALID_EDGE)
       return &m_states[state->default];
@@ -184,221 +246,248 @@ namespace brandy
 
   // ---------------------------------------------------------------------------
 
-  lexer gBrandyLexer;
+  namespace
+  {
+    // The Brandy DFA. It's built before main and never changes after that,
+    // so any number of threads can lex with it at once.
+    class brandy_tables
+    {
+    public:
+      brandy_tables();
+
+      lexer dfa;
+
+      // Identifiers longer than this can't be keywords, so the scanner can
+      // classify them without running the DFA
+      size_t longestKeyword;
+
+    private:
+      void add_operator_edges(lexer::state_reference from, char op, token_types::type regular, token_types::type side_effect);
+      void add_keyword(lexer::state_reference from, lexer::state_reference identifier, lexer::state_reference finish, const char *str);
+    };
+
+    // A function static would be built by whichever worker lexes first,
+    // which VS2013 doesn't make thread safe. Nothing lexes before main.
+    const brandy_tables g_tables;
+  }
 
   // ---------------------------------------------------------------------------
 
-  static void add_operator_edges(lexer::state_reference from, char op, token_types::type regular, token_types::type side_effect)
+  void brandy_tables::add_operator_edges(lexer::state_reference from, char op, token_types::type regular, token_types::type side_effect)
   {
-    auto opState = gBrandyLexer.create_state(regular);
-    gBrandyLexer.add_edge(from, opState, op);
-    gBrandyLexer.add_edge(opState, gBrandyLexer.create_state(side_effect), '=');
+    auto opState = dfa.create_state(regular);
+    dfa.add_edge(from, opState, op);
+    dfa.add_edge(opState, dfa.create_state(side_effect), '=');
   }
 
-  static void add_keyword(lexer::state_reference from, lexer::state_reference identifier, lexer::state_reference finish, const char *str)
+  void brandy_tables::add_keyword(lexer::state_reference from, lexer::state_reference identifier, lexer::state_reference finish, const char *str)
   {
+    longestKeyword = std::max(longestKeyword, strlen(str));
+
     while (str[1] != 0)
     {
       // get the edge from here to the next letter in the string
-      lexer::state_reference intermediate = gBrandyLexer.get_edge(from, *str);
+      lexer::state_reference intermediate = dfa.get_edge(from, *str);
 
       // Check for no edge or one that goes to THE identifier state (not just any identifier)
       if (intermediate == INVALID_EDGE || intermediate == identifier)
       {
         // Create a new edge and hook it up
-        intermediate = gBrandyLexer.create_state(token_types::IDENTIFIER);
+        intermediate = dfa.create_state(token_types::IDENTIFIER);
 
-        gBrandyLexer.add_letter_edge(intermediate, identifier);
-        gBrandyLexer.add_number_edge(intermediate, identifier);
-        gBrandyLexer.add_edge(intermediate, identifier, '_');
-        gBrandyLexer.add_edge(intermediate, identifier, '$');
+        dfa.add_letter_edge(intermediate, identifier);
+        dfa.add_number_edge(intermediate, identifier);
+        dfa.add_edge(intermediate, identifier, '_');
+        dfa.add_edge(intermediate, identifier, '$');
 
-        gBrandyLexer.add_edge(from, intermediate, *str);
+        dfa.add_edge(from, intermediate, *str);
       }
 
       from = intermediate;
       ++str;
     }
 
-    gBrandyLexer.add_letter_edge(finish, identifier);
-    gBrandyLexer.add_number_edge(finish, identifier);
-    gBrandyLexer.add_edge(finish, identifier, '_');
-    gBrandyLexer.add_edge(finish, identifier, '$');
+    dfa.add_letter_edge(finish, identifier);
+    dfa.add_number_edge(finish, identifier);
+    dfa.add_edge(finish, identifier, '_');
+    dfa.add_edge(finish, identifier, '$');
 
     // Add an edge to the finishing state
-    gBrandyLexer.add_edge(from, finish, *str);
+    dfa.add_edge(from, finish, *str);
   }
 
-  void setup_lexer()
+  brandy_tables::brandy_tables() :
+    longestKeyword(0)
   {
-    auto root = gBrandyLexer.root();
-    auto identifier = gBrandyLexer.create_state(token_types::IDENTIFIER);
+    auto root = dfa.root();
+    auto identifier = dfa.create_state(token_types::IDENTIFIER);
 
     {
-      auto whitespace = gBrandyLexer.create_state(token_types::WHITESPACE);
-      gBrandyLexer.add_edge(root, whitespace, ' ');
-      gBrandyLexer.add_edge(root, whitespace, '\t');
-
-      gBrandyLexer.add_edge(whitespace, whitespace, ' ');
-      gBrandyLexer.add_edge(whitespace, whitespace, '\t');
+      auto whitespace = dfa.create_state(token_types::WHITESPACE);
+      dfa.add_edge(root, whitespace, ' ');
+      dfa.add_edge(root, whitespace, '\t');
+      dfa.add_edge(root, whitespace, '\r');
+
+      dfa.add_edge(whitespace, whitespace, ' ');
+      dfa.add_edge(whitespace, whitespace, '\t');
+      dfa.add_edge(whitespace, whitespace, '\r');
     }
 
     {
-      auto newline = gBrandyLexer.create_state(token_types::NEWLINE);
-      gBrandyLexer.add_edge(root, newline, '\n');
+      auto newline = dfa.create_state(token_types::NEWLINE);
+      dfa.add_edge(root, newline, '\n');
     }
 
     {
-      auto at = gBrandyLexer.create_state();
-      auto attribute = gBrandyLexer.create_state(token_types::ATTRIBUTE_START);
+      auto at = dfa.create_state();
+      auto attribute = dfa.create_state(token_types::ATTRIBUTE_START);
 
-      gBrandyLexer.add_edge(root, at, '@');
-      gBrandyLexer.add_edge(at, attribute, '[');
-      gBrandyLexer.add_default_edge(at, identifier);
+      dfa.add_edge(root, at, '@');
+      dfa.add_edge(at, attribute, '[');
+      dfa.add_default_edge(at, identifier);
 
-      gBrandyLexer.add_edge(root, identifier, '_');
-      gBrandyLexer.add_edge(root, identifier, '$');
-      gBrandyLexer.add_letter_edge(root, identifier);
+      dfa.add_edge(root, identifier, '_');
+      dfa.add_edge(root, identifier, '$');
+      dfa.add_letter_edge(root, identifier);
 
-      gBrandyLexer.add_edge(identifier, identifier, '_');
-      gBrandyLexer.add_edge(identifier, identifier, '$');
-      gBrandyLexer.add_letter_edge(identifier, identifier);
-      gBrandyLexer.add_number_edge(identifier, identifier);
+      dfa.add_edge(identifier, identifier, '_');
+      dfa.add_edge(identifier, identifier, '$');
+      dfa.add_letter_edge(identifier, identifier);
+      dfa.add_number_edge(identifier, identifier);
     }
 
     {
-      auto lit_i8 = gBrandyLexer.create_state(token_types::I8_LITERAL);
-      auto lit_i16 = gBrandyLexer.create_state(token_types::I16_LITERAL);
-      auto lit_i32 = gBrandyLexer.create_state(token_types::I32_LITERAL);
-      auto lit_i64 = gBrandyLexer.create_state(token_types::I64_LITERAL);
+      auto lit_i8 = dfa.create_state(token_types::I8_LITERAL);
+      auto lit_i16 = dfa.create_state(token_types::I16_LITERAL);
+      auto lit_i32 = dfa.create_state(token_types::I32_LITERAL);
+      auto lit_i64 = dfa.create_state(token_types::I64_LITERAL);
       
-      auto lit_ui8 = gBrandyLexer.create_state(token_types::UI8_LITERAL);
-      auto lit_ui16 = gBrandyLexer.create_state(token_types::UI16_LITERAL);
-      auto lit_ui32 = gBrandyLexer.create_state(token_types::UI32_LITERAL);
-      auto lit_ui64 = gBrandyLexer.create_state(token_types::UI64_LITERAL);
+      auto lit_ui8 = dfa.create_state(token_types::UI8_LITERAL);
+      auto lit_ui16 = dfa.create_state(token_types::UI16_LITERAL);
+      auto lit_ui32 = dfa.create_state(token_types::UI32_LITERAL);
+      auto lit_ui64 = dfa.create_state(token_types::UI64_LITERAL);
       
-      auto dot = gBrandyLexer.create_state();
-      auto lit_f32 = gBrandyLexer.create_state(token_types::F32_LITERAL);
-      auto lit_f64 = gBrandyLexer.create_state(token_types::F64_LITERAL);
-      auto exp = gBrandyLexer.create_state();
-      auto expPlus = gBrandyLexer.create_state();
-      auto expMinus = gBrandyLexer.create_state();
-      auto expVal = gBrandyLexer.create_state(token_types::F64_LITERAL);
-
-      gBrandyLexer.add_number_edge(root, lit_i32);
-      gBrandyLexer.add_number_edge(lit_i32, lit_i32);
-      gBrandyLexer.add_edge(lit_i32, lit_i8, 'b');
-      gBrandyLexer.add_edge(lit_i32, lit_i8, 'B');
-      gBrandyLexer.add_edge(lit_i32, lit_i16, 's');
-      gBrandyLexer.add_edge(lit_i32, lit_i16, 'S');
-      gBrandyLexer.add_edge(lit_i32, lit_i64, 'l');
-      gBrandyLexer.add_edge(lit_i32, lit_i64, 'L');
-      gBrandyLexer.add_edge(lit_i32, lit_f32, 'f');
-      gBrandyLexer.add_edge(lit_i32, lit_f32, 'F');
-
-      gBrandyLexer.add_edge(lit_i32, lit_ui32, 'u');
-      gBrandyLexer.add_edge(lit_i32, lit_ui32, 'U');
-
-      gBrandyLexer.add_edge(lit_ui32, lit_ui8, 'b');
-      gBrandyLexer.add_edge(lit_ui32, lit_ui8, 'B');
-      gBrandyLexer.add_edge(lit_ui32, lit_ui16, 's');
-      gBrandyLexer.add_edge(lit_ui32, lit_ui16, 'S');
-      gBrandyLexer.add_edge(lit_ui32, lit_ui64, 'l');
-      gBrandyLexer.add_edge(lit_ui32, lit_ui64, 'L');
-
-      gBrandyLexer.add_edge(lit_i32, dot, '.');
-
-      gBrandyLexer.add_number_edge(dot, lit_f64);
-      gBrandyLexer.add_number_edge(lit_f64, lit_f64);
-      gBrandyLexer.add_edge(lit_f64, lit_f32, 'f');
-      gBrandyLexer.add_edge(lit_f64, lit_f32, 'F');
-
-      gBrandyLexer.add_edge(lit_f64, exp, 'e');
-      gBrandyLexer.add_edge(lit_f64, exp, 'E');
-
-      gBrandyLexer.add_edge(exp, expPlus, '+');
-      gBrandyLexer.add_edge(exp, expMinus, '-');
-      gBrandyLexer.add_number_edge(exp, expVal);
-      gBrandyLexer.add_number_edge(expPlus, expVal);
-      gBrandyLexer.add_number_edge(expMinus, expVal);
-      gBrandyLexer.add_number_edge(expVal, expVal);
-      gBrandyLexer.add_edge(expVal, lit_f32, 'f');
-      gBrandyLexer.add_edge(expVal, lit_f32, 'F');
+      auto dot = dfa.create_state();
+      auto lit_f32 = dfa.create_state(token_types::F32_LITERAL);
+      auto lit_f64 = dfa.create_state(token_types::F64_LITERAL);
+      auto exp = dfa.create_state();
+      auto expPlus = dfa.create_state();
+      auto expMinus = dfa.create_state();
+      auto expVal = dfa.create_state(token_types::F64_LITERAL);
+
+      dfa.add_number_edge(root, lit_i32);
+      dfa.add_number_edge(lit_i32, lit_i32);
+      dfa.add_edge(lit_i32, lit_i8, 'b');
+      dfa.add_edge(lit_i32, lit_i8, 'B');
+      dfa.add_edge(lit_i32, lit_i16, 's');
+      dfa.add_edge(lit_i32, lit_i16, 'S');
+      dfa.add_edge(lit_i32, lit_i64, 'l');
+      dfa.add_edge(lit_i32, lit_i64, 'L');
+      dfa.add_edge(lit_i32, lit_f32, 'f');
+      dfa.add_edge(lit_i32, lit_f32, 'F');
+
+      dfa.add_edge(lit_i32, lit_ui32, 'u');
+      dfa.add_edge(lit_i32, lit_ui32, 'U');
+
+      dfa.add_edge(lit_ui32, lit_ui8, 'b');
+      dfa.add_edge(lit_ui32, lit_ui8, 'B');
+      dfa.add_edge(lit_ui32, lit_ui16, 's');
+      dfa.add_edge(lit_ui32, lit_ui16, 'S');
+      dfa.add_edge(lit_ui32, lit_ui64, 'l');
+      dfa.add_edge(lit_ui32, lit_ui64, 'L');
+
+      dfa.add_edge(lit_i32, dot, '.');
+
+      dfa.add_number_edge(dot, lit_f64);
+      dfa.add_number_edge(lit_f64, lit_f64);
+      dfa.add_edge(lit_f64, lit_f32, 'f');
+      dfa.add_edge(lit_f64, lit_f32, 'F');
+
+      dfa.add_edge(lit_f64, exp, 'e');
+      dfa.add_edge(lit_f64, exp, 'E');
+
+      dfa.add_edge(exp, expPlus, '+');
+      dfa.add_edge(exp, expMinus, '-');
+      dfa.add_number_edge(exp, expVal);
+      dfa.add_number_edge(expPlus, expVal);
+      dfa.add_number_edge(expMinus, expVal);
+      dfa.add_number_edge(expVal, expVal);
+      dfa.add_edge(expVal, lit_f32, 'f');
+      dfa.add_edge(expVal, lit_f32, 'F');
     }
 
     {
-      auto str = gBrandyLexer.create_state();
-      auto escape = gBrandyLexer.create_state();
-      auto escChar = gBrandyLexer.create_state();
-      auto endStr = gBrandyLexer.create_state(token_types::STRING_LITERAL);
+      auto str = dfa.create_state();
+      auto escape = dfa.create_state();
+      auto escChar = dfa.create_state();
+      auto endStr = dfa.create_state(token_types::STRING_LITERAL);
 
-      gBrandyLexer.add_edge(root, str, '"');
+      dfa.add_edge(root, str, '"');
 
-      gBrandyLexer.add_default_edge(str, str);
-      gBrandyLexer.add_edge(str, escape, '\\');
+      dfa.add_default_edge(str, str);
+      dfa.add_edge(str, escape, '\\');
 
-      gBrandyLexer.add_edge(escape, escChar, 'n');
-      gBrandyLexer.add_edge(escape, escChar, 'r');
-      gBrandyLexer.add_edge(escape, escChar, 't');
-      gBrandyLexer.add_edge(escape, escChar, 'b');
-      gBrandyLexer.add_edge(escape, escChar, '"');
-      gBrandyLexer.add_edge(escape, escChar, '\\');
+      dfa.add_edge(escape, escChar, 'n');
+      dfa.add_edge(escape, escChar, 'r');
+      dfa.add_edge(escape, escChar, 't');
+      dfa.add_edge(escape, escChar, 'b');
+      dfa.add_edge(escape, escChar, '"');
+      dfa.add_edge(escape, escChar, '\\');
 
-      gBrandyLexer.add_default_edge(escChar, str);
+      dfa.add_default_edge(escChar, str);
 
-      gBrandyLexer.add_edge(escChar, endStr, '"');
-      gBrandyLexer.add_edge(str, endStr, '"');
+      dfa.add_edge(escChar, endStr, '"');
+      dfa.add_edge(str, endStr, '"');
     }
 
     {
-      auto chr = gBrandyLexer.create_state();
-      auto chrMid = gBrandyLexer.create_state();
-      auto escape = gBrandyLexer.create_state();
-      auto escChar = gBrandyLexer.create_state();
-      auto endChr = gBrandyLexer.create_state(token_types::CHAR_LITERAL);
+      auto chr = dfa.create_state();
+      auto chrMid = dfa.create_state();
+      auto escape = dfa.create_state();
+      auto escChar = dfa.create_state();
+      auto endChr = dfa.create_state(token_types::CHAR_LITERAL);
 
-      gBrandyLexer.add_edge(root, chr, '\'');
+      dfa.add_edge(root, chr, '\'');
 
-      gBrandyLexer.add_default_edge(chr, chrMid);
-      gBrandyLexer.add_edge(chr, escape, '\\');
+      dfa.add_default_edge(chr, chrMid);
+      dfa.add_edge(chr, escape, '\\');
 
-      gBrandyLexer.add_edge(chr, gBrandyLexer.create_state(), '\n');
+      dfa.add_edge(chr, dfa.create_state(), '\n');
 
 
-      gBrandyLexer.add_edge(escape, escChar, 'n');
-      gBrandyLexer.add_edge(escape, escChar, 'r');
-      gBrandyLexer.add_edge(escape, escChar, 't');
-      gBrandyLexer.add_edge(escape, escChar, 'b');
-      gBrandyLexer.add_edge(escape, escChar, '\'');
-      gBrandyLexer.add_edge(escape, escChar, '\\');
+      dfa.add_edge(escape, escChar, 'n');
+      dfa.add_edge(escape, escChar, 'r');
+      dfa.add_edge(escape, escChar, 't');
+      dfa.add_edge(escape, escChar, 'b');
+      dfa.add_edge(escape, escChar, '\'');
+      dfa.add_edge(escape, escChar, '\\');
 
-      gBrandyLexer.add_edge(escChar, endChr, '\'');
-      gBrandyLexer.add_edge(chrMid, endChr, '\'');
+      dfa.add_edge(escChar, endChr, '\'');
+      dfa.add_edge(chrMid, endChr, '\'');
     }
 
     {
-      auto div = gBrandyLexer.create_state(token_types::DIVIDE);
-      auto assign = gBrandyLexer.create_state(token_types::ASSIGNMENT_DIVIDE);
-      auto blockInner = gBrandyLexer.create_state();
-      auto blockEnd1 = gBrandyLexer.create_state();
-      auto blockEnd2 = gBrandyLexer.create_state(token_types::BLOCK_COMMENT);
-      auto lineComment = gBrandyLexer.create_state();
-      auto lineCommentEnd = gBrandyLexer.create_state(token_types::LINE_COMMENT);
-
-      gBrandyLexer.add_edge(root, div, '/');
-      gBrandyLexer.add_edge(div, assign, '=');
-
-      gBrandyLexer.add_edge(div, blockInner, '*');
-      gBrandyLexer.add_default_edge(blockInner, blockInner);
-      gBrandyLexer.add_default_edge(blockEnd1, blockInner);
-      gBrandyLexer.add_edge(blockInner, blockEnd1, '*');
-      gBrandyLexer.add_edge(blockEnd1, blockEnd2, '/');
-
-      gBrandyLexer.add_edge(div, lineComment, '/');
-      gBrandyLexer.add_default_edge(lineComment, lineComment);
-      gBrandyLexer.add_edge(lineComment, lineCommentEnd, '\n');
-      gBrandyLexer.add_edge(lineComment, lineCommentEnd, '\r');
-      gBrandyLexer.add_edge(lineComment, lineCommentEnd, '\0');
+      auto div = dfa.create_state(token_types::DIVIDE);
+      auto assign = dfa.create_state(token_types::ASSIGNMENT_DIVIDE);
+      auto blockInner = dfa.create_state();
+      auto blockEnd1 = dfa.create_state();
+      auto blockEnd2 = dfa.create_state(token_types::BLOCK_COMMENT);
+      auto lineComment = dfa.create_state();
+      auto lineCommentEnd = dfa.create_state(token_types::LINE_COMMENT);
+
+      dfa.add_edge(root, div, '/');
+      dfa.add_edge(div, assign, '=');
+
+      dfa.add_edge(div, blockInner, '*');
+      dfa.add_default_edge(blockInner, blockInner);
+      dfa.add_default_edge(blockEnd1, blockInner);
+      dfa.add_edge(blockInner, blockEnd1, '*');
+      dfa.add_edge(blockEnd1, blockEnd2, '/');
+
+      dfa.add_edge(div, lineComment, '/');
+      dfa.add_default_edge(lineComment, lineComment);
+      dfa.add_edge(lineComment, lineCommentEnd, '\n');
+      dfa.add_edge(lineComment, lineCommentEnd, '\0');
     }
 
     add_operator_edges(root, '+', token_types::ADD, token_types::ASSIGNMENT_ADD);
@@ -408,175 +497,260 @@ namespace brandy
     add_operator_edges(root, '^', token_types::BITWISE_XOR, token_types::ASSIGNMENT_BITWISE_XOR);
 
     {
-      auto greater = gBrandyLexer.create_state(token_types::GREATER_THAN);
-      auto greaterEqual = gBrandyLexer.create_state(token_types::GREATER_THAN_OR_EQUAL);
-      auto rShift = gBrandyLexer.create_state(token_types::BITWISE_RIGHT_SHIFT);
-      auto rShiftAssign = gBrandyLexer.create_state(token_types::ASSIGNMENT_BITWISE_RIGHT_SHIFT);
-
-      gBrandyLexer.add_edge(root, greater, '>');
-      gBrandyLexer.add_edge(greater, greaterEqual, '=');
-      gBrandyLexer.add_edge(greater, rShift, '>');
-      gBrandyLexer.add_edge(rShift, rShiftAssign, '=');
+      auto greater = dfa.create_state(token_types::GREATER_THAN);
+      auto greaterEqual = dfa.create_state(token_types::GREATER_THAN_OR_EQUAL);
+      auto rShift = dfa.create_state(token_types::BITWISE_RIGHT_SHIFT);
+      auto rShiftAssign = dfa.create_state(token_types::ASSIGNMENT_BITWISE_RIGHT_SHIFT);
+
+      dfa.add_edge(root, greater, '>');
+      dfa.add_edge(greater, greaterEqual, '=');
+      dfa.add_edge(greater, rShift, '>');
+      dfa.add_edge(rShift, rShiftAssign, '=');
     }
 
     {
-      auto less = gBrandyLexer.create_state(token_types::LESS_THAN);
-      auto lessEqual = gBrandyLexer.create_state(token_types::LESS_THAN_OR_EQUAL);
-      auto lShift = gBrandyLexer.create_state(token_types::BITWISE_LEFT_SHIFT);
-      auto lShiftAssign = gBrandyLexer.create_state(token_types::ASSIGNMENT_BITWISE_LEFT_SHIFT);
-
-      gBrandyLexer.add_edge(root, less, '<');
-      gBrandyLexer.add_edge(less, lessEqual, '=');
-      gBrandyLexer.add_edge(less, lShift, '<');
-      gBrandyLexer.add_edge(lShift, lShiftAssign, '=');
+      auto less = dfa.create_state(token_types::LESS_THAN);
+      auto lessEqual = dfa.create_state(token_types::LESS_THAN_OR_EQUAL);
+      auto lShift = dfa.create_state(token_types::BITWISE_LEFT_SHIFT);
+      auto lShiftAssign = dfa.create_state(token_types::ASSIGNMENT_BITWISE_LEFT_SHIFT);
+
+      dfa.add_edge(root, less, '<');
+      dfa.add_edge(less, lessEqual, '=');
+      dfa.add_edge(less, lShift, '<');
+      dfa.add_edge(lShift, lShiftAssign, '=');
     }
 
     {
-      auto assign = gBrandyLexer.create_state(token_types::ASSIGNMENT);
-      auto equality = gBrandyLexer.create_state(token_types::EQUALITY);
+      auto assign = dfa.create_state(token_types::ASSIGNMENT);
+      auto equality = dfa.create_state(token_types::EQUALITY);
 
-      gBrandyLexer.add_edge(root, assign, '=');
-      gBrandyLexer.add_edge(assign, equality, '=');
+      dfa.add_edge(root, assign, '=');
+      dfa.add_edge(assign, equality, '=');
     }
 
     {
-      auto bitwiseAnd = gBrandyLexer.create_state(token_types::AMPERSAND);
-      auto logicalAnd = gBrandyLexer.create_state(token_types::LOGICAL_AND);
+      auto bitwiseAnd = dfa.create_state(token_types::AMPERSAND);
+      auto logicalAnd = dfa.create_state(token_types::LOGICAL_AND);
 
-      auto bitwiseAndAssign = gBrandyLexer.create_state(token_types::ASSIGNMENT_BITWISE_AND);
-      auto logicalAndAssign = gBrandyLexer.create_state(token_types::ASSIGNMENT_LOGICAL_AND);
+      auto bitwiseAndAssign = dfa.create_state(token_types::ASSIGNMENT_BITWISE_AND);
+      auto logicalAndAssign = dfa.create_state(token_types::ASSIGNMENT_LOGICAL_AND);
 
-      gBrandyLexer.add_edge(root, bitwiseAnd, '&');
-      gBrandyLexer.add_edge(bitwiseAnd, logicalAnd, '&');
-      gBrandyLexer.add_edge(bitwiseAnd, bitwiseAndAssign, '=');
-      gBrandyLexer.add_edge(logicalAnd, logicalAndAssign, '=');
+      dfa.add_edge(root, bitwiseAnd, '&');
+      dfa.add_edge(bitwiseAnd, logicalAnd, '&');
+      dfa.add_edge(bitwiseAnd, bitwiseAndAssign, '=');
+      dfa.add_edge(logicalAnd, logicalAndAssign, '=');
     }
 
     {
-      auto bitwiseOr = gBrandyLexer.create_state(token_types::BITWISE_OR);
-      auto logicalOr = gBrandyLexer.create_state(token_types::LOGICAL_OR);
+      auto bitwiseOr = dfa.create_state(token_types::BITWISE_OR);
+      auto logicalOr = dfa.create_state(token_types::LOGICAL_OR);
+
+      auto bitwiseOrAssign = dfa.create_state(token_types::ASSIGNMENT_BITWISE_OR);
+      auto logicalOrAssign = dfa.create_state(token_types::ASSIGNMENT_LOGICAL_OR);
+
+      dfa.add_edge(root, bitwiseOr, '|');
+      dfa.add_edge(bitwiseOr, logicalOr, '|');
+      dfa.add_edge(bitwiseOr, bitwiseOrAssign, '=');
+      dfa.add_edge(logicalOr, logicalOrAssign, '=');
+    }
 
-      auto bitwiseOrAssign = gBrandyLexer.create_state(token_types::ASSIGNMENT_BITWISE_OR);
-      auto logicalOrAssign = gBrandyLexer.create_state(token_types::ASSIGNMENT_LOGICAL_OR);
+    {
+      auto not = dfa.create_state(token_types::LOGICAL_NOT);
+      auto inequality = dfa.create_state(token_types::INEQUALITY);
 
-      gBrandyLexer.add_edge(root, bitwiseOr, '|');
-      gBrandyLexer.add_edge(bitwiseOr, logicalOr, '|');
-      gBrandyLexer.add_edge(bitwiseOr, bitwiseOrAssign, '=');
-      gBrandyLexer.add_edge(logicalOr, logicalOrAssign, '=');
+      dfa.add_edge(root, not, '!');
+      dfa.add_edge(not, inequality, '=');
     }
 
     {
-      auto not = gBrandyLexer.create_state(token_types::LOGICAL_NOT);
-      auto inequality = gBrandyLexer.create_state(token_types::INEQUALITY);
+      auto dot = dfa.create_state(token_types::DOT);
+      auto twoDot = dfa.create_state();
+      auto tupleExpand = dfa.create_state(token_types::TUPLE_EXPANSION);
 
-      gBrandyLexer.add_edge(root, not, '!');
-      gBrandyLexer.add_edge(not, inequality, '=');
+      dfa.add_edge(root, dot, '.');
+      dfa.add_edge(dot, twoDot, '.');
+      dfa.add_edge(twoDot, tupleExpand, '.');
+    }
+
+    {
+      auto docStart = dfa.create_state();
+      auto docStr = dfa.create_state();
+      auto docEnd = dfa.create_state(token_types::DOCUMENTION_BLOCK);
+
+      dfa.add_edge(root, docStart, '`');
+      dfa.add_edge(docStart, docEnd, '`');
+      dfa.add_default_edge(docStart, docStr);
+      dfa.add_default_edge(docStr, docStr);
+      dfa.add_edge(docStr, docEnd, '`');
     }
 
+    add_keyword(root, identifier, dfa.create_state(token_types::META), "meta");
+    add_keyword(root, identifier, dfa.create_state(token_types::IMPORT), "import");
+    add_keyword(root, identifier, dfa.create_state(token_types::FUNCTION), "func");
+    add_keyword(root, identifier, dfa.create_state(token_types::FUNCTION), "function");
+    add_keyword(root, identifier, dfa.create_state(token_types::LAMBDA), "lambda");
+    add_keyword(root, identifier, dfa.create_state(token_types::CLASS), "class");
+    add_keyword(root, identifier, dfa.create_state(token_types::IF), "if");
+    add_keyword(root, identifier, dfa.create_state(token_types::ELIF), "elif");
+    add_keyword(root, identifier, dfa.create_state(token_types::ELSE), "else");
+    add_keyword(root, identifier, dfa.create_state(token_types::UNLESS), "unless");
+    add_keyword(root, identifier, dfa.create_state(token_types::FOR), "for");
+    add_keyword(root, identifier, dfa.create_state(token_types::IN), "in");
+    add_keyword(root, identifier, dfa.create_state(token_types::FROM), "from");
+    add_keyword(root, identifier, dfa.create_state(token_types::TO), "to");
+    add_keyword(root, identifier, dfa.create_state(token_types::EVERY), "every");
+    add_keyword(root, identifier, dfa.create_state(token_types::WHILE), "while");
+    add_keyword(root, identifier, dfa.create_state(token_types::DO), "do");
+    add_keyword(root, identifier, dfa.create_state(token_types::UNTIL), "until");
+    add_keyword(root, identifier, dfa.create_state(token_types::EXPORT), "export");
+    add_keyword(root, identifier, dfa.create_state(token_types::ENUM), "enum");
+    add_keyword(root, identifier, dfa.create_state(token_types::PROPERTY), "property");
+    add_keyword(root, identifier, dfa.create_state(token_types::GET), "get");
+    add_keyword(root, identifier, dfa.create_state(token_types::SET), "set");
+    add_keyword(root, identifier, dfa.create_state(token_types::VAR), "var");
+    add_keyword(root, identifier, dfa.create_state(token_types::RETURN), "return");
+    add_keyword(root, identifier, dfa.create_state(token_types::YIELD), "yield");
+    add_keyword(root, identifier, dfa.create_state(token_types::BREAK), "break");
+    add_keyword(root, identifier, dfa.create_state(token_types::CONTINUE), "continue");
+    add_keyword(root, identifier, dfa.create_state(token_types::AS), "as");
+    add_keyword(root, identifier, dfa.create_state(token_types::TRUE), "true");
+    add_keyword(root, identifier, dfa.create_state(token_types::GOTO), "goto");
+    add_keyword(root, identifier, dfa.create_state(token_types::LABEL), "label");
+    add_keyword(root, identifier, dfa.create_state(token_types::LOGICAL_AND), "and");
+    add_keyword(root, identifier, dfa.create_state(token_types::LOGICAL_OR), "or");
+    add_keyword(root, identifier, dfa.create_state(token_types::LOGICAL_NOT), "not");
+    add_keyword(root, identifier, dfa.create_state(token_types::FALSE), "false");
+    add_keyword(root, identifier, dfa.create_state(token_types::NIL), "nil");
+    add_keyword(root, identifier, dfa.create_state(token_types::VALUE), "val");
+    add_keyword(root, identifier, dfa.create_state(token_types::VALUE), "value");
+    add_keyword(root, identifier, dfa.create_state(token_types::REFERENCE), "ref");
+    add_keyword(root, identifier, dfa.create_state(token_types::REFERENCE), "reference");
+    add_keyword(root, identifier, dfa.create_state(token_types::TYPEDEF), "typedef");
+    add_keyword(root, identifier, dfa.create_state(token_types::DECLTYPE), "decltype");
+    add_keyword(root, identifier, dfa.create_state(token_types::TYPENAME), "typename");
+    add_keyword(root, identifier, dfa.create_state(token_types::CONST), "const");
+    add_keyword(root, identifier, dfa.create_state(token_types::STATIC), "static");
+    add_keyword(root, identifier, dfa.create_state(token_types::VIRTUAL), "virtual");
+
+    dfa.add_edge(root, dfa.create_state(token_types::BITWISE_NOT), '~');
+    dfa.add_edge(root, dfa.create_state(token_types::COLON), ':');
+    dfa.add_edge(root, dfa.create_state(token_types::SEMICOLON), ';');
+    dfa.add_edge(root, dfa.create_state(token_types::COMMA), ',');
+    dfa.add_edge(root, dfa.create_state(token_types::OPEN_CURLY), '{');
+    dfa.add_edge(root, dfa.create_state(token_types::CLOSE_CURLY), '}');
+    dfa.add_edge(root, dfa.create_state(token_types::OPEN_PAREN), '(');
+    dfa.add_edge(root, dfa.create_state(token_types::CLOSE_PAREN), ')');
+    dfa.add_edge(root, dfa.create_state(token_types::OPEN_BRACKET), '[');
+    dfa.add_edge(root, dfa.create_state(token_types::CLOSE_BRACKET), ']');
+
+    dfa.freeze();
+  }
+
+  const lexer &brandy_lexer()
+  {
+    return g_tables.dfa;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  // Reads whitespace runs, long identifiers and comments with the vectorized
+  // scanners. Returns false when the DFA needs to read the token instead.
+  static bool scan_token(const char *str, lexeme *output)
+  {
+    switch (*str)
     {
-      auto dot = gBrandyLexer.create_state(token_types::DOT);
-      auto twoDot = gBrandyLexer.create_state();
-      auto tupleExpand = gBrandyLexer.create_state(token_types::TUPLE_EXPANSION);
+    case ' ':
+    case '\t':
+    case '\r':
+      *output = { scan::whitespace(str), token_types::WHITESPACE, 0 };
+      return true;
+
+    case '/':
+      if (str[1] == '/')
+      {
+        // The DFA consumes the line ending as part of the comment
+        size_t length = 2 + scan::line_comment_body(str + 2);
+        if (str[length] == '\0') return false;
 
-      gBrandyLexer.add_edge(root, dot, '.');
-      gBrandyLexer.add_edge(dot, twoDot, '.');
-      gBrandyLexer.add_edge(twoDot, tupleExpand, '.');
+        *output = { length + 1, token_types::LINE_COMMENT, 0 };
+        return true;
+      }
+      else if (str[1] == '*')
+      {
+        // A star always eats the character after it, so "**/" doesn't close
+        for (const char *c = str + 2;; c += 2)
+        {
+          c += scan::block_comment_body(c);
+          if (c[0] == '\0' || c[1] == '\0') return false;
+
+          if (c[1] == '/')
+          {
+            *output = { size_t(c + 2 - str), token_types::BLOCK_COMMENT, 0 };
+            return true;
+          }
+        }
+      }
+      return false;
+
+    default:
+      if (isalpha(std::uint8_t(*str)) || *str == '_' || *str == '$')
+      {
+        size_t length = scan::identifier(str);
+        if (length <= g_tables.longestKeyword) return false;
+
+        *output = { length, token_types::IDENTIFIER, 0 };
+        return true;
+      }
+      return false;
     }
+  }
+
+  // ---------------------------------------------------------------------------
 
+  bool read_next_token(const char *str, lexeme *output, bool *reachedEnd)
+  {
+    if (scan_token(str, output))
     {
-      auto docStart = gBrandyLexer.create_state();
-      auto docStr = gBrandyLexer.create_state();
-      auto docEnd = gBrandyLexer.create_state(token_types::DOCUMENTION_BLOCK);
-
-      gBrandyLexer.add_edge(root, docStart, '`');
-      gBrandyLexer.add_edge(docStart, docEnd, '`');
-      gBrandyLexer.add_default_edge(docStart, docStr);
-      gBrandyLexer.add_default_edge(docStr, docStr);
-      gBrandyLexer.add_edge(docStr, docEnd, '`');
+      if (reachedEnd)
+      {
+        // Only runs can stop at the terminator, comments are read to the end
+        *reachedEnd =
+          (output->type == token_types::WHITESPACE || output->type == token_types::IDENTIFIER) &&
+          str[output->length] == '\0';
+      }
+    }
+    else if (!g_tables.dfa.read_token(str, output, reachedEnd))
+    {
+      return false;
     }
 
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::META), "meta");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::IMPORT), "import");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::FUNCTION), "func");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::FUNCTION), "function");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::LAMBDA), "lambda");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::CLASS), "class");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::IF), "if");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::ELIF), "elif");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::ELSE), "else");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::UNLESS), "unless");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::FOR), "for");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::IN), "in");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::FROM), "from");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::TO), "to");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::EVERY), "every");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::WHILE), "while");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::DO), "do");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::UNTIL), "until");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::EXPORT), "export");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::ENUM), "enum");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::PROPERTY), "property");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::GET), "get");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::SET), "set");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::VAR), "var");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::RETURN), "return");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::YIELD), "yield");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::BREAK), "break");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::CONTINUE), "continue");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::AS), "as");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::TRUE), "true");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::GOTO), "goto");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::LABEL), "label");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::LOGICAL_AND), "and");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::LOGICAL_OR), "or");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::LOGICAL_NOT), "not");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::FALSE), "false");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::NIL), "nil");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::VALUE), "val");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::VALUE), "value");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::REFERENCE), "ref");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::REFERENCE), "reference");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::TYPEDEF), "typedef");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::DECLTYPE), "decltype");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::TYPENAME), "typename");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::CONST), "const");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::STATIC), "static");
-    add_keyword(root, identifier, gBrandyLexer.create_state(token_types::VIRTUAL), "virtual");
-
-    gBrandyLexer.add_edge(root, gBrandyLexer.create_state(token_types::BITWISE_NOT), '~');
-    gBrandyLexer.add_edge(root, gBrandyLexer.create_state(token_types::COLON), ':');
-    gBrandyLexer.add_edge(root, gBrandyLexer.create_state(token_types::SEMICOLON), ';');
-    gBrandyLexer.add_edge(root, gBrandyLexer.create_state(token_types::COMMA), ',');
-    gBrandyLexer.add_edge(root, gBrandyLexer.create_state(token_types::OPEN_CURLY), '{');
-    gBrandyLexer.add_edge(root, gBrandyLexer.create_state(token_types::CLOSE_CURLY), '}');
-    gBrandyLexer.add_edge(root, gBrandyLexer.create_state(token_types::OPEN_PAREN), '(');
-    gBrandyLexer.add_edge(root, gBrandyLexer.create_state(token_types::CLOSE_PAREN), ')');
-    gBrandyLexer.add_edge(root, gBrandyLexer.create_state(token_types::OPEN_BRACKET), '[');
-    gBrandyLexer.add_edge(root, gBrandyLexer.create_state(token_types::CLOSE_BRACKET), ']');
+    // Hash identifiers while their text is still in cache, so interning them
+    // doesn't have to go back over it
+    if (output->type == token_types::IDENTIFIER)
+      output->hash = hash_text(str, output->length);
+
+    return true;
   }
 
   // ---------------------------------------------------------------------------
 
   bool tokenize_string(const char *str, std::vector<token> &tokens)
   {
+    const token_sources::id source = token_sources::add(str);
+    const char *begin = str;
     size_t lineNum = 1;
 
     while (*str)
     {
-      brandy::token tok;
-      if (!brandy::gBrandyLexer.read_token(str, &tok)) return false;
+      lexeme lex;
+      if (!read_next_token(str, &lex)) return false;
 
 
-      switch (tok.type())
+      switch (lex.type)
       {
       case token_types::BLOCK_COMMENT:
-        // Block comments can have any number of newlines in them, so loop over
-        // it and check for any newlines
-        for (size_t i = 0; i < tok.length(); ++i)
-        {
-          if (tok.text()[i] == '\n')
-            ++lineNum;
-        }
+        // Block comments can have any number of newlines in them
+        lineNum += scan::count_newlines(str, lex.length);
         break;
       case token_types::LINE_COMMENT:
       case token_types::NEWLINE:
@@ -588,12 +762,12 @@ namespace brandy
         break;
       default:
         // Add the character
-        tok.line_number(lineNum);
-        tokens.push_back(tok);
+        tokens.emplace_back(source, std::uint32_t(str - begin), std::uint32_t(lex.length), lex.type, lex.hash);
+        tokens.back().line_number(lineNum);
         break;
       }
 
-      str += tok.length();
+      str += lex.length;
     }
 
     return true;
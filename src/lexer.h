@@ -9,6 +9,7 @@
 #pragma once
 
 #include "tokens.h"
+#include <cstdint>
 #include <map>
 #include <memory>
 #include <utility>
@@ -20,13 +21,25 @@ namespace brandy
 {
   // ---------------------------------------------------------------------------
 
+  // A token as read by the lexer, before it's given a place in a source
+  struct lexeme
+  {
+    size_t length;
+    token_types::type type;
+    std::uint32_t hash; // hash_text of the spelling, identifiers only
+  };
+
+  // ---------------------------------------------------------------------------
+
   class lexer
   {
   public:
     typedef size_t state_reference;
     lexer();
 
-    bool read_token(const char *stream, token *outputTok) const;
+    // reachedEnd (if given) is set when the DFA ran into the terminator, IE
+    // the token could have continued had there been more input
+    bool read_token(const char *stream, lexeme *output, bool *reachedEnd = nullptr) const;
 
     state_reference root() const;
     state_reference create_state(token_types::type accept = token_types::INVALID);
@@ -36,7 +49,11 @@ namespace brandy
     void add_default_edge(state_reference from, state_reference to);
     state_reference get_edge(state_reference state, char c) const;
 
-    void dump_dotfile(FILE *f);
+    // Compiles the states into the flat transition table read_token runs on.
+    // Must be called once all states and edges have been added.
+    void freeze();
+
+    void dump_dotfile(FILE *f) const;
 
   private:
     struct state;
@@ -56,11 +73,23 @@ namespace brandy
     };
 
     std::vector<state> m_states;
+
+    // Frozen DFA: one row per state, one column per byte equivalence class
+    typedef std::uint16_t table_state;
+    static const table_state DEAD_STATE = table_state(-1);
+
+    std::vector<table_state>       m_table;
+    std::vector<token_types::type> m_accepts;
+    std::uint8_t                   m_byteClasses[256];
+    size_t                         m_classCount;
   };
 
-  extern lexer gBrandyLexer;
+  // The lexer for Brandy source, built before main and read only after
+  const lexer &brandy_lexer();
 
-  void setup_lexer();
+  // Reads one token (including whitespace and comments) from str, using the
+  // fast scanners where possible. reachedEnd is set as in lexer::read_token.
+  bool read_next_token(const char *str, lexeme *output, bool *reachedEnd = nullptr);
 
   bool tokenize_string(const char *str, std::vector<token> &tokens);
 
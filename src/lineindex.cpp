@@ -0,0 +1,50 @@
+// -----------------------------------------------------------------------------
+// Brandy token line index
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "lineindex.h"
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  const std::uint32_t line_index::NONE;
+
+  // ---------------------------------------------------------------------------
+
+  line_index::line_index()
+  {
+  }
+
+  line_index::line_index(const std::vector<token> &tokens) :
+    m_nextComma(tokens.size())
+  {
+    std::uint32_t nextComma = NONE;
+
+    for (size_t i = tokens.size(); i-- > 0;)
+    {
+      // Commas past the end of this line don't count
+      if (i + 1 < tokens.size() && tokens[i + 1].line_number() != tokens[i].line_number())
+        nextComma = NONE;
+
+      if (tokens[i].type() == token_types::COMMA)
+        nextComma = std::uint32_t(i);
+
+      m_nextComma[i] = nextComma;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool line_index::comma_ahead(size_t index) const
+  {
+    return index < m_nextComma.size() && m_nextComma[index] != NONE;
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,45 @@
+// -----------------------------------------------------------------------------
+// Brandy token line index
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#ifndef LINE_INDEX_H
+#define LINE_INDEX_H
+
+#pragma once
+
+#include "tokens.h"
+#include <cstdint>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  // Answers questions about the rest of a token's line without walking it.
+  // Built in one pass over the tokens, back to front.
+  class line_index
+  {
+  public:
+    line_index();
+    line_index(const std::vector<token> &tokens);
+
+    // Whether a comma follows the token at index on the same line, counting
+    // the token itself
+    bool comma_ahead(size_t index) const;
+
+  private:
+    static const std::uint32_t NONE = ~std::uint32_t(0);
+
+    // Per token, index of the next comma on its line, or NONE
+    std::vector<std::uint32_t> m_nextComma;
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
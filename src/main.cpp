@@ -3,46 +3,17 @@
 // Howard Hughes
 // -----------------------------------------------------------------------------
 
-#include "flags.h"
-#include "lexer.h"
-#include "parser.h"
-#include <algorithm>
+#include "context.h"
+#include "driver.h"
 #include <iostream>
 #include <memory>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <vector>
 
-#include "functionreturnvisitor.h"
 #include "dotfilevisitor.h"
 #include "treedumpvisitor.h"
-#include "symbolfillervisitor.h"
-#include "namereferenceresolvervisitor.h"
-#include "binopnodereplacervisitor.h"
-
-std::unique_ptr<char[]> load_file(const char *filename)
-{
-  std::unique_ptr<char[]> source;
-  FILE *fp = fopen(filename, "rt");
-  if (fp)
-  {
-    if (fseek(fp, 0L, SEEK_END) == 0)
-    {
-      long bufsize = ftell(fp);
-      if (bufsize == -1) return nullptr;
-
-      source = std::make_unique<char[]>(bufsize + 1);
-
-      if (fseek(fp, 0L, SEEK_SET) != 0) return nullptr;
-
-      size_t newLen = fread(source.get(), sizeof(char), bufsize, fp);
-      source[newLen] = '\0';
-    }
-    fclose(fp);
-  }
-
-  return std::move(source);
-}
 
 template<typename visitor_type>
 void walk_with(brandy::module_node *module)
@@ -59,46 +30,79 @@ int main(int argc, const char **argv)
     return -1;
   }
 
-  opts.push_options();
+  brandy::compilation_context context(opts);
 
-  brandy::setup_lexer();
+  brandy::compilation_driver driver(context);
 
-  auto file = load_file(CURRENT_FLAGS.input_file());
-
-  if (!file)
+  for (const char *input : context.flags().input_files())
   {
-    std::cout << "Failed to open " << CURRENT_FLAGS.input_file() << std::endl;
-    return -1;
+    if (!driver.add_input(input))
+    {
+      std::cout << "Failed to open " << input << std::endl;
+      return -1;
+    }
   }
 
-  // Tokenize the file
-  std::vector<brandy::token> tokens;
-  brandy::tokenize_string(file.get(), tokens);
+  driver.compile();
 
-  brandy::parser parser(std::move(tokens));
+  // Only name the file when there's more than one
+  const bool showPaths = driver.modules().size() > 1;
 
-  try
+  for (auto &module : driver.modules())
   {
-    auto module = parser.parse_module();
+    const char *prefix = showPaths ? module->path.c_str() : "";
+    const char *separator = showPaths ? ": " : "";
+
+    if (!module->loaded)
+    {
+      std::cout << "Failed to open " << module->path << std::endl;
+      continue;
+    }
 
-    walk_with<brandy::function_return_visitor>(module.get());
-    walk_with<brandy::symbol_table_filler_visitor>(module.get());
-    walk_with<brandy::name_reference_resolver_visitor>(module.get());
-    walk_with<brandy::bin_op_replacer_visitor>(module.get());
+    // Nothing new to say about modules that weren't compiled again
+    if (module->up_to_date)
+      continue;
 
-    if (CURRENT_FLAGS.dump_ast())
-      walk_with<brandy::tree_dump_visitor>(module.get());
+    auto &parser = *module->module_parser;
 
-    if (CURRENT_FLAGS.dump_ast_graph())
-      walk_with<brandy::dotfile_visitor>(module.get());
-  }
-  catch (brandy::parsing_error &err)
-  {
-    auto position = err.position();
-    if (position == parser.tokens().end())
-      --position;
+    for (auto &err : parser.errors())
+    {
+      auto position = err.position();
+      if (position == parser.tokens().end())
+        --position;
+
+      std::cout << prefix << separator << "Error on line " << position->line_number() << ": " << err.error_str() << std::endl;
+    }
+
+    if (!parser.errors().empty())
+      continue;
+
+    // Meta code only runs on modules that parsed
+    if (module->meta)
+    {
+      for (auto &err : module->meta->errors())
+        std::cout << prefix << separator << "Error on line " << err.line << ": " << err.message << std::endl;
+    }
+
+    if (context.flags().dump_ast())
+    {
+      walk_with<brandy::tree_dump_visitor>(module->module.get());
+
+      if (module->meta)
+      {
+        for (auto &instance : module->meta->instances())
+          walk_with<brandy::tree_dump_visitor>(instance.get());
+      }
+    }
+
+    if (context.flags().dump_bytecode() && module->meta)
+    {
+      for (auto &function : module->meta->functions())
+        function->disassemble(std::cout);
+    }
 
-    std::cout << "Error on line " << position->line_number() << ": " << err.error_str() << std::endl;
+    if (context.flags().dump_ast_graph())
+      walk_with<brandy::dotfile_visitor>(module->module.get());
   }
 
   std::cin.get();
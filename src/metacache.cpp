@@ -0,0 +1,384 @@
+// -----------------------------------------------------------------------------
+// Brandy meta function result cache
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "metacache.h"
+#include "bytecode.h"
+#include <fstream>
+#include <iomanip>
+#include <stdlib.h>
+#include <string.h>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    // Bump this whenever the file layout or what goes into a key changes
+    const char CACHE_HEADER[] = "brandy meta cache 3";
+
+    // Tables nested deeper than this are taken to hold themselves
+    const size_t MAX_TABLE_DEPTH = 64;
+
+    template<typename hasher_type>
+    void add_text(hasher_type &hasher, atoms::id text)
+    {
+      hasher.add(std::uint32_t(atoms::length(text)));
+      hasher.add(atoms::text(text), atoms::length(text));
+    }
+
+    template<typename hasher_type>
+    bool hash_value(hasher_type &hasher, const meta_value &value, size_t depth)
+    {
+      hasher.add(std::uint8_t(value.tag));
+
+      switch (value.tag)
+      {
+      case meta_value::nil_value:
+        return true;
+      case meta_value::bool_value:
+        hasher.add(std::uint8_t(value.as_bool));
+        return true;
+      case meta_value::int_value:
+        hasher.add(value.as_int);
+        return true;
+      case meta_value::real_value:
+        hasher.add(value.as_real);
+        return true;
+      case meta_value::string_value:
+        add_text(hasher, value.as_string);
+        return true;
+      case meta_value::type_value:
+        add_text(hasher, value.as_type->name);
+        hasher.add(value.as_type->source_hash);
+        return true;
+      case meta_value::function_value:
+        hasher.add(value.as_function->code_hash);
+        return true;
+      case meta_value::native_value:
+        hasher.add(value.as_native->name, strlen(value.as_native->name));
+        return true;
+      case meta_value::module_value:
+        hasher.add(value.as_module->name, strlen(value.as_module->name));
+        hasher.add(value.as_module->hash);
+        return true;
+      case meta_value::table_value:
+        break;
+      }
+
+      if (depth == MAX_TABLE_DEPTH)
+        return false;
+
+      const meta_table &table = *value.as_table;
+      hasher.add(std::uint64_t(table.size()));
+
+      for (auto &entry : table.entries)
+      {
+        if (!hash_value(hasher, entry.first, depth + 1) || !hash_value(hasher, entry.second, depth + 1))
+          return false;
+      }
+
+      return true;
+    }
+
+    // Types are only saved when they aren't instances
+    bool cacheable(const meta_value &value)
+    {
+      return value.tag <= meta_value::type_value;
+    }
+
+    void write_hash(std::ostream &out, std::uint64_t hash)
+    {
+      out << std::hex << std::setw(16) << std::setfill('0') << hash << std::dec;
+    }
+
+    // Keys are bytes, so they're written as two hex digits each
+    bool parse_key(const std::string &text, std::string *key)
+    {
+      static const char digits[] = "0123456789abcdef";
+
+      if (text.empty() || text.size() % 2 != 0)
+        return false;
+
+      key->clear();
+
+      for (size_t i = 0; i < text.size(); i += 2)
+      {
+        const char *high = strchr(digits, text[i]);
+        const char *low = strchr(digits, text[i + 1]);
+        if (!high || !low || !*high || !*low)
+          return false;
+
+        key->push_back(char(((high - digits) << 4) | (low - digits)));
+      }
+
+      return true;
+    }
+
+    void write_key(std::ostream &out, const std::string &key)
+    {
+      static const char digits[] = "0123456789abcdef";
+
+      for (char c : key)
+        out << digits[(unsigned char)(c) >> 4] << digits[c & 0xF];
+    }
+
+    // Strings are kept on one line
+    std::string escape(atoms::id text)
+    {
+      std::string escaped;
+
+      for (const char *at = atoms::text(text), *end = at + atoms::length(text); at < end; ++at)
+      {
+        switch (*at)
+        {
+        case '\\': escaped += "\\\\"; break;
+        case '\n': escaped += "\\n"; break;
+        case '\r': escaped += "\\r"; break;
+        default:   escaped += *at; break;
+        }
+      }
+
+      return escaped;
+    }
+
+    std::string unescape(const std::string &text)
+    {
+      std::string unescaped;
+
+      for (size_t i = 0; i < text.size(); ++i)
+      {
+        if (text[i] != '\\' || i + 1 == text.size())
+        {
+          unescaped += text[i];
+          continue;
+        }
+
+        switch (text[++i])
+        {
+        case 'n': unescaped += '\n'; break;
+        case 'r': unescaped += '\r'; break;
+        default:  unescaped += text[i]; break;
+        }
+      }
+
+      return unescaped;
+    }
+
+    bool parse_value(const std::string &kind, const std::string &text, meta_value *value, atoms::id *typeName)
+    {
+      char *end = nullptr;
+
+      if (kind == "nil" && text.empty())
+        *value = meta_value();
+      else if (kind == "bool" && (text == "true" || text == "false"))
+        *value = meta_value::of_bool(text == "true");
+      else if (kind == "int" && !text.empty())
+        *value = meta_value::of_int(strtoll(text.c_str(), &end, 10));
+      else if (kind == "real" && !text.empty())
+      {
+        // The bits, so it reads back exactly
+        const std::uint64_t bits = strtoull(text.c_str(), &end, 16);
+
+        double real;
+        memcpy(&real, &bits, sizeof(real));
+        *value = meta_value::of_real(real);
+      }
+      else if (kind == "string")
+        *value = meta_value::of_string(unescape(text));
+      else if (kind == "type" && !text.empty())
+      {
+        value->tag = meta_value::type_value;
+        *typeName = atoms::intern(text.data(), text.size());
+      }
+      else
+        return false;
+
+      // Numbers have to be the whole of the text
+      return !end || *end == '\0';
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool hash_meta_value(fnv_hasher &hasher, const meta_value &value)
+  {
+    return hash_value(hasher, value, 0);
+  }
+
+  bool hash_meta_value(key_writer &writer, const meta_value &value)
+  {
+    return hash_value(writer, value, 0);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  meta_result_cache::meta_result_cache() :
+    m_hits(0),
+    m_misses(0)
+  {
+  }
+
+  bool meta_result_cache::find(const std::string &key, meta_heap &heap, meta_value &result)
+  {
+    entry found;
+
+    {
+      std::lock_guard<std::mutex> lock(m_lock);
+
+      auto it = m_entries.find(key);
+      if (it == m_entries.end())
+      {
+        ++m_misses;
+        return false;
+      }
+
+      ++m_hits;
+      found = it->second;
+    }
+
+    result = found.value;
+
+    if (found.value.tag == meta_value::type_value)
+      result = meta_value::of_type(heap.type(found.type_name, found.declaration));
+
+    return true;
+  }
+
+  void meta_result_cache::store(const std::string &key, const meta_value &result)
+  {
+    if (!cacheable(result))
+      return;
+
+    entry stored;
+    stored.value = result;
+    stored.type_name = atoms::NONE;
+    stored.declaration = nullptr;
+
+    if (result.tag == meta_value::type_value)
+    {
+      stored.type_name = result.as_type->name;
+      stored.declaration = result.as_type->declaration;
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_entries.emplace(key, stored);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void meta_result_cache::load(const char *filename)
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_entries.clear();
+
+    std::ifstream in(filename);
+    std::string line;
+
+    if (!std::getline(in, line) || line != CACHE_HEADER)
+      return;
+
+    // Each line is "result <key> <kind> <value>"
+    while (std::getline(in, line))
+    {
+      const size_t keyStart = line.find(' ');
+      const size_t kindStart = keyStart == std::string::npos ? keyStart : line.find(' ', keyStart + 1);
+
+      if (kindStart == std::string::npos || line.compare(0, keyStart, "result") != 0)
+        break;
+
+      const size_t valueStart = line.find(' ', kindStart + 1);
+      const std::string kind = line.substr(kindStart + 1, valueStart == std::string::npos ? valueStart : valueStart - kindStart - 1);
+      const std::string text = valueStart == std::string::npos ? std::string() : line.substr(valueStart + 1);
+
+      std::string key;
+      entry loaded;
+      loaded.type_name = atoms::NONE;
+      loaded.declaration = nullptr;
+
+      if (!parse_key(line.substr(keyStart + 1, kindStart - keyStart - 1), &key) ||
+          !parse_value(kind, text, &loaded.value, &loaded.type_name))
+        break;
+
+      m_entries.emplace(key, loaded);
+    }
+
+    // Anything unexpected means the file is damaged, so trust none of it
+    if (!in.eof())
+      m_entries.clear();
+  }
+
+  bool meta_result_cache::save(const char *filename) const
+  {
+    std::ofstream out(filename);
+    if (!out)
+      return false;
+
+    out << CACHE_HEADER << '\n';
+
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    for (auto &cached : m_entries)
+    {
+      const meta_value &value = cached.second.value;
+
+      // Instances are remade each compilation
+      if (cached.second.declaration)
+        continue;
+
+      out << "result ";
+      write_key(out, cached.first);
+
+      switch (value.tag)
+      {
+      case meta_value::nil_value:
+        out << " nil";
+        break;
+      case meta_value::bool_value:
+        out << " bool " << (value.as_bool ? "true" : "false");
+        break;
+      case meta_value::int_value:
+        out << " int " << value.as_int;
+        break;
+      case meta_value::real_value:
+      {
+        std::uint64_t bits;
+        memcpy(&bits, &value.as_real, sizeof(bits));
+        out << " real ";
+        write_hash(out, bits);
+        break;
+      }
+      case meta_value::string_value:
+        out << " string " << escape(value.as_string);
+        break;
+      default:
+        out << " type " << atoms::text(cached.second.type_name);
+        break;
+      }
+
+      out << '\n';
+    }
+
+    return bool(out);
+  }
+
+  size_t meta_result_cache::hits() const
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_hits;
+  }
+
+  size_t meta_result_cache::misses() const
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_misses;
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,86 @@
+// -----------------------------------------------------------------------------
+// Brandy meta function result cache
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#ifndef META_CACHE_H
+#define META_CACHE_H
+
+#pragma once
+
+#include "buildstate.h"
+#include "metavalue.h"
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  // Adds a value to a hash by what it is rather than where it is: strings
+  // by their text, types by their name and the tokens declaring them, tables
+  // by their entries in order, functions by their code hash. Returns false
+  // for values that have no such identity, like a table holding itself.
+  bool hash_meta_value(fnv_hasher &hasher, const meta_value &value);
+  bool hash_meta_value(key_writer &writer, const meta_value &value);
+
+  // ---------------------------------------------------------------------------
+
+  // What @[cache_result()] meta functions returned, keyed by the bytes a
+  // key_writer makes of the function's code hash and its arguments (see
+  // meta_evaluator), so two calls never share a result by a collision of
+  // their hashes. One cache is
+  // shared by every module in a compilation, so any module running the same
+  // meta code with the same arguments gets the result without running it.
+  //
+  // Only nil, booleans, numbers, strings and types are kept. Tables belong
+  // to the run that made them and can be changed, so they're never cached.
+  //
+  // It can be saved between compilations, without the types that are
+  // classes compile_class made, as those only exist in the compilation that
+  // made them.
+  class meta_result_cache
+  {
+  public:
+    meta_result_cache();
+
+    // A type found is made in the heap, so it's the same type as any other
+    // of that name the caller sees. Returns false if there's no result.
+    bool find(const std::string &key, meta_heap &heap, meta_value &result);
+
+    // Results that can't be cached are ignored. Two modules finding the
+    // same miss at once both run the function, the first result is kept.
+    void store(const std::string &key, const meta_value &result);
+
+    // A missing or damaged file just leaves the cache empty
+    void load(const char *filename);
+    bool save(const char *filename) const;
+
+    size_t hits() const;
+    size_t misses() const;
+
+  private:
+    // Types belong to a heap, so only their name and declaration are kept
+    struct entry
+    {
+      meta_value value;
+      atoms::id type_name;
+      class_node *declaration;
+    };
+
+    mutable std::mutex m_lock;
+    std::unordered_map<std::string, entry> m_entries;
+    size_t m_hits;
+    size_t m_misses;
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
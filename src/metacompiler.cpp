@@ -0,0 +1,1290 @@
+// -----------------------------------------------------------------------------
+// Brandy meta code compiler
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "metacompiler.h"
+#include "metaevaluator.h"
+#include <algorithm>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    // The result register of an assignment whose value isn't used
+    const unsigned DISCARD = ~0u;
+
+    struct operator_name
+    {
+      const char *name;
+      opcodes::type op;
+    };
+
+    const operator_name binary_operators[] =
+    {
+      { "@add", opcodes::ADD },
+      { "@subtract", opcodes::SUB },
+      { "@astrisk", opcodes::MUL },
+      { "@divide", opcodes::DIV },
+      { "@modulo", opcodes::MOD },
+      { "@ampersand", opcodes::BAND },
+      { "@bitwise_or", opcodes::BOR },
+      { "@bitwise_xor", opcodes::BXOR },
+      { "@bitwise_left_shift", opcodes::SHL },
+      { "@bitwise_right_shift", opcodes::SHR },
+      { "@equality", opcodes::EQ },
+      { "@inequality", opcodes::NE },
+      { "@greater_than", opcodes::GT },
+      { "@less_than", opcodes::LT },
+      { "@greather_than_or_equal", opcodes::GE },
+      { "@less_than_or_equal", opcodes::LE }
+    };
+
+    const operator_name compound_assignments[] =
+    {
+      { "@assign_add", opcodes::ADD },
+      { "@assign_subtract", opcodes::SUB },
+      { "@assign_multiply", opcodes::MUL },
+      { "@assign_divide", opcodes::DIV },
+      { "@assign_modulo", opcodes::MOD },
+      { "@assign_bitwise_and", opcodes::BAND },
+      { "@assign_bitwise_or", opcodes::BOR },
+      { "@assign_bitwise_xor", opcodes::BXOR },
+      { "@assign_bitwise_left_shift", opcodes::SHL },
+      { "@assign_bitwise_right_shift", opcodes::SHR }
+    };
+
+    bool is_named(const token &tok, const char *name)
+    {
+      const size_t length = strlen(name);
+      return tok.length() == length && strncmp(tok.text(), name, length) == 0;
+    }
+
+    template<size_t count>
+    const operator_name *find_operator(const operator_name (&names)[count], const token &tok)
+    {
+      for (auto &name : names)
+      {
+        if (is_named(tok, name.name))
+          return &name;
+      }
+
+      return nullptr;
+    }
+
+    std::string text_of(const token &tok)
+    {
+      return std::string(tok.text(), tok.length());
+    }
+
+    size_t line_of(const abstract_node *node)
+    {
+      return node->begin->line_number();
+    }
+
+    bool is_word(const token &tok)
+    {
+      const char c = tok.length() ? tok.text()[0] : 0;
+      return isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '@';
+    }
+
+    // The text of a string or character literal without its quotes, with
+    // escapes replaced
+    std::string unquote(const token &tok)
+    {
+      std::string text;
+      const char *at = tok.text() + 1;
+      const char *end = tok.text() + tok.length() - 1;
+
+      for (; at < end; ++at)
+      {
+        if (*at != '\\' || at + 1 == end)
+        {
+          text += *at;
+          continue;
+        }
+
+        switch (*++at)
+        {
+        case 'n': text += '\n'; break;
+        case 'r': text += '\r'; break;
+        case 't': text += '\t'; break;
+        case '0': text += '\0'; break;
+        default:  text += *at; break;
+        }
+      }
+
+      return text;
+    }
+
+    // -------------------------------------------------------------------------
+
+    // Finds the variables declared in the scopes under a node
+    class local_finder : public static_visitor<local_finder>
+    {
+    public:
+      using static_visitor<local_finder>::visit;
+
+      static const node_kind_set handled_kinds = node_kind_of<scope_node>::bit;
+
+      // Lambdas aren't supported, and have their own locals anyway
+      static const node_kind_set skipped_kinds =
+        node_kinds_of<lambda_node>::value | node_kinds_of<type_node>::value;
+
+      ast_visitor::visitor_result visit(scope_node *node)
+      {
+        for (auto &entry : node->symbols)
+        {
+          if (entry.second.symbol_type == symbol::variable && entry.second.node)
+            declarations.push_back(entry.second.node);
+        }
+
+        return ast_visitor::resume;
+      }
+
+      std::vector<const abstract_node *> declarations;
+    };
+
+    // Finds the variables a meta block declares by assigning them at its top
+    class implicit_global_finder : public static_visitor<implicit_global_finder>
+    {
+    public:
+      using static_visitor<implicit_global_finder>::visit;
+
+      static const node_kind_set handled_kinds = node_kind_of<name_reference_node>::bit;
+      static const node_kind_set skipped_kinds =
+        node_kinds_of<lambda_node>::value | node_kinds_of<type_node>::value;
+
+      ast_visitor::visitor_result visit(name_reference_node *node)
+      {
+        const symbol *declared = node->resolved_symbol();
+
+        if (declared && declared->is_implicit && declared->node == node)
+          declarations.push_back(node);
+
+        return ast_visitor::resume;
+      }
+
+      std::vector<const abstract_node *> declarations;
+    };
+  }
+
+  // ---------------------------------------------------------------------------
+
+  std::string type_text(const type_node *node)
+  {
+    auto first = node->begin;
+    auto last = node->end;
+
+    // "typename (int)" is written "int"
+    if (first < last && first->type() == token_types::TYPENAME)
+      ++first;
+
+    if (last - first > 1 && first->type() == token_types::OPEN_PAREN && (last - 1)->type() == token_types::CLOSE_PAREN)
+    {
+      ++first;
+      --last;
+    }
+
+    std::string text;
+
+    for (auto it = first; it < last; ++it)
+    {
+      if (it->type() == token_types::NEWLINE)
+        continue;
+
+      if (it != first && is_word(*it) && is_word(*(it - 1)))
+        text += ' ';
+
+      text.append(it->text(), it->length());
+    }
+
+    return text;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  meta_compiler::meta_compiler(meta_heap &heap, meta_globals &globals, const symbol_table &moduleSymbols,
+    std::vector<meta_error> &errors) :
+    m_heap(heap),
+    m_globals(globals),
+    m_moduleSymbols(moduleSymbols),
+    m_errors(errors),
+    m_out(nullptr),
+    m_failed(false),
+    m_line(0),
+    m_localCount(0),
+    m_top(0)
+  {
+  }
+
+  bool meta_compiler::compile_block(const meta_node *block, bytecode_function &out)
+  {
+    begin(out, block);
+
+    for (auto &statement : block->statements)
+      add_locals(statement.get());
+
+    m_top = m_localCount;
+
+    // Found before compiling, as functions (compiled after every block) or
+    // earlier statements can use them before the line assigning them
+    implicit_global_finder globals;
+    for (auto &statement : block->statements)
+      static_walk(const_cast<statement_node *>(statement.get()), globals);
+
+    for (const abstract_node *declaration : globals.declarations)
+    {
+      if (!m_locals.count(declaration))
+        m_globals.slot(declaration);
+    }
+
+    // So are variables declared at the top of the block, which the parser
+    // takes as statements unless they have qualifiers
+    for (auto &statement : block->statements)
+    {
+      if (statement->kind == node_kind::var_node)
+        m_globals.slot(statement.get());
+    }
+
+    for (auto &symbol : block->symbols)
+    {
+      if (symbol->kind == node_kind::function_node)
+        continue;
+
+      if (symbol->kind != node_kind::var_node)
+      {
+        error(symbol.get(), "Only functions and variables can be declared in meta blocks");
+        continue;
+      }
+
+      auto var = static_cast<const var_node *>(symbol.get());
+      const unsigned slot = unsigned(m_globals.slot(var));
+
+      if (var->expression)
+      {
+        const unsigned value = operand(var->expression.get());
+        emit(instructions::make_bx(opcodes::SETGLOBAL, value, slot), var);
+        pop_temps(m_localCount);
+      }
+    }
+
+    statements(block->statements);
+    return finish();
+  }
+
+  bool meta_compiler::compile_function(const function_node *function, bytecode_function &out)
+  {
+    begin(out, function);
+
+    out.name = function->name.atom();
+    out.parameters = function->parameters.size();
+
+    for (auto &param : function->parameters)
+    {
+      if (param->default_value)
+        error(param.get(), "Meta functions can't have default values");
+
+      m_locals[param.get()] = m_localCount++;
+    }
+
+    add_locals(function->scope.get());
+    m_top = m_localCount;
+
+    statements(function->scope->statements);
+    return finish();
+  }
+
+  bool meta_compiler::compile_expression(const expression_node *expression, bytecode_function &out)
+  {
+    begin(out, expression);
+
+    const unsigned value = push_temp();
+    this->expression(expression, value);
+    emit(instructions::make(opcodes::RETURN, value), expression);
+
+    return finish();
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void meta_compiler::begin(bytecode_function &out, const abstract_node *at)
+  {
+    m_out = &out;
+    m_failed = false;
+    m_line = line_of(at);
+
+    m_locals.clear();
+    m_loopVars.clear();
+    m_loops.clear();
+    m_constants.clear();
+    m_localCount = 0;
+    m_top = 0;
+
+    out.name = atoms::NONE;
+    out.parameters = 0;
+    out.registers = 0;
+    out.code.clear();
+    out.lines.clear();
+    out.constants.clear();
+  }
+
+  bool meta_compiler::finish()
+  {
+    emit(instructions::make(opcodes::RETURNNIL), nullptr);
+
+    if (m_out->registers < m_localCount)
+      m_out->registers = m_localCount;
+
+    if (m_out->registers > instructions::MAX_OPERAND + 1)
+    {
+      m_errors.push_back(meta_error());
+      m_errors.back().line = m_line;
+      m_errors.back().message = "Too many variables and temporaries in meta code, it can only use 256";
+      m_failed = true;
+    }
+
+    return !m_failed;
+  }
+
+  // Every variable declared in a scope under the node gets a register for
+  // the whole function, in the order they're declared
+  void meta_compiler::add_locals(const abstract_node *node)
+  {
+    local_finder finder;
+    static_walk(const_cast<abstract_node *>(node), finder);
+
+    std::sort(finder.declarations.begin(), finder.declarations.end(), [](const abstract_node *lhs, const abstract_node *rhs)
+    {
+      return lhs->begin < rhs->begin;
+    });
+
+    for (const abstract_node *declaration : finder.declarations)
+    {
+      if (!m_locals.count(declaration))
+        m_locals[declaration] = m_localCount++;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void meta_compiler::statements(const unique_vector<statement_node> &list)
+  {
+    for (auto &node : list)
+      statement(node.get());
+  }
+
+  void meta_compiler::statement(const statement_node *node)
+  {
+    const unsigned top = m_top;
+    m_line = line_of(node);
+
+    if (kind_bit(node->kind) & node_kinds_of<expression_node>::value)
+    {
+      auto expr = static_cast<const expression_node *>(node);
+
+      // Assignments don't need their value put anywhere
+      if (expr->kind == node_kind::call_node)
+      {
+        auto call = static_cast<const call_node *>(expr);
+        auto member = dynamic_cast<const member_access_node *>(call->left.get());
+
+        if (member && is_named(member->member_name, "@assign"))
+        {
+          operator_call(call, member, DISCARD);
+          return;
+        }
+      }
+
+      expression(expr, push_temp());
+      pop_temps(top);
+      return;
+    }
+
+    switch (node->kind)
+    {
+    case node_kind::var_node:
+    {
+      auto var = static_cast<const var_node *>(node);
+
+      size_t slot;
+      auto local = m_locals.find(var);
+
+      if (local != m_locals.end())
+      {
+        if (var->expression)
+          expression(var->expression.get(), local->second);
+        else
+          emit(instructions::make(opcodes::LOADNIL, local->second), var);
+      }
+      else if (m_globals.find(var, &slot))
+      {
+        // Globals start out nil anyway
+        if (var->expression)
+          emit(instructions::make_bx(opcodes::SETGLOBAL, operand(var->expression.get()), unsigned(slot)), var);
+      }
+      else
+      {
+        error(var, "Meta code can't declare a variable here");
+      }
+      break;
+    }
+
+    case node_kind::return_node:
+    {
+      auto ret = static_cast<const return_node *>(node);
+
+      if (ret->value)
+        emit(instructions::make(opcodes::RETURN, operand(ret->value.get())), ret);
+      else
+        emit(instructions::make(opcodes::RETURNNIL), ret);
+      break;
+    }
+
+    case node_kind::if_node:
+      if_statement(static_cast<const if_node *>(node));
+      break;
+
+    case node_kind::while_node:
+      while_statement(static_cast<const while_node *>(node));
+      break;
+
+    case node_kind::for_node:
+      for_statement(static_cast<const for_node *>(node));
+      break;
+
+    case node_kind::break_node:
+      loop_exit(node, static_cast<const break_node *>(node)->count, true);
+      break;
+
+    case node_kind::continue_node:
+      loop_exit(node, static_cast<const continue_node *>(node)->count, false);
+      break;
+
+    // Meta code finds imports through the names they declare
+    case node_kind::import_node:
+      break;
+
+    case node_kind::goto_node:
+    case node_kind::label_node:
+      error(node, "Meta code can't use goto or labels");
+      break;
+
+    case node_kind::meta_node:
+      error(node, "Meta blocks can't be inside meta code");
+      break;
+
+    default:
+      error(node, "Meta functions can only declare variables");
+      break;
+    }
+
+    pop_temps(top);
+  }
+
+  void meta_compiler::if_statement(const if_node *node)
+  {
+    std::vector<size_t> ends;
+
+    for (const if_node *clause = node; clause; clause = clause->else_clause.get())
+    {
+      const unsigned top = m_top;
+      size_t skip = 0;
+
+      // An else has no condition
+      if (clause->condition)
+        skip = emit_jump(opcodes::JMPIFNOT, operand(clause->condition.get()), clause);
+
+      pop_temps(top);
+      statements(clause->scope->statements);
+
+      if (!clause->condition)
+        break;
+
+      if (clause->else_clause)
+        ends.push_back(emit_jump(opcodes::JMP, 0, clause));
+
+      patch(skip, here());
+    }
+
+    for (size_t jump : ends)
+      patch(jump, here());
+  }
+
+  void meta_compiler::while_statement(const while_node *node)
+  {
+    const size_t top = here();
+    const unsigned temps = m_top;
+
+    const size_t exit = emit_jump(opcodes::JMPIFNOT, operand(node->condition.get()), node);
+    pop_temps(temps);
+
+    m_loops.push_back(loop_jumps());
+    statements(node->scope->statements);
+
+    emit(instructions::make_sbx(opcodes::JMP, 0, int(top) - int(here()) - 1), node);
+    patch(exit, here());
+
+    for (size_t jump : m_loops.back().continues)
+      patch(jump, top);
+
+    for (size_t jump : m_loops.back().breaks)
+      patch(jump, here());
+
+    m_loops.pop_back();
+  }
+
+  // "for i in range a, b" and "for i from a to b every c" count in
+  // registers with FORPREP and FORLOOP, anything else is a table to go
+  // through with ITERNEXT
+  void meta_compiler::for_statement(const for_node *node)
+  {
+    auto range = dynamic_cast<const call_node *>(node->loop_iterator.get());
+    auto rangeName = range ? dynamic_cast<const name_reference_node *>(range->left.get()) : nullptr;
+
+    const bool counting = !node->loop_iterator ||
+      (rangeName && !rangeName->resolved_table && is_named(rangeName->name, "range"));
+
+    // Counting takes the start, limit, step and a copy of the count for the
+    // body, tables the table, position and value (see ITERNEXT)
+    const unsigned loop = push_temp();
+    push_temp();
+    push_temp();
+    const unsigned var = counting ? push_temp() : loop + 2;
+
+    size_t top;
+    size_t exit;
+
+    if (counting)
+    {
+      const unsigned temps = m_top;
+      bool inclusive = false;
+
+      auto set = [&](const expression_node *value, unsigned reg, std::int64_t otherwise)
+      {
+        if (value)
+          expression(value, reg);
+        else
+          emit(instructions::make_bx(opcodes::LOADK, reg, constant(meta_value::of_int(otherwise))), node);
+
+        pop_temps(temps);
+      };
+
+      if (node->loop_iterator)
+      {
+        auto &args = range->parameters;
+
+        if (args.empty() || args.size() > 3)
+          error(node, "range takes 1 to 3 arguments");
+
+        // range n counts from 0
+        const bool fromZero = args.size() == 1;
+
+        set(fromZero || args.empty() ? nullptr : args[0].get(), loop, 0);
+        set(args.empty() ? nullptr : args[fromZero ? 0 : 1].get(), loop + 1, 0);
+        set(args.size() == 3 ? args[2].get() : nullptr, loop + 2, 1);
+      }
+      else
+      {
+        set(node->loop_start.get(), loop, 0);
+        set(node->loop_end.get(), loop + 1, 0);
+        set(node->loop_increment.get(), loop + 2, 1);
+        inclusive = true;
+      }
+
+      emit(instructions::make(opcodes::FORPREP, loop, inclusive ? 1 : 0), node);
+      exit = emit_jump(opcodes::JMP, 0, node);
+
+      top = here();
+      emit(instructions::make(opcodes::MOVE, var, loop), node);
+    }
+    else
+    {
+      expression(node->loop_iterator.get(), loop);
+      emit(instructions::make_bx(opcodes::LOADK, loop + 1, constant(meta_value::of_int(0))), node);
+
+      top = here();
+      emit(instructions::make(opcodes::ITERNEXT, loop), node);
+      exit = emit_jump(opcodes::JMP, 0, node);
+    }
+
+    m_loopVars.push_back(std::make_pair(node->loop_var_name.atom(), var));
+    m_loops.push_back(loop_jumps());
+
+    // Values the condition is false for are skipped like a continue
+    if (node->condition)
+    {
+      const unsigned temps = m_top;
+      m_loops.back().continues.push_back(emit_jump(opcodes::JMPIFNOT, operand(node->condition.get()), node));
+      pop_temps(temps);
+    }
+
+    statements(node->scope->statements);
+
+    const size_t next = here();
+
+    if (counting)
+      emit(instructions::make_sbx(opcodes::FORLOOP, loop, int(top) - int(here()) - 1), node);
+    else
+      emit(instructions::make_sbx(opcodes::JMP, 0, int(top) - int(here()) - 1), node);
+
+    patch(exit, here());
+
+    for (size_t jump : m_loops.back().continues)
+      patch(jump, next);
+
+    for (size_t jump : m_loops.back().breaks)
+      patch(jump, here());
+
+    m_loops.pop_back();
+    m_loopVars.pop_back();
+    pop_temps(loop);
+  }
+
+  // "break 2" leaves two loops
+  void meta_compiler::loop_exit(const statement_node *node, const token &count, bool isBreak)
+  {
+    size_t loops = 1;
+
+    if (count.type() != token_types::INVALID && count.length())
+      loops = size_t(strtoul(text_of(count).c_str(), nullptr, 10));
+
+    if (loops == 0 || loops > m_loops.size())
+    {
+      error(node, isBreak ? "Nothing to break out of" : "Nothing to continue");
+      return;
+    }
+
+    loop_jumps &loop = m_loops[m_loops.size() - loops];
+    const size_t jump = emit_jump(opcodes::JMP, 0, node);
+
+    if (isBreak)
+      loop.breaks.push_back(jump);
+    else
+      loop.continues.push_back(jump);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void meta_compiler::expression(const expression_node *node, unsigned result)
+  {
+    const unsigned top = m_top;
+
+    if (kind_bit(node->kind) & node_kinds_of<type_node>::value)
+    {
+      type(static_cast<const type_node *>(node), result);
+      return;
+    }
+
+    switch (node->kind)
+    {
+    case node_kind::literal_node:
+      literal(static_cast<const literal_node *>(node), result);
+      break;
+
+    case node_kind::name_reference_node:
+      name(static_cast<const name_reference_node *>(node), result);
+      break;
+
+    case node_kind::call_node:
+      call(static_cast<const call_node *>(node), result);
+      break;
+
+    case node_kind::member_access_node:
+    {
+      auto member = static_cast<const member_access_node *>(node);
+      const unsigned container = operand(member->left.get());
+      const unsigned key = push_temp();
+
+      emit(instructions::make_bx(opcodes::LOADK, key, constant(meta_value::of_string(member->member_name.atom()))), node);
+      emit(instructions::make(opcodes::GETINDEX, result, container, key), node);
+      break;
+    }
+
+    case node_kind::index_node:
+    {
+      auto index = static_cast<const index_node *>(node);
+      const unsigned container = operand(index->left.get());
+      const unsigned key = operand(index->index.get());
+
+      emit(instructions::make(opcodes::GETINDEX, result, container, key), node);
+      break;
+    }
+
+    case node_kind::unary_operator_node:
+    {
+      auto unary = static_cast<const unary_operator_node *>(node);
+      opcodes::type op;
+
+      switch (unary->operation.type())
+      {
+      case token_types::SUBTRACT:    op = opcodes::NEG; break;
+      case token_types::LOGICAL_NOT: op = opcodes::NOT; break;
+      case token_types::BITWISE_NOT: op = opcodes::BNOT; break;
+      default:
+        error(node, "Meta code has no pointers to take the address of or dereference");
+        return;
+      }
+
+      emit(instructions::make(op, result, operand(unary->expression.get())), node);
+      break;
+    }
+
+    case node_kind::table_literal_node:
+      table(static_cast<const table_literal_node *>(node), result);
+      break;
+
+    case node_kind::tuple_literal_node:
+      tuple(static_cast<const tuple_literal_node *>(node), result);
+      break;
+
+    case node_kind::lambda_node:
+      error(node, "Meta code can't use lambdas");
+      break;
+
+    case node_kind::cast_node:
+      error(node, "Meta code can't use casts");
+      break;
+
+    default:
+      error(node, "Meta code can't use this kind of expression");
+      break;
+    }
+
+    pop_temps(top);
+  }
+
+  // The register a value is in, a local's own or a new temporary
+  unsigned meta_compiler::operand(const expression_node *node)
+  {
+    // Resolved once, as resolving reports errors
+    if (node->kind == node_kind::name_reference_node)
+    {
+      const location found = resolve(static_cast<const name_reference_node *>(node));
+      if (found.where == location::local)
+        return found.index;
+
+      const unsigned reg = push_temp();
+      place(found, reg, node);
+      return reg;
+    }
+
+    const unsigned reg = push_temp();
+    expression(node, reg);
+    return reg;
+  }
+
+  void meta_compiler::literal(const literal_node *node, unsigned result)
+  {
+    const token &value = node->value;
+    meta_value constant;
+
+    switch (value.type())
+    {
+    case token_types::I8_LITERAL:
+    case token_types::I16_LITERAL:
+    case token_types::I32_LITERAL:
+    case token_types::I64_LITERAL:
+    case token_types::UI8_LITERAL:
+    case token_types::UI16_LITERAL:
+    case token_types::UI32_LITERAL:
+    case token_types::UI64_LITERAL:
+      // The suffix stops it
+      constant = meta_value::of_int(std::int64_t(strtoull(text_of(value).c_str(), nullptr, 10)));
+      break;
+
+    case token_types::F32_LITERAL:
+    case token_types::F64_LITERAL:
+      constant = meta_value::of_real(strtod(text_of(value).c_str(), nullptr));
+      break;
+
+    case token_types::STRING_LITERAL:
+      constant = meta_value::of_string(unquote(value));
+      break;
+
+    case token_types::CHAR_LITERAL:
+    {
+      const std::string text = unquote(value);
+      constant = meta_value::of_int(text.empty() ? 0 : static_cast<unsigned char>(text[0]));
+      break;
+    }
+
+    case token_types::TRUE:
+    case token_types::FALSE:
+      emit(instructions::make(opcodes::LOADBOOL, result, value.type() == token_types::TRUE), node);
+      return;
+
+    default:
+      emit(instructions::make(opcodes::LOADNIL, result), node);
+      return;
+    }
+
+    emit(instructions::make_bx(opcodes::LOADK, result, this->constant(constant)), node);
+  }
+
+  void meta_compiler::name(const name_reference_node *node, unsigned result)
+  {
+    place(resolve(node), result, node);
+  }
+
+  void meta_compiler::place(const location &found, unsigned result, const abstract_node *at)
+  {
+    switch (found.where)
+    {
+    case location::local:
+      if (found.index != result)
+        emit(instructions::make(opcodes::MOVE, result, found.index), at);
+      break;
+    case location::global:
+      emit(instructions::make_bx(opcodes::GETGLOBAL, result, found.index), at);
+      break;
+    case location::constant:
+      emit(instructions::make_bx(opcodes::LOADK, result, constant(found.value)), at);
+      break;
+    case location::invalid:
+      break;
+    }
+  }
+
+  void meta_compiler::call(const call_node *node, unsigned result)
+  {
+    auto member = dynamic_cast<const member_access_node *>(node->left.get());
+
+    // Operators, from bin_op_replacer_visitor
+    if (member && member->member_name.length() && member->member_name.text()[0] == '@')
+    {
+      operator_call(node, member, result);
+      return;
+    }
+
+    // The callee, then its arguments in the registers after it. The result
+    // ends up where the callee was.
+    const unsigned callee = is_temp(result) && result + 1 == m_top ? result : push_temp();
+    expression(node->left.get(), callee);
+
+    for (auto &param : node->parameters)
+      expression(param.get(), push_temp());
+
+    if (node->parameters.size() > instructions::MAX_OPERAND)
+      error(node, "Too many arguments for a meta call");
+
+    emit(instructions::make(opcodes::CALL, callee, unsigned(node->parameters.size())), node);
+
+    if (result != callee)
+      emit(instructions::make(opcodes::MOVE, result, callee), node);
+  }
+
+  void meta_compiler::operator_call(const call_node *node, const member_access_node *member, unsigned result)
+  {
+    const expression_node *lhs = member->left.get();
+    const token &name = member->member_name;
+
+    if (node->parameters.size() != 1)
+    {
+      error(node, "Meta code can't call " + text_of(name));
+      return;
+    }
+
+    const expression_node *rhs = node->parameters[0].get();
+
+    if (is_named(name, "@logical_and") || is_named(name, "@logical_or"))
+    {
+      logical(lhs, rhs, is_named(name, "@logical_and"), result);
+      return;
+    }
+
+    if (auto op = find_operator(binary_operators, name))
+    {
+      const unsigned left = operand(lhs);
+      const unsigned right = operand(rhs);
+      emit(instructions::make(op->op, result, left, right), node);
+      return;
+    }
+
+    const bool assign = is_named(name, "@assign");
+    const operator_name *compound = find_operator(compound_assignments, name);
+    const bool logicalAnd = is_named(name, "@assign_logical_and");
+
+    if (!assign && !compound && !logicalAnd && !is_named(name, "@assign_logical_or"))
+    {
+      error(node, "Meta code can't use " + text_of(name));
+      return;
+    }
+
+    const target to = assignable(lhs);
+    if (to.where == location::invalid)
+      return;
+
+    // A local is assigned in place, anything else goes through a temporary
+    unsigned value = to.where == location::local ? to.index : push_temp();
+
+    if (assign)
+    {
+      expression(rhs, value);
+    }
+    else if (compound)
+    {
+      load(to, value, node);
+      emit(instructions::make(compound->op, value, value, operand(rhs)), node);
+    }
+    else
+    {
+      // x &&= y only evaluates y when x is true
+      load(to, value, node);
+      const size_t skip = emit_jump(logicalAnd ? opcodes::JMPIFNOT : opcodes::JMPIF, value, node);
+      expression(rhs, value);
+      patch(skip, here());
+    }
+
+    store(to, value, node);
+
+    if (result != DISCARD && result != value)
+      emit(instructions::make(opcodes::MOVE, result, value), node);
+  }
+
+  // Only evaluates the right side when the left doesn't decide it
+  void meta_compiler::logical(const expression_node *lhs, const expression_node *rhs, bool isAnd, unsigned result)
+  {
+    // The left side's value can't go in a local the right side reads
+    const unsigned value = is_temp(result) && result + 1 == m_top ? result : push_temp();
+
+    expression(lhs, value);
+    const size_t skip = emit_jump(isAnd ? opcodes::JMPIFNOT : opcodes::JMPIF, value, lhs);
+    expression(rhs, value);
+    patch(skip, here());
+
+    if (value != result)
+      emit(instructions::make(opcodes::MOVE, result, value), rhs);
+  }
+
+  void meta_compiler::table(const table_literal_node *node, unsigned result)
+  {
+    const unsigned table = is_temp(result) && result + 1 == m_top ? result : push_temp();
+    emit(instructions::make(opcodes::NEWTABLE, table), node);
+
+    for (size_t i = 0; i < node->keys.size(); ++i)
+    {
+      const unsigned top = m_top;
+      const unsigned key = operand(node->keys[i].get());
+      const unsigned value = operand(node->values[i].get());
+
+      emit(instructions::make(opcodes::SETINDEX, table, key, value), node->values[i].get());
+      pop_temps(top);
+    }
+
+    if (table != result)
+      emit(instructions::make(opcodes::MOVE, result, table), node);
+  }
+
+  // Tuples are tables keyed from 0
+  void meta_compiler::tuple(const tuple_literal_node *node, unsigned result)
+  {
+    const unsigned table = is_temp(result) && result + 1 == m_top ? result : push_temp();
+    emit(instructions::make(opcodes::NEWTABLE, table), node);
+
+    for (size_t i = 0; i < node->items.size(); ++i)
+    {
+      const unsigned top = m_top;
+      const unsigned key = push_temp();
+
+      emit(instructions::make_bx(opcodes::LOADK, key, constant(meta_value::of_int(std::int64_t(i)))), node);
+      emit(instructions::make(opcodes::SETINDEX, table, key, operand(node->items[i].get())), node->items[i].get());
+      pop_temps(top);
+    }
+
+    if (table != result)
+      emit(instructions::make(opcodes::MOVE, result, table), node);
+  }
+
+  void meta_compiler::type(const type_node *node, unsigned result)
+  {
+    const std::string text = type_text(node);
+
+    // A class of the module's, which compiler.compile_class can instantiate
+    class_node *declaration = nullptr;
+
+    auto plain = dynamic_cast<const plain_type_node *>(node);
+    if (plain && plain->name.size() == 1 && plain->post_type.empty())
+    {
+      auto found = m_moduleSymbols.find(plain->name[0]);
+      if (found != m_moduleSymbols.end() && found->second.node && found->second.node->kind == node_kind::class_node)
+        declaration = static_cast<class_node *>(found->second.node);
+    }
+
+    const meta_type *value = m_heap.type(atoms::intern(text.data(), text.size()), declaration);
+    emit(instructions::make_bx(opcodes::LOADK, result, constant(meta_value::of_type(value))), node);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  meta_compiler::target meta_compiler::assignable(const expression_node *node)
+  {
+    target to;
+    to.where = location::invalid;
+    to.index = 0;
+    to.table = 0;
+    to.key = 0;
+
+    if (node->kind == node_kind::name_reference_node)
+    {
+      const location found = resolve(static_cast<const name_reference_node *>(node));
+
+      if (found.where == location::constant)
+        error(node, text_of(static_cast<const name_reference_node *>(node)->name) + " can't be assigned to");
+      else
+      {
+        to.where = found.where;
+        to.index = found.index;
+      }
+    }
+    else if (node->kind == node_kind::index_node)
+    {
+      auto index = static_cast<const index_node *>(node);
+
+      to.where = location::constant;
+      to.table = operand(index->left.get());
+      to.key = operand(index->index.get());
+    }
+    else if (node->kind == node_kind::member_access_node)
+    {
+      auto member = static_cast<const member_access_node *>(node);
+
+      to.where = location::constant;
+      to.table = operand(member->left.get());
+      to.key = push_temp();
+      emit(instructions::make_bx(opcodes::LOADK, to.key, constant(meta_value::of_string(member->member_name.atom()))), node);
+    }
+    else
+    {
+      error(node, "Meta code can only assign to variables and indexes");
+    }
+
+    return to;
+  }
+
+  // Targets that are constant locations are table entries
+  void meta_compiler::load(const target &to, unsigned result, const abstract_node *at)
+  {
+    switch (to.where)
+    {
+    case location::local:
+      if (to.index != result)
+        emit(instructions::make(opcodes::MOVE, result, to.index), at);
+      break;
+    case location::global:
+      emit(instructions::make_bx(opcodes::GETGLOBAL, result, to.index), at);
+      break;
+    case location::constant:
+      emit(instructions::make(opcodes::GETINDEX, result, to.table, to.key), at);
+      break;
+    case location::invalid:
+      break;
+    }
+  }
+
+  void meta_compiler::store(const target &to, unsigned value, const abstract_node *at)
+  {
+    switch (to.where)
+    {
+    case location::local:
+      if (to.index != value)
+        emit(instructions::make(opcodes::MOVE, to.index, value), at);
+      break;
+    case location::global:
+      emit(instructions::make_bx(opcodes::SETGLOBAL, value, to.index), at);
+      break;
+    case location::constant:
+      emit(instructions::make(opcodes::SETINDEX, to.table, to.key, value), at);
+      break;
+    case location::invalid:
+      break;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  meta_compiler::location meta_compiler::resolve(const name_reference_node *node)
+  {
+    location found;
+    found.where = location::invalid;
+    found.index = 0;
+
+    const atoms::id name = node->name.atom();
+
+    // Loop variables aren't declared in any table
+    for (auto it = m_loopVars.rbegin(); it != m_loopVars.rend(); ++it)
+    {
+      if (it->first == name)
+      {
+        found.where = location::local;
+        found.index = it->second;
+        return found;
+      }
+    }
+
+    const symbol *declared = node->resolved_symbol();
+
+    if (!declared)
+    {
+      if (const native_function *builtin = meta_vm::builtin(name))
+      {
+        found.where = location::constant;
+        found.value = meta_value::of_native(builtin);
+      }
+      else
+      {
+        error(node, "Nothing named " + text_of(node->name) + " is known to meta code");
+      }
+
+      return found;
+    }
+
+    const abstract_node *declaration = declared->node;
+
+    auto local = m_locals.find(declaration);
+    if (local != m_locals.end())
+    {
+      found.where = location::local;
+      found.index = local->second;
+      return found;
+    }
+
+    size_t slot;
+    if (declaration && m_globals.find(declaration, &slot))
+    {
+      found.where = location::global;
+      found.index = unsigned(slot);
+      return found;
+    }
+
+    const node_kind kind = declaration ? declaration->kind : node_kind::count;
+
+    if (kind == node_kind::class_node)
+    {
+      auto type = static_cast<const class_node *>(declaration);
+
+      found.where = location::constant;
+      found.value = meta_value::of_type(m_heap.type(type->name.atom(), const_cast<class_node *>(type)));
+    }
+    else if (kind == node_kind::import_node)
+    {
+      const meta_module *module = meta_import(static_cast<const import_node *>(declaration));
+
+      if (module)
+      {
+        found.where = location::constant;
+        found.value = meta_value::of_module(module);
+      }
+      else
+      {
+        error(node, "Meta code can't use the module " + text_of(node->name) + ", only compiler and modules whose meta code ran");
+      }
+    }
+    else if (kind == node_kind::function_node)
+    {
+      error(node, text_of(node->name) + " isn't a meta function, it can't be called at compile time");
+    }
+    else
+    {
+      error(node, text_of(node->name) + " isn't known at compile time");
+    }
+
+    return found;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  unsigned meta_compiler::push_temp()
+  {
+    const unsigned reg = m_top++;
+
+    if (m_top > m_out->registers)
+      m_out->registers = m_top;
+
+    return reg;
+  }
+
+  void meta_compiler::pop_temps(unsigned top)
+  {
+    if (top < m_top)
+      m_top = top;
+  }
+
+  bool meta_compiler::is_temp(unsigned reg) const
+  {
+    return reg != DISCARD && reg >= m_localCount;
+  }
+
+  size_t meta_compiler::emit(instruction code, const abstract_node *at)
+  {
+    if (at)
+      m_line = line_of(at);
+
+    m_out->code.push_back(code);
+    m_out->lines.push_back(std::uint32_t(m_line));
+    return m_out->code.size() - 1;
+  }
+
+  size_t meta_compiler::emit_jump(opcodes::type op, unsigned reg, const abstract_node *at)
+  {
+    return emit(instructions::make_sbx(op, reg, 0), at);
+  }
+
+  void meta_compiler::patch(size_t jump, size_t destination)
+  {
+    const int offset = int(destination) - int(jump) - 1;
+
+    if (offset < -instructions::SBX_BIAS || offset > instructions::SBX_BIAS)
+    {
+      error(nullptr, "Meta function is too long to jump across");
+      return;
+    }
+
+    const instruction code = m_out->code[jump];
+    m_out->code[jump] = instructions::make_sbx(instructions::op(code), instructions::a(code), offset);
+  }
+
+  size_t meta_compiler::here() const
+  {
+    return m_out->code.size();
+  }
+
+  unsigned meta_compiler::constant(const meta_value &value)
+  {
+    auto found = m_constants.find(value);
+    if (found != m_constants.end())
+      return found->second;
+
+    if (m_out->constants.size() > instructions::MAX_BX)
+    {
+      error(nullptr, "Too many constants in one meta function");
+      return 0;
+    }
+
+    const unsigned index = unsigned(m_out->constants.size());
+    m_out->constants.push_back(value);
+    m_constants.emplace(value, index);
+    return index;
+  }
+
+  void meta_compiler::error(const abstract_node *at, const std::string &message)
+  {
+    meta_error found;
+    found.line = at ? line_of(at) : m_line;
+    found.message = message;
+
+    m_errors.push_back(found);
+    m_failed = true;
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
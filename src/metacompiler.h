@@ -0,0 +1,153 @@
+// -----------------------------------------------------------------------------
+// Brandy meta code compiler
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#ifndef META_COMPILER_H
+#define META_COMPILER_H
+
+#pragma once
+
+#include "astnodes.h"
+#include "bytecode.h"
+#include "metavm.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  // The name a type node is written with, IE "int[]" for "typename int[]"
+  std::string type_text(const type_node *node);
+
+  // ---------------------------------------------------------------------------
+
+  // Compiles meta code that's been through the semantic passes to bytecode.
+  // The name resolution pass has already found what every name refers to,
+  // so locals and parameters become registers and meta block variables and
+  // functions become global slots while compiling, and nothing is looked up
+  // by name when it runs.
+  //
+  // Operators are @ calls by now (see bin_op_replacer_visitor), the ones on
+  // numbers, strings and booleans compile to their own instructions. Lambdas,
+  // casts, gotos and declaring classes aren't supported in meta code.
+  class meta_compiler
+  {
+  public:
+    // Types written in meta code that name a class in the module's symbols
+    // know its declaration, for compiler.compile_class
+    meta_compiler(meta_heap &heap, meta_globals &globals, const symbol_table &moduleSymbols,
+      std::vector<meta_error> &errors);
+
+    // The statements and variables of a meta block, to run once. Variables
+    // assigned there without being declared anywhere become globals too.
+    bool compile_block(const meta_node *block, bytecode_function &out);
+
+    // A function declared in a meta block, which has to have a global slot
+    bool compile_function(const function_node *function, bytecode_function &out);
+
+    // An expression outside meta code that calls a meta function, as a
+    // function of no parameters that returns its value
+    bool compile_expression(const expression_node *expression, bytecode_function &out);
+
+  private:
+    // Where a name's value is
+    struct location
+    {
+      enum kind { invalid, local, global, constant };
+
+      kind where;
+      unsigned index;
+      meta_value value;
+    };
+
+    // Jumps to fill in once the end or the top of a loop is known
+    struct loop_jumps
+    {
+      std::vector<size_t> breaks;
+      std::vector<size_t> continues;
+    };
+
+    // What an assignment or a compound assignment stores to
+    struct target
+    {
+      location::kind where;
+      unsigned index;
+
+      // For tables
+      unsigned table;
+      unsigned key;
+    };
+
+    void begin(bytecode_function &out, const abstract_node *at);
+    bool finish();
+
+    void add_locals(const abstract_node *node);
+
+    void statements(const unique_vector<statement_node> &list);
+    void statement(const statement_node *node);
+    void if_statement(const if_node *node);
+    void while_statement(const while_node *node);
+    void for_statement(const for_node *node);
+    void loop_exit(const statement_node *node, const token &count, bool isBreak);
+
+    void expression(const expression_node *node, unsigned result);
+    unsigned operand(const expression_node *node);
+    void literal(const literal_node *node, unsigned result);
+    void name(const name_reference_node *node, unsigned result);
+    void place(const location &found, unsigned result, const abstract_node *at);
+    void call(const call_node *node, unsigned result);
+    void operator_call(const call_node *node, const member_access_node *member, unsigned result);
+    void logical(const expression_node *lhs, const expression_node *rhs, bool isAnd, unsigned result);
+    void table(const table_literal_node *node, unsigned result);
+    void tuple(const tuple_literal_node *node, unsigned result);
+    void type(const type_node *node, unsigned result);
+
+    target assignable(const expression_node *node);
+    void load(const target &to, unsigned result, const abstract_node *at);
+    void store(const target &to, unsigned value, const abstract_node *at);
+
+    location resolve(const name_reference_node *node);
+
+    unsigned push_temp();
+    void pop_temps(unsigned top);
+    bool is_temp(unsigned reg) const;
+
+    size_t emit(instruction code, const abstract_node *at);
+    size_t emit_jump(opcodes::type op, unsigned reg, const abstract_node *at);
+    void patch(size_t jump, size_t destination);
+    size_t here() const;
+    unsigned constant(const meta_value &value);
+
+    void error(const abstract_node *at, const std::string &message);
+
+    meta_heap &m_heap;
+    meta_globals &m_globals;
+    const symbol_table &m_moduleSymbols;
+    std::vector<meta_error> &m_errors;
+
+    // The function being compiled
+    bytecode_function *m_out;
+    bool m_failed;
+    size_t m_line;
+
+    std::unordered_map<const abstract_node *, unsigned> m_locals;
+    std::vector<std::pair<atoms::id, unsigned>> m_loopVars;
+    std::vector<loop_jumps> m_loops;
+    std::unordered_map<meta_value, unsigned, meta_value_hash> m_constants;
+
+    // Locals take the registers up to m_localCount, temporaries go above
+    unsigned m_localCount;
+    unsigned m_top;
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,1012 @@
+// -----------------------------------------------------------------------------
+// Brandy meta code evaluation
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "metaevaluator.h"
+#include "astclone.h"
+#include "metacompiler.h"
+#include "passmanager.h"
+#include <algorithm>
+#include <cstdint>
+#include <sstream>
+#include <string.h>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    bool compiler_compile_class(meta_vm &vm, const meta_value *args, size_t count, meta_value &result)
+    {
+      if (count != 2 || args[0].tag != meta_value::type_value || args[1].tag != meta_value::table_value)
+        return vm.fail("compiler.compile_class takes a class and a table of the typedefs to bind");
+
+      if (!vm.evaluator())
+        return vm.fail("compiler.compile_class can only be called while compiling a module");
+
+      return vm.evaluator()->compile_class(vm, args[0].as_type, args[1].as_table, result);
+    }
+
+    const native_function compiler_functions[] =
+    {
+      { "compile_class", compiler_compile_class }
+    };
+
+    const meta_module compiler_module =
+    {
+      "compiler",
+      compiler_functions,
+      sizeof(compiler_functions) / sizeof(compiler_functions[0]),
+      nullptr,
+      0,
+      0
+    };
+
+    // -------------------------------------------------------------------------
+
+    // Tokens for nodes the evaluator makes. Their text is an atom's, so it
+    // lives as long as the program and takes no token source.
+    token make_token(const std::string &text, token_types::type type, size_t line)
+    {
+      token made(atoms::intern(text.data(), text.size()), type);
+      made.line_number(line);
+      return made;
+    }
+
+    std::string quote(atoms::id value)
+    {
+      std::string text = "\"";
+
+      for (const char *at = atoms::text(value); *at; ++at)
+      {
+        switch (*at)
+        {
+        case '\n': text += "\\n"; break;
+        case '\r': text += "\\r"; break;
+        case '\t': text += "\\t"; break;
+        case '"':  text += "\\\""; break;
+        case '\\': text += "\\\\"; break;
+        default:   text += *at; break;
+        }
+      }
+
+      return text + "\"";
+    }
+
+    // A value that's a type, or a table of them for a tuple
+    bool is_type(const meta_value &value)
+    {
+      if (value.tag == meta_value::type_value)
+        return true;
+
+      if (value.tag != meta_value::table_value)
+        return false;
+
+      for (auto &entry : value.as_table->entries)
+      {
+        if (!is_type(entry.second))
+          return false;
+      }
+
+      return true;
+    }
+
+    unique_ptr<type_node> type_node_for(const meta_value &value, const abstract_node *near)
+    {
+      const size_t line = near->begin->line_number();
+
+      if (value.tag == meta_value::type_value)
+      {
+        auto type = make_node_near<plain_type_node>(near);
+        type->name.push_back(make_token(atoms::text(value.as_type->name), token_types::IDENTIFIER, line));
+        return move(type);
+      }
+
+      auto tuple = make_node_near<tuple_node>(near);
+
+      for (auto &entry : value.as_table->entries)
+        tuple->inner_types.push_back(type_node_for(entry.second, near));
+
+      return move(tuple);
+    }
+
+    bool is_named(const token &name, const char *text)
+    {
+      const size_t length = strlen(text);
+      return name.length() == length && strncmp(name.text(), text, length) == 0;
+    }
+
+    typedef_node *find_typedef(const class_node *node, atoms::id name)
+    {
+      for (auto &member : node->members)
+      {
+        if (member->kind == node_kind::typedef_node && static_cast<typedef_node *>(member.get())->name.atom() == name)
+          return static_cast<typedef_node *>(member.get());
+      }
+
+      return nullptr;
+    }
+
+    // Whether any of a node's tokens is one of the names
+    bool mentions(const abstract_node *node, const std::vector<atoms::id> &names)
+    {
+      for (auto it = node->begin; it < node->end; ++it)
+      {
+        if (it->type() == token_types::IDENTIFIER && std::find(names.begin(), names.end(), it->atom()) != names.end())
+          return true;
+      }
+
+      return false;
+    }
+
+    // An attribute written as a name or a call with no arguments, IE
+    // @[cache_result()]
+    bool has_attribute(const symbol_node *node, const char *name)
+    {
+      if (!node->attributes)
+        return false;
+
+      for (auto &attribute : node->attributes->attributes)
+      {
+        const expression_node *expression = attribute.get();
+
+        if (expression->kind == node_kind::call_node)
+          expression = static_cast<const call_node *>(expression)->left.get();
+
+        if (expression->kind != node_kind::name_reference_node)
+          continue;
+
+        if (is_named(static_cast<const name_reference_node *>(expression)->name, name))
+          return true;
+      }
+
+      return false;
+    }
+
+    // A type that's a pointer, which are all the same size
+    bool is_pointer(const meta_value &value)
+    {
+      if (value.tag != meta_value::type_value)
+        return false;
+
+      const size_t length = atoms::length(value.as_type->name);
+      return length && atoms::text(value.as_type->name)[length - 1] == '*';
+    }
+
+    // -------------------------------------------------------------------------
+
+    // Finds the typedefs of a class that its code only copies values of, so
+    // any pointer bound to one makes the same layout and code. Using a
+    // member of something that might be one, other than assigning to it,
+    // depends on what it points to, as does naming the typedef as a value,
+    // naming something inside it or deriving from it. There are no types to
+    // go on, so a member of anything that isn't a name declared with a type
+    // might be a member of any of them.
+    class copied_typedef_finder : public static_visitor<copied_typedef_finder>
+    {
+    public:
+      using static_visitor<copied_typedef_finder>::visit;
+
+      static const node_kind_set handled_kinds = node_kind_of<class_node>::bit | node_kind_of<plain_type_node>::bit |
+        node_kind_of<member_access_node>::bit | node_kind_of<index_node>::bit | node_kind_of<name_reference_node>::bit;
+      static const node_kind_set skipped_kinds = node_kind_of<meta_node>::bit;
+
+      copied_typedef_finder(const class_node *node)
+      {
+        for (auto &member : node->members)
+        {
+          if (member->kind == node_kind::typedef_node)
+            copied.push_back(static_cast<const typedef_node *>(member.get())->name.atom());
+        }
+      }
+
+      ast_visitor::visitor_result visit(class_node *node)
+      {
+        for (auto &base : node->base_classes)
+        {
+          auto plain = base->kind == node_kind::plain_type_node ? static_cast<const plain_type_node *>(base.get()) : nullptr;
+          if (plain && !plain->name.empty())
+            depends_on(plain->name.front().atom());
+        }
+
+        return ast_visitor::resume;
+      }
+
+      ast_visitor::visitor_result visit(plain_type_node *node)
+      {
+        if (node->name.size() > 1)
+          depends_on(node->name.front().atom());
+
+        return ast_visitor::resume;
+      }
+
+      ast_visitor::visitor_result visit(member_access_node *node)
+      {
+        if (is_named(node->member_name, "@assign"))
+          return ast_visitor::resume;
+
+        if (node->left->kind != node_kind::name_reference_node)
+        {
+          copied.clear();
+          return ast_visitor::resume;
+        }
+
+        const symbol *resolved = static_cast<name_reference_node *>(node->left.get())->resolved_symbol();
+        const type_node *declared = nullptr;
+
+        if (resolved && resolved->node)
+        {
+          switch (resolved->node->kind)
+          {
+          case node_kind::var_node:
+          case node_kind::parameter_node:
+            declared = static_cast<const var_node *>(resolved->node)->type.get();
+            break;
+          case node_kind::property_node:
+            declared = static_cast<const property_node *>(resolved->node)->type.get();
+            break;
+          case node_kind::class_node:
+          case node_kind::function_node:
+            return ast_visitor::resume;
+          default:
+            break;
+          }
+        }
+
+        // Its type is worked out from what it's given, so could be any
+        if (!declared)
+          copied.clear();
+        else if (declared->kind == node_kind::plain_type_node)
+        {
+          auto plain = static_cast<const plain_type_node *>(declared);
+          if (plain->name.size() == 1 && plain->post_type.empty())
+            depends_on(plain->name.front().atom());
+        }
+
+        return ast_visitor::resume;
+      }
+
+      // "alloc item_type[size]" names it as a type
+      ast_visitor::visitor_result visit(index_node *node)
+      {
+        if (node->left->kind == node_kind::name_reference_node)
+          m_typeNames.push_back(node->left.get());
+
+        return ast_visitor::resume;
+      }
+
+      ast_visitor::visitor_result visit(name_reference_node *node)
+      {
+        if (std::find(m_typeNames.begin(), m_typeNames.end(), node) == m_typeNames.end())
+          depends_on(node->name.atom());
+
+        return ast_visitor::resume;
+      }
+
+      std::vector<atoms::id> copied;
+
+    private:
+      void depends_on(atoms::id name)
+      {
+        copied.erase(std::remove(copied.begin(), copied.end(), name), copied.end());
+      }
+
+      std::vector<const abstract_node *> m_typeNames;
+    };
+
+    // -------------------------------------------------------------------------
+
+    class meta_finder : public static_visitor<meta_finder>
+    {
+    public:
+      using static_visitor<meta_finder>::visit;
+
+      static const node_kind_set handled_kinds = node_kind_of<meta_node>::bit;
+
+      ast_visitor::visitor_result visit(meta_node *node)
+      {
+        blocks.push_back(node);
+        return ast_visitor::stop;
+      }
+
+      std::vector<meta_node *> blocks;
+    };
+  }
+
+  // ---------------------------------------------------------------------------
+
+  // Replaces calls to meta functions with what they return. Whatever is
+  // under a replaced call was part of the call, so isn't walked.
+  class meta_evaluator::call_replacer : public static_visitor<meta_evaluator::call_replacer>
+  {
+  public:
+    using static_visitor<call_replacer>::visit;
+
+    static const node_kind_set handled_kinds = node_kind_of<call_node>::bit;
+    static const node_kind_set skipped_kinds = node_kind_of<meta_node>::bit;
+
+    call_replacer(meta_evaluator &owner, module_node *module, meta_vm &vm) :
+      m_owner(owner),
+      m_module(module),
+      m_vm(vm)
+    {
+    }
+
+    ast_visitor::visitor_result visit(call_node *node)
+    {
+      auto callee = dynamic_cast<name_reference_node *>(node->left.get());
+
+      if (!callee || !callee->resolved_table || !m_owner.m_metaFunctions.count(callee->resolved_symbol()->node))
+        return ast_visitor::resume;
+
+      replacement_node = m_owner.run_call(node, m_module, m_vm);
+      return replacement_node ? ast_visitor::replace : ast_visitor::stop;
+    }
+
+  private:
+    meta_evaluator &m_owner;
+    module_node *m_module;
+    meta_vm &m_vm;
+  };
+
+  // ---------------------------------------------------------------------------
+
+  meta_evaluator::meta_evaluator(module_node *module, meta_result_cache *cache, instance_cache *instances) :
+    m_module(module),
+    m_profiler(nullptr),
+    m_cache(cache),
+    m_instanceCache(instances),
+    m_blockCount(0),
+    m_compiledCount(0),
+    m_depth(0)
+  {
+    if (!m_cache)
+    {
+      m_ownCache.reset(new meta_result_cache());
+      m_cache = m_ownCache.get();
+    }
+
+    if (!m_instanceCache)
+    {
+      m_ownInstanceCache.reset(new instance_cache());
+      m_instanceCache = m_ownInstanceCache.get();
+    }
+  }
+
+  meta_evaluator::~meta_evaluator()
+  {
+    for (auto &instance : m_instances)
+    {
+      for (auto &member : instance->members)
+      {
+        if (member->kind == node_kind::class_node)
+          return_borrowed(static_cast<class_node *>(member.get()));
+      }
+    }
+  }
+
+  bool meta_evaluator::evaluate(pass_profiler *profiler, const std::string &path)
+  {
+    m_profiler = profiler;
+    m_path = path;
+
+    meta_finder finder;
+    static_walk(m_module, finder);
+
+    // Without meta blocks there are no meta functions to call either
+    if (finder.blocks.empty())
+      return true;
+
+    meta_vm vm(m_heap, m_globals, this);
+
+    if (!import_libraries(finder.blocks, vm) || !compile(finder.blocks))
+      return false;
+
+    for (size_t i = 0; i < finder.blocks.size(); ++i)
+    {
+      meta_value result;
+
+      if (!vm.call(meta_value::of_function(m_functions[i].get()), nullptr, 0, result))
+      {
+        error(vm.error().line, vm.error().message);
+        return false;
+      }
+    }
+
+    replace_calls(m_module, vm);
+    return m_errors.empty();
+  }
+
+  const std::vector<meta_error> &meta_evaluator::errors() const
+  {
+    return m_errors;
+  }
+
+  const unique_vector<module_node> &meta_evaluator::instances() const
+  {
+    return m_instances;
+  }
+
+  const std::vector<std::unique_ptr<bytecode_function>> &meta_evaluator::functions() const
+  {
+    return m_functions;
+  }
+
+  size_t meta_evaluator::block_count() const
+  {
+    return m_blockCount;
+  }
+
+  size_t meta_evaluator::compiled_count() const
+  {
+    return m_compiledCount;
+  }
+
+  const meta_globals &meta_evaluator::globals() const
+  {
+    return m_globals;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool meta_evaluator::compile_class(meta_vm &vm, const meta_type *type, const meta_table *bindings, meta_value &result)
+  {
+    const class_node *original = type->declaration;
+
+    if (!original)
+      return vm.fail(std::string(atoms::text(type->name)) + " isn't a class compiler.compile_class can instantiate");
+
+    if (m_depth >= MAX_INSTANCE_DEPTH)
+      return vm.fail("Classes instantiating classes went more than " + std::to_string(MAX_INSTANCE_DEPTH) + " deep");
+
+    // The instance is named for its bindings in order, so the same bindings
+    // give the same class however the table was written
+    binding_list sorted;
+
+    for (auto &entry : bindings->entries)
+    {
+      if (entry.first.tag != meta_value::string_value)
+        return vm.fail("compiler.compile_class needs the names of typedefs to bind, not a " + std::string(entry.first.kind_name()));
+
+      if (!is_type(entry.second))
+        return vm.fail("The typedef " + meta_text(entry.first) + " can only be bound to a type or a table of them");
+
+      sorted.push_back(std::make_pair(std::string(atoms::text(entry.first.as_string)), &entry.second));
+    }
+
+    std::sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, const meta_value *> &lhs,
+      const std::pair<std::string, const meta_value *> &rhs)
+    {
+      return lhs.first < rhs.first;
+    });
+
+    std::string name = std::string(atoms::text(type->name)) + "(";
+
+    for (size_t i = 0; i < sorted.size(); ++i)
+      name += (i ? ", " : "") + sorted[i].first + ": " + meta_text(*sorted[i].second);
+
+    name += ")";
+
+    const meta_type *instance = m_heap.type(atoms::intern(name.data(), name.size()));
+
+    if (instance->declaration)
+    {
+      result = meta_value::of_type(instance);
+      return true;
+    }
+
+    // Made by another module, or the same as one that was
+    std::string key, shape;
+    instance_keys(type, sorted, key, shape);
+
+    if (class_node *shared = m_instanceCache->find(key, shape))
+    {
+      result = meta_value::of_type(m_heap.type(instance->name, shared));
+      return true;
+    }
+
+    std::vector<atoms::id> bound;
+
+    for (auto &binding : sorted)
+    {
+      bound.push_back(atoms::intern(binding.first.data(), binding.first.size()));
+
+      if (!find_typedef(original, bound.back()))
+        return vm.fail(std::string(atoms::text(type->name)) + " has no typedef named " + binding.first);
+    }
+
+    // Its own module, which sees everything the original's does
+    unique_ptr<module_node> module = make_node<module_node>(*new node_arena());
+    module->begin = original->begin;
+    module->end = original->end;
+    module->symbols = m_module->symbols;
+    module->borrows_nodes = true;
+
+    auto copy = clone_class_sharing(original, shared_members(original, bound), *node_arena::owner(module.get()));
+    copy->name = make_token(name, token_types::IDENTIFIER, original->name.line_number());
+
+    // Typedefs that are bound are always copied
+    for (size_t i = 0; i < sorted.size(); ++i)
+    {
+      typedef_node *found = find_typedef(copy.get(), bound[i]);
+      found->type = type_node_for(*sorted[i].second, found);
+    }
+
+    class_node *declaration = copy.get();
+    module->members.push_back(move(copy));
+
+    // Known before its members are, so it can refer to itself
+    instance = m_heap.type(instance->name, declaration);
+
+    const size_t errors = m_errors.size();
+
+    ++m_depth;
+
+    pass_manager passes;
+    add_semantic_passes(passes);
+    passes.run(module.get(), m_profiler, m_path);
+
+    replace_calls(module.get(), vm);
+
+    --m_depth;
+
+    m_instances.push_back(move(module));
+
+    if (m_errors.size() != errors)
+      return vm.fail("Couldn't instantiate " + name);
+
+    m_instanceCache->store(key, shape, declaration);
+    result = meta_value::of_type(instance);
+    return true;
+  }
+
+  // Members that don't mention a bound typedef, the class, a meta function
+  // or a member that's copied come out of the passes the same in every
+  // instance, so instances borrow them from the class. It goes by the names
+  // in their tokens, so anything else by one of those names only means more
+  // is copied than had to be.
+  std::vector<bool> meta_evaluator::shared_members(const class_node *node, std::vector<atoms::id> names)
+  {
+    names.push_back(node->name.atom());
+
+    for (const abstract_node *function : m_metaFunctions)
+      names.push_back(static_cast<const function_node *>(function)->name.atom());
+
+    std::vector<bool> share(node->members.size(), true);
+    bool changed = true;
+
+    while (changed)
+    {
+      changed = false;
+
+      for (size_t i = 0; i < share.size(); ++i)
+      {
+        const symbol_node *member = node->members[i].get();
+
+        if (!share[i] || !mentions(member, names))
+          continue;
+
+        share[i] = false;
+        changed = true;
+
+        if (member->kind == node_kind::typedef_node)
+          names.push_back(static_cast<const typedef_node *>(member)->name.atom());
+        else
+          names.push_back(member->name.atom());
+      }
+    }
+
+    return share;
+  }
+
+  // The key is the class's name and tokens then each binding in order. The
+  // shape is the same, except that pointers bound to typedefs the class only
+  // copies are left out, as the class comes out the same for any of them.
+  void meta_evaluator::instance_keys(const meta_type *type, const binding_list &bindings, std::string &key,
+    std::string &shape)
+  {
+    key_writer keyWriter;
+    keyWriter.add(std::uint32_t(atoms::length(type->name)));
+    keyWriter.add(atoms::text(type->name), atoms::length(type->name));
+    keyWriter.add(type->source_hash);
+
+    key_writer shapeWriter = keyWriter;
+
+    // Only worth a walk of the class when something could be left out
+    std::vector<atoms::id> copied;
+
+    for (auto &binding : bindings)
+    {
+      if (is_pointer(*binding.second))
+      {
+        copied_typedef_finder finder(type->declaration);
+        static_walk(type->declaration, finder);
+        copied = move(finder.copied);
+        break;
+      }
+    }
+
+    for (auto &binding : bindings)
+    {
+      const atoms::id name = atoms::intern(binding.first.data(), binding.first.size());
+
+      for (key_writer *writer : { &keyWriter, &shapeWriter })
+      {
+        writer->add(std::uint32_t(binding.first.size()));
+        writer->add(binding.first.data(), binding.first.size());
+      }
+
+      // Types and tables of them always hash
+      hash_meta_value(keyWriter, *binding.second);
+
+      if (is_pointer(*binding.second) && std::find(copied.begin(), copied.end(), name) != copied.end())
+        shapeWriter.add(std::uint8_t('*'));
+      else
+        hash_meta_value(shapeWriter, *binding.second);
+    }
+
+    key = keyWriter.bytes();
+    shape = shapeWriter.bytes();
+  }
+
+  // ---------------------------------------------------------------------------
+
+  // Each import of another module's meta code gets a global slot holding
+  // the module, which is where the compiler finds it
+  bool meta_evaluator::import_libraries(const std::vector<meta_node *> &blocks, meta_vm &vm)
+  {
+    for (meta_node *block : blocks)
+    {
+      for (auto &statement : block->statements)
+      {
+        if (statement->kind != node_kind::import_node)
+          continue;
+
+        auto import = static_cast<const import_node *>(statement.get());
+        if (!import->resolved_meta || meta_import(import))
+          continue;
+
+        std::string name;
+        for (const token &part : import->name_path)
+        {
+          if (!name.empty()) name += '.';
+          name.append(part.text(), part.length());
+        }
+
+        const meta_module *module = load_library(import->resolved_meta, name, vm, import->begin->line_number());
+        if (!module)
+          return false;
+
+        m_globals.values[m_globals.slot(import)] = meta_value::of_module(module);
+      }
+    }
+
+    return true;
+  }
+
+  // What the library imports is loaded first, and its blocks run before
+  // anything can call its functions. Each image is only loaded once.
+  const meta_module *meta_evaluator::load_library(const bytecode_image *image, const std::string &name, meta_vm &vm,
+    size_t line)
+  {
+    auto found = m_loaded.find(image);
+    if (found != m_loaded.end())
+      return found->second;
+
+    std::vector<const meta_module *> imports;
+
+    for (size_t i = 0; i < image->import_count(); ++i)
+    {
+      if (!image->linked(i))
+      {
+        error(line, "The meta code of " + name + " imports " + image->import_name(i) + ", which isn't being compiled");
+        return nullptr;
+      }
+
+      const meta_module *imported = load_library(image->linked(i), image->import_name(i), vm, line);
+      if (!imported)
+        return nullptr;
+
+      imports.push_back(imported);
+    }
+
+    std::unique_ptr<meta_library> library(new meta_library(*image, name, m_heap, imports));
+    if (!library->valid())
+    {
+      error(line, "The meta code of " + name + " uses something this compiler doesn't have");
+      return nullptr;
+    }
+
+    for (const bytecode_function *block : library->blocks())
+    {
+      meta_value result;
+
+      if (!vm.call(meta_value::of_function(block), nullptr, 0, result))
+      {
+        error(line, "Running the meta code of " + name + ": " + vm.error().message);
+        return nullptr;
+      }
+    }
+
+    const meta_module *module = library->module();
+    m_loaded.emplace(image, module);
+    m_libraries.push_back(move(library));
+    return module;
+  }
+
+  // Every function has its slot before anything's compiled, as blocks can
+  // call functions declared after them
+  bool meta_evaluator::compile(const std::vector<meta_node *> &blocks)
+  {
+    meta_compiler compiler(m_heap, m_globals, m_module->symbols, m_errors);
+    std::vector<const function_node *> functions;
+
+    for (meta_node *block : blocks)
+    {
+      for (auto &symbol : block->symbols)
+      {
+        if (symbol->kind != node_kind::function_node)
+          continue;
+
+        functions.push_back(static_cast<const function_node *>(symbol.get()));
+        m_metaFunctions.insert(symbol.get());
+        m_globals.slot(symbol.get());
+      }
+    }
+
+    for (meta_node *block : blocks)
+    {
+      m_functions.emplace_back(new bytecode_function());
+      compiler.compile_block(block, *m_functions.back());
+    }
+
+    m_blockCount = m_functions.size();
+
+    for (const function_node *function : functions)
+    {
+      m_functions.emplace_back(new bytecode_function());
+      compiler.compile_function(function, *m_functions.back());
+      m_functions.back()->cache_results = has_attribute(function, "cache_result");
+
+      size_t slot;
+      m_globals.find(function, &slot);
+      m_globals.values[slot] = meta_value::of_function(m_functions.back().get());
+    }
+
+    m_compiledCount = m_functions.size();
+
+    if (!m_errors.empty())
+      return false;
+
+    // Once every function is in its slot, so calls can be followed
+    for (auto &function : m_functions)
+      hash_code(function.get());
+
+    return true;
+  }
+
+  // The function's code and everything it can call, found through the
+  // globals it reads. Slots are numbered in the order they're declared, so
+  // functions are hashed by their code rather than where they are.
+  void meta_evaluator::hash_code(bytecode_function *function)
+  {
+    fnv_hasher hasher;
+    std::vector<const bytecode_function *> reached(1, function);
+    std::vector<size_t> &reads = m_globalReads[function];
+
+    for (size_t i = 0; i < reached.size(); ++i)
+    {
+      const bytecode_function &current = *reached[i];
+
+      hasher.add(std::uint32_t(atoms::length(current.name)));
+      hasher.add(atoms::text(current.name), atoms::length(current.name));
+      hasher.add(std::uint64_t(current.parameters));
+
+      for (const meta_value &constant : current.constants)
+        hash_meta_value(hasher, constant);
+
+      for (instruction code : current.code)
+      {
+        const opcodes::type op = instructions::op(code);
+
+        if (op != opcodes::GETGLOBAL && op != opcodes::SETGLOBAL)
+        {
+          hasher.add(code);
+          continue;
+        }
+
+        const size_t slot = instructions::bx(code);
+        const meta_value &global = m_globals.values[slot];
+
+        hasher.add(std::uint8_t(op));
+        hasher.add(std::uint8_t(instructions::a(code)));
+
+        if (global.tag != meta_value::function_value)
+        {
+          // Its value is part of the key when the function is called
+          hasher.add(std::uint32_t(reads.size()));
+          reads.push_back(slot);
+          continue;
+        }
+
+        // Which function, by the order they were reached in
+        auto found = std::find(reached.begin(), reached.end(), global.as_function);
+        hasher.add(std::uint32_t(found - reached.begin()));
+
+        if (found == reached.end())
+          reached.push_back(global.as_function);
+      }
+    }
+
+    function->code_hash = hasher.value();
+  }
+
+  bool meta_evaluator::cached_call(meta_vm &vm, const bytecode_function *function, const meta_value *args, size_t count,
+    meta_value &result)
+  {
+    key_writer keyWriter;
+    keyWriter.add(function->code_hash);
+    keyWriter.add(std::uint64_t(count));
+
+    // Arguments like a table holding itself can't be looked up
+    bool cacheable = true;
+
+    for (size_t i = 0; cacheable && i < count; ++i)
+      cacheable = hash_meta_value(keyWriter, args[i]);
+
+    auto reads = m_globalReads.find(function);
+    if (reads != m_globalReads.end())
+    {
+      for (size_t slot : reads->second)
+        cacheable = cacheable && hash_meta_value(keyWriter, m_globals.values[slot]);
+    }
+    else if (function->globals)
+    {
+      // Which globals another module's function reads isn't kept in its
+      // image, so all of them are part of the key
+      for (const meta_value &global : function->globals->values)
+        cacheable = cacheable && hash_meta_value(keyWriter, global);
+    }
+
+    const std::string &key = keyWriter.bytes();
+
+    if (cacheable && m_cache->find(key, m_heap, result))
+      return true;
+
+    if (!vm.call(meta_value::of_function(function), args, count, result))
+      return false;
+
+    if (cacheable)
+      m_cache->store(key, result);
+
+    return true;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void meta_evaluator::replace_calls(module_node *module, meta_vm &vm)
+  {
+    call_replacer replacer(*this, module, vm);
+    static_walk(module, replacer);
+  }
+
+  // The call is compiled as a function of its own, as its arguments can be
+  // anything meta code can work out
+  unique_ptr<expression_node> meta_evaluator::run_call(call_node *node, const module_node *module, meta_vm &vm)
+  {
+    meta_compiler compiler(m_heap, m_globals, module->symbols, m_errors);
+    std::unique_ptr<bytecode_function> code(new bytecode_function());
+
+    if (!compiler.compile_expression(node, *code))
+      return nullptr;
+
+    meta_value result;
+    const bool succeeded = vm.call(meta_value::of_function(code.get()), nullptr, 0, result);
+
+    m_functions.push_back(move(code));
+
+    if (!succeeded)
+    {
+      const meta_error &failed = vm.error();
+      error(failed.line ? failed.line : node->begin->line_number(), failed.message);
+      return nullptr;
+    }
+
+    return value_node(result, node);
+  }
+
+  unique_ptr<expression_node> meta_evaluator::value_node(const meta_value &value, const abstract_node *near)
+  {
+    const size_t line = near->begin->line_number();
+
+    if (value.tag == meta_value::type_value)
+      return type_node_for(value, near);
+
+    auto literal = make_node_near<literal_node>(near);
+
+    switch (value.tag)
+    {
+    case meta_value::nil_value:
+      literal->value = make_token("nil", token_types::NIL, line);
+      break;
+
+    case meta_value::bool_value:
+      literal->value = value.as_bool ? make_token("true", token_types::TRUE, line) : make_token("false", token_types::FALSE, line);
+      break;
+
+    case meta_value::int_value:
+    {
+      // Anything an int can't hold is a long
+      const bool isInt = value.as_int >= INT32_MIN && value.as_int <= INT32_MAX;
+      literal->value = make_token(std::to_string(value.as_int) + (isInt ? "" : "l"),
+        isInt ? token_types::I32_LITERAL : token_types::I64_LITERAL, line);
+      break;
+    }
+
+    case meta_value::real_value:
+    {
+      std::ostringstream text;
+      text.precision(17);
+      text << value.as_real;
+
+      // Has to read as a real, not an int
+      std::string written = text.str();
+      if (written.find_first_of(".eEni") == std::string::npos)
+        written += ".0";
+
+      literal->value = make_token(written, token_types::F64_LITERAL, line);
+      break;
+    }
+
+    case meta_value::string_value:
+      literal->value = make_token(quote(value.as_string), token_types::STRING_LITERAL, line);
+      break;
+
+    default:
+      error(line, std::string("A meta function returned a ") + value.kind_name() + ", which can't be used outside meta code");
+      return nullptr;
+    }
+
+    return move(literal);
+  }
+
+  void meta_evaluator::error(size_t line, const std::string &message)
+  {
+    // A failed call in an instance fails the call making the instance with
+    // the same error
+    if (!m_errors.empty() && m_errors.back().line == line && m_errors.back().message == message)
+      return;
+
+    meta_error found;
+    found.line = line;
+    found.message = message;
+    m_errors.push_back(found);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  const meta_module *meta_import(const import_node *node)
+  {
+    if (node->name_path.size() != 1)
+      return nullptr;
+
+    const token &name = node->name_path[0];
+    return meta_import(std::string(name.text(), name.length()).c_str());
+  }
+
+  const meta_module *meta_import(const char *name)
+  {
+    if (strcmp(name, compiler_module.name) == 0)
+      return &compiler_module;
+
+    return nullptr;
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,156 @@
+// -----------------------------------------------------------------------------
+// Brandy meta code evaluation
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#ifndef META_EVALUATOR_H
+#define META_EVALUATOR_H
+
+#pragma once
+
+#include "astnodes.h"
+#include "bytecode.h"
+#include "bytecodeimage.h"
+#include "instancecache.h"
+#include "metacache.h"
+#include "metavalue.h"
+#include "metavm.h"
+#include "passprofiler.h"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  // Runs a module's meta code once it's been through the semantic passes.
+  // Every meta block and meta function is compiled to bytecode, then the
+  // blocks run in the order they're written. After that, calls to meta
+  // functions outside meta code are run and replaced by what they returned:
+  // a type becomes a type node, a number, string or boolean a literal.
+  //
+  // compiler.compile_class makes a copy of a class with its typedefs bound
+  // to other types, in a module of its own that goes through the semantic
+  // passes like any other. Those are the instances, kept here as long as the
+  // module is. The instance_cache shares them with every other module, so
+  // the same class bound the same way is only made once, and classes that
+  // only copy the pointers they're bound to are made once for any pointer.
+  //
+  // Functions marked @[cache_result()] only run once for each set of
+  // arguments, later calls get the result from the meta_result_cache. It's
+  // up to the function to only depend on its arguments and the globals it
+  // reads, which are part of what the result is cached under.
+  //
+  // Meta code can import another module that has meta code, and call its
+  // meta functions through it. They're run from that module's image (see
+  // bytecode_image), its blocks first. Outside meta code only meta
+  // functions declared in the module itself can be called.
+  class meta_evaluator
+  {
+  public:
+    // Instances made by compile_class that make more instances can only go
+    // this deep, past it they're taken to be recursing forever
+    static const size_t MAX_INSTANCE_DEPTH = 32;
+
+    // Without caches to share, results and instances are only cached for
+    // this module
+    meta_evaluator(module_node *module, meta_result_cache *cache = nullptr, instance_cache *instances = nullptr);
+    ~meta_evaluator();
+
+    // Returns false if there were errors
+    bool evaluate(pass_profiler *profiler = nullptr, const std::string &path = std::string());
+
+    const std::vector<meta_error> &errors() const;
+
+    // The modules compile_class made, one class in each. Instances found in
+    // the instance_cache belong to the module that made them.
+    const unique_vector<module_node> &instances() const;
+
+    // Every meta block then every meta function, for --dump-bytecode, then
+    // the calls outside meta code that were run
+    const std::vector<std::unique_ptr<bytecode_function>> &functions() const;
+
+    // How many of the functions are blocks, and blocks and meta functions,
+    // for the module's bytecode_image
+    size_t block_count() const;
+    size_t compiled_count() const;
+
+    const meta_globals &globals() const;
+
+    // For compiler.compile_class, the bindings are a table of typedef names
+    // to types, or to tables of types for tuples
+    bool compile_class(meta_vm &vm, const meta_type *type, const meta_table *bindings, meta_value &result);
+
+    // For the vm, calls a @[cache_result()] function unless the cache has
+    // its result for the arguments
+    bool cached_call(meta_vm &vm, const bytecode_function *function, const meta_value *args, size_t count,
+      meta_value &result);
+
+  private:
+    class call_replacer;
+
+    // Typedef names and what they're bound to, in name order
+    typedef std::vector<std::pair<std::string, const meta_value *>> binding_list;
+
+    bool import_libraries(const std::vector<meta_node *> &blocks, meta_vm &vm);
+    const meta_module *load_library(const bytecode_image *image, const std::string &name, meta_vm &vm, size_t line);
+    bool compile(const std::vector<meta_node *> &blocks);
+    void hash_code(bytecode_function *function);
+    std::vector<bool> shared_members(const class_node *node, std::vector<atoms::id> names);
+    void instance_keys(const meta_type *type, const binding_list &bindings, std::string &key, std::string &shape);
+
+    // Replaces calls to meta functions under a node, outside meta code
+    void replace_calls(module_node *module, meta_vm &vm);
+    unique_ptr<expression_node> run_call(call_node *node, const module_node *module, meta_vm &vm);
+    unique_ptr<expression_node> value_node(const meta_value &value, const abstract_node *near);
+
+    void error(size_t line, const std::string &message);
+
+    module_node *m_module;
+    pass_profiler *m_profiler;
+    std::string m_path;
+
+    meta_heap m_heap;
+    meta_globals m_globals;
+    std::vector<meta_error> m_errors;
+
+    meta_result_cache *m_cache;
+    std::unique_ptr<meta_result_cache> m_ownCache;
+    instance_cache *m_instanceCache;
+    std::unique_ptr<instance_cache> m_ownInstanceCache;
+
+    std::unordered_set<const abstract_node *> m_metaFunctions;
+    std::vector<std::unique_ptr<bytecode_function>> m_functions;
+    size_t m_blockCount;
+    size_t m_compiledCount;
+
+    // Other modules' meta code imported by this one, and what it imports
+    std::vector<std::unique_ptr<meta_library>> m_libraries;
+    std::unordered_map<const bytecode_image *, const meta_module *> m_loaded;
+
+    // The slots of the variables each function and the functions it calls
+    // read
+    std::unordered_map<const bytecode_function *, std::vector<size_t>> m_globalReads;
+
+    unique_vector<module_node> m_instances;
+    size_t m_depth;
+  };
+
+  // ---------------------------------------------------------------------------
+
+  // The module of natives an import in meta code names, or null when there's
+  // no such module. There's only "compiler" for now.
+  const meta_module *meta_import(const import_node *node);
+  const meta_module *meta_import(const char *name);
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
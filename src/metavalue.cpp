@@ -0,0 +1,297 @@
+// -----------------------------------------------------------------------------
+// Brandy compile time values
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "metavalue.h"
+#include "astnodes.h"
+#include "buildstate.h"
+#include "bytecode.h"
+#include <functional>
+#include <stdio.h>
+#include <string.h>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  meta_value::meta_value() :
+    tag(nil_value),
+    as_int(0)
+  {
+  }
+
+  meta_value meta_value::of_bool(bool value)
+  {
+    meta_value result;
+    result.tag = bool_value;
+    result.as_bool = value;
+    return result;
+  }
+
+  meta_value meta_value::of_int(std::int64_t value)
+  {
+    meta_value result;
+    result.tag = int_value;
+    result.as_int = value;
+    return result;
+  }
+
+  meta_value meta_value::of_real(double value)
+  {
+    meta_value result;
+    result.tag = real_value;
+    result.as_real = value;
+    return result;
+  }
+
+  meta_value meta_value::of_string(atoms::id value)
+  {
+    meta_value result;
+    result.tag = string_value;
+    result.as_string = value;
+    return result;
+  }
+
+  meta_value meta_value::of_string(const std::string &value)
+  {
+    return of_string(atoms::intern(value.data(), value.size()));
+  }
+
+  meta_value meta_value::of_type(const meta_type *value)
+  {
+    meta_value result;
+    result.tag = type_value;
+    result.as_type = value;
+    return result;
+  }
+
+  meta_value meta_value::of_table(meta_table *value)
+  {
+    meta_value result;
+    result.tag = table_value;
+    result.as_table = value;
+    return result;
+  }
+
+  meta_value meta_value::of_function(const bytecode_function *value)
+  {
+    meta_value result;
+    result.tag = function_value;
+    result.as_function = value;
+    return result;
+  }
+
+  meta_value meta_value::of_native(const native_function *value)
+  {
+    meta_value result;
+    result.tag = native_value;
+    result.as_native = value;
+    return result;
+  }
+
+  meta_value meta_value::of_module(const meta_module *value)
+  {
+    meta_value result;
+    result.tag = module_value;
+    result.as_module = value;
+    return result;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool meta_value::truthy() const
+  {
+    return tag != nil_value && !(tag == bool_value && !as_bool);
+  }
+
+  bool meta_value::operator==(const meta_value &rhs) const
+  {
+    if (tag != rhs.tag)
+      return false;
+
+    switch (tag)
+    {
+    case nil_value:    return true;
+    case bool_value:   return as_bool == rhs.as_bool;
+    case real_value:   return as_real == rhs.as_real;
+    case string_value: return as_string == rhs.as_string;
+    default:
+      // Everything else is an integer or a pointer the same size as one
+      return as_int == rhs.as_int;
+    }
+  }
+
+  bool meta_value::operator!=(const meta_value &rhs) const
+  {
+    return !(*this == rhs);
+  }
+
+  size_t meta_value::hash_code() const
+  {
+    switch (tag)
+    {
+    case nil_value:    return 0;
+    case bool_value:   return as_bool ? 1 : 2;
+    case real_value:   return std::hash<double>()(as_real);
+    case string_value: return atoms::hash(as_string);
+    default:           return std::hash<std::int64_t>()(as_int) ^ tag;
+    }
+  }
+
+  const char *meta_value::kind_name() const
+  {
+    static const char *const names[] =
+    {
+      "nil", "bool", "int", "real", "string", "type", "table", "function", "function", "module"
+    };
+
+    return names[tag];
+  }
+
+  // ---------------------------------------------------------------------------
+
+  std::string meta_text(const meta_value &value)
+  {
+    char buffer[32];
+
+    switch (value.tag)
+    {
+    case meta_value::nil_value:
+      return "nil";
+    case meta_value::bool_value:
+      return value.as_bool ? "true" : "false";
+    case meta_value::int_value:
+      sprintf(buffer, "%lld", static_cast<long long>(value.as_int));
+      return buffer;
+    case meta_value::real_value:
+      sprintf(buffer, "%.17g", value.as_real);
+
+      // Keep it reading as a real
+      if (!strpbrk(buffer, ".eEn"))
+        strcat(buffer, ".0");
+      return buffer;
+    case meta_value::string_value:
+      return '"' + std::string(atoms::text(value.as_string), atoms::length(value.as_string)) + '"';
+    case meta_value::type_value:
+      return std::string(atoms::text(value.as_type->name), atoms::length(value.as_type->name));
+    case meta_value::table_value:
+    {
+      // Tables used as lists, keyed 0 up, only show their values
+      const meta_table &table = *value.as_table;
+      std::string text = "{";
+
+      for (size_t i = 0; i < table.size(); ++i)
+      {
+        const auto &entry = table.entries[i];
+        if (i) text += ", ";
+
+        if (entry.first != meta_value::of_int(std::int64_t(i)))
+          text += meta_text(entry.first) + ": ";
+
+        text += meta_text(entry.second);
+      }
+
+      return text + "}";
+    }
+    case meta_value::function_value:
+    case meta_value::native_value:
+      return "function";
+    case meta_value::module_value:
+      return std::string("module ") + value.as_module->name;
+    }
+
+    return std::string();
+  }
+
+  // ---------------------------------------------------------------------------
+
+  const meta_value *meta_table::find(const meta_value &key) const
+  {
+    auto found = m_index.find(key);
+    return found == m_index.end() ? nullptr : &entries[found->second].second;
+  }
+
+  void meta_table::set(const meta_value &key, const meta_value &value)
+  {
+    auto found = m_index.find(key);
+
+    if (found != m_index.end())
+    {
+      entries[found->second].second = value;
+      return;
+    }
+
+    m_index.emplace(key, entries.size());
+    entries.push_back(std::make_pair(key, value));
+  }
+
+  size_t meta_table::size() const
+  {
+    return entries.size();
+  }
+
+  // ---------------------------------------------------------------------------
+
+  const native_function *meta_module::find(atoms::id name) const
+  {
+    for (size_t i = 0; i < count; ++i)
+    {
+      if (strcmp(functions[i].name, atoms::text(name)) == 0)
+        return &functions[i];
+    }
+
+    return nullptr;
+  }
+
+  const bytecode_function *meta_module::find_function(atoms::id name) const
+  {
+    for (size_t i = 0; i < meta_count; ++i)
+    {
+      if (meta_functions[i]->name == name)
+        return meta_functions[i];
+    }
+
+    return nullptr;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  meta_table *meta_heap::new_table()
+  {
+    m_tables.emplace_back(new meta_table());
+    return m_tables.back().get();
+  }
+
+  const meta_type *meta_heap::type(atoms::id name, class_node *declaration)
+  {
+    std::unique_ptr<meta_type> &found = m_types[name];
+
+    if (!found)
+    {
+      found.reset(new meta_type());
+      found->name = name;
+      found->declaration = nullptr;
+      found->source_hash = 0;
+    }
+
+    if (declaration && declaration != found->declaration)
+    {
+      found->declaration = declaration;
+
+      fnv_hasher hasher;
+      for (auto it = declaration->begin; it < declaration->end; ++it)
+        hasher.add(*it);
+
+      found->source_hash = hasher.value();
+    }
+
+    return found.get();
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,189 @@
+// -----------------------------------------------------------------------------
+// Brandy compile time values
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#ifndef META_VALUE_H
+#define META_VALUE_H
+
+#pragma once
+
+#include "atoms.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  struct class_node;
+  struct bytecode_function;
+  struct meta_table;
+  struct meta_type;
+  struct meta_module;
+  struct native_function;
+  class meta_vm;
+
+  // ---------------------------------------------------------------------------
+
+  // A value in meta code. Strings are atoms, so they're compared and hashed
+  // as one number. Tables, types and functions are pointers to things the
+  // meta_heap or the evaluator own.
+  struct meta_value
+  {
+    enum kind : std::uint8_t
+    {
+      nil_value,
+      bool_value,
+      int_value,
+      real_value,
+      string_value,
+      type_value,
+      table_value,
+      function_value,
+      native_value,
+      module_value
+    };
+
+    meta_value();
+
+    static meta_value of_bool(bool value);
+    static meta_value of_int(std::int64_t value);
+    static meta_value of_real(double value);
+    static meta_value of_string(atoms::id value);
+    static meta_value of_string(const std::string &value);
+    static meta_value of_type(const meta_type *value);
+    static meta_value of_table(meta_table *value);
+    static meta_value of_function(const bytecode_function *value);
+    static meta_value of_native(const native_function *value);
+    static meta_value of_module(const meta_module *value);
+
+    // Only nil and false are false
+    bool truthy() const;
+
+    // Values of different kinds are never equal, tables are the same table
+    bool operator==(const meta_value &rhs) const;
+    bool operator!=(const meta_value &rhs) const;
+
+    size_t hash_code() const;
+
+    // "int", "table" and so on, for errors
+    const char *kind_name() const;
+
+    kind tag;
+
+    union
+    {
+      bool as_bool;
+      std::int64_t as_int;
+      double as_real;
+      atoms::id as_string;
+      const meta_type *as_type;
+      meta_table *as_table;
+      const bytecode_function *as_function;
+      const native_function *as_native;
+      const meta_module *as_module;
+    };
+  };
+
+  struct meta_value_hash
+  {
+    size_t operator()(const meta_value &value) const
+    {
+      return value.hash_code();
+    }
+  };
+
+  // How a value reads in an error, or in the name of a class instance
+  std::string meta_text(const meta_value &value);
+
+  // ---------------------------------------------------------------------------
+
+  // A type as meta code sees it, the one for a name is shared so two of them
+  // are the same type when they're the same pointer. Classes written in the
+  // module, and ones made by compiler.compile_class, have their declaration.
+  struct meta_type
+  {
+    atoms::id name;
+    class_node *declaration;
+
+    // A hash of the tokens declaring it, zero without a declaration. Classes
+    // of the same name in different modules can be told apart by it.
+    std::uint64_t source_hash;
+  };
+
+  // Keeps the order entries were first set in, which is the order for loops
+  // go through them
+  struct meta_table
+  {
+    const meta_value *find(const meta_value &key) const;
+    void set(const meta_value &key, const meta_value &value);
+
+    size_t size() const;
+
+    std::vector<std::pair<meta_value, meta_value>> entries;
+
+  private:
+    std::unordered_map<meta_value, size_t, meta_value_hash> m_index;
+  };
+
+  // A function meta code can call that's written in C++. It returns false
+  // after reporting an error on the vm.
+  typedef bool (*native_callback)(meta_vm &vm, const meta_value *args, size_t count, meta_value &result);
+
+  struct native_function
+  {
+    const char *name;
+    native_callback call;
+  };
+
+  // A module of native functions meta code can import, IE compiler, or the
+  // meta functions of another module, loaded from its bytecode_image
+  struct meta_module
+  {
+    const char *name;
+    const native_function *functions;
+    size_t count;
+
+    const bytecode_function *const *meta_functions;
+    size_t meta_count;
+
+    // Of the image the meta functions came from, so results cached from
+    // calls into it change when it does
+    std::uint64_t hash;
+
+    const native_function *find(atoms::id name) const;
+    const bytecode_function *find_function(atoms::id name) const;
+  };
+
+  // ---------------------------------------------------------------------------
+
+  // Owns the tables and types made while a module's meta code runs, they all
+  // go when it does
+  class meta_heap
+  {
+  public:
+    meta_table *new_table();
+
+    // The type with a name, made the first time it's asked for. Its
+    // declaration is filled in when one is given.
+    const meta_type *type(atoms::id name, class_node *declaration = nullptr);
+
+  private:
+    std::vector<std::unique_ptr<meta_table>> m_tables;
+    std::unordered_map<atoms::id, std::unique_ptr<meta_type>> m_types;
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
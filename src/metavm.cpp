@@ -0,0 +1,687 @@
+// -----------------------------------------------------------------------------
+// Brandy meta code virtual machine
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "metavm.h"
+#include "metaevaluator.h"
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    bool is_number(const meta_value &value)
+    {
+      return value.tag == meta_value::int_value || value.tag == meta_value::real_value;
+    }
+
+    double as_real(const meta_value &value)
+    {
+      return value.tag == meta_value::int_value ? double(value.as_int) : value.as_real;
+    }
+
+    // Ints wrap rather than overflowing
+    std::int64_t wrap(std::uint64_t value)
+    {
+      return std::int64_t(value);
+    }
+
+    const char *operator_text(opcodes::type op)
+    {
+      switch (op)
+      {
+      case opcodes::ADD:  return "+";
+      case opcodes::SUB:  return "-";
+      case opcodes::MUL:  return "*";
+      case opcodes::DIV:  return "/";
+      case opcodes::MOD:  return "%";
+      case opcodes::BAND: return "&";
+      case opcodes::BOR:  return "|";
+      case opcodes::BXOR: return "^";
+      case opcodes::SHL:  return "<<";
+      case opcodes::SHR:  return ">>";
+      case opcodes::LT:   return "<";
+      case opcodes::LE:   return "<=";
+      case opcodes::GT:   return ">";
+      case opcodes::GE:   return ">=";
+      default:            return opcodes::names[op];
+      }
+    }
+
+    // -------------------------------------------------------------------------
+
+    bool builtin_len(meta_vm &vm, const meta_value *args, size_t count, meta_value &result)
+    {
+      if (count != 1)
+        return vm.fail("len takes 1 argument");
+
+      if (args[0].tag == meta_value::table_value)
+        result = meta_value::of_int(std::int64_t(args[0].as_table->size()));
+      else if (args[0].tag == meta_value::string_value)
+        result = meta_value::of_int(std::int64_t(atoms::length(args[0].as_string)));
+      else
+        return vm.fail(std::string("Can't take the length of a ") + args[0].kind_name());
+
+      return true;
+    }
+
+    const native_function builtins[] =
+    {
+      { "len", builtin_len }
+    };
+  }
+
+  // ---------------------------------------------------------------------------
+
+  size_t meta_globals::slot(const abstract_node *declaration)
+  {
+    auto found = m_slots.find(declaration);
+    if (found != m_slots.end())
+      return found->second;
+
+    m_slots.emplace(declaration, values.size());
+    values.push_back(meta_value());
+    return values.size() - 1;
+  }
+
+  bool meta_globals::find(const abstract_node *declaration, size_t *slot) const
+  {
+    auto found = m_slots.find(declaration);
+    if (found == m_slots.end())
+      return false;
+
+    *slot = found->second;
+    return true;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  meta_vm::meta_vm(meta_heap &heap, meta_globals &globals, meta_evaluator *evaluator) :
+    m_heap(heap),
+    m_globals(globals),
+    m_evaluator(evaluator),
+    m_steps(0),
+    m_failed(false)
+  {
+    m_error.line = 0;
+  }
+
+  bool meta_vm::call(const meta_value &callee, const meta_value *args, size_t count, meta_value &result)
+  {
+    const size_t depth = m_frames.size();
+
+    // A new run from outside
+    if (depth == 0)
+    {
+      m_steps = 0;
+      m_failed = false;
+    }
+
+    if (callee.tag == meta_value::native_value)
+      return callee.as_native->call(*this, args, count, result);
+
+    if (callee.tag != meta_value::function_value)
+      return fail(std::string("Can't call a ") + callee.kind_name());
+
+    // The arguments may be registers of a native's caller, which can move
+    const std::vector<meta_value> arguments(args, args + count);
+
+    const size_t base = m_registers.size();
+    m_registers.insert(m_registers.end(), arguments.begin(), arguments.end());
+
+    bool succeeded = enter(callee.as_function, base, count) && run(depth, result);
+
+    m_frames.resize(depth);
+    m_registers.resize(base);
+    return succeeded;
+  }
+
+  bool meta_vm::fail(const std::string &message)
+  {
+    // Natives failing because a call they made failed keep the first error
+    if (m_failed)
+      return false;
+
+    m_failed = true;
+    m_error.message = message;
+    m_error.line = 0;
+
+    if (!m_frames.empty())
+    {
+      const frame &current = m_frames.back();
+      if (current.pc > 0)
+        m_error.line = current.function->line(current.pc - 1);
+    }
+
+    return false;
+  }
+
+  const meta_error &meta_vm::error() const
+  {
+    return m_error;
+  }
+
+  meta_heap &meta_vm::heap()
+  {
+    return m_heap;
+  }
+
+  meta_evaluator *meta_vm::evaluator() const
+  {
+    return m_evaluator;
+  }
+
+  const native_function *meta_vm::builtin(atoms::id name)
+  {
+    for (auto &function : builtins)
+    {
+      if (strcmp(function.name, atoms::text(name)) == 0)
+        return &function;
+    }
+
+    return nullptr;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  // The arguments are already in the registers from base up
+  bool meta_vm::enter(const bytecode_function *function, size_t base, size_t count)
+  {
+    if (count != function->parameters)
+    {
+      return fail(std::string(atoms::text(function->name)) + " takes " + std::to_string(function->parameters) +
+        " arguments, not " + std::to_string(count));
+    }
+
+    if (m_frames.size() >= MAX_CALL_DEPTH)
+      return fail("Meta calls nested too deep, is something recursing forever?");
+
+    if (m_registers.size() < base + function->registers)
+      m_registers.resize(base + function->registers);
+
+    std::fill(m_registers.begin() + base + count, m_registers.begin() + base + function->registers, meta_value());
+
+    frame callee = { function, base, 0 };
+    m_frames.push_back(callee);
+    return true;
+  }
+
+  // Runs until the frame at exitDepth returns
+  bool meta_vm::run(size_t exitDepth, meta_value &result)
+  {
+    using namespace instructions;
+
+    frame *current = &m_frames.back();
+    const instruction *code = current->function->code_data();
+    const meta_value *constants = current->function->constants.data();
+    meta_globals *globals = current->function->globals ? current->function->globals : &m_globals;
+    meta_value *regs = m_registers.data() + current->base;
+    size_t pc = current->pc;
+
+    // After anything that could push a frame or grow the registers
+#define RELOAD()\
+    current = &m_frames.back();\
+    code = current->function->code_data();\
+    constants = current->function->constants.data();\
+    globals = current->function->globals ? current->function->globals : &m_globals;\
+    regs = m_registers.data() + current->base;\
+    pc = current->pc
+
+#define FAIL(message)\
+    do { current->pc = pc; return fail(message); } while (false)
+
+    for (;;)
+    {
+      const instruction i = code[pc++];
+
+      if (++m_steps > MAX_STEPS)
+        FAIL("Meta code ran for too long, is it stuck in a loop?");
+
+      switch (op(i))
+      {
+      case opcodes::LOADNIL:
+        regs[a(i)] = meta_value();
+        break;
+
+      case opcodes::LOADBOOL:
+        regs[a(i)] = meta_value::of_bool(b(i) != 0);
+        break;
+
+      case opcodes::LOADK:
+        regs[a(i)] = constants[bx(i)];
+        break;
+
+      case opcodes::MOVE:
+        regs[a(i)] = regs[b(i)];
+        break;
+
+      case opcodes::GETGLOBAL:
+        regs[a(i)] = globals->values[bx(i)];
+        break;
+
+      case opcodes::SETGLOBAL:
+        globals->values[bx(i)] = regs[a(i)];
+        break;
+
+      case opcodes::NEWTABLE:
+        regs[a(i)] = meta_value::of_table(m_heap.new_table());
+        break;
+
+      case opcodes::GETINDEX:
+      {
+        // Where the error is, if it fails
+        current->pc = pc;
+
+        meta_value value;
+        if (!index(regs[b(i)], regs[c(i)], value))
+          return false;
+
+        regs[a(i)] = value;
+        break;
+      }
+
+      case opcodes::SETINDEX:
+      {
+        const meta_value &table = regs[a(i)];
+        const meta_value &key = regs[b(i)];
+
+        if (table.tag != meta_value::table_value)
+          FAIL(std::string("Can't set an index of a ") + table.kind_name());
+
+        if (key.tag == meta_value::nil_value)
+          FAIL("Tables can't have nil keys");
+
+        table.as_table->set(key, regs[c(i)]);
+        break;
+      }
+
+      case opcodes::ADD:
+      case opcodes::SUB:
+      case opcodes::MUL:
+      case opcodes::DIV:
+      case opcodes::MOD:
+      case opcodes::BAND:
+      case opcodes::BOR:
+      case opcodes::BXOR:
+      case opcodes::SHL:
+      case opcodes::SHR:
+      {
+        const meta_value &lhs = regs[b(i)];
+        const meta_value &rhs = regs[c(i)];
+
+        // Counting in loops is most of what meta code does
+        if (op(i) == opcodes::ADD && lhs.tag == meta_value::int_value && rhs.tag == meta_value::int_value)
+        {
+          regs[a(i)] = meta_value::of_int(wrap(std::uint64_t(lhs.as_int) + std::uint64_t(rhs.as_int)));
+          break;
+        }
+
+        // Where the error is, if it fails
+        current->pc = pc;
+
+        meta_value value;
+        if (!arithmetic(op(i), lhs, rhs, value))
+          return false;
+
+        regs[a(i)] = value;
+        break;
+      }
+
+      case opcodes::EQ:
+      case opcodes::NE:
+      case opcodes::LT:
+      case opcodes::LE:
+      case opcodes::GT:
+      case opcodes::GE:
+      {
+        const meta_value &lhs = regs[b(i)];
+        const meta_value &rhs = regs[c(i)];
+
+        if (op(i) == opcodes::LT && lhs.tag == meta_value::int_value && rhs.tag == meta_value::int_value)
+        {
+          regs[a(i)] = meta_value::of_bool(lhs.as_int < rhs.as_int);
+          break;
+        }
+
+        // Where the error is, if it fails
+        current->pc = pc;
+
+        meta_value value;
+        if (!compare(op(i), lhs, rhs, value))
+          return false;
+
+        regs[a(i)] = value;
+        break;
+      }
+
+      case opcodes::NEG:
+      {
+        const meta_value &operand = regs[b(i)];
+
+        if (operand.tag == meta_value::int_value)
+          regs[a(i)] = meta_value::of_int(wrap(0 - std::uint64_t(operand.as_int)));
+        else if (operand.tag == meta_value::real_value)
+          regs[a(i)] = meta_value::of_real(-operand.as_real);
+        else
+          FAIL(std::string("Can't negate a ") + operand.kind_name());
+        break;
+      }
+
+      case opcodes::NOT:
+        regs[a(i)] = meta_value::of_bool(!regs[b(i)].truthy());
+        break;
+
+      case opcodes::BNOT:
+      {
+        const meta_value &operand = regs[b(i)];
+
+        if (operand.tag != meta_value::int_value)
+          FAIL(std::string("Can't take the bitwise not of a ") + operand.kind_name());
+
+        regs[a(i)] = meta_value::of_int(~operand.as_int);
+        break;
+      }
+
+      case opcodes::JMP:
+        pc += sbx(i);
+        break;
+
+      case opcodes::JMPIF:
+        if (regs[a(i)].truthy())
+          pc += sbx(i);
+        break;
+
+      case opcodes::JMPIFNOT:
+        if (!regs[a(i)].truthy())
+          pc += sbx(i);
+        break;
+
+      case opcodes::FORPREP:
+      {
+        meta_value *loop = &regs[a(i)];
+
+        if (loop[0].tag != meta_value::int_value || loop[1].tag != meta_value::int_value ||
+            loop[2].tag != meta_value::int_value)
+          FAIL("For loops can only count in ints");
+
+        const std::int64_t step = loop[2].as_int;
+        if (step == 0)
+          FAIL("A for loop can't count up by 0");
+
+        // Up to and including the end
+        if (b(i))
+          loop[1].as_int += step > 0 ? 1 : -1;
+
+        if (step > 0 ? loop[0].as_int < loop[1].as_int : loop[0].as_int > loop[1].as_int)
+          ++pc;
+        break;
+      }
+
+      case opcodes::FORLOOP:
+      {
+        meta_value *loop = &regs[a(i)];
+        const std::int64_t step = loop[2].as_int;
+
+        loop[0].as_int += step;
+
+        if (step > 0 ? loop[0].as_int < loop[1].as_int : loop[0].as_int > loop[1].as_int)
+          pc += sbx(i);
+        break;
+      }
+
+      case opcodes::ITERNEXT:
+      {
+        meta_value *loop = &regs[a(i)];
+
+        if (loop[0].tag != meta_value::table_value)
+          FAIL(std::string("Can't loop over a ") + loop[0].kind_name());
+
+        const meta_table &table = *loop[0].as_table;
+        const size_t position = size_t(loop[1].as_int);
+
+        if (position < table.size())
+        {
+          loop[2] = table.entries[position].second;
+          loop[1].as_int += 1;
+          ++pc;
+        }
+        break;
+      }
+
+      case opcodes::CALL:
+      {
+        const unsigned callee = a(i);
+        const meta_value &function = regs[callee];
+
+        current->pc = pc;
+
+        if (function.tag == meta_value::function_value && function.as_function->cache_results && m_evaluator)
+        {
+          meta_value value;
+          if (!m_evaluator->cached_call(*this, function.as_function, &regs[callee + 1], b(i), value))
+            return false;
+
+          // Running it may have grown the registers
+          RELOAD();
+          regs[callee] = value;
+          break;
+        }
+
+        if (function.tag == meta_value::function_value)
+        {
+          // The arguments become the callee's first registers
+          if (!enter(function.as_function, current->base + callee + 1, b(i)))
+            return false;
+
+          RELOAD();
+          break;
+        }
+
+        if (function.tag != meta_value::native_value)
+          FAIL(std::string("Can't call a ") + function.kind_name());
+
+        meta_value value;
+        if (!function.as_native->call(*this, &regs[callee + 1], b(i), value))
+          return false;
+
+        // It may have run meta code of its own
+        RELOAD();
+        regs[callee] = value;
+        break;
+      }
+
+      case opcodes::RETURN:
+      case opcodes::RETURNNIL:
+      {
+        const meta_value value = op(i) == opcodes::RETURN ? regs[a(i)] : meta_value();
+
+        // A bytecode caller wants it in the register it called from
+        const size_t slot = current->base - 1;
+
+        m_frames.pop_back();
+
+        if (m_frames.size() == exitDepth)
+        {
+          result = value;
+          return true;
+        }
+
+        m_registers[slot] = value;
+        RELOAD();
+        break;
+      }
+
+      default:
+        FAIL("Bad instruction in meta code");
+      }
+    }
+
+#undef RELOAD
+#undef FAIL
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool meta_vm::arithmetic(opcodes::type op, const meta_value &lhs, const meta_value &rhs, meta_value &result)
+  {
+    // Joining strings
+    if (op == opcodes::ADD && lhs.tag == meta_value::string_value && rhs.tag == meta_value::string_value)
+    {
+      std::string text(atoms::text(lhs.as_string), atoms::length(lhs.as_string));
+      text.append(atoms::text(rhs.as_string), atoms::length(rhs.as_string));
+      result = meta_value::of_string(text);
+      return true;
+    }
+
+    if (!is_number(lhs) || !is_number(rhs))
+    {
+      return fail(std::string("Can't use ") + operator_text(op) + " on a " + lhs.kind_name() +
+        " and a " + rhs.kind_name());
+    }
+
+    if (lhs.tag == meta_value::int_value && rhs.tag == meta_value::int_value)
+    {
+      const std::int64_t x = lhs.as_int;
+      const std::int64_t y = rhs.as_int;
+
+      switch (op)
+      {
+      case opcodes::ADD: result = meta_value::of_int(wrap(std::uint64_t(x) + std::uint64_t(y))); return true;
+      case opcodes::SUB: result = meta_value::of_int(wrap(std::uint64_t(x) - std::uint64_t(y))); return true;
+      case opcodes::MUL: result = meta_value::of_int(wrap(std::uint64_t(x) * std::uint64_t(y))); return true;
+      case opcodes::DIV:
+      case opcodes::MOD:
+        if (y == 0)
+          return fail("Divided by zero in meta code");
+
+        // The one quotient that doesn't fit
+        if (y == -1)
+          result = meta_value::of_int(op == opcodes::DIV ? wrap(0 - std::uint64_t(x)) : 0);
+        else
+          result = meta_value::of_int(op == opcodes::DIV ? x / y : x % y);
+        return true;
+      case opcodes::BAND: result = meta_value::of_int(x & y); return true;
+      case opcodes::BOR:  result = meta_value::of_int(x | y); return true;
+      case opcodes::BXOR: result = meta_value::of_int(x ^ y); return true;
+      case opcodes::SHL:
+      case opcodes::SHR:
+        if (y < 0 || y > 63)
+          return fail("Can't shift by " + std::to_string(y));
+
+        result = meta_value::of_int(op == opcodes::SHL ? wrap(std::uint64_t(x) << y) : x >> y);
+        return true;
+      default:
+        break;
+      }
+    }
+
+    const double x = as_real(lhs);
+    const double y = as_real(rhs);
+
+    switch (op)
+    {
+    case opcodes::ADD: result = meta_value::of_real(x + y); return true;
+    case opcodes::SUB: result = meta_value::of_real(x - y); return true;
+    case opcodes::MUL: result = meta_value::of_real(x * y); return true;
+    case opcodes::DIV: result = meta_value::of_real(x / y); return true;
+    case opcodes::MOD: result = meta_value::of_real(std::fmod(x, y)); return true;
+    default:
+      return fail(std::string("Can't use ") + operator_text(op) + " on reals");
+    }
+  }
+
+  bool meta_vm::compare(opcodes::type op, const meta_value &lhs, const meta_value &rhs, meta_value &result)
+  {
+    if (op == opcodes::EQ || op == opcodes::NE)
+    {
+      // An int and a real are compared as numbers
+      bool equal = is_number(lhs) && is_number(rhs) && lhs.tag != rhs.tag ?
+        as_real(lhs) == as_real(rhs) : lhs == rhs;
+
+      result = meta_value::of_bool(op == opcodes::EQ ? equal : !equal);
+      return true;
+    }
+
+    int order;
+
+    if (lhs.tag == meta_value::int_value && rhs.tag == meta_value::int_value)
+    {
+      order = lhs.as_int < rhs.as_int ? -1 : lhs.as_int > rhs.as_int;
+    }
+    else if (is_number(lhs) && is_number(rhs))
+    {
+      const double x = as_real(lhs);
+      const double y = as_real(rhs);
+
+      // Nothing is ordered against NaN
+      if (x != x || y != y)
+      {
+        result = meta_value::of_bool(false);
+        return true;
+      }
+
+      order = x < y ? -1 : x > y;
+    }
+    else if (lhs.tag == meta_value::string_value && rhs.tag == meta_value::string_value)
+    {
+      order = strcmp(atoms::text(lhs.as_string), atoms::text(rhs.as_string));
+    }
+    else
+    {
+      return fail(std::string("Can't compare a ") + lhs.kind_name() + " and a " + rhs.kind_name() +
+        " with " + operator_text(op));
+    }
+
+    switch (op)
+    {
+    case opcodes::LT: result = meta_value::of_bool(order < 0); break;
+    case opcodes::LE: result = meta_value::of_bool(order <= 0); break;
+    case opcodes::GT: result = meta_value::of_bool(order > 0); break;
+    default:          result = meta_value::of_bool(order >= 0); break;
+    }
+
+    return true;
+  }
+
+  bool meta_vm::index(const meta_value &container, const meta_value &key, meta_value &result)
+  {
+    if (container.tag == meta_value::table_value)
+    {
+      const meta_value *found = container.as_table->find(key);
+      result = found ? *found : meta_value();
+      return true;
+    }
+
+    if (container.tag == meta_value::module_value && key.tag == meta_value::string_value)
+    {
+      const meta_module *module = container.as_module;
+
+      if (const native_function *function = module->find(key.as_string))
+      {
+        result = meta_value::of_native(function);
+        return true;
+      }
+
+      if (const bytecode_function *function = module->find_function(key.as_string))
+      {
+        result = meta_value::of_function(function);
+        return true;
+      }
+
+      return fail(std::string("Module ") + module->name + " has no function named " + atoms::text(key.as_string));
+    }
+
+    return fail(std::string("Can't index a ") + container.kind_name());
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,120 @@
+// -----------------------------------------------------------------------------
+// Brandy meta code virtual machine
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#ifndef META_VM_H
+#define META_VM_H
+
+#pragma once
+
+#include "bytecode.h"
+#include "metavalue.h"
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  struct abstract_node;
+  class meta_evaluator;
+
+  // ---------------------------------------------------------------------------
+
+  // Something wrong with meta code, found compiling or running it
+  struct meta_error
+  {
+    size_t line;
+    std::string message;
+  };
+
+  // Variables and functions declared at the top of meta blocks. Each has a
+  // slot given to it when its declaration is first compiled, which is what
+  // GETGLOBAL and SETGLOBAL use.
+  class meta_globals
+  {
+  public:
+    // The slot for the global a node declares, made the first time
+    size_t slot(const abstract_node *declaration);
+
+    // Returns false if it hasn't got one
+    bool find(const abstract_node *declaration, size_t *slot) const;
+
+    std::vector<meta_value> values;
+
+  private:
+    std::unordered_map<const abstract_node *, size_t> m_slots;
+  };
+
+  // ---------------------------------------------------------------------------
+
+  // Runs bytecode. Calls from one bytecode function to another stay in the
+  // one loop, the callee's registers starting at the caller's arguments, so
+  // only natives go through the C++ stack. Natives can call back into it.
+  class meta_vm
+  {
+  public:
+    // Deeper than this is taken as meta code that recurses forever
+    static const size_t MAX_CALL_DEPTH = 200;
+
+    // Instructions one call from outside can run before it's given up on
+    static const size_t MAX_STEPS = 100000000;
+
+    meta_vm(meta_heap &heap, meta_globals &globals, meta_evaluator *evaluator = nullptr);
+
+    // Calls a function or a native. Returns false if it failed, error says
+    // why.
+    bool call(const meta_value &callee, const meta_value *args, size_t count, meta_value &result);
+
+    // For natives to report what went wrong at the line calling them.
+    // Always returns false.
+    bool fail(const std::string &message);
+
+    const meta_error &error() const;
+
+    meta_heap &heap();
+
+    // What's running meta code, for natives that work on the module
+    meta_evaluator *evaluator() const;
+
+    // Functions every meta block can use without importing them, IE len
+    static const native_function *builtin(atoms::id name);
+
+  private:
+    struct frame
+    {
+      const bytecode_function *function;
+      size_t base;
+      size_t pc;
+    };
+
+    bool enter(const bytecode_function *function, size_t base, size_t count);
+    bool run(size_t exitDepth, meta_value &result);
+
+    bool arithmetic(opcodes::type op, const meta_value &lhs, const meta_value &rhs, meta_value &result);
+    bool compare(opcodes::type op, const meta_value &lhs, const meta_value &rhs, meta_value &result);
+    bool index(const meta_value &container, const meta_value &key, meta_value &result);
+
+    meta_heap &m_heap;
+    meta_globals &m_globals;
+    meta_evaluator *m_evaluator;
+
+    std::vector<meta_value> m_registers;
+    std::vector<frame> m_frames;
+    size_t m_steps;
+
+    meta_error m_error;
+    bool m_failed;
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,319 @@
+// -----------------------------------------------------------------------------
+// Brandy compiled module interface
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "moduleinterface.h"
+#include "astnodes.h"
+#include "buildstate.h"
+#include <algorithm>
+#include <fstream>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  const std::uint32_t module_interface::VERSION;
+  const std::uint32_t module_interface::NO_PARENT;
+
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    const char MAGIC[4] = { 'B', 'R', 'D', 'I' };
+
+    // Written as is, so files only work on machines with the same byte order
+    struct file_header
+    {
+      char magic[4];
+      std::uint32_t version;
+      std::uint64_t source_hash;
+      std::uint64_t interface_hash;
+
+      // Of everything after the header
+      std::uint64_t content_hash;
+
+      std::uint32_t entry_count;
+      std::uint32_t names_size;
+    };
+
+    struct file_entry
+    {
+      std::uint32_t kind;
+      std::uint32_t name;
+      std::uint32_t type;
+      std::uint32_t parent;
+    };
+
+    static_assert(sizeof(file_header) == 40, "The interface header can't have padding");
+    static_assert(sizeof(file_entry) == 16, "Interface entries can't have padding");
+
+    const file_header &header_of(const char *data)
+    {
+      return *reinterpret_cast<const file_header *>(data);
+    }
+
+    const file_entry *entries_of(const char *data)
+    {
+      return reinterpret_cast<const file_entry *>(data + sizeof(file_header));
+    }
+
+    const char *names_of(const char *data)
+    {
+      return reinterpret_cast<const char *>(entries_of(data) + header_of(data).entry_count);
+    }
+
+    // -------------------------------------------------------------------------
+
+    void append_tokens(std::string &text, const abstract_node *node)
+    {
+      for (auto it = node->begin; it < node->end; ++it)
+      {
+        if (!text.empty() && text.back() != '(') text += ' ';
+        text.append(it->text(), it->length());
+      }
+    }
+
+    // The type of a symbol as it was written. Functions get their parameter
+    // and return types, classes their base classes.
+    std::string type_text(const symbol &sym)
+    {
+      std::string text;
+
+      if (auto function = dynamic_cast<function_node *>(sym.node))
+      {
+        text += '(';
+        for (auto &param : function->parameters)
+        {
+          if (text.size() > 1) text += ',';
+          if (param->type) append_tokens(text, param->type.get());
+        }
+        text += ')';
+
+        if (function->return_type)
+          append_tokens(text, function->return_type.get());
+      }
+      else if (auto var = dynamic_cast<var_node *>(sym.node))
+      {
+        if (var->type) append_tokens(text, var->type.get());
+      }
+      else if (auto property = dynamic_cast<property_node *>(sym.node))
+      {
+        if (property->type) append_tokens(text, property->type.get());
+      }
+      else if (auto alias = dynamic_cast<typedef_node *>(sym.node))
+      {
+        if (alias->type) append_tokens(text, alias->type.get());
+      }
+      else if (auto type = dynamic_cast<class_node *>(sym.node))
+      {
+        for (auto &base : type->base_classes)
+        {
+          if (!text.empty()) text += ',';
+          append_tokens(text, base.get());
+        }
+      }
+
+      return text;
+    }
+
+    // -------------------------------------------------------------------------
+
+    class interface_builder
+    {
+    public:
+      interface_builder()
+      {
+        // Offset zero is the empty string, for symbols with no type
+        m_names.push_back('\0');
+        m_interned.emplace(std::string(), 0);
+      }
+
+      void add_table(const symbol_table &table, std::uint32_t parent)
+      {
+        std::vector<const symbol *> exported;
+
+        for (auto &entry : table)
+        {
+          // Imports and labels can't be reached from another module
+          switch (entry.second.symbol_type)
+          {
+          case symbol::function:
+          case symbol::variable:
+          case symbol::type_name:
+          case symbol::property:
+          case symbol::typedef_name:
+            exported.push_back(&entry.second);
+            break;
+          default:
+            break;
+          }
+        }
+
+        // The same module always makes the same bytes
+        std::sort(exported.begin(), exported.end(), [](const symbol *lhs, const symbol *rhs)
+        {
+          return std::lexicographical_compare(
+            lhs->name.text(), lhs->name.text() + lhs->name.length(),
+            rhs->name.text(), rhs->name.text() + rhs->name.length());
+        });
+
+        std::vector<std::pair<std::uint32_t, class_node *>> classes;
+
+        for (const symbol *sym : exported)
+        {
+          file_entry entry;
+          entry.kind = std::uint32_t(sym->symbol_type);
+          entry.name = intern(std::string(sym->name.text(), sym->name.length()));
+          entry.type = intern(type_text(*sym));
+          entry.parent = parent;
+
+          if (auto type = dynamic_cast<class_node *>(sym->node))
+            classes.push_back(std::make_pair(std::uint32_t(m_entries.size()), type));
+
+          m_entries.push_back(entry);
+        }
+
+        for (auto &type : classes)
+          add_table(type.second->symbols, type.first);
+      }
+
+      void build(std::vector<char> &storage, std::uint64_t sourceHash, std::uint64_t interfaceHash) const
+      {
+        const size_t entriesSize = m_entries.size() * sizeof(file_entry);
+        storage.resize(sizeof(file_header) + entriesSize + m_names.size());
+
+        char *body = storage.data() + sizeof(file_header);
+        if (entriesSize) memcpy(body, m_entries.data(), entriesSize);
+        memcpy(body + entriesSize, m_names.data(), m_names.size());
+
+        file_header header;
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = module_interface::VERSION;
+        header.source_hash = sourceHash;
+        header.interface_hash = interfaceHash;
+        header.content_hash = hash_source(body, entriesSize + m_names.size());
+        header.entry_count = std::uint32_t(m_entries.size());
+        header.names_size = std::uint32_t(m_names.size());
+
+        memcpy(storage.data(), &header, sizeof(header));
+      }
+
+    private:
+      std::uint32_t intern(const std::string &text)
+      {
+        auto found = m_interned.find(text);
+        if (found != m_interned.end())
+          return found->second;
+
+        std::uint32_t offset = std::uint32_t(m_names.size());
+        m_names.insert(m_names.end(), text.begin(), text.end());
+        m_names.push_back('\0');
+
+        m_interned.emplace(text, offset);
+        return offset;
+      }
+
+      std::vector<file_entry> m_entries;
+      std::vector<char> m_names;
+      std::unordered_map<std::string, std::uint32_t> m_interned;
+    };
+  }
+
+  // ---------------------------------------------------------------------------
+
+  module_interface::module_interface(module_node *module, std::uint64_t sourceHash, std::uint64_t interfaceHash) :
+    m_data(nullptr),
+    m_length(0),
+    m_valid(true)
+  {
+    interface_builder builder;
+    builder.add_table(module->symbols, NO_PARENT);
+    builder.build(m_storage, sourceHash, interfaceHash);
+
+    m_data = m_storage.data();
+    m_length = m_storage.size();
+  }
+
+  module_interface::module_interface(const char *data, size_t length) :
+    m_data(data),
+    m_length(length),
+    m_valid(false)
+  {
+    if (length < sizeof(file_header))
+      return;
+
+    const file_header &header = header_of(data);
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION)
+      return;
+
+    // Sizes are checked before anything is read through them
+    const size_t bodySize = length - sizeof(file_header);
+    if (header.entry_count > bodySize / sizeof(file_entry))
+      return;
+
+    if (header.names_size == 0 || header.entry_count * sizeof(file_entry) + header.names_size != bodySize)
+      return;
+
+    if (hash_source(data + sizeof(file_header), bodySize) != header.content_hash)
+      return;
+
+    const char *names = names_of(data);
+    if (names[header.names_size - 1] != '\0')
+      return;
+
+    const file_entry *entries = entries_of(data);
+    for (size_t i = 0; i < header.entry_count; ++i)
+    {
+      const file_entry &entry = entries[i];
+
+      // Classes always come before their members
+      if (entry.name >= header.names_size || entry.type >= header.names_size)
+        return;
+      if (entry.parent != NO_PARENT && entry.parent >= i)
+        return;
+      if (entry.kind > symbol::typedef_name)
+        return;
+    }
+
+    m_valid = true;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool module_interface::valid() const
+  {
+    return m_valid;
+  }
+
+  bool module_interface::write(const char *filename) const
+  {
+    std::ofstream out(filename, std::ios::binary);
+    if (!out)
+      return false;
+
+    out.write(m_data, std::streamsize(m_length));
+    return bool(out);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  std::uint64_t module_interface::source_hash() const
+  {
+    return header_of(m_data).source_hash;
+  }
+
+  std::uint64_t module_interface::interface_hash() const
+  {
+    return header_of(m_data).interface_hash;
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,71 @@
+// -----------------------------------------------------------------------------
+// Brandy compiled module interface
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#ifndef MODULE_INTERFACE_H
+#define MODULE_INTERFACE_H
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  struct module_node;
+
+  // ---------------------------------------------------------------------------
+
+  // What other modules can see of a module, in a form that's written to disk
+  // and read back by mapping it. An up to date module is skipped when its
+  // interface file loads and matches the build state. Nothing looks up the
+  // symbols in it yet, importers still only see the module's interface hash.
+  //
+  // The file is a header, then a fixed size entry for every exported symbol,
+  // then the names. Names (and types, which are kept as they were written)
+  // are offsets into the names, and each distinct string is stored once.
+  // Module level symbols come first, sorted by name, then the members of
+  // each class in turn.
+  class module_interface
+  {
+  public:
+    static const std::uint32_t VERSION = 1;
+    static const std::uint32_t NO_PARENT = 0xFFFFFFFF;
+
+    // Builds the interface of a module that's been through the semantic passes
+    module_interface(module_node *module, std::uint64_t sourceHash, std::uint64_t interfaceHash);
+
+    // Views the bytes of an interface file, which have to outlive it. Check
+    // valid() before using it.
+    module_interface(const char *data, size_t length);
+
+    // False if the bytes are from another version, cut short or damaged
+    bool valid() const;
+
+    bool write(const char *filename) const;
+
+    // The hashes of the source it was built from (see build_state)
+    std::uint64_t source_hash() const;
+    std::uint64_t interface_hash() const;
+
+  private:
+    // Only used when built from a module, otherwise the bytes are borrowed
+    std::vector<char> m_storage;
+
+    const char *m_data;
+    size_t m_length;
+    bool m_valid;
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
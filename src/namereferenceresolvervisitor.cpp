@@ -12,10 +12,15 @@ namespace brandy
 {
   // ---------------------------------------------------------------------------
 
+  name_reference_resolver_visitor::name_reference_resolver_visitor()
+  {
+    handled_kinds |= node_kinds_of<name_reference_node>::value;
+  }
+
   ast_visitor::visitor_result name_reference_resolver_visitor::visit(name_reference_node *node)
   {
-    node->resolved_symbol = get_symbol(node->name);
-    if (!node->resolved_symbol)
+    node->resolved_table = get_symbol_table(node->name);
+    if (!node->resolved_table)
     {
       // TOOD: Name error
     }
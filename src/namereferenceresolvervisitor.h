@@ -19,6 +19,8 @@ namespace brandy
   class name_reference_resolver_visitor : public symbol_table_visitor
   {
   public:
+    name_reference_resolver_visitor();
+
     ast_visitor::visitor_result visit(name_reference_node *node) override;
   };
 
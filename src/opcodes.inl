@@ -0,0 +1,42 @@
+OPCODE(LOADNIL, a)
+OPCODE(LOADBOOL, ab)
+OPCODE(LOADK, abx)
+OPCODE(MOVE, ab)
+OPCODE(GETGLOBAL, abx)
+OPCODE(SETGLOBAL, abx)
+OPCODE(NEWTABLE, a)
+OPCODE(GETINDEX, abc)
+OPCODE(SETINDEX, abc)
+
+OPCODE(ADD, abc)
+OPCODE(SUB, abc)
+OPCODE(MUL, abc)
+OPCODE(DIV, abc)
+OPCODE(MOD, abc)
+OPCODE(BAND, abc)
+OPCODE(BOR, abc)
+OPCODE(BXOR, abc)
+OPCODE(SHL, abc)
+OPCODE(SHR, abc)
+
+OPCODE(EQ, abc)
+OPCODE(NE, abc)
+OPCODE(LT, abc)
+OPCODE(LE, abc)
+OPCODE(GT, abc)
+OPCODE(GE, abc)
+
+OPCODE(NEG, ab)
+OPCODE(NOT, ab)
+OPCODE(BNOT, ab)
+
+OPCODE(JMP, sbx)
+OPCODE(JMPIF, asbx)
+OPCODE(JMPIFNOT, asbx)
+OPCODE(FORPREP, ab)
+OPCODE(FORLOOP, asbx)
+OPCODE(ITERNEXT, a)
+
+OPCODE(CALL, ab)
+OPCODE(RETURN, a)
+OPCODE(RETURNNIL, none)
@@ -6,6 +6,7 @@
 #include "flags.h"
 #include "parser.h"
 #include <cassert>
+#include <initializer_list>
 #include <iostream>
 #include <stack>
 
@@ -18,52 +19,122 @@ namespace brandy
 
   // ---------------------------------------------------------------------------
 
-  class rule_tracker
+  // Undoes what a rejected rule allocated, and traces the rules when the
+  // build asks for it, see parser_trace
+  template<typename trace_policy>
+  class basic_rule_tracker : private trace_policy
   {
   public:
-    rule_tracker(const char *text) : m_text(text) { ++depth; }
-    ~rule_tracker() { --depth; }
+    basic_rule_tracker(const char *text, node_arena *arena, typename trace_policy::state &trace) :
+      trace_policy(text, trace),
+      m_arena(arena),
+      m_mark(arena ? arena->mark() : node_arena::position())
+    {
+    }
 
     void accept()
     {
-      outStack.emplace(depth, m_text);
+      trace_policy::accept();
     }
 
-    static void dump()
+    // Nothing made since the rule started outlives it being rejected, so the
+    // arena can have it all back
+    void reject()
     {
-      while (!outStack.empty())
-      {
-        auto top = outStack.top();
-
-        for (size_t i = 0; i < top.first - 1; ++i)
-          std::cout << "  ";
-
-        std::cout << top.second << std::endl;
-
-        outStack.pop();
-      }
+      if (m_arena) m_arena->release(m_mark);
     }
 
   private:
-    const char *m_text;
-    static size_t depth;
-    static std::stack<std::pair<size_t, const char *>> outStack;
+    node_arena *m_arena;
+    node_arena::position m_mark;
   };
 
-  size_t rule_tracker::depth = 0;
-  std::stack<std::pair<size_t, const char*>> rule_tracker::outStack;
+  typedef basic_rule_tracker<parser_trace> rule_tracker;
 
   // ---------------------------------------------------------------------------
 
-#define ENTER_RULE(name) rule_tracker ruleDontFuckWithThis(#name)
-#define REJECT_RULE() return nullptr
-#define REJECT_RULE_ERROR(msg) throw parsing_error(msg, m_current)
+#define ENTER_RULE(name) rule_tracker ruleDontFuckWithThis(#name, m_arena, m_trace)
+#define REJECT_RULE() do { ruleDontFuckWithThis.reject(); return nullptr; } while(false)
+#define REJECT_RULE_ERROR(msg) do { report_error(msg); REJECT_RULE(); } while(false)
 #define ACCEPT_RULE(retval) do { ruleDontFuckWithThis.accept(); retval->end = m_current; return move(retval); } while(false)
-#define ACCEPT_RULE_AND_DUMP(retval) do { ruleDontFuckWithThis.accept(); retval->end = m_current; rule_tracker::dump(); return move(retval); } while(false)
 #define NEWLINE_GAURD() newline_gaurd gaurdDontFuckWithThis(this)
 
   // ---------------------------------------------------------------------------
 
+  // How tightly each binary operator binds, loosest first
+  namespace precedence
+  {
+    enum level
+    {
+      NONE,
+      ASSIGNMENT,
+      LOGICAL_CONJUNCTION,
+      BITWISE_CONJUNCTION,
+      EQUALITY,
+      COMPARISON,
+      BITWISE_SHIFT,
+      ADDITION,
+      MULTIPLICATION
+    };
+  }
+
+  class precedence_table
+  {
+  public:
+    precedence_table()
+    {
+      for (auto &level : m_levels)
+        level = precedence::NONE;
+
+      set(precedence::ASSIGNMENT, {
+        token_types::ASSIGNMENT,
+        token_types::ASSIGNMENT_ADD,
+        token_types::ASSIGNMENT_SUBTRACT,
+        token_types::ASSIGNMENT_MULTIPLY,
+        token_types::ASSIGNMENT_DIVIDE,
+        token_types::ASSIGNMENT_MODULO,
+        token_types::ASSIGNMENT_BITWISE_LEFT_SHIFT,
+        token_types::ASSIGNMENT_BITWISE_RIGHT_SHIFT,
+        token_types::ASSIGNMENT_BITWISE_AND,
+        token_types::ASSIGNMENT_BITWISE_OR,
+        token_types::ASSIGNMENT_BITWISE_XOR,
+        token_types::ASSIGNMENT_LOGICAL_AND,
+        token_types::ASSIGNMENT_LOGICAL_OR });
+
+      set(precedence::LOGICAL_CONJUNCTION, { token_types::LOGICAL_AND, token_types::LOGICAL_OR });
+      set(precedence::BITWISE_CONJUNCTION, { token_types::AMPERSAND, token_types::BITWISE_OR, token_types::BITWISE_XOR });
+      set(precedence::EQUALITY, { token_types::EQUALITY, token_types::INEQUALITY });
+
+      set(precedence::COMPARISON, {
+        token_types::GREATER_THAN,
+        token_types::LESS_THAN,
+        token_types::GREATER_THAN_OR_EQUAL,
+        token_types::LESS_THAN_OR_EQUAL });
+
+      set(precedence::BITWISE_SHIFT, { token_types::BITWISE_LEFT_SHIFT, token_types::BITWISE_RIGHT_SHIFT });
+      set(precedence::ADDITION, { token_types::ADD, token_types::SUBTRACT });
+      set(precedence::MULTIPLICATION, { token_types::ASTRISK, token_types::DIVIDE, token_types::MODULO });
+    }
+
+    unsigned operator[](token_types::type type) const
+    {
+      return m_levels[type];
+    }
+
+  private:
+    void set(precedence::level level, std::initializer_list<token_types::type> operators)
+    {
+      for (auto op : operators)
+        m_levels[op] = std::uint8_t(level);
+    }
+
+    std::uint8_t m_levels[token_types::COUNT];
+  };
+
+  static const precedence_table binary_precedence;
+
+  // ---------------------------------------------------------------------------
+
   parsing_error::parsing_error(const char *error, std::vector<token>::const_iterator position) :
     m_errStr(error),
     m_pos(position)
@@ -82,29 +153,32 @@ namespace brandy
 
   // ---------------------------------------------------------------------------
 
-  parser::parser() :
-    m_tokens(),
-    m_current(),
-    m_disallowNewLines(),
-    m_lastLineNum(1)
-  {
-    m_disallowNewLines.push(false);
-  }
-
-  parser::parser(const std::vector<token> &tokens) :
+  parser::parser(const compilation_context &context, const std::vector<token> &tokens) :
+    m_context(context),
     m_tokens(tokens),
+    m_lines(m_tokens),
     m_current(m_tokens.begin()),
     m_disallowNewLines(),
-    m_lastLineNum(1)
+    m_lastLineNum(1),
+    m_errors(),
+    m_panic(false),
+    m_arena(nullptr),
+    m_trace()
   {
     m_disallowNewLines.push(false);
   }
 
-  parser::parser(std::vector<token> &&tokens) :
+  parser::parser(const compilation_context &context, std::vector<token> &&tokens) :
+    m_context(context),
     m_tokens(move(tokens)),
+    m_lines(m_tokens),
     m_current(m_tokens.begin()),
     m_disallowNewLines(),
-    m_lastLineNum(1)
+    m_lastLineNum(1),
+    m_errors(),
+    m_panic(false),
+    m_arena(nullptr),
+    m_trace()
   {
     m_disallowNewLines.push(false);
   }
@@ -120,7 +194,12 @@ namespace brandy
 
   unique_ptr<module_node> parser::parse_module()
   {
-    return accept_module();
+    m_trace.start(m_context.flags().dump_parser_stack(), m_context.flags().dump_parser_timings());
+
+    auto module = accept_module();
+
+    m_trace.finish();
+    return module;
   }
 
   // ---------------------------------------------------------------------------
@@ -130,27 +209,35 @@ namespace brandy
     return m_tokens;
   }
 
+  const std::vector<parsing_error> &parser::errors() const
+  {
+    return m_errors;
+  }
+
   // ---------------------------------------------------------------------------
 
   unique_ptr<module_node> parser::accept_module()
   {
     ENTER_RULE(module);
 
+    m_arena = new node_arena();
     auto moduleNode = create_node<module_node>();
 
     while (!at_end_of_stream())
     {
+      auto memberBegin = m_current;
+
       if (auto symbol = accept_symbol())
         moduleNode->members.push_back(move(symbol));
       else if (auto statement = accept_statement())
         moduleNode->statements.push_back(move(statement));
       else
-        break;
+        report_error("Expected a declaration or statement");
+
+      if (m_panic) synchronize(memberBegin);
     }
-    if (brandy::compiler_flags::current().dump_parser_stack())
-      ACCEPT_RULE_AND_DUMP(moduleNode);
-    else
-      ACCEPT_RULE(moduleNode);
+
+    ACCEPT_RULE(moduleNode);
   }
 
   // ---------------------------------------------------------------------------
@@ -217,8 +304,8 @@ namespace brandy
   {
     ENTER_RULE(expression);
 
-    if (auto assignment = accept_assignment())
-      ACCEPT_RULE(assignment);
+    if (auto node = accept_binary_operator(precedence::ASSIGNMENT))
+      ACCEPT_RULE(node);
     else
       REJECT_RULE();
   }
@@ -312,10 +399,16 @@ namespace brandy
 
     while (!accept(token_types::CLOSE_CURLY))
     {
+      auto memberBegin = m_current;
+
       if (auto symbol = accept_symbol())
         classNode->members.push_back(move(symbol));
-      else
+      else if (at_end_of_stream())
         REJECT_RULE_ERROR("Classes can only contain functions, variables, or properties");
+      else
+        report_error("Classes can only contain functions, variables, or properties");
+
+      if (m_panic) synchronize(memberBegin);
     }
 
     ACCEPT_RULE(classNode);
@@ -778,12 +871,14 @@ namespace brandy
       token_types::LOGICAL_NOT
     };
 
-    auto unaryOpNode = create_node<unary_operator_node>();
+    auto unaryOpBegin = m_current;
 
     for (token_types::type op : unary_operators)
     {
       if (!accept(op)) continue;
 
+      auto unaryOpNode = create_node<unary_operator_node>();
+      unaryOpNode->begin = unaryOpBegin;
       unaryOpNode->operation = last_token();
       unaryOpNode->expression = accept_unary_operator();
       ACCEPT_RULE(unaryOpNode);
@@ -797,217 +892,54 @@ namespace brandy
 
   // ---------------------------------------------------------------------------
 
-  unique_ptr<expression_node> parser::accept_generic_expression(
-    unique_ptr<expression_node>(parser::*leftRecurse)(),
-    unique_ptr<expression_node>(parser::*rightRecurse)(),
-    const token_types::type *operators)
+  unique_ptr<expression_node> parser::accept_binary_operator(unsigned minPrecedence)
   {
-    auto binOpNode = create_node<binary_operator_node>();
+    // Nodes are only made once there's an operator, most expressions are a
+    // single value and would leave a discarded node behind otherwise
+    auto binOpBegin = m_current;
 
-    auto leftNode = (this->*leftRecurse)();
+    auto leftNode = accept_unary_operator();
     if (!leftNode)
       return nullptr;
 
-  again:
-    for (auto op = operators; *op; ++op)
+    for (;;)
     {
-      disallow_skip_newlines();
-      if (!accept(*op))
-      {
-        pop_skip_newlines();
-        continue;
-      }
-      pop_skip_newlines();
+      // Binary operators have to be on the same line as their left hand side
+      if (m_panic || at_end_of_stream() || m_current->line_number() != m_lastLineNum)
+        break;
+
+      unsigned precedence = binary_precedence[m_current->type()];
+      if (precedence == precedence::NONE || precedence < minPrecedence)
+        break;
 
+      accept(m_current->type());
+
+      auto binOpNode = create_node<binary_operator_node>();
+      binOpNode->begin = binOpBegin;
       binOpNode->left = move(leftNode);
       binOpNode->operation = last_token();
 
-      binOpNode->right = (this->*rightRecurse)();
+      // Assignments take the whole expression on their right, which makes
+      // them right associative. Everything else is left associative, so the
+      // right hand side only takes operators that bind tighter.
+      if (precedence == precedence::ASSIGNMENT)
+        binOpNode->right = accept_expression();
+      else
+        binOpNode->right = accept_binary_operator(precedence + 1);
 
-      if (!binOpNode) REJECT_RULE_ERROR("No right hand side for binary operator expression");
+      if (!binOpNode->right)
+      {
+        report_error("No right hand side for binary operator expression");
+        return nullptr;
+      }
 
+      binOpNode->end = m_current;
       leftNode = move(binOpNode);
-      binOpNode = create_node<binary_operator_node>();
-      goto again;
     }
 
     return leftNode;
   }
 
-  unique_ptr<expression_node> parser::accept_generic_expression(
-    unique_ptr<expression_node>(parser::*recurse)(),
-    const token_types::type *operators)
-  {
-    return accept_generic_expression(recurse, recurse, operators);
-  }
-
-  unique_ptr<expression_node> parser::accept_multiplication()
-  {
-    ENTER_RULE(multiplication);
-
-    static const token_types::type operators[] =
-    {
-      token_types::ASTRISK,
-      token_types::DIVIDE,
-      token_types::MODULO,
-      token_types::INVALID
-    };
-
-    auto node = accept_generic_expression(&parser::accept_unary_operator, operators);
-
-    if (node)
-      ACCEPT_RULE(node);
-    else
-      REJECT_RULE();
-  }
-
-  unique_ptr<expression_node> parser::accept_addition()
-  {
-    ENTER_RULE(addition);
-
-    static const token_types::type operators[] =
-    {
-      token_types::ADD,
-      token_types::SUBTRACT,
-      token_types::INVALID
-    };
-
-    auto node = accept_generic_expression(&parser::accept_multiplication, operators);
-
-    if (node)
-      ACCEPT_RULE(node);
-    else
-      REJECT_RULE();
-  }
-
-  unique_ptr<expression_node> parser::accept_bitwise_shift()
-  {
-    ENTER_RULE(bitwise shift);
-
-    static const token_types::type operators[] =
-    {
-      token_types::BITWISE_LEFT_SHIFT,
-      token_types::BITWISE_RIGHT_SHIFT,
-      token_types::INVALID
-    };
-
-    auto node = accept_generic_expression(&parser::accept_addition, operators);
-
-    if (node)
-      ACCEPT_RULE(node);
-    else
-      REJECT_RULE();
-  }
-
-  unique_ptr<expression_node> parser::accept_comparison()
-  {
-    ENTER_RULE(comparison);
-
-    static const token_types::type operators[] =
-    {
-      token_types::GREATER_THAN,
-      token_types::LESS_THAN,
-      token_types::GREATER_THAN_OR_EQUAL,
-      token_types::LESS_THAN_OR_EQUAL,
-      token_types::INVALID
-    };
-
-    auto node = accept_generic_expression(&parser::accept_bitwise_shift, operators);
-
-    if (node)
-      ACCEPT_RULE(node);
-    else
-      REJECT_RULE();
-  }
-
-  unique_ptr<expression_node> parser::accept_equality()
-  {
-    ENTER_RULE(equality);
-
-    static const token_types::type operators[] =
-    {
-      token_types::EQUALITY,
-      token_types::INEQUALITY,
-      token_types::INVALID
-    };
-
-    auto node = accept_generic_expression(&parser::accept_comparison, operators);
-
-    if (node)
-      ACCEPT_RULE(node);
-    else
-      REJECT_RULE();
-  }
-
-  unique_ptr<expression_node> parser::accept_bitwise_conjunction()
-  {
-    ENTER_RULE(bitwise conjunction);
-
-    static const token_types::type operators[] =
-    {
-      token_types::AMPERSAND,
-      token_types::BITWISE_OR,
-      token_types::BITWISE_XOR,
-      token_types::INVALID
-    };
-
-    auto node = accept_generic_expression(&parser::accept_equality, operators);
-
-    if (node)
-      ACCEPT_RULE(node);
-    else
-      REJECT_RULE();
-  }
-
-  unique_ptr<expression_node> parser::accept_logical_conjunction()
-  {
-    ENTER_RULE(logical conjunction);
-
-    static const token_types::type operators[] =
-    {
-      token_types::LOGICAL_AND,
-      token_types::LOGICAL_OR,
-      token_types::INVALID
-    };
-
-    auto node = accept_generic_expression(&parser::accept_bitwise_conjunction, operators);
-
-    if (node)
-      ACCEPT_RULE(node);
-    else
-      REJECT_RULE();
-  }
-
-  unique_ptr<expression_node> parser::accept_assignment()
-  {
-    ENTER_RULE(logical conjunction);
-
-    static const token_types::type operators[] =
-    {
-      token_types::ASSIGNMENT,
-      token_types::ASSIGNMENT_ADD,
-      token_types::ASSIGNMENT_SUBTRACT,
-      token_types::ASSIGNMENT_MULTIPLY,
-      token_types::ASSIGNMENT_DIVIDE,
-      token_types::ASSIGNMENT_MODULO,
-      token_types::ASSIGNMENT_BITWISE_LEFT_SHIFT,
-      token_types::ASSIGNMENT_BITWISE_RIGHT_SHIFT,
-      token_types::ASSIGNMENT_BITWISE_AND,
-      token_types::ASSIGNMENT_BITWISE_OR,
-      token_types::ASSIGNMENT_BITWISE_XOR,
-      token_types::ASSIGNMENT_LOGICAL_AND,
-      token_types::ASSIGNMENT_LOGICAL_OR,
-      token_types::INVALID
-    };
-
-    auto node = accept_generic_expression(&parser::accept_logical_conjunction, &parser::accept_expression, operators);
-
-    if (node)
-      ACCEPT_RULE(node);
-    else
-      REJECT_RULE();
-  }
-
   unique_ptr<expression_node> parser::accept_typename()
   {
     ENTER_RULE(typename);
@@ -1042,7 +974,7 @@ namespace brandy
       ACCEPT_RULE(returnNode);
     else if (auto breakNode = accept_break())
       ACCEPT_RULE(breakNode);
-    else if (auto continueNode = accept_break())
+    else if (auto continueNode = accept_continue())
       ACCEPT_RULE(continueNode);
     else if (auto labelNode = accept_label())
       ACCEPT_RULE(labelNode);
@@ -1147,10 +1079,11 @@ namespace brandy
 
   unique_ptr<statement_node> parser::accept_continue()
   {
-    ENTER_RULE(break);
+    ENTER_RULE(continue);
+
     auto continueNode = create_node<continue_node>();
 
-    if (!accept(token_types::BREAK))
+    if (!accept(token_types::CONTINUE))
       REJECT_RULE();
 
     if (accept(token_types::I32_LITERAL))
@@ -1391,12 +1324,18 @@ namespace brandy
 
     while (!accept(token_types::CLOSE_CURLY))
     {
+      auto memberBegin = m_current;
+
       if (auto statement = accept_statement())
         metaNode->statements.push_back(move(statement));
       else if (auto symbol = accept_symbol())
         metaNode->symbols.push_back(move(symbol));
-      else
+      else if (at_end_of_stream())
         REJECT_RULE_ERROR("Meta blocks can only contain symbols and statements");
+      else
+        report_error("Meta blocks can only contain symbols and statements");
+
+      if (m_panic) synchronize(memberBegin);
     }
 
     ACCEPT_RULE(metaNode);
@@ -1620,9 +1559,16 @@ namespace brandy
     }
     else if (accept(token_types::OPEN_CURLY))
     {
-      while (auto statement = accept_statement())
+      for (;;)
       {
-        scopeNode->statements.push_back(move(statement));
+        auto statementBegin = m_current;
+
+        if (auto statement = accept_statement())
+          scopeNode->statements.push_back(move(statement));
+        else if (!m_panic)
+          break;
+
+        if (m_panic) synchronize(statementBegin);
       }
 
       expect(token_types::CLOSE_CURLY);
@@ -1636,7 +1582,7 @@ namespace brandy
 
   bool parser::accept(token_types::type type)
   {
-    if (at_end_of_stream()) return false;
+    if (m_panic || at_end_of_stream()) return false;
 
     // If currently not allowing for newlines,
     // don't accept tokens on a different line
@@ -1660,7 +1606,7 @@ namespace brandy
   void parser::expect(token_types::type type)
   {
     if (!accept(type))
-      throw parsing_error("Expected token of different type", m_current);
+      report_error("Expected token of different type");
   }
 
   // ---------------------------------------------------------------------------
@@ -1686,7 +1632,7 @@ namespace brandy
     }
     else
     {
-      throw parsing_error("Expected a semicolon or newline", m_current);
+      report_error("Expected a semicolon or newline");
     }
   }
 
@@ -1700,13 +1646,10 @@ namespace brandy
     }
     else
     {
-      for (auto it = m_current; it != m_tokens.end(); ++it)
-      {
-        if (it->line_number() != m_lastLineNum)
-          break;
-        else if (it->type() == token_types::COMMA)
-          return true;
-      }
+      // A comma further along the line means a call with several parameters
+      if (m_current->line_number() == m_lastLineNum &&
+        m_lines.comma_ahead(m_current - m_tokens.begin()))
+        return true;
 
       return
         m_current->type() != token_types::SUBTRACT &&
@@ -1717,6 +1660,51 @@ namespace brandy
 
   // ---------------------------------------------------------------------------
 
+  void parser::report_error(const char *error)
+  {
+    if (!m_panic)
+      m_errors.emplace_back(error, m_current);
+
+    m_panic = true;
+  }
+
+  void parser::synchronize(std::vector<token>::const_iterator begin)
+  {
+    m_panic = false;
+
+    // Stop at the end of the line, after a semicolon, or before the curly
+    // closing the enclosing scope. Anything in curlies opened on the way is
+    // skipped whole so the body of a broken header isn't parsed on its own.
+    // Always skip something if nothing was taken since begin, else the
+    // same error would come straight back.
+    bool skipped = m_current != begin;
+    size_t line = m_lastLineNum;
+    size_t depth = 0;
+
+    while (!at_end_of_stream())
+    {
+      auto type = m_current->type();
+
+      if (depth == 0 && skipped &&
+        (type == token_types::CLOSE_CURLY || m_current->line_number() != line))
+        break;
+
+      if (type == token_types::OPEN_CURLY)
+        ++depth;
+      else if (type == token_types::CLOSE_CURLY && depth > 0)
+        --depth;
+
+      line = m_lastLineNum = m_current->line_number();
+      ++m_current;
+      skipped = true;
+
+      if (depth == 0 && type == token_types::SEMICOLON)
+        break;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
   void parser::disallow_skip_newlines()
   {
     //++m_disallowNewlines;
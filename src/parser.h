@@ -9,6 +9,9 @@
 #pragma once
 
 #include "astnodes.h"
+#include "context.h"
+#include "lineindex.h"
+#include "parsertrace.h"
 #include "tokens.h"
 #include <stack>
 #include <vector>
@@ -37,9 +40,8 @@ namespace brandy
   class parser
   {
   public:
-    parser();
-    parser(const std::vector<token> &tokens);
-    parser(std::vector<token> &&tokens);
+    parser(const compilation_context &context, const std::vector<token> &tokens);
+    parser(const compilation_context &context, std::vector<token> &&tokens);
     
     bool at_end_of_stream();
 
@@ -47,6 +49,10 @@ namespace brandy
 
     const std::vector<token> &tokens() const;
 
+    // Everything wrong with the module, in the order it was found. Parsing
+    // picks up again after an error, so one parse reports them all.
+    const std::vector<parsing_error> &errors() const;
+
   private:
     unique_ptr<module_node> accept_module();
 
@@ -72,24 +78,11 @@ namespace brandy
     unique_ptr<name_reference_node> accept_name_reference();
     unique_ptr<expression_node> accept_value();
 
-    unique_ptr<expression_node> accept_generic_expression(
-      unique_ptr<expression_node>(parser::*leftRecurse)(), 
-      unique_ptr<expression_node>(parser::*rightRecurse)(),
-      const token_types::type *operators);
+    unique_ptr<expression_node> accept_unary_operator();
 
-    unique_ptr<expression_node> accept_generic_expression(
-      unique_ptr<expression_node>(parser::*recurse)(),
-      const token_types::type *operators);
+    // Parses binary operators binding at least as tightly as minPrecedence
+    unique_ptr<expression_node> accept_binary_operator(unsigned minPrecedence);
 
-    unique_ptr<expression_node> accept_unary_operator();
-    unique_ptr<expression_node> accept_multiplication();
-    unique_ptr<expression_node> accept_addition();
-    unique_ptr<expression_node> accept_bitwise_shift();
-    unique_ptr<expression_node> accept_comparison();
-    unique_ptr<expression_node> accept_equality();
-    unique_ptr<expression_node> accept_bitwise_conjunction();
-    unique_ptr<expression_node> accept_logical_conjunction();
-    unique_ptr<expression_node> accept_assignment();
     unique_ptr<expression_node> accept_typename();
 
     unique_ptr<statement_node> accept_delimited_statement();
@@ -123,6 +116,14 @@ namespace brandy
 
     bool allows_for_noparen_call();
 
+    // Records an error at the current token. No more tokens are accepted
+    // until synchronize(), so the rules unwind back up to a statement or
+    // declaration list, and errors hit while unwinding aren't recorded.
+    void report_error(const char *error);
+
+    // Skips what's left of a broken statement or declaration started at begin
+    void synchronize(std::vector<token>::const_iterator begin);
+
     void disallow_skip_newlines();
     void allow_skip_newlines();
     void pop_skip_newlines();
@@ -133,7 +134,7 @@ namespace brandy
     template<typename node_type>
     typename std::unique_ptr<node_type> create_node()
     {
-      auto node = make_unique<node_type>();
+      auto node = make_node<node_type>(*m_arena);
       node->begin = m_current;
       return node;
     }
@@ -147,11 +148,23 @@ namespace brandy
       parser *m_parser;
     };
 
+    const compilation_context &m_context;
+
     const std::vector<token> m_tokens;
+    const line_index m_lines;
     std::vector<token>::const_iterator m_current;
     //unsigned m_disallowNewlines;
     std::stack<bool> m_disallowNewLines;
     size_t m_lastLineNum;
+
+    std::vector<parsing_error> m_errors;
+    bool m_panic;
+
+    // The arena of the module being parsed, owned by that module
+    node_arena *m_arena;
+
+    // Shared by the rule trackers of this parser, see parser_trace
+    parser_trace::state m_trace;
   };
 
   // ---------------------------------------------------------------------------
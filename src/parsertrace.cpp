@@ -0,0 +1,118 @@
+// -----------------------------------------------------------------------------
+// Brandy parser tracing
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "parsertrace.h"
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  void no_trace::state::start(bool dumpStack, bool dumpTimings)
+  {
+    if (dumpStack || dumpTimings)
+      std::cout << "Parser tracing isn't built in, rebuild with BRANDY_TRACE_PARSER" << std::endl;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  stack_trace::state::state() :
+    m_traceStack(false),
+    m_traceTimings(false),
+    m_depth(0)
+  {
+  }
+
+  void stack_trace::state::start(bool dumpStack, bool dumpTimings)
+  {
+    m_traceStack = dumpStack;
+    m_traceTimings = dumpTimings;
+  }
+
+  void stack_trace::state::finish()
+  {
+    while (!m_accepted.empty())
+    {
+      auto top = m_accepted.top();
+
+      for (size_t i = 0; i < top.first - 1; ++i)
+        std::cout << "  ";
+
+      std::cout << top.second << std::endl;
+
+      m_accepted.pop();
+    }
+
+    if (m_traceTimings)
+    {
+      std::vector<std::pair<std::string, rule_timing>> rules(m_timings.begin(), m_timings.end());
+      std::sort(rules.begin(), rules.end(), [](const std::pair<std::string, rule_timing> &lhs, const std::pair<std::string, rule_timing> &rhs)
+      {
+        return lhs.second.total > rhs.second.total;
+      });
+
+      std::cout << std::left << std::setw(24) << "rule" << std::right
+        << std::setw(12) << "calls" << std::setw(12) << "accepted" << std::setw(12) << "total ms" << std::endl;
+
+      for (auto &rule : rules)
+      {
+        double ms = std::chrono::duration<double, std::milli>(rule.second.total).count();
+
+        std::cout << std::left << std::setw(24) << rule.first << std::right
+          << std::setw(12) << rule.second.calls << std::setw(12) << rule.second.accepted
+          << std::setw(12) << std::fixed << std::setprecision(3) << ms << std::endl;
+      }
+
+      m_timings.clear();
+    }
+
+    m_traceStack = false;
+    m_traceTimings = false;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  stack_trace::stack_trace(const char *text, state &trace) :
+    m_text(text),
+    m_state(trace),
+    m_accepted(false)
+  {
+    ++m_state.m_depth;
+
+    if (m_state.m_traceTimings)
+      m_start = std::chrono::steady_clock::now();
+  }
+
+  stack_trace::~stack_trace()
+  {
+    --m_state.m_depth;
+
+    if (m_state.m_traceTimings)
+    {
+      // Time spent in rules this one called counts towards it too
+      state::rule_timing &timing = m_state.m_timings[m_text];
+      ++timing.calls;
+      timing.accepted += m_accepted ? 1 : 0;
+      timing.total += std::chrono::steady_clock::now() - m_start;
+    }
+  }
+
+  void stack_trace::accept()
+  {
+    m_accepted = true;
+
+    if (m_state.m_traceStack)
+      m_state.m_accepted.emplace(m_state.m_depth, m_text);
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,100 @@
+// -----------------------------------------------------------------------------
+// Brandy parser tracing
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#ifndef PARSER_TRACE_H
+#define PARSER_TRACE_H
+
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <stack>
+#include <string>
+#include <utility>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  // What the parser's rule tracker does besides undoing rejected rules is
+  // picked when building. no_trace is empty and compiles away, so a normal
+  // build pays nothing for tracing. Defining BRANDY_TRACE_PARSER (the Debug
+  // configuration does) uses stack_trace instead, which records the accepted
+  // rules for --dump-parser-stack and the time taken by each kind of rule
+  // for --dump-parser-timings.
+  //
+  // Each parser owns a policy::state the trackers of its rules share, so
+  // separate parsers can trace on separate threads.
+  class no_trace
+  {
+  public:
+    class state
+    {
+    public:
+      void start(bool dumpStack, bool dumpTimings);
+      void finish() {}
+    };
+
+    no_trace(const char *, state &) {}
+
+    void accept() {}
+  };
+
+  class stack_trace
+  {
+  public:
+    class state
+    {
+    public:
+      state();
+
+      // Turns tracing on for one parse, and prints what was asked for after it
+      void start(bool dumpStack, bool dumpTimings);
+      void finish();
+
+    private:
+      friend class stack_trace;
+
+      struct rule_timing
+      {
+        size_t calls;
+        size_t accepted;
+        std::chrono::steady_clock::duration total;
+      };
+
+      bool m_traceStack;
+      bool m_traceTimings;
+
+      size_t m_depth;
+      std::stack<std::pair<size_t, const char *>> m_accepted;
+      std::map<std::string, rule_timing> m_timings;
+    };
+
+    stack_trace(const char *text, state &trace);
+    ~stack_trace();
+
+    void accept();
+
+  private:
+    const char *m_text;
+    state &m_state;
+    bool m_accepted;
+    std::chrono::steady_clock::time_point m_start;
+  };
+
+#ifdef BRANDY_TRACE_PARSER
+  typedef stack_trace parser_trace;
+#else
+  typedef no_trace parser_trace;
+#endif
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,357 @@
+// -----------------------------------------------------------------------------
+// Brandy semantic pass manager
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "passmanager.h"
+
+#include "functionreturnvisitor.h"
+#include "symbolfillervisitor.h"
+#include "namereferenceresolvervisitor.h"
+#include "binopnodereplacervisitor.h"
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    typedef pass_profiler::clock clock;
+
+    // Visits every node with each of a walk's passes in turn. The node's own
+    // type is kept, so every pass still gets its most specific overload.
+    //
+    // Given somewhere to put them, it keeps each pass's stats and counts the
+    // nodes it walks, and how much the module's arena grew in each pass.
+    //
+    // Given the arena of a module that borrows nodes, it doesn't go into any
+    // node from another arena. Only class members are borrowed, so those are
+    // always visited to check.
+    class fused_visitor : public ast_visitor
+    {
+    public:
+      fused_visitor(const std::vector<std::unique_ptr<ast_visitor>> &passes,
+        pass_profiler::stats *stats = nullptr, const node_arena *arena = nullptr, const node_arena *home = nullptr) :
+        m_active(passes.size(), true),
+        m_stats(stats),
+        m_arena(arena),
+        m_home(home),
+        m_nodes(0)
+      {
+        // Nodes no pass looks at are walked straight through. A pass that
+        // skips a kind still needs to see it, to know when to start again.
+        handled_kinds = 0;
+        skipped_kinds = ALL_NODE_KINDS;
+
+        for (auto &pass : passes)
+        {
+          m_passes.push_back(pass.get());
+          handled_kinds |= pass->handled_kinds | pass->skipped_kinds;
+          skipped_kinds &= pass->skipped_kinds;
+        }
+
+        if (m_home)
+          handled_kinds |= node_kinds_of<symbol_node>::value;
+      }
+
+#define FUSED_VISIT(node_type)\
+      ast_visitor::visitor_result visit(node_type *node) override { return visit_all(node); }
+
+      FUSED_VISIT(abstract_node)
+      FUSED_VISIT(module_node)
+      FUSED_VISIT(symbol_node)
+      FUSED_VISIT(expression_node)
+      FUSED_VISIT(post_expression_node)
+      FUSED_VISIT(statement_node)
+      FUSED_VISIT(class_node)
+      FUSED_VISIT(function_node)
+      FUSED_VISIT(var_node)
+      FUSED_VISIT(parameter_node)
+      FUSED_VISIT(property_node)
+      FUSED_VISIT(binary_operator_node)
+      FUSED_VISIT(unary_operator_node)
+      FUSED_VISIT(member_access_node)
+      FUSED_VISIT(call_node)
+      FUSED_VISIT(cast_node)
+      FUSED_VISIT(index_node)
+      FUSED_VISIT(tuple_expansion_node)
+      FUSED_VISIT(literal_node)
+      FUSED_VISIT(tuple_literal_node)
+      FUSED_VISIT(table_literal_node)
+      FUSED_VISIT(lambda_capture_node)
+      FUSED_VISIT(lambda_node)
+      FUSED_VISIT(name_reference_node)
+      FUSED_VISIT(goto_node)
+      FUSED_VISIT(label_node)
+      FUSED_VISIT(return_node)
+      FUSED_VISIT(break_node)
+      FUSED_VISIT(continue_node)
+      FUSED_VISIT(if_node)
+      FUSED_VISIT(while_node)
+      FUSED_VISIT(for_node)
+      FUSED_VISIT(import_node)
+      FUSED_VISIT(meta_node)
+      FUSED_VISIT(typedef_node)
+      FUSED_VISIT(type_node)
+      FUSED_VISIT(tuple_node)
+      FUSED_VISIT(delegate_node)
+      FUSED_VISIT(plain_type_node)
+      FUSED_VISIT(decltype_node)
+      FUSED_VISIT(post_type_node)
+      FUSED_VISIT(type_indirect_node)
+      FUSED_VISIT(type_array_node)
+      FUSED_VISIT(type_template_node)
+      FUSED_VISIT(qualifier_node)
+      FUSED_VISIT(attribute_node)
+      FUSED_VISIT(scope_node)
+
+#undef FUSED_VISIT
+
+      void leave(abstract_node *node) override
+      {
+        const node_kind_set kind = kind_bit(node->kind);
+
+        for (size_t i = m_passes.size(); i-- > 0;)
+        {
+          if (!m_active[i] || !(m_passes[i]->handled_kinds & kind)) continue;
+
+          if (!m_stats)
+          {
+            m_passes[i]->leave(node);
+            continue;
+          }
+
+          const clock::time_point start = clock::now();
+          const size_t bytes = m_arena->bytes_allocated();
+
+          m_passes[i]->leave(node);
+
+          m_stats[i].time += clock::now() - start;
+          m_stats[i].arena_bytes += m_arena->bytes_allocated() - bytes;
+        }
+
+        // Passes that stopped at this node get the rest of the tree back
+        if (!m_stops.empty() && m_stops.back().node == node)
+        {
+          restart(m_stops.back().first);
+          m_stops.pop_back();
+        }
+      }
+
+      size_t nodes() const
+      {
+        return m_nodes;
+      }
+
+    private:
+      // Passes that returned stop at a node, from first in m_stopped
+      struct stop_frame
+      {
+        abstract_node *node;
+        size_t first;
+      };
+
+      template<typename node_type>
+      ast_visitor::visitor_result visit_all(node_type *node)
+      {
+        const size_t firstStopped = m_stopped.size();
+        const node_kind_set kind = kind_bit(node->kind);
+        bool walking = false;
+
+        if (m_home && node_arena::owner(node) != m_home)
+          return ast_visitor::stop;
+
+        ++m_nodes;
+
+        for (size_t i = 0; i < m_passes.size(); ++i)
+        {
+          if (!m_active[i]) continue;
+
+          ast_visitor::visitor_result result;
+
+          if (m_passes[i]->skipped_kinds & kind)
+            result = ast_visitor::stop;
+          else if (!(m_passes[i]->handled_kinds & kind))
+            result = ast_visitor::resume;
+          else if (m_stats)
+            result = profiled_visit(i, node);
+          else
+            result = m_passes[i]->visit(node);
+
+          switch (result)
+          {
+          case ast_visitor::resume:
+            walking = true;
+            break;
+          case ast_visitor::stop:
+            m_active[i] = false;
+            m_stopped.push_back(i);
+            break;
+          case ast_visitor::replace:
+            // Every pass starts over on the new node
+            replacement_node = std::move(m_passes[i]->replacement_node);
+            restart(firstStopped);
+            return result;
+          case ast_visitor::rewalk:
+            restart(firstStopped);
+            return result;
+          }
+        }
+
+        if (m_stopped.size() == firstStopped)
+          return ast_visitor::resume;
+
+        // Nothing wants the children, so there's no leave to undo this in
+        if (!walking)
+        {
+          restart(firstStopped);
+          return ast_visitor::stop;
+        }
+
+        stop_frame frame = { node, firstStopped };
+        m_stops.push_back(frame);
+        return ast_visitor::resume;
+      }
+
+      template<typename node_type>
+      ast_visitor::visitor_result profiled_visit(size_t pass, node_type *node)
+      {
+        const clock::time_point start = clock::now();
+        const size_t bytes = m_arena->bytes_allocated();
+
+        ast_visitor::visitor_result result = m_passes[pass]->visit(node);
+
+        pass_profiler::stats &stats = m_stats[pass];
+        stats.time += clock::now() - start;
+        stats.arena_bytes += m_arena->bytes_allocated() - bytes;
+        ++stats.count;
+
+        if (result == ast_visitor::replace)
+          ++stats.replaced;
+
+        return result;
+      }
+
+      void restart(size_t firstStopped)
+      {
+        for (size_t i = firstStopped; i < m_stopped.size(); ++i)
+          m_active[m_stopped[i]] = true;
+
+        m_stopped.resize(firstStopped);
+      }
+
+      std::vector<ast_visitor *> m_passes;
+
+      // Whether each pass is walking the current part of the tree
+      std::vector<bool> m_active;
+
+      std::vector<size_t> m_stopped;
+      std::vector<stop_frame> m_stops;
+
+      // One for each pass, only when profiling
+      pass_profiler::stats *m_stats;
+      const node_arena *m_arena;
+      const node_arena *m_home;
+      size_t m_nodes;
+    };
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void pass_manager::add(const char *name, std::unique_ptr<ast_visitor> pass, ordering order)
+  {
+    if (m_walks.empty() || order == after_earlier)
+      m_walks.emplace_back();
+
+    m_walks.back().passes.push_back(std::move(pass));
+    m_walks.back().names.push_back(name);
+  }
+
+  void pass_manager::run(module_node *module, pass_profiler *profiler, const std::string &path)
+  {
+    for (walk &passes : m_walks)
+    {
+      if (profiler)
+      {
+        run_profiled(module, passes, *profiler, path);
+        continue;
+      }
+
+      // A lone pass doesn't need anything in between
+      if (passes.passes.size() == 1 && !module->borrows_nodes)
+      {
+        walk_node(module, passes.passes.front().get());
+        continue;
+      }
+
+      fused_visitor fused(passes.passes, nullptr, nullptr, module->borrows_nodes ? node_arena::owner(module) : nullptr);
+      walk_node(module, &fused);
+    }
+  }
+
+  // Every walk goes through a fused_visitor when profiling, even a lone pass,
+  // so there's somewhere to count from. Timing each call costs a little, and
+  // that lands in the time between nodes.
+  void pass_manager::run_profiled(module_node *module, walk &passes, pass_profiler &profiler, const std::string &path)
+  {
+    const node_arena *arena = node_arena::owner(module);
+    std::vector<pass_profiler::stats> stats(passes.passes.size());
+
+    fused_visitor fused(passes.passes, stats.data(), arena, module->borrows_nodes ? arena : nullptr);
+
+    const size_t bytes = arena->bytes_allocated();
+    const clock::time_point start = clock::now();
+
+    walk_node(module, &fused);
+
+    const clock::time_point end = clock::now();
+
+    pass_profiler::stats walkStats;
+    walkStats.time = end - start;
+    walkStats.count = fused.nodes();
+    walkStats.arena_bytes = arena->bytes_allocated() - bytes;
+
+    pass_profiler::stats between;
+    between.time = walkStats.time;
+    between.count = fused.nodes();
+
+    std::string name;
+
+    for (size_t i = 0; i < stats.size(); ++i)
+    {
+      profiler.add(passes.names[i], stats[i]);
+
+      between.time -= stats[i].time;
+      walkStats.replaced += stats[i].replaced;
+
+      if (!name.empty()) name += " + ";
+      name += passes.names[i];
+    }
+
+    profiler.add("walking the tree", between);
+    profiler.trace(name, path, start, end, walkStats);
+  }
+
+  size_t pass_manager::walk_count() const
+  {
+    return m_walks.size();
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void add_semantic_passes(pass_manager &passes)
+  {
+    passes.add<function_return_visitor>("function returns");
+    passes.add<symbol_table_filler_visitor>("symbol tables");
+
+    // Names can be used before the line that declares them
+    passes.add<name_reference_resolver_visitor>("name resolution", pass_manager::after_earlier);
+    passes.add<bin_op_replacer_visitor>("operator overloads");
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
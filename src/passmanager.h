@@ -0,0 +1,99 @@
+// -----------------------------------------------------------------------------
+// Brandy semantic pass manager
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#ifndef PASS_MANAGER_H
+#define PASS_MANAGER_H
+
+#pragma once
+
+#include "astnodes.h"
+#include "passprofiler.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  // Runs passes over a module in the order they're added. Passes that don't
+  // need the whole module to have been through the ones before them share a
+  // walk, so the tree is only pulled through the cache once for all of them.
+  //
+  // In a shared walk every pass visits a node before any of them move on to
+  // its children, in the order they were added, and leave is called on them
+  // in reverse. A pass returning stop only skips the node's children for
+  // itself. A pass that replaces nodes has to come after any pass in its walk
+  // that keeps state on the node being replaced, since they never leave it.
+  // Each pass is only called for the kinds of node it handles.
+  //
+  // Given a pass_profiler, run reports each pass's time, the nodes it visited
+  // and replaced and the nodes it allocated, with the time spent getting
+  // between nodes on its own line.
+  class pass_manager
+  {
+  public:
+    enum ordering
+    {
+      // Can share a walk with the passes added before it
+      same_walk,
+
+      // Needs every earlier pass to have been over the whole module first,
+      // IE it looks up names that may only be declared further on
+      after_earlier
+    };
+
+    // The name is what the profiler reports it as
+    template<typename pass_type>
+    void add(const char *name, ordering order = same_walk)
+    {
+      add(name, std::unique_ptr<ast_visitor>(new pass_type()), order);
+    }
+
+    void add(const char *name, std::unique_ptr<ast_visitor> pass, ordering order = same_walk);
+
+    // The path is only for the profiler's trace
+    void run(module_node *module, pass_profiler *profiler = nullptr, const std::string &path = std::string());
+
+    // How many times run walks the tree
+    size_t walk_count() const;
+
+  private:
+    struct walk
+    {
+      walk() { }
+
+      // VS2013 doesn't generate the moves, which m_walks needs to grow
+      walk(walk &&other) : passes(std::move(other.passes)), names(std::move(other.names)) { }
+
+      walk &operator=(walk &&other)
+      {
+        passes = std::move(other.passes);
+        names = std::move(other.names);
+        return *this;
+      }
+
+      std::vector<std::unique_ptr<ast_visitor>> passes;
+      std::vector<const char *> names;
+    };
+
+    void run_profiled(module_node *module, walk &passes, pass_profiler &profiler, const std::string &path);
+
+    std::vector<walk> m_walks;
+  };
+
+  // ---------------------------------------------------------------------------
+
+  // The passes every module goes through once it's parsed, in order
+  void add_semantic_passes(pass_manager &passes);
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
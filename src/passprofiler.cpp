@@ -0,0 +1,211 @@
+// -----------------------------------------------------------------------------
+// Brandy compile time profiler
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "passprofiler.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <stdio.h>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    double milliseconds(pass_profiler::clock::duration time)
+    {
+      return std::chrono::duration<double, std::milli>(time).count();
+    }
+
+    double microseconds(pass_profiler::clock::duration time)
+    {
+      return std::chrono::duration<double, std::micro>(time).count();
+    }
+
+    void write_json_string(std::ostream &out, const std::string &text)
+    {
+      out << '"';
+      for (char c : text)
+      {
+        switch (c)
+        {
+        case '"':  out << "\\\""; break;
+        case '\\': out << "\\\\"; break;
+        case '\n': out << "\\n"; break;
+        case '\t': out << "\\t"; break;
+        default:
+          if (static_cast<unsigned char>(c) < 0x20)
+          {
+            char escaped[8];
+            sprintf(escaped, "\\u%04x", c);
+            out << escaped;
+          }
+          else
+          {
+            out << c;
+          }
+        }
+      }
+      out << '"';
+    }
+
+    void add_stats(pass_profiler::stats &totals, const pass_profiler::stats &more)
+    {
+      totals.time += more.time;
+      totals.count += more.count;
+      totals.replaced += more.replaced;
+      totals.arena_bytes += more.arena_bytes;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  pass_profiler::stats::stats() :
+    time(clock::duration::zero()),
+    count(0),
+    replaced(0),
+    arena_bytes(0)
+  {
+  }
+
+  pass_profiler::pass_profiler() :
+    m_start(clock::now())
+  {
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void pass_profiler::add(const char *stage, const stats &stageStats)
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    auto found = std::find_if(m_stages.begin(), m_stages.end(), [stage](const pass_profiler::stage &existing)
+    {
+      return existing.name == stage;
+    });
+
+    if (found == m_stages.end())
+    {
+      m_stages.push_back(pass_profiler::stage());
+      m_stages.back().name = stage;
+      found = m_stages.end() - 1;
+    }
+
+    add_stats(found->totals, stageStats);
+  }
+
+  void pass_profiler::trace(const std::string &name, const std::string &module,
+    clock::time_point start, clock::time_point end, const stats &spanStats)
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    span work;
+    work.name = name;
+    work.module = module;
+    work.thread = thread_index();
+    work.start = start;
+    work.end = end;
+    work.totals = spanStats;
+    m_spans.push_back(work);
+  }
+
+  // Numbers the threads in the order they first report, so the trace has
+  // small, stable row ids. Called with the lock held.
+  size_t pass_profiler::thread_index()
+  {
+    std::thread::id current = std::this_thread::get_id();
+
+    auto found = std::find(m_threads.begin(), m_threads.end(), current);
+    if (found != m_threads.end())
+      return size_t(found - m_threads.begin());
+
+    m_threads.push_back(current);
+    return m_threads.size() - 1;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void pass_profiler::print_summary(std::ostream &out) const
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    stats total;
+    for (auto &stage : m_stages)
+      add_stats(total, stage.totals);
+
+    // Threads overlap, so the percentages are of the time spent working
+    const double totalMs = std::max(milliseconds(total.time), 1e-9);
+
+    out << "Compile time by stage, summed over every module and thread\n";
+    out << std::left << std::setw(28) << "Stage" << std::right
+      << std::setw(12) << "Time (ms)" << std::setw(8) << "%"
+      << std::setw(14) << "Count" << std::setw(12) << "Replaced"
+      << std::setw(14) << "Arena (KB)" << '\n';
+
+    auto row = [&](const std::string &name, const stats &totals)
+    {
+      const double ms = milliseconds(totals.time);
+      out << std::left << std::setw(28) << name << std::right << std::fixed
+        << std::setw(12) << std::setprecision(2) << ms
+        << std::setw(8) << std::setprecision(1) << ms * 100.0 / totalMs
+        << std::setw(14) << totals.count << std::setw(12) << totals.replaced
+        << std::setw(14) << totals.arena_bytes / 1024 << '\n';
+    };
+
+    for (auto &stage : m_stages)
+      row(stage.name, stage.totals);
+
+    row("Total", total);
+    out << std::defaultfloat;
+  }
+
+  bool pass_profiler::write_trace(const char *filename) const
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    std::ofstream out(filename);
+    if (!out)
+      return false;
+
+    // Complete ("X") events, times in microseconds from when the profiler
+    // was made
+    out << "{\"traceEvents\":[\n";
+
+    for (size_t i = 0; i < m_threads.size(); ++i)
+    {
+      out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << i
+        << ",\"args\":{\"name\":\"worker " << i << "\"}},\n";
+    }
+
+    out << std::fixed << std::setprecision(3);
+
+    for (size_t i = 0; i < m_spans.size(); ++i)
+    {
+      const span &work = m_spans[i];
+
+      out << "{\"name\":";
+      write_json_string(out, work.name);
+      out << ",\"cat\":\"compile\",\"ph\":\"X\",\"pid\":1,\"tid\":" << work.thread
+        << ",\"ts\":" << microseconds(work.start - m_start)
+        << ",\"dur\":" << microseconds(work.end - work.start)
+        << ",\"args\":{\"module\":";
+      write_json_string(out, work.module);
+      out << ",\"count\":" << work.totals.count
+        << ",\"replaced\":" << work.totals.replaced
+        << ",\"arena_bytes\":" << work.totals.arena_bytes << "}}"
+        << (i + 1 < m_spans.size() ? ",\n" : "\n");
+    }
+
+    out << "],\"displayTimeUnit\":\"ms\"}\n";
+    return bool(out);
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
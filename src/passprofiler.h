@@ -0,0 +1,93 @@
+// -----------------------------------------------------------------------------
+// Brandy compile time profiler
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#ifndef PASS_PROFILER_H
+#define PASS_PROFILER_H
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  // Collects where compile time goes, for --time-passes and --trace-passes.
+  // Every stage (lexing, parsing, each semantic pass) adds up over all the
+  // modules, and spans of work are kept for a Chrome trace (load the file in
+  // chrome://tracing or Perfetto). Modules can report from any thread.
+  class pass_profiler
+  {
+  public:
+    typedef std::chrono::steady_clock clock;
+
+    struct stats
+    {
+      stats();
+
+      clock::duration time;
+
+      // Nodes visited by a pass, tokens made or read by the lexer and parser
+      size_t count;
+      size_t replaced;
+
+      // What the module's node arena grew by while it ran, or the size of the
+      // tokens the lexer made. That isn't all it allocated: symbol tables,
+      // strings and meta values come from the heap and aren't counted.
+      size_t arena_bytes;
+    };
+
+    pass_profiler();
+
+    // Adds to a stage's totals, stages are listed in the order first added
+    void add(const char *stage, const stats &stageStats);
+
+    // A span of work on one module, on the calling thread's row of the trace
+    void trace(const std::string &name, const std::string &module,
+      clock::time_point start, clock::time_point end, const stats &spanStats);
+
+    void print_summary(std::ostream &out) const;
+    bool write_trace(const char *filename) const;
+
+  private:
+    struct stage
+    {
+      std::string name;
+      stats totals;
+    };
+
+    struct span
+    {
+      std::string name;
+      std::string module;
+      size_t thread;
+      clock::time_point start;
+      clock::time_point end;
+      stats totals;
+    };
+
+    size_t thread_index();
+
+    mutable std::mutex m_lock;
+    clock::time_point m_start;
+    std::vector<stage> m_stages;
+    std::vector<span> m_spans;
+    std::vector<std::thread::id> m_threads;
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
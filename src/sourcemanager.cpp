@@ -0,0 +1,184 @@
+// -----------------------------------------------------------------------------
+// Brandy source file manager
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "sourcemanager.h"
+#include <stdio.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    size_t page_size()
+    {
+#ifdef _WIN32
+      SYSTEM_INFO info;
+      GetSystemInfo(&info);
+      return info.dwPageSize;
+#else
+      return size_t(sysconf(_SC_PAGESIZE));
+#endif
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  source_file::source_file(const std::string &name) :
+    m_name(name),
+    m_text(nullptr),
+    m_length(0),
+    m_view(nullptr),
+    m_viewLength(0)
+  {
+  }
+
+  source_file::~source_file()
+  {
+    unmap();
+  }
+
+  const char *source_file::name() const { return m_name.c_str(); }
+  const char *source_file::text() const { return m_text; }
+  size_t    source_file::length() const { return m_length; }
+
+  // ---------------------------------------------------------------------------
+
+  bool source_file::map()
+  {
+    // The mapping is zero filled to the end of its last page, which gives us
+    // the terminator the lexer needs - unless the file ends exactly on a page
+    // boundary (or is empty), in which case it has to be copied instead.
+#ifdef _WIN32
+    HANDLE file = CreateFileA(m_name.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+      OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0 || size.QuadPart % page_size() == 0)
+    {
+      CloseHandle(file);
+      return false;
+    }
+
+    // The view keeps the mapping (and the mapping keeps the file) alive
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!mapping) return false;
+
+    m_view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!m_view) return false;
+
+    m_length = size_t(size.QuadPart);
+#else
+    int fd = open(m_name.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0 || size_t(info.st_size) % page_size() == 0)
+    {
+      close(fd);
+      return false;
+    }
+
+    void *view = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED) return false;
+
+    posix_madvise(view, size_t(info.st_size), POSIX_MADV_SEQUENTIAL);
+
+    m_view = view;
+    m_length = size_t(info.st_size);
+#endif
+
+    m_viewLength = m_length;
+    m_text = static_cast<const char *>(m_view);
+    return true;
+  }
+
+  bool source_file::copy()
+  {
+    FILE *fp = fopen(m_name.c_str(), "rb");
+    if (!fp) return false;
+
+    bool success = false;
+
+    if (fseek(fp, 0L, SEEK_END) == 0)
+    {
+      long bufsize = ftell(fp);
+
+      if (bufsize != -1 && fseek(fp, 0L, SEEK_SET) == 0)
+      {
+        m_copy = std::make_unique<char[]>(bufsize + 1);
+
+        m_length = fread(m_copy.get(), sizeof(char), bufsize, fp);
+        m_copy[m_length] = '\0';
+        m_text = m_copy.get();
+
+        success = true;
+      }
+    }
+
+    fclose(fp);
+    return success;
+  }
+
+  void source_file::unmap()
+  {
+    if (!m_view) return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(m_view);
+#else
+    munmap(m_view, m_viewLength);
+#endif
+
+    m_view = nullptr;
+    m_viewLength = 0;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  const source_file *source_manager::load(const char *filename)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_lock);
+
+      auto found = m_files.find(filename);
+      if (found != m_files.end())
+        return found->second.get();
+    }
+
+    // Mapped without the lock so other files can load meanwhile
+    std::unique_ptr<source_file> file(new source_file(filename));
+
+    if (!file->map() && !file->copy())
+      return nullptr;
+
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    // Whoever finished loading the same path first wins
+    auto inserted = m_files.emplace(filename, std::move(file));
+    return inserted.first->second.get();
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
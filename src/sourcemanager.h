@@ -0,0 +1,76 @@
+// -----------------------------------------------------------------------------
+// Brandy source file manager
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#ifndef SOURCE_MANAGER_H
+#define SOURCE_MANAGER_H
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  // A read-only, NUL terminated view of a source file. Files are memory mapped
+  // where possible so tokens can point straight into the mapping.
+  class source_file
+  {
+  public:
+    ~source_file();
+
+    const char *name() const;
+    const char *text() const;
+    size_t    length() const;
+
+  private:
+    friend class source_manager;
+
+    source_file(const std::string &name);
+
+    bool map();
+    bool copy();
+    void unmap();
+
+    std::string m_name;
+    const char *m_text;
+    size_t m_length;
+
+    // Set when the file couldn't be mapped with a terminator after it
+    std::unique_ptr<char[]> m_copy;
+
+    void *m_view;
+    size_t m_viewLength;
+  };
+
+  // ---------------------------------------------------------------------------
+
+  // Owns every loaded source file. Text handed out stays valid (and at the
+  // same address) for the lifetime of the manager.
+  class source_manager
+  {
+  public:
+    // Returns nullptr if the file can't be opened. Loading the same path
+    // twice returns the same file. Files can be loaded from several threads
+    // at once.
+    const source_file *load(const char *filename);
+
+  private:
+    std::mutex m_lock;
+    std::unordered_map<std::string, std::unique_ptr<source_file>> m_files;
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
@@ -8,9 +8,9 @@
 
 #pragma once
 
+#include "flatmap.h"
 #include "tokens.h"
 #include "type.h"
-#include <unordered_map>
 #include <vector>
 
 // -----------------------------------------------------------------------------
@@ -49,7 +49,7 @@ namespace brandy
 
   // ---------------------------------------------------------------------------
 
-  typedef std::unordered_map<token, symbol> symbol_table;
+  typedef flat_map<token, symbol> symbol_table;
   typedef std::vector<symbol_table *> symbol_stack;
 
   extern symbol_table g_baseSymbolTable;
@@ -11,14 +11,39 @@ namespace brandy
 {
   // ---------------------------------------------------------------------------
 
+  symbol_table_filler_visitor::symbol_table_filler_visitor() :
+    m_assign("@assign", token_types::IDENTIFIER)
+  {
+    handled_kinds = node_kinds_of<module_node>::value |
+      node_kinds_of<class_node>::value |
+      node_kinds_of<scope_node>::value |
+      node_kinds_of<lambda_node>::value |
+      node_kinds_of<var_node>::value |
+      node_kinds_of<function_node>::value |
+      node_kinds_of<label_node>::value |
+      node_kinds_of<property_node>::value |
+      node_kinds_of<import_node>::value |
+      node_kinds_of<typedef_node>::value |
+      node_kinds_of<binary_operator_node>::value |
+      node_kinds_of<call_node>::value;
+
+    // Parameters are declared by their function or lambda, and nothing is
+    // declared in types or attributes
+    skipped_kinds = node_kinds_of<parameter_node>::value |
+      node_kinds_of<type_node>::value |
+      node_kinds_of<attribute_node>::value;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  // Tables are pushed on the way in and popped in leave rather than walked
+  // here, so this can share a walk with other passes (see pass_manager)
   ast_visitor::visitor_result symbol_table_filler_visitor::visit(module_node *node)
   {
     ast_visitor::visit(node);
 
-    m_symStack.push_back(&node->symbols);
-    walk_node(node, this, false);
-    m_symStack.pop_back();
-    return ast_visitor::stop;
+    push(node, &node->symbols);
+    return ast_visitor::resume;
   }
 
   ast_visitor::visitor_result symbol_table_filler_visitor::visit(class_node *node)
@@ -27,38 +52,39 @@ namespace brandy
 
     insert_node(node, node->name, symbol::type_name);
 
-    m_symStack.push_back(&node->symbols);
-    walk_node(node, this, false);
-    m_symStack.pop_back();
-    return ast_visitor::stop;
+    push(node, &node->symbols);
+    return ast_visitor::resume;
   }
 
   ast_visitor::visitor_result symbol_table_filler_visitor::visit(scope_node *node)
   {
     ast_visitor::visit(node);
 
-    m_symStack.push_back(&node->symbols);
-    walk_node(node, this, false);
-    m_symStack.pop_back();
-    return ast_visitor::stop;
+    push(node, &node->symbols);
+    return ast_visitor::resume;
+  }
+
+  void symbol_table_filler_visitor::leave(abstract_node *node)
+  {
+    if (!m_symOwners.empty() && m_symOwners.back() == node)
+    {
+      m_symOwners.pop_back();
+      m_symStack.pop_back();
+    }
   }
 
   // ---------------------------------------------------------------------------
 
+  // Parameters go straight into the body's table, the body is pushed when
+  // the walk gets to it
   ast_visitor::visitor_result symbol_table_filler_visitor::visit(lambda_node *node)
   {
     ast_visitor::visit(node);
 
-    m_symStack.push_back(&node->scope->symbols);
-
     for (auto &param : node->parameters)
-      insert_node(param.get(), param->name, symbol::variable);
+      insert_node(node->scope->symbols, param.get(), param->name, symbol::variable);
 
-    walk_node(node->scope, this, false);
-
-    m_symStack.pop_back();
-
-    return ast_visitor::stop;
+    return ast_visitor::resume;
   }
 
   // ---------------------------------------------------------------------------
@@ -75,16 +101,10 @@ namespace brandy
     ast_visitor::visit(node);
     insert_node(node, node->name, symbol::function);
 
-    m_symStack.push_back(&node->scope->symbols);
-
     for (auto &param : node->parameters)
-      insert_node(param.get(), param->name, symbol::variable);
-
-    walk_node(node->scope, this, false);
-
-    m_symStack.pop_back();
+      insert_node(node->scope->symbols, param.get(), param->name, symbol::variable);
 
-    return ast_visitor::stop;
+    return ast_visitor::resume;
   }
 
   ast_visitor::visitor_result symbol_table_filler_visitor::visit(label_node *node)
@@ -99,24 +119,15 @@ namespace brandy
     ast_visitor::visit(node);
     insert_node(node, node->name, symbol::property);
 
-    if (node->getter)
-    {
-      m_symStack.push_back(&node->getter->symbols);
-      walk_node(node->getter, this, false);
-      m_symStack.pop_back();
-    }
-
     if (node->setter)
     {
-      m_symStack.push_back(&node->setter->symbols);
       if (node->setter_value)
-        insert_node(node->setter_value.get(), node->setter_value->name, symbol::variable);
+        insert_node(node->setter->symbols, node->setter_value.get(), node->setter_value->name, symbol::variable);
       else
-        insert_node(nullptr, token("value", 5, token_types::IDENTIFIER), symbol::variable);
-      m_symStack.pop_back();
+        insert_node(node->setter->symbols, nullptr, token("value", 5, token_types::IDENTIFIER), symbol::variable);
     }
 
-    return ast_visitor::stop;
+    return ast_visitor::resume;
   }
 
   ast_visitor::visitor_result symbol_table_filler_visitor::visit(import_node *node)
@@ -140,17 +151,35 @@ namespace brandy
     ast_visitor::visit(node);
 
     // Only check on assignment operations
-    if (node->operation.type() != token_types::ASSIGNMENT)
-      return ast_visitor::resume;
+    if (node->operation.type() == token_types::ASSIGNMENT)
+      declare_implicit(node->left.get());
+
+    return ast_visitor::resume;
+  }
+
+  // A copy of a tree that's already been through the passes (IE a class
+  // template being instantiated) has its assignments as @assign calls
+  ast_visitor::visitor_result symbol_table_filler_visitor::visit(call_node *node)
+  {
+    ast_visitor::visit(node);
+
+    auto member = dynamic_cast<member_access_node *>(node->left.get());
+    if (member && member->member_name == m_assign)
+      declare_implicit(member->left.get());
 
+    return ast_visitor::resume;
+  }
+
+  void symbol_table_filler_visitor::declare_implicit(expression_node *assigned)
+  {
     // If the left hand side of the assignment is a name reference
-    if (auto nameRef = dynamic_cast<name_reference_node *>(node->left.get()))
+    if (auto nameRef = dynamic_cast<name_reference_node *>(assigned))
     {
       for (auto table : m_symStack)
       {
         // If this table has the name we're looking for in it, then return (Was declared earlier)
         if (table->find(nameRef->name) != table->end())
-          return ast_visitor::resume;
+          return;
       }
 
       // Didn't find it, add it (implicit declaration)
@@ -158,15 +187,17 @@ namespace brandy
       pair.second.is_implicit = true;
       m_symStack.back()->insert(pair);
     }
-
-    return ast_visitor::resume;
   }
 
   // ---------------------------------------------------------------------------
 
   void symbol_table_filler_visitor::insert_node(abstract_node *node, const token &name, symbol::kind type)
   {
-    auto &table = *m_symStack.back();
+    insert_node(*m_symStack.back(), node, name, type);
+  }
+
+  void symbol_table_filler_visitor::insert_node(symbol_table &table, abstract_node *node, const token &name, symbol::kind type)
+  {
     auto found = table.find(name);
 
     if (found == table.end())
@@ -180,6 +211,12 @@ namespace brandy
     }
   }
 
+  void symbol_table_filler_visitor::push(abstract_node *node, symbol_table *table)
+  {
+    m_symOwners.push_back(node);
+    m_symStack.push_back(table);
+  }
+
   // ---------------------------------------------------------------------------
 }
 
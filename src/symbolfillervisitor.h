@@ -19,9 +19,12 @@ namespace brandy
   class symbol_table_filler_visitor : public ast_visitor
   {
   public:
+    symbol_table_filler_visitor();
+
     ast_visitor::visitor_result visit(module_node *node) override;
     ast_visitor::visitor_result visit(class_node *node) override;
     ast_visitor::visitor_result visit(scope_node *node) override;
+    void leave(abstract_node *node) override;
 
     ast_visitor::visitor_result visit(lambda_node *node) override;
 
@@ -33,10 +36,19 @@ namespace brandy
     ast_visitor::visitor_result visit(typedef_node *node) override;
 
     ast_visitor::visitor_result visit(binary_operator_node *node) override;
+    ast_visitor::visitor_result visit(call_node *node) override;
   private:
+    void declare_implicit(expression_node *assigned);
     void insert_node(abstract_node *node, const token &name, symbol::kind type);
+    void insert_node(symbol_table &table, abstract_node *node, const token &name, symbol::kind type);
+    void push(abstract_node *node, symbol_table *table);
 
     symbol_stack m_symStack;
+
+    // The node each table on the stack belongs to, popped on leaving it
+    std::vector<abstract_node *> m_symOwners;
+
+    token m_assign;
   };
 
   // ---------------------------------------------------------------------------
@@ -14,46 +14,60 @@ namespace brandy
   symbol_table_visitor::symbol_table_visitor()
   {
     m_symStack.push_back(&g_baseSymbolTable);
+
+    // Visitors deriving from this add the kinds they look at
+    handled_kinds = node_kinds_of<module_node>::value |
+      node_kinds_of<class_node>::value |
+      node_kinds_of<scope_node>::value;
   }
 
   // ---------------------------------------------------------------------------
   
+  // Tables are pushed on the way in and popped in leave rather than walked
+  // here, so this can share a walk with other passes (see pass_manager)
   ast_visitor::visitor_result symbol_table_visitor::visit(module_node *node)
   {
-    m_symStack.push_back(&node->symbols);
-    walk_node(node, this, false);
-    m_symStack.pop_back();
-    return ast_visitor::stop;
+    push(node, &node->symbols);
+    return ast_visitor::resume;
   }
   
   ast_visitor::visitor_result symbol_table_visitor::visit(class_node *node)
   {
-    m_symStack.push_back(&node->symbols);
-    walk_node(node, this, false);
-    m_symStack.pop_back();
-    return ast_visitor::stop;
+    push(node, &node->symbols);
+    return ast_visitor::resume;
   }
   
   ast_visitor::visitor_result symbol_table_visitor::visit(scope_node *node)
   {
-    m_symStack.push_back(&node->symbols);
-    walk_node(node, this, false);
-    m_symStack.pop_back();
-    return ast_visitor::stop;
+    push(node, &node->symbols);
+    return ast_visitor::resume;
+  }
+
+  void symbol_table_visitor::leave(abstract_node *node)
+  {
+    if (!m_symOwners.empty() && m_symOwners.back() == node)
+    {
+      m_symOwners.pop_back();
+      m_symStack.pop_back();
+    }
+  }
+
+  void symbol_table_visitor::push(abstract_node *node, symbol_table *table)
+  {
+    m_symOwners.push_back(node);
+    m_symStack.push_back(table);
   }
 
   // ---------------------------------------------------------------------------
   
-  symbol *symbol_table_visitor::get_symbol(token name)
+  symbol_table *symbol_table_visitor::get_symbol_table(token name)
   {
     for (auto it = m_symStack.rbegin(); it != m_symStack.rend(); ++it)
     {
       auto table = *it;
 
-      auto found = table->find(name);
-
-      if (found != table->end())
-        return &found->second;
+      if (table->find(name) != table->end())
+        return table;
     }
 
     return nullptr;
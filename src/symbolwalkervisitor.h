@@ -24,10 +24,17 @@ namespace brandy
     ast_visitor::visitor_result visit(module_node *node) override;
     ast_visitor::visitor_result visit(class_node *node) override;
     ast_visitor::visitor_result visit(scope_node *node) override;
+    void leave(abstract_node *node) override;
 
-    symbol *get_symbol(token name);
+    // The innermost table on the stack that has the name, or null
+    symbol_table *get_symbol_table(token name);
   private:
+    void push(abstract_node *node, symbol_table *table);
+
     symbol_stack m_symStack;
+
+    // The node each table on the stack belongs to, popped on leaving it
+    std::vector<abstract_node *> m_symOwners;
   };
 
   // ---------------------------------------------------------------------------
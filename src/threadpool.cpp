@@ -0,0 +1,163 @@
+// -----------------------------------------------------------------------------
+// Brandy work stealing thread pool
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "threadpool.h"
+#include <algorithm>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  thread_pool::thread_pool(size_t threadCount) :
+    m_nextWorker(0),
+    m_queued(0),
+    m_unfinished(0),
+    m_stopping(false)
+  {
+    if (threadCount == 0)
+      threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+    for (size_t i = 0; i < threadCount; ++i)
+      m_workers.emplace_back(new worker());
+
+    // Nothing runs until every worker exists, stealing looks at all of them
+    for (size_t i = 0; i < threadCount; ++i)
+      m_workers[i]->thread = std::thread(&thread_pool::run, this, i);
+  }
+
+  thread_pool::~thread_pool()
+  {
+    wait();
+
+    {
+      std::lock_guard<std::mutex> lock(m_lock);
+      m_stopping = true;
+    }
+
+    m_wake.notify_all();
+
+    for (auto &w : m_workers)
+      w->thread.join();
+  }
+
+  size_t thread_pool::size() const
+  {
+    return m_workers.size();
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void thread_pool::submit(task work)
+  {
+    size_t index = current_worker();
+
+    {
+      std::lock_guard<std::mutex> lock(m_lock);
+      ++m_queued;
+      ++m_unfinished;
+
+      // Spread tasks from outside the pool across the workers
+      if (index == m_workers.size())
+        index = m_nextWorker++ % m_workers.size();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(m_workers[index]->lock);
+      m_workers[index]->tasks.push_back(std::move(work));
+    }
+
+    m_wake.notify_one();
+  }
+
+  void thread_pool::wait()
+  {
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_idle.wait(lock, [this] { return m_unfinished == 0; });
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void thread_pool::run(size_t index)
+  {
+    for (;;)
+    {
+      task work;
+      if (pop(index, work) || steal(index, work))
+      {
+        {
+          std::lock_guard<std::mutex> lock(m_lock);
+          --m_queued;
+        }
+
+        work();
+
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (--m_unfinished == 0)
+          m_idle.notify_all();
+
+        continue;
+      }
+
+      // A task can be counted a moment before it's on a queue, in which case
+      // this goes straight round again
+      std::unique_lock<std::mutex> lock(m_lock);
+      m_wake.wait(lock, [this] { return m_queued != 0 || m_stopping; });
+
+      if (m_stopping && m_queued == 0)
+        return;
+    }
+  }
+
+  bool thread_pool::pop(size_t index, task &work)
+  {
+    worker &self = *m_workers[index];
+    std::lock_guard<std::mutex> lock(self.lock);
+
+    if (self.tasks.empty())
+      return false;
+
+    work = std::move(self.tasks.back());
+    self.tasks.pop_back();
+    return true;
+  }
+
+  bool thread_pool::steal(size_t thief, task &work)
+  {
+    for (size_t i = 1; i < m_workers.size(); ++i)
+    {
+      worker &victim = *m_workers[(thief + i) % m_workers.size()];
+      std::lock_guard<std::mutex> lock(victim.lock);
+
+      if (victim.tasks.empty())
+        continue;
+
+      work = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      return true;
+    }
+
+    return false;
+  }
+
+  // The index of the worker running on this thread, or size() if it isn't one
+  size_t thread_pool::current_worker() const
+  {
+    auto id = std::this_thread::get_id();
+
+    for (size_t i = 0; i < m_workers.size(); ++i)
+    {
+      if (m_workers[i]->thread.get_id() == id)
+        return i;
+    }
+
+    return m_workers.size();
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,78 @@
+// -----------------------------------------------------------------------------
+// Brandy work stealing thread pool
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  // Every worker has its own queue. Tasks submitted by a worker go on the
+  // back of its queue and it takes its work from the back too, so a task's
+  // follow-ups run next while their data is still in cache. A worker that
+  // runs dry steals from the front of the others' queues, where the oldest
+  // and usually biggest tasks are.
+  class thread_pool
+  {
+  public:
+    typedef std::function<void()> task;
+
+    // Zero threads means one per core
+    thread_pool(size_t threadCount = 0);
+    ~thread_pool();
+
+    size_t size() const;
+
+    // Safe to call from tasks
+    void submit(task work);
+
+    // Blocks until every task, including ones submitted by other tasks, has
+    // finished. Must not be called from a task.
+    void wait();
+
+  private:
+    struct worker
+    {
+      std::mutex lock;
+      std::deque<task> tasks;
+      std::thread thread;
+    };
+
+    void run(size_t index);
+    bool pop(size_t index, task &work);
+    bool steal(size_t thief, task &work);
+    size_t current_worker() const;
+
+    std::vector<std::unique_ptr<worker>> m_workers;
+    size_t m_nextWorker;
+
+    // Guards the counts and the stop flag, and goes with both conditions
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    std::condition_variable m_idle;
+    size_t m_queued;
+    size_t m_unfinished;
+    bool m_stopping;
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
@@ -5,6 +5,11 @@
 
 #include "tokens.h"
 #include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
 
 // -----------------------------------------------------------------------------
 
@@ -21,100 +26,144 @@ namespace brandy
 #undef TOKEN_VALUE
   }
 
+  // ---------------------------------------------------------------------------
+
+  namespace token_sources
+  {
+    namespace
+    {
+      const size_t CHUNK_SIZE = 1 << 16;
+      const size_t MAX_CHUNKS = (size_t(MAX) + 1) / CHUNK_SIZE;
+
+      // Chunks are only ever added, so looking a base up never races with a
+      // registration
+      const char **g_chunks[MAX_CHUNKS] = { nullptr };
+      std::unordered_map<const char *, id> g_ids;
+      id g_next = ATOMS + 1;
+      std::mutex g_lock;
+    }
+
+    id add(const char *base)
+    {
+      if (!base) return NONE;
+
+      std::lock_guard<std::mutex> lock(g_lock);
+
+      auto found = g_ids.find(base);
+      if (found != g_ids.end())
+        return found->second;
+
+      if (g_next > MAX)
+      {
+        std::fprintf(stderr, "Fatal error: more than %u source buffers\n", unsigned(MAX));
+        std::abort();
+      }
+
+      id source = g_next++;
+
+      const char **&chunk = g_chunks[source / CHUNK_SIZE];
+      if (!chunk)
+        chunk = new const char *[CHUNK_SIZE]();
+
+      chunk[source % CHUNK_SIZE] = base;
+      g_ids.emplace(base, source);
+      return source;
+    }
+
+    const char *base(id source)
+    {
+      const char **chunk = g_chunks[source / CHUNK_SIZE];
+      return chunk ? chunk[source % CHUNK_SIZE] : nullptr;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
   token::token() :
-    m_text(nullptr),
-    m_len(0),
-    m_tokType(token_types::INVALID)
+    m_offset(0),
+    m_lenOrAtom(0),
+    m_tokType(token_types::INVALID),
+    m_source(token_sources::NONE),
+    m_lineNum(0)
   {
   }
 
   token::token(const char *str, token_types::type type) :
-    m_text(str),
-    m_len(strlen(m_text)),
-    m_tokType(type),
-    m_lineNum(0)
+    token(atoms::intern(str, strlen(str)), type)
   {
   }
 
   token::token(const char *str, size_t length, token_types::type type) :
-    m_text(str),
-    m_len(length),
+    token(atoms::intern(str, length), type)
+  {
+  }
+
+  token::token(atoms::id atom, token_types::type type) :
+    m_offset(atom),
+    m_lenOrAtom(type == token_types::IDENTIFIER ? atom : std::uint32_t(atoms::length(atom))),
     m_tokType(type),
+    m_source(token_sources::ATOMS),
     m_lineNum(0)
   {
   }
 
-  const char       *token::text() const { return m_text; }
-  size_t          token::length() const { return m_len; }
-  token_types::type token::type() const { return m_tokType; }
-  size_t     token::line_number() const { return m_lineNum; }
- 
-  void token::line_number(size_t n) { m_lineNum = n; }
-
-#define GET_16_BITS(d) (*((const std::uint16_t *) (d)))
-
-  std::int32_t token::hash_code() const
+  token::token(token_sources::id source, std::uint32_t offset, std::uint32_t length, token_types::type type) :
+    m_offset(offset),
+    m_lenOrAtom(length),
+    m_tokType(type),
+    m_source(source),
+    m_lineNum(0)
   {
-    size_t      len = m_len;
-    const char *data = m_text;
-
-    std::uint32_t hash = std::uint32_t(len), tmp;
-    int rem;
+    if (type == token_types::IDENTIFIER)
+      m_lenOrAtom = atoms::intern(text(), length);
+  }
 
-    if (len == 0) return 0;
+  token::token(token_sources::id source, std::uint32_t offset, std::uint32_t length, token_types::type type, std::uint32_t hash) :
+    m_offset(offset),
+    m_lenOrAtom(length),
+    m_tokType(type),
+    m_source(source),
+    m_lineNum(0)
+  {
+    if (type == token_types::IDENTIFIER)
+      m_lenOrAtom = atoms::intern(text(), length, hash);
+  }
 
-    rem = len & 3;
-    len >>= 2;
+  const char *token::text() const
+  {
+    if (m_source == token_sources::ATOMS)
+      return atoms::text(m_offset);
 
-    /* Main loop */
-    for (; len > 0; len--) {
-      hash += GET_16_BITS(data);
-      tmp = (GET_16_BITS(data + 2) << 11) ^ hash;
-      hash = (hash << 16) ^ tmp;
-      data += 2 * sizeof(uint16_t);
-      hash += hash >> 11;
-    }
+    const char *base = token_sources::base(m_source);
+    return base ? base + m_offset : nullptr;
+  }
 
-    /* Handle end cases */
-    switch (rem) {
-    case 3:
-      hash += GET_16_BITS(data);
-      hash ^= hash << 16;
-      hash ^= ((signed char)data[sizeof(uint16_t)]) << 18;
-      hash += hash >> 11;
-      break;
-
-    case 2:
-      hash += GET_16_BITS(data);
-      hash ^= hash << 11;
-      hash += hash >> 17;
-      break;
-
-    case 1:
-      hash += (signed char)*data;
-      hash ^= hash << 10;
-      hash += hash >> 1;
-    }
+  size_t token::length() const
+  {
+    return m_tokType == token_types::IDENTIFIER ? atoms::length(m_lenOrAtom) : m_lenOrAtom;
+  }
 
-    /* Force "avalanching" of final 127 bits */
-    hash ^= hash << 3;
-    hash += hash >> 5;
-    hash ^= hash << 4;
-    hash += hash >> 17;
-    hash ^= hash << 25;
-    hash += hash >> 6;
+  token_types::type token::type() const { return token_types::type(m_tokType); }
+  size_t            token::line_number() const { return m_lineNum; }
 
-    return hash;
+  atoms::id token::atom() const
+  {
+    return m_tokType == token_types::IDENTIFIER ? m_lenOrAtom : atoms::NONE;
   }
 
-  bool token::operator==(const token &rhs) const
+  void token::line_number(size_t n) { m_lineNum = std::uint32_t(n); }
+
+  std::int32_t token::hash_code() const
   {
-    return tokcmp(*this, rhs) == 0;
+    if (m_tokType == token_types::IDENTIFIER)
+      return atoms::hash(m_lenOrAtom);
+
+    return hash_text(text(), m_lenOrAtom);
   }
 
-  bool token::operator!=(const token &rhs) const
+  bool token::same_text(const token &rhs) const
   {
-    return tokcmp(*this, rhs) != 0;
+    return length() == rhs.length() && (length() == 0 || memcmp(text(), rhs.text(), length()) == 0);
   }
 
   int tokcmp(const token &tok1, const token &tok2)
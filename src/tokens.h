@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include "atoms.h"
 #include <cstdint>
 #include <functional>
 #include <ostream>
@@ -33,17 +34,46 @@ namespace brandy
 
   // ---------------------------------------------------------------------------
 
+  // Tokens don't hold a pointer to their text, but an offset into one of the
+  // buffers registered here. Registering the same buffer twice returns the
+  // same id, and registered buffers must outlive the tokens that use them.
+  // Only whole buffers are registered (source text and token stream blocks),
+  // tokens made from other text are interned and use ATOMS instead.
+  namespace token_sources
+  {
+    typedef std::uint32_t id;
+
+    const id NONE  = 0;
+    const id ATOMS = 1; // The offset is an atom, see atoms.h
+
+    // Ids fit in 24 bits, running out is fatal
+    const id MAX = (1 << 24) - 1;
+
+    id add(const char *base);
+    const char *base(id source);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  // Identifier tokens are interned as they're made and carry their atom, so
+  // comparing or hashing two of them never touches their text.
   class token
   {
   public:
     token();
     token(const char *str, token_types::type type);
     token(const char *str, size_t length, token_types::type type);
+    token(atoms::id atom, token_types::type type);
+    token(token_sources::id source, std::uint32_t offset, std::uint32_t length, token_types::type type);
+
+    // For identifiers the lexer already hashed, see lexeme::hash
+    token(token_sources::id source, std::uint32_t offset, std::uint32_t length, token_types::type type, std::uint32_t hash);
 
     const char       *text() const;
     size_t          length() const;
     token_types::type type() const;
     size_t     line_number() const;
+    atoms::id         atom() const;
     
     void line_number(size_t n);
 
@@ -53,11 +83,31 @@ namespace brandy
     bool operator!=(const token &rhs) const;
 
   private:
-    const char *m_text;
-    size_t m_len;
-    token_types::type m_tokType;
-    size_t m_lineNum;
+    bool same_text(const token &rhs) const;
+
+    std::uint32_t m_offset;
+    std::uint32_t m_lenOrAtom; // The atom for identifiers, length otherwise
+    std::uint32_t m_tokType : 8;
+    std::uint32_t m_source : 24;
+    std::uint32_t m_lineNum;
   };
+
+  static_assert(token_types::COUNT <= 256, "Token types are stored in 8 bits");
+  static_assert(sizeof(token) <= 16, "Tokens are stored by the million, keep them small");
+
+  // Inline so that comparing two names in a symbol table is one compare
+  inline bool token::operator==(const token &rhs) const
+  {
+    if (m_tokType == token_types::IDENTIFIER && rhs.m_tokType == token_types::IDENTIFIER)
+      return m_lenOrAtom == rhs.m_lenOrAtom;
+
+    return same_text(rhs);
+  }
+
+  inline bool token::operator!=(const token &rhs) const
+  {
+    return !(*this == rhs);
+  }
   
   // strcmp for tokens
   int tokcmp(const token &tok1, const token &tok2);
@@ -0,0 +1,188 @@
+// -----------------------------------------------------------------------------
+// Brandy chunked token stream
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#include "tokenstream.h"
+#include "charscan.h"
+#include "lexer.h"
+#include <algorithm>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  const size_t TEXT_BLOCK_SIZE = 64 * 1024;
+
+  const size_t token_stream::DEFAULT_CHUNK_SIZE;
+
+  // ---------------------------------------------------------------------------
+
+  token_stream::token_stream(reader read, size_t chunkSize) :
+    m_read(read),
+    m_chunkSize(std::max(chunkSize, size_t(1))),
+    m_buffer(1, '\0'),
+    m_begin(0),
+    m_end(0),
+    m_eof(false),
+    m_failed(false),
+    m_lineNum(1),
+    m_textBlockSource(token_sources::NONE),
+    m_textBlockUsed(0),
+    m_textBlockSize(0)
+  {
+  }
+
+  std::unique_ptr<token_stream> token_stream::from_file(FILE *fp, size_t chunkSize)
+  {
+    return std::unique_ptr<token_stream>(new token_stream([fp](char *buffer, size_t size)
+    {
+      return fread(buffer, sizeof(char), size, fp);
+    }, chunkSize));
+  }
+
+  std::unique_ptr<token_stream> token_stream::from_descriptor(int fd, size_t chunkSize)
+  {
+    return std::unique_ptr<token_stream>(new token_stream([fd](char *buffer, size_t size) -> size_t
+    {
+#ifdef _WIN32
+      int got = _read(fd, buffer, unsigned(size));
+#else
+      ssize_t got = ::read(fd, buffer, size);
+#endif
+      return got > 0 ? size_t(got) : 0;
+    }, chunkSize));
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool token_stream::next(token *outputTok)
+  {
+    for (;;)
+    {
+      if (m_begin == m_end && !fill())
+        return false;
+
+      const char *str = &m_buffer[m_begin];
+
+      // A NUL in the input ends it, same as tokenize_string
+      if (*str == '\0')
+      {
+        m_begin = m_end;
+        m_eof = true;
+        return false;
+      }
+
+      lexeme lex;
+      bool reachedEnd;
+      bool accepted = read_next_token(str, &lex, &reachedEnd);
+
+      // The token might carry on into the next chunk, read it and try again
+      if (reachedEnd && !m_eof)
+      {
+        fill();
+        continue;
+      }
+
+      if (!accepted)
+      {
+        m_failed = true;
+        return false;
+      }
+
+      m_begin += lex.length;
+
+      switch (lex.type)
+      {
+      case token_types::BLOCK_COMMENT:
+        m_lineNum += scan::count_newlines(str, lex.length);
+        break;
+      case token_types::LINE_COMMENT:
+      case token_types::NEWLINE:
+        ++m_lineNum;
+        break;
+      case token_types::WHITESPACE:
+        break;
+      default:
+      {
+        std::uint32_t offset = store_text(str, lex.length);
+        *outputTok = token(m_textBlockSource, offset, std::uint32_t(lex.length), lex.type, lex.hash);
+        outputTok->line_number(m_lineNum);
+        return true;
+      }
+      }
+    }
+  }
+
+  bool token_stream::failed() const
+  {
+    return m_failed;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool token_stream::fill()
+  {
+    if (m_eof) return false;
+
+    // Slide whatever hasn't been lexed yet to the front of the buffer
+    if (m_begin != 0)
+    {
+      memmove(m_buffer.data(), m_buffer.data() + m_begin, m_end - m_begin);
+      m_end -= m_begin;
+      m_begin = 0;
+    }
+
+    if (m_buffer.size() < m_end + m_chunkSize + 1)
+      m_buffer.resize(m_end + m_chunkSize + 1);
+
+    size_t read = m_read(m_buffer.data() + m_end, m_chunkSize);
+
+    m_eof = read == 0;
+    m_end += read;
+    m_buffer[m_end] = '\0';
+
+    return read != 0;
+  }
+
+  std::uint32_t token_stream::store_text(const char *text, size_t length)
+  {
+    if (m_textBlocks.empty() || m_textBlockUsed + length > m_textBlockSize)
+    {
+      m_textBlockSize = std::max(TEXT_BLOCK_SIZE, length);
+      m_textBlocks.emplace_back(new char[m_textBlockSize]);
+      m_textBlockSource = token_sources::add(m_textBlocks.back().get());
+      m_textBlockUsed = 0;
+    }
+
+    std::uint32_t offset = std::uint32_t(m_textBlockUsed);
+    memcpy(m_textBlocks.back().get() + offset, text, length);
+    m_textBlockUsed += length;
+
+    return offset;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool tokenize_stream(token_stream &stream, std::vector<token> &tokens)
+  {
+    token tok;
+    while (stream.next(&tok))
+      tokens.push_back(tok);
+
+    return !stream.failed();
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
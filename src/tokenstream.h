@@ -0,0 +1,80 @@
+// -----------------------------------------------------------------------------
+// Brandy chunked token stream
+// Howard Hughes
+// -----------------------------------------------------------------------------
+
+#ifndef TOKEN_STREAM_H
+#define TOKEN_STREAM_H
+
+#pragma once
+
+#include "tokens.h"
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+
+namespace brandy
+{
+  // ---------------------------------------------------------------------------
+
+  // Lexes input that arrives in chunks instead of one NUL terminated buffer.
+  // The text of every token handed out is copied into storage owned by the
+  // stream, so the read buffer only holds the token being read plus one chunk.
+  // Tokens stay valid for as long as the stream that produced them.
+  class token_stream
+  {
+  public:
+    // Fills buffer with up to size bytes and returns the count read, 0 at the
+    // end of the input
+    typedef std::function<size_t(char *buffer, size_t size)> reader;
+
+    static const size_t DEFAULT_CHUNK_SIZE = 64 * 1024;
+
+    token_stream(reader read, size_t chunkSize = DEFAULT_CHUNK_SIZE);
+
+    // Streams own the text of their tokens, so they're handed out by pointer
+    // rather than copied or moved
+    token_stream(const token_stream &) = delete;
+    token_stream &operator=(const token_stream &) = delete;
+
+    static std::unique_ptr<token_stream> from_file(FILE *fp, size_t chunkSize = DEFAULT_CHUNK_SIZE);
+    static std::unique_ptr<token_stream> from_descriptor(int fd, size_t chunkSize = DEFAULT_CHUNK_SIZE);
+
+    // Reads the next token, skipping whitespace and comments. Returns false at
+    // the end of the input or when the input can't be lexed (see failed()).
+    bool next(token *outputTok);
+
+    bool failed() const;
+
+  private:
+    bool fill();
+    std::uint32_t store_text(const char *text, size_t length);
+
+    reader m_read;
+    size_t m_chunkSize;
+
+    std::vector<char> m_buffer;
+    size_t m_begin;
+    size_t m_end;
+    bool m_eof;
+    bool m_failed;
+    size_t m_lineNum;
+
+    std::vector<std::unique_ptr<char[]>> m_textBlocks;
+    token_sources::id m_textBlockSource;
+    size_t m_textBlockUsed;
+    size_t m_textBlockSize;
+  };
+
+  // Reads every remaining token of the stream
+  bool tokenize_stream(token_stream &stream, std::vector<token> &tokens);
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
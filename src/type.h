@@ -8,8 +8,9 @@
 
 #pragma once
 
+#include "flatmap.h"
 #include "tokens.h"
-#include <unordered_map>
+#include <vector>
 #include <cstdint>
 
 // -----------------------------------------------------------------------------
@@ -49,7 +50,7 @@ namespace brandy
 
     type *base;
     std::uint32_t flag;
-    std::unordered_map<token, symbol_node *> members;
+    flat_map<token, symbol_node *> members;
     size_t size;
   };
 